@@ -28,6 +28,7 @@ extern "C" {
 #include "switch/kernel/virtmem.h"
 #include "switch/kernel/detect.h"
 #include "switch/kernel/random.h"
+#include "switch/kernel/prng.h"
 #include "switch/kernel/jit.h"
 #include "switch/kernel/ipc.h"
 
@@ -54,6 +55,7 @@ extern "C" {
 #include "switch/services/lr.h"
 
 #include "switch/gfx/gfx.h"
+#include "switch/gfx/blit.h"
 #include "switch/gfx/binder.h"
 #include "switch/gfx/parcel.h"
 #include "switch/gfx/buffer_producer.h"
@@ -0,0 +1,47 @@
+/**
+ * @file blit.h
+ * @brief Software 2D blitter for the block-linear framebuffer.
+ * These functions draw into the framebuffer returned by \ref gfxGetFramebuffer, using the same coordinates as \ref gfxGetFramebufferDisplayOffset. The destination is processed in the framebuffer's memory order (16x128-pixel blocks, 16x8-pixel GOBs) instead of one pixel-offset calculation per pixel.
+ * Do not use these when \ref GfxMode is GfxMode_LinearDouble.
+ * Areas outside the display width/height (see \ref gfxConfigureCrop) are clipped. Source images are linear RGBA8 (see \ref RGBA8), with the stride in pixels.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "../runtime/devices/console.h"
+
+/// Fills a rectangle with the specified color.
+void blitFillRect(s32 x, s32 y, u32 width, u32 height, u32 color);
+
+/// Copies an image to the framebuffer, without blending.
+void blitCopyRect(s32 x, s32 y, u32 width, u32 height, const u32* src, u32 stride);
+
+/// Draws an image with alpha-blending, using the alpha of each source pixel.
+void blitSprite(s32 x, s32 y, u32 width, u32 height, const u32* src, u32 stride);
+
+/**
+ * @brief Draws an image scaled to the specified size, with nearest-neighbor sampling.
+ * @param[in] x Destination X.
+ * @param[in] y Destination Y.
+ * @param[in] width Destination width.
+ * @param[in] height Destination height.
+ * @param[in] src Source image.
+ * @param[in] stride Source stride, in pixels.
+ * @param[in] src_width Source width.
+ * @param[in] src_height Source height.
+ * @param[in] blend Whether to alpha-blend like \ref blitSprite, otherwise the pixels are copied like \ref blitCopyRect.
+ */
+void blitScaled(s32 x, s32 y, u32 width, u32 height, const u32* src, u32 stride, u32 src_width, u32 src_height, bool blend);
+
+/**
+ * @brief Draws a span of text with a console font (16x16 glyphs), see \ref ConsoleFont.
+ * @param[in] x Destination X of the first glyph.
+ * @param[in] y Destination Y of the first glyph.
+ * @param[in] font Font to use, NULL for the default console font.
+ * @param[in] text Text to draw, each byte is one glyph. Bytes missing from the font graphics use the font's glyphSource when set, and are skipped otherwise.
+ * @param[in] len Number of bytes of text.
+ * @param[in] fg Color of the glyph pixels.
+ * @param[in] bg Color of the remaining pixels. When the alpha is 0, these pixels are left unchanged.
+ * @return X following the last glyph.
+ */
+s32 blitTextSpan(s32 x, s32 y, const ConsoleFont* font, const char* text, size_t len, u32 fg, u32 bg);
@@ -1,4 +1,5 @@
 #pragma once
+#include "../gfx/binder.h"
 #include "../gfx/nvioctl.h"
 
 typedef struct {
@@ -142,6 +143,8 @@ Result bufferProducerInitialize(Binder *session);
 void bufferProducerExit(void);
 
 Result bufferProducerRequestBuffer(s32 bufferIdx, bufferProducerGraphicBuffer *buf);
+
+/// DequeueBuffer and QueueBuffer reuse preallocated parcels with a pre-serialized interface token, hence these must not be used concurrently from multiple threads.
 Result bufferProducerDequeueBuffer(bool async, u32 width, u32 height, s32 format, u32 usage, s32 *buf, bufferProducerFence *fence);
 Result bufferProducerDetachBuffer(s32 slot);
 Result bufferProducerQueueBuffer(s32 buf, bufferProducerQueueBufferInput *input, bufferProducerQueueBufferOutput *output);
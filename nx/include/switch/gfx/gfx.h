@@ -7,6 +7,7 @@
  */
 #pragma once
 #include "../types.h"
+#include "buffer_producer.h"
 
 /// Converts red, green, blue, and alpha components to packed RGBA8.
 #define RGBA8(r,g,b,a)  (((r)&0xff)|(((g)&0xff)<<8)|(((b)&0xff)<<16)|(((a)&0xff)<<24))
@@ -22,6 +23,35 @@ typedef enum
     GfxMode_LinearDouble ///< Double-buffering with linear framebuffer, which is transferred to the actual framebuffer by \ref gfxFlushBuffers().
 } GfxMode;
 
+/// Maximum number of framebuffers, see \ref gfxInitBufferCount.
+#define GFX_MAX_FRAMEBUFFERS 4
+
+/// Number of frames kept for \ref gfxGetFrameStats.
+#define GFX_FRAME_STATS_COUNT 64
+
+/// Statistics for a frame presented by \ref gfxSwapBuffers. Times are in system ticks, see \ref svcGetSystemTick.
+typedef struct {
+    u64 frame;           ///< Frame number, counting from \ref gfxInitDefault.
+    u64 present_tick;    ///< System tick at which the frame was queued.
+    u64 cpu_ticks;       ///< Time between the previous \ref gfxSwapBuffers returning and this one being called, excluding vsync waits.
+    u64 vsync_ticks;     ///< Time spent waiting for vsync during the frame, with \ref gfxWaitForVsync and frame-pacing.
+    u64 queue_ticks;     ///< Time spent queueing the frame.
+    u64 dequeue_ticks;   ///< Time spent dequeueing the next framebuffer.
+    u64 fence_ticks;     ///< Time spent waiting on the dequeue fence during the frame, when it's waited on implicitly (see \ref gfxConfigureAsyncDequeue).
+    u32 vsyncs;          ///< Number of vsync intervals (rounded) since the previous frame was presented.
+    u32 missed_vsyncs;   ///< Number of vsync intervals beyond the target interval (1, or the one set by \ref gfxConfigureFramePacing).
+    u32 pending_buffers; ///< Number of buffers queued in the compositor, as reported by QueueBuffer.
+} GfxFrameStats;
+
+/// Max number of syncpoint fences in a \ref GfxFence.
+#define GFX_FENCE_MAX 4
+
+/// GPU fence, which is signalled once each syncpoint reached its value.
+typedef struct {
+    u32 num_fences;                      ///< Number of entries in fences, 0 when the fence is always signalled.
+    nvioctl_fence fences[GFX_FENCE_MAX]; ///< Syncpoint id/value pairs.
+} GfxFence;
+
 /// Framebuffer pixel-format is RGBA8888, there's no known way to change this.
 
 /**
@@ -47,9 +77,30 @@ void gfxExit(void);
  */
 void gfxInitResolution(u32 width, u32 height);
 
+/**
+ * @brief Sets the number of framebuffers to be used when initializing the graphics subsystem.
+ * @param[in] count Number of framebuffers, 2 for double-buffering (the default) or 3 for triple-buffering. This is clamped to \ref GFX_MAX_FRAMEBUFFERS, 0 selects the default.
+ * @note This can only be used before calling \ref gfxInitDefault, this will use \ref fatalSimple otherwise. The count is reset to the default when \ref gfxExit is used.
+ * @note With more than 2 framebuffers \ref gfxSwapBuffers can usually dequeue a free framebuffer while the compositor still holds the previous ones, see also \ref gfxConfigureAsyncDequeue.
+ */
+void gfxInitBufferCount(u32 count);
+
 /// Wrapper for \ref gfxInitResolution with resolution=1080p. Use this if you want to support 1080p or >720p in docked-mode.
 void gfxInitResolutionDefault(void);
 
+/**
+ * @brief Changes the framebuffer resolution while the graphics subsystem is initialized, without closing the layer.
+ * @param[in] width Horizontal resolution, in pixels.
+ * @param[in] height Vertical resolution, in pixels.
+ * @return Result code. On failure the previous resolution, framebuffers and crop are kept, and a framebuffer is dequeued again if needed.
+ * @note The framebuffers are reallocated and the buffer producer slots are detached and registered again, then a new framebuffer is dequeued. The contents of the current framebuffer are discarded, so this should be called before drawing a frame.
+ * @note On success the addresses previously returned by \ref gfxGetFramebuffer and \ref gfxGetFramebuffers are no longer valid, they have to be retrieved again. The console does this on each draw, but its window has to fit the new resolution (see \ref consoleSetWindow).
+ * @note The previous framebuffer memory is freed once it's no longer displayed, during a later \ref gfxSwapBuffers.
+ * @note The crop is reset like with \ref gfxConfigureCrop with all-zero input, and the \ref gfxConfigureAutoResolution config is applied again when enabled.
+ * @note Before \ref gfxInitDefault this is the same as \ref gfxInitResolution. The width and height are aligned to 4.
+ */
+Result gfxSetFramebufferResolution(u32 width, u32 height);
+
 /// Configure framebuffer crop, by default crop is all-zero. Use all-zero input to reset to default. \ref gfxExit resets this to the default.
 /// When the input is invalid this returns without changing the crop data, this includes the input values being larger than the framebuf width/height.
 /// This will update the display width/height returned by \ref gfxGetFramebuffer, with that width/height being reset to the default when required.
@@ -73,9 +124,51 @@ void gfxWaitForVsync(void);
 /// Swaps the framebuffers (for double-buffering).
 void gfxSwapBuffers(void);
 
+/// Configures frame-pacing: \ref gfxSwapBuffers waits on the vsync event until the specified number of vsync intervals elapsed since the previous frame was presented. 1 = 60Hz, 2 = 30Hz, 0 = disabled (the default). \ref gfxExit resets this to the default.
+void gfxConfigureFramePacing(u32 interval);
+
+/// Copies the statistics of the most recent frames (up to \ref GFX_FRAME_STATS_COUNT) into the output array, ordered from the oldest to the newest. Returns the number of entries written, which is at most max.
+u32 gfxGetFrameStats(GfxFrameStats *stats, u32 max);
+
+/**
+ * @brief Configures how the dequeue fence is waited on.
+ * The dequeue fence is the one returned by the previous DequeueBuffer, which official sw waits on before writing the framebuffer returned by the current one. It isn't necessarily the fence of the current framebuffer.
+ * By default (disabled), the fence is waited on when the framebuffer memory is first accessed after \ref gfxSwapBuffers: by \ref gfxGetFramebuffer with the tiled modes, or by \ref gfxFlushBuffers with GfxMode_LinearDouble. Work done before that overlaps with the framebuffer still being in use.
+ * If enabled, only \ref gfxGetFramebuffers waits on the fence. It can be retrieved with \ref gfxGetDequeueFence, and must be waited on (for example with \ref gfxWaitDequeueFence) before the framebuffer is written. Disabling this waits on the pending fence. \ref gfxExit resets this to the default (disabled).
+ */
+void gfxConfigureAsyncDequeue(bool enable);
+
+/// Creates a \ref GfxFence from syncpoint fences, such as the one from \ref nvgfxGpfifoSubmit. Entries with id 0xffffffff (no fence) are skipped, up to \ref GFX_FENCE_MAX entries are used.
+void gfxFenceCreate(GfxFence *fence, const nvioctl_fence *nv_fences, u32 count);
+
+/**
+ * @brief Waits for a fence to be signalled.
+ * @param[in] fence Fence, NULL is treated as signalled.
+ * @param[in] timeout Timeout in nanoseconds, 0 to only check the fence, UINT64_MAX to wait indefinitely. This is applied with millisecond granularity.
+ * @return Result code, MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Timeout) when the timeout expired.
+ */
+Result gfxWaitFence(const GfxFence *fence, u64 timeout);
+
+/// Sets the fence which the compositor waits on before displaying the frame queued by the next \ref gfxSwapBuffers, for framebuffers which are still being written by the GPU. NULL for no fence (the default).
+void gfxSetPresentFence(const GfxFence *fence);
+
+/// Gets the dequeue fence: the fence returned by the previous DequeueBuffer, not the one of the current framebuffer (see \ref gfxConfigureAsyncDequeue). Like official sw, it has to be signalled before the current framebuffer is written. Returns false when there's no pending fence, in which case the framebuffer can be used immediately.
+bool gfxGetDequeueFence(GfxFence *fence);
+
+/// Waits for the fence returned by \ref gfxGetDequeueFence, if any.
+Result gfxWaitDequeueFence(void);
+
 /// Get the current framebuffer address, with optional output ptrs for the display framebuffer width/height. The display width/height is adjusted by \ref gfxConfigureCrop and \ref gfxConfigureResolution.
 u8* gfxGetFramebuffer(u32* width, u32* height);
 
+/**
+ * @brief Gets the addresses of all framebuffers, for drawing content which has to be kept across \ref gfxSwapBuffers.
+ * @param[out] framebufs Output array with room for \ref GFX_MAX_FRAMEBUFFERS entries.
+ * @return Number of framebuffers, see \ref gfxInitBufferCount.
+ * @note The framebuffers are always in the block-linear layout used by the tiled modes, see \ref gfxGetFramebufferDisplayOffset. This waits on the dequeue fence (see \ref gfxGetDequeueFence), even with async-dequeue, so callers drawing in a loop should look the framebuffers up once per batch instead of per draw.
+ */
+u32 gfxGetFramebuffers(u8 **framebufs);
+
 /// Get the framebuffer width/height without crop.
 void gfxGetFramebufferResolution(u32* width, u32* height);
 
@@ -92,8 +185,14 @@ void gfxSetDrawFlip(bool flip);
 void gfxConfigureTransform(u32 transform);
 
 /// Flushes the framebuffer in the data cache. When \ref GfxMode is GfxMode_LinearDouble, this also transfers the linear-framebuffer to the actual framebuffer.
+/// When \ref gfxMarkDirtyRect was used since the last flush, only the marked areas are transferred/flushed, otherwise the whole framebuffer is.
 void gfxFlushBuffers(void);
 
+/// Marks an area of the framebuffer as modified since the last \ref gfxFlushBuffers, so that only the modified areas are transferred/flushed.
+/// Coordinates are the same as with \ref gfxGetFramebufferDisplayOffset, and the area is rounded out to 16x8-pixel blocks.
+/// Areas are tracked per framebuffer, so with double-buffering an area is also transferred/flushed for the next framebuffer.
+void gfxMarkDirtyRect(u32 x, u32 y, u32 width, u32 height);
+
 /// Use this to get the pixel-offset in the framebuffer. Returned value is in pixels, not bytes.
 /// This implements tegra blocklinear, with hard-coded constants etc.
 /// Do not use this when \ref GfxMode is GfxMode_LinearDouble.
@@ -0,0 +1,50 @@
+/**
+ * @file gfx_host.h
+ * @brief Host backend for the gfx code.
+ * The host library (built with Makefile.host) contains gfx.c and blit.c built for the host, with the services they use (vi, nv, binder, buffer producer, system tick and vsync event) emulated on host memory, as well as thread handles for code telling threads apart. This allows running framebuffer, swizzle and blit code in headless tests and benchmarks.
+ * Framebuffers are block-linear like on hardware. Queued frames are consumed by an emulated compositor, one per vsync.
+ * These functions are only available in the host library.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+
+/// Vsync clock used by the host backend, see \ref gfxHostConfigureVsync.
+typedef enum {
+    GfxHostVsync_Virtual,  ///< Waiting for a vsync advances the system tick to the next vsync instead of sleeping, so frames are presented as fast as they are drawn. This is the default.
+    GfxHostVsync_Realtime, ///< Waiting for a vsync sleeps until the next 60Hz vsync of the host clock.
+} GfxHostVsync;
+
+/// Configures the vsync clock. This also applies to blocking in \ref gfxSwapBuffers and frame-pacing.
+void gfxHostConfigureVsync(GfxHostVsync mode);
+
+/**
+ * @brief Configures dumping of each queued frame to a binary PPM file.
+ * @param[in] path printf-style format string for the file path, which is formatted with the frame number (unsigned int): the number of frames queued since \ref gfxInitDefault, including the frames queued during initialization. NULL to disable dumping (the default).
+ * @note The image is what the compositor displays: the queued crop and the flip transforms are applied. Rotation transforms aren't applied.
+ */
+void gfxHostConfigureFrameDump(const char *path);
+
+/**
+ * @brief Gets the most recently queued frame, like it's dumped by \ref gfxHostConfigureFrameDump.
+ * @param[out] out Output RGBA8 pixels, with room for width*height pixels. Can be NULL to only get the size.
+ * @param[out] width Output width, can be NULL.
+ * @param[out] height Output height, can be NULL.
+ * @return false when no frame was queued yet.
+ */
+bool gfxHostGetFrame(u32 *out, u32 *width, u32 *height);
+
+/// Gets the number of fence waits since startup. Fences are always signalled, but each dequeued framebuffer comes with one.
+u32 gfxHostGetFenceWaits(void);
+
+/// Makes the next buffer producer DequeueBuffer call fail with LibnxError_BufferProducerError, for testing error handling.
+void gfxHostFailNextDequeue(void);
+
+/**
+ * @brief Creates an emulated kernel thread for the calling host thread.
+ * @return Thread handle, which works with svcGetThreadId and svcWaitSynchronization. Store it in the thread vars of the host thread.
+ */
+Handle gfxHostThreadCreate(void);
+
+/// Marks an emulated kernel thread as exited, which signals its handle.
+void gfxHostThreadExit(Handle handle);
@@ -1,8 +1,55 @@
 #pragma once
 #include "../types.h"
+#include "../gfx/nvioctl.h"
 
+typedef enum {
+    NvgfxInitStep_Open,           //Opening the devices.
+    NvgfxInitStep_AddressSpace,   //GPU address space setup.
+    NvgfxInitStep_Framebuffers,   //Framebuffer memory allocation and mapping.
+    NvgfxInitStep_GraphicBuffers, //Framebuffer registration with the buffer producer.
+    NvgfxInitStep_GpuInfo,        //GPU characteristics/zcull/L2 queries.
+    NvgfxInitStep_GpuChannel,     //GPU channel setup.
+    NvgfxInitStep_GpuBuffers,     //GPU buffers used by the channel (command ring etc).
+    NvgfxInitStep_Count
+} NvgfxInitStep;
+
+//nvgfxInitialize only does the steps before NvgfxInitStep_GpuInfo, the GPU steps are done on a background thread (or on first use of the nvgfxGpfifo* functions when the thread can't be started).
 Result nvgfxInitialize(void);
+//Waits for the GPU steps and returns their result, which is also returned by the nvgfxGpfifo* functions. Without the thread, the steps are done now.
+Result nvgfxWaitGpuInit(void);
 void nvgfxExit(void);
 Result nvgfxEventWait(u32 syncpt_id, u32 threshold, s32 timeout);
 Result nvgfxSubmitGpfifo(void);
+
+#define NVGFX_GPFIFO_MAX_ENTRIES 16
+#define NVGFX_GPFIFO_MAX_INFLIGHT 16
+
+//GPFIFO command ring: allocate space with nvgfxGpfifoAlloc and write the commands, add them to the batch with nvgfxGpfifoPush, then send the whole batch with a single ioctl using nvgfxGpfifoSubmit. Command lists must be pushed in the order they were allocated.
+//Ring space is reclaimed by waiting on the fences of older submissions when needed. Only the pushed ranges are flushed from the data cache.
+Result nvgfxGpfifoAlloc(size_t size, void **cpu_ptr, u64 *gpu_va);
+Result nvgfxGpfifoPush(u64 gpu_va, size_t size, u32 flags);
+Result nvgfxGpfifoSubmit(nvioctl_fence *fence_out);
 Result nvgfxGetFramebuffer(u8 **buffer, size_t *size);
+
+//Framebuffer reallocation after g_gfx_singleframebuf_size changed: nvgfxResizeFramebuffers replaces the framebuffer memory, then nvgfxRegisterFramebuffers registers it with the buffer producer.
+//When nvgfxResizeFramebuffers fails nothing is replaced. The replaced memory can still be displayed, so it's only freed by nvgfxFreeRetiredFramebuffers, the next resize or nvgfxExit.
+//Until then, nvgfxRestoreFramebuffers frees the new memory and puts the replaced memory back, for when the new framebuffers can't be used. g_gfx_singleframebuf_size has to be restored first.
+Result nvgfxResizeFramebuffers(void);
+Result nvgfxRegisterFramebuffers(void);
+void nvgfxRestoreFramebuffers(void);
+void nvgfxFreeRetiredFramebuffers(void);
+
+#define NVGFX_HEAP_PAGE_SIZE 0x1000
+#define NVGFX_HEAP_ORDERS 11
+#define NVGFX_HEAP_CHUNK_SIZE (NVGFX_HEAP_PAGE_SIZE << (NVGFX_HEAP_ORDERS-1))
+#define NVGFX_HEAP_MAX_CHUNKS 8
+#define NVGFX_HEAP_MAX_DEFERRED 64
+
+//GPU-visible memory heap: blocks are power-of-two multiples of NVGFX_HEAP_PAGE_SIZE (at most NVGFX_HEAP_CHUNK_SIZE), allocated from chunks which are mapped once when needed.
+//With a fence, nvgfxHeapFree only releases the block once the fence is signalled, for memory which is still in use by the GPU.
+Result nvgfxHeapAlloc(size_t size, void **cpu_ptr, u64 *gpu_va);
+void nvgfxHeapFree(void *cpu_ptr, const nvioctl_fence *fence);
+
+//Time spent in each step of nvgfxInitialize, in system ticks. 0 when the step wasn't completed.
+//For the GPU steps this waits for the thread. Without the thread, it's 0 until they were done on first use or by nvgfxWaitGpuInit.
+u64 nvgfxGetInitStepTicks(NvgfxInitStep step);
@@ -2,8 +2,11 @@
 #include "../result.h"
 #include "../gfx/binder.h"
 
+#define PARCEL_HEADER_SIZE 0x10
+
 typedef struct {
-    u8 payload[0x400];
+    u8 data[0x400];//Parcel header followed by the payload, this is used directly as the IPC buffer by parcelTransact.
+    u8 *payload;
     u32 capacity;
     u32 size;
     u32 pos;
@@ -12,6 +15,15 @@ typedef struct {
     u32 ParcelObjectsSize;
 } Parcel;
 
+/// A string pre-encoded the way \ref parcelWriteString16 writes it, see \ref parcelInternString16.
+typedef struct {
+    const u8 *data;
+    u32 size;
+} ParcelString16;
+
+#define PARCEL_STRING16_POOL_ENTRIES 32
+#define PARCEL_STRING16_POOL_SIZE 0x1000
+
 void parcelInitialize(Parcel *ctx);
 Result parcelTransact(Binder *session, u32 code, Parcel *in_parcel, Parcel *reply_parcel);
 
@@ -22,6 +34,12 @@ void parcelWriteInt32(Parcel *ctx, s32 val);
 void parcelWriteUInt32(Parcel *ctx, u32 val);
 void parcelWriteString16(Parcel *ctx, const char *str);
 
+/// Returns the encoding of a string from a global pool, encoding and adding it first when needed. Returns NULL when the pool is full.
+/// Strings are matched by content and the pool keeps its own copy, so this is meant for a small set of strings which are written repeatedly, such as interface tokens.
+const ParcelString16* parcelInternString16(const char *str);
+/// Writes a string returned by \ref parcelInternString16, this is the same as \ref parcelWriteString16 with a single copy.
+void parcelWriteInternedString16(Parcel *ctx, const ParcelString16 *str);
+
 s32 parcelReadInt32(Parcel *ctx);
 u32 parcelReadUInt32(Parcel *ctx);
 void parcelWriteInterfaceToken(Parcel *ctx, const char *str);
@@ -0,0 +1,150 @@
+/**
+ * @file prng.h
+ * @brief Fast non-cryptographic pseudo-random number generation (xoshiro256** algorithm).
+ * @copyright libnx Authors
+ * @remark Use this for gameplay/simulation randomness only. For anything security-sensitive use \ref randomGet instead.
+ */
+#pragma once
+#include "../types.h"
+
+/// PRNG state. Two states seeded with the same value produce the same sequence.
+typedef struct {
+    u64 s[4];
+} Prng;
+
+/**
+ * @brief Seeds a PRNG from a 64-bit value, for reproducible sequences.
+ * @param p PRNG state.
+ * @param seed Seed value.
+ */
+void prngSeed(Prng* p, u64 seed);
+
+/**
+ * @brief Seeds a PRNG from the OS random number generator.
+ * @param p PRNG state.
+ */
+void prngSeedRandom(Prng* p);
+
+static inline u64 _prngRotl(u64 x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * @brief Returns the next 64-bit value of a PRNG.
+ * @param p PRNG state.
+ * @return Random value.
+ */
+static inline u64 prngNext64(Prng* p)
+{
+    u64* s = p->s;
+    u64 ret = _prngRotl(s[1] * 5, 7) * 9;
+    u64 t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = _prngRotl(s[3], 45);
+
+    return ret;
+}
+
+/**
+ * @brief Returns the next 32-bit value of a PRNG.
+ * @param p PRNG state.
+ * @return Random value.
+ */
+static inline u32 prngNext32(Prng* p)
+{
+    return prngNext64(p) >> 32;
+}
+
+/**
+ * @brief Returns a uniformly distributed value in [0, bound).
+ * @param p PRNG state.
+ * @param bound Exclusive upper bound, must not be 0.
+ * @return Random value.
+ */
+u32 prngNextBounded(Prng* p, u32 bound);
+
+/**
+ * @brief Returns a uniformly distributed float in [0, 1).
+ * @param p PRNG state.
+ * @return Random value.
+ */
+static inline float prngNextFloat(Prng* p)
+{
+    return (prngNext64(p) >> 40) * (1.0f / (1U << 24));
+}
+
+/**
+ * @brief Returns a uniformly distributed double in [0, 1).
+ * @param p PRNG state.
+ * @return Random value.
+ */
+static inline double prngNextDouble(Prng* p)
+{
+    return (prngNext64(p) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/**
+ * @brief Advances a PRNG by 2^128 steps.
+ * @param p PRNG state.
+ */
+void prngJump(Prng* p);
+
+/**
+ * @brief Advances a PRNG by 2^192 steps.
+ * @param p PRNG state.
+ */
+void prngLongJump(Prng* p);
+
+/**
+ * @brief Splits off an independent stream from a PRNG.
+ * @param p PRNG state, which is advanced by 2^128 steps.
+ * @param out PRNG state that will be filled in with the stream preceding the jump.
+ * @note Calling this repeatedly on the same state yields up to 2^128 non-overlapping streams, e.g. one per worker thread.
+ */
+void prngSplit(Prng* p, Prng* out);
+
+/**
+ * @brief Fills a buffer with random bytes.
+ * @param p PRNG state.
+ * @param buf Pointer to the buffer.
+ * @param len Size of the buffer in bytes.
+ */
+void prngFill(Prng* p, void* buf, size_t len);
+
+/**
+ * @brief Fills an array with uniformly distributed floats in [0, 1).
+ * @param p PRNG state.
+ * @param out Output array.
+ * @param count Number of elements.
+ */
+void prngFillFloat(Prng* p, float* out, size_t count);
+
+/**
+ * @brief Fills an array with uniformly distributed values in [0, bound).
+ * @param p PRNG state.
+ * @param out Output array.
+ * @param count Number of elements.
+ * @param bound Exclusive upper bound, must not be 0.
+ */
+void prngFillBounded(Prng* p, u32* out, size_t count, u32 bound);
+
+/**
+ * @brief Gets the calling thread's default PRNG.
+ * @return PRNG state, seeded from the OS random number generator on first use.
+ */
+Prng* prngGetThreadDefault(void);
+
+/**
+ * @brief Returns a random 64-bit value from the calling thread's default PRNG.
+ * @return Random value.
+ */
+static inline u64 prngGet64(void)
+{
+    return prngNext64(prngGetThreadDefault());
+}
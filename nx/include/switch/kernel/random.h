@@ -11,6 +11,7 @@
  * @brief Fills a buffer with random data.
  * @param buf Pointer to the buffer.
  * @param len Size of the buffer in bytes.
+ * @note Each thread uses its own generator, forked from the process TRNG seed on first use, so no lock is taken.
  */
 void randomGet(void* buf, size_t len);
 
@@ -28,6 +28,7 @@ enum {
 
 /// Kernel error codes
 enum {
+    KernelError_InvalidHandle=114,
     KernelError_Timeout=117,
 };
 
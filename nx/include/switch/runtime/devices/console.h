@@ -31,17 +31,56 @@
 #define CONSOLE_CYAN    CONSOLE_ESC(36;1m)
 #define CONSOLE_WHITE   CONSOLE_ESC(37;1m)
 
+#define CONSOLE_ESC_MAX_PARAMS 16 ///< Maximum number of parameters of an escape sequence, further ones are ignored
+
 /// A callback for printing a character.
 typedef bool(*ConsolePrint)(void* con, int c);
 
+/**
+ * @brief A callback for rasterizing a glyph that isn't part of the font graphics.
+ * @param userdata User data of the font, see \ref ConsoleFont.
+ * @param codepoint Unicode code point of the glyph.
+ * @param bitmap Output 16x16 glyph bitmap: one u16 per row, with the MSB as the leftmost pixel.
+ * @return false if the glyph isn't available.
+ */
+typedef bool(*ConsoleGlyphSource)(void* userdata, u32 codepoint, u16* bitmap);
+
 /// A font struct for the console.
 typedef struct ConsoleFont
 {
 	u16* gfx;         ///< A pointer to the font graphics
 	u16 asciiOffset; ///< Offset to the first valid character in the font table
 	u16 numChars;    ///< Number of characters in the font graphics
+	ConsoleGlyphSource glyphSource; ///< Optional callback for code points missing from the font graphics, glyphs are rasterized once and cached by code point
+	void* glyphUserdata; ///< User data passed to glyphSource
 }ConsoleFont;
 
+/// A glyph index entry of a \ref ConsoleBdfFont.
+typedef struct ConsoleBdfGlyph
+{
+	u32 codepoint; ///< Unicode code point
+	u32 offset;    ///< Offset of the glyph definition in the BDF source
+}ConsoleBdfGlyph;
+
+/// A BDF bitmap font, usable as a glyph source via \ref consoleBdfFontGetGlyph.
+typedef struct ConsoleBdfFont
+{
+	const char* data;        ///< BDF source text, which must stay valid while the font is in use
+	size_t size;             ///< Size of the BDF source text
+	ConsoleBdfGlyph* glyphs; ///< Glyph index sorted by code point
+	u32 numGlyphs;           ///< Number of glyphs in the index
+	int baseline;            ///< Cell row of the font baseline
+}ConsoleBdfFont;
+
+/// A character cell of a buffered console.
+typedef struct ConsoleCell
+{
+	u32 chr;   ///< Character code
+	u8  fg;    ///< Foreground color index, with bold/faint/reverse already applied
+	u8  bg;    ///< Background color index, with reverse already applied
+	u16 flags; ///< Attribute flags (CONSOLE_UNDERLINE, CONSOLE_CROSSED_OUT)
+}ConsoleCell;
+
 /**
  * @brief Console structure used to store the state of a console render context.
  *
@@ -53,7 +92,9 @@ typedef struct ConsoleFont
  * 	{
  * 		(u16*)default_font_bin, //font gfx
  * 		0, //first ascii character in the set
- * 		128, //number of characters in the font set
+ * 		256, //number of characters in the font set
+ * 		NULL, //glyph source
+ * 		NULL, //glyph source user data
  *	},
  *	0,0, //cursorX cursorY
  *	0,0, //prevcursorX prevcursorY
@@ -66,7 +107,20 @@ typedef struct ConsoleFont
  *	3, //tab size
  *	0, //font character offset
  *	0,  //print callback
- *	false //console initialized
+ *	false, //console initialized
+ *	false, //buffered
+ *	NULL, //cells
+ *	NULL, //dirty rows
+ *	0,  //top row
+ *	0,  //pending scroll
+ *	0,  //partial UTF-8 character
+ *	0,  //pending UTF-8 bytes
+ *	0,  //escape sequence state
+ *	0,  //number of escape sequence parameters
+ *	{0}, //escape sequence parameters
+ *	false, //staged
+ *	NULL, //staging buffer of the thread drained last
+ *	0 //bytes of staged output dropped
  * };
  * @endcode
  */
@@ -74,8 +128,8 @@ typedef struct PrintConsole
 {
 	ConsoleFont font;        ///< Font of the console
 
-	u32 *frameBuffer;        ///< Framebuffer address
-	u32 *frameBuffer2;       ///< Framebuffer address
+	u32 *frameBuffer DEPRECATED;  ///< Deprecated: address of framebuffer 0, set by \ref consoleInit. Use \ref gfxGetFramebuffers, the console draws into every framebuffer.
+	u32 *frameBuffer2 DEPRECATED; ///< Deprecated: address of framebuffer 1, set by \ref consoleInit. Use \ref gfxGetFramebuffers, the console draws into every framebuffer.
 
 	int cursorX;             ///< Current X location of the cursor (as a tile offset by default)
 	int cursorY;             ///< Current Y location of the cursor (as a tile offset by default)
@@ -99,6 +153,23 @@ typedef struct PrintConsole
 	ConsolePrint PrintChar;  ///< Callback for printing a character. Should return true if it has handled rendering the graphics (else the print engine will attempt to render via tiles).
 
 	bool consoleInitialised; ///< True if the console is initialized
+
+	bool buffered;           ///< True if output only updates the cell buffer, see \ref consoleSetBuffered
+	ConsoleCell* cells;      ///< Internal state: windowWidth*windowHeight character cells, used when buffered
+	u8* dirtyRows;           ///< Internal state: per-row dirty flags for the cells, used when buffered
+	int topRow;              ///< Internal state: row of the cell buffer shown at the top of the window (the rows form a ring)
+	int scrollPending;       ///< Internal state: rows scrolled since the framebuffer was last updated, used when buffered
+
+	u32 utf8Char;            ///< Internal state: partially decoded UTF-8 character, which may span several writes
+	int utf8Pending;         ///< Internal state: continuation bytes still expected for utf8Char
+
+	int escState;            ///< Internal state: escape sequence parser state, sequences may span several writes
+	int escNumParams;        ///< Internal state: number of parameters of the current escape sequence
+	int escParams[CONSOLE_ESC_MAX_PARAMS]; ///< Internal state: parameters of the current escape sequence, -1 when omitted
+
+	bool staged;             ///< True if writes are staged per thread until the next update, see \ref consoleSetStaged
+	struct ConsoleStaging* stagingLast; ///< Internal state: staging buffer of the thread drained last, whose text state is loaded
+	u64 stagingDropped;      ///< Bytes of staged output dropped since the console was initialized, see \ref consoleGetStagingDropped
 }PrintConsole;
 
 #define CONSOLE_COLOR_BOLD	(1<<0) ///< Bold text
@@ -121,11 +192,36 @@ typedef enum {
 
 /**
  * @brief Loads the font into the console.
+ * Console output is decoded as UTF-8. Code points are used as indices into the font graphics
+ * (the default font covers ASCII and the code page 437 characters), falling back to the glyph source of the font.
  * @param console Pointer to the console to update, if NULL it will update the current console.
  * @param font The font to load.
  */
 void consoleSetFont(PrintConsole* console, ConsoleFont* font);
 
+/**
+ * @brief Indexes a BDF font so it can be used as a console glyph source.
+ * The source text isn't copied, and glyphs are only rasterized when first printed.
+ * Glyphs larger than 16x16 are clipped to the character cell.
+ * @code
+ * ConsoleFont font = consoleGetDefault()->font;
+ * font.glyphSource = consoleBdfFontGetGlyph;
+ * font.glyphUserdata = &bdf;
+ * consoleSetFont(NULL, &font);
+ * @endcode
+ * @param font The font to initialize.
+ * @param data BDF source text.
+ * @param size Size of the BDF source text.
+ * @return false if the source isn't a BDF font or the index couldn't be allocated.
+ */
+bool consoleBdfFontInit(ConsoleBdfFont* font, const char* data, size_t size);
+
+/// Frees the glyph index of a BDF font, and drops the glyphs the console cached from it.
+void consoleBdfFontExit(ConsoleBdfFont* font);
+
+/// \ref ConsoleGlyphSource rasterizing glyphs of a \ref ConsoleBdfFont passed as the user data.
+bool consoleBdfFontGetGlyph(void* userdata, u32 codepoint, u16* bitmap);
+
 /**
  * @brief Sets the print window.
  * @param console Console to set, if NULL it will set the current console window.
@@ -154,6 +250,8 @@ PrintConsole *consoleSelect(PrintConsole* console);
  * @brief Initialise the console.
  * @param console A pointer to the console data to initialize (if it's NULL, the default console will be used).
  * @return A pointer to the current console.
+ * @note The console data doesn't have to be initialized. When the console was initialized before and is buffered or staged, its cell buffer is released and staged output is drawn first. Such a console has to be reinitialized, or have buffering and staging disabled, before its memory is reused.
+ * @note The console draws into every framebuffer (see \ref gfxGetFramebuffers), so its output stays on screen with any framebuffer count.
  */
 PrintConsole* consoleInit(PrintConsole* console);
 
@@ -163,5 +261,52 @@ PrintConsole* consoleInit(PrintConsole* console);
  */
 void consoleDebugInit(debugDevice device);
 
+/**
+ * @brief Enables or disables buffered output for a console.
+ * When buffered, printing only updates a character cell model of the window and marks the touched rows as dirty.
+ * Nothing is drawn or presented until \ref consoleUpdate is called, so printing many lines doesn't wait for a vsync per line.
+ * @param console Console to configure, if NULL it will configure the current console.
+ * @param buffered Whether to buffer output.
+ * @return false if the cell buffer couldn't be allocated.
+ * @note The window is cleared when buffering is enabled. When buffering is disabled, pending output is drawn first.
+ */
+bool consoleSetBuffered(PrintConsole* console, bool buffered);
+
+/**
+ * @brief Enables or disables staged output for a console, which makes printing from several threads safe.
+ * When staged, each thread appends its writes to its own staging buffer without taking locks, so printing never waits for rendering.
+ * Nothing is parsed or drawn until \ref consoleUpdate merges the staging buffers in timestamp order.
+ * Colors and escape sequence state are tracked per thread, so sequences printed by different threads can't interleave.
+ * @param console Console to configure, if NULL it will configure the current console.
+ * @param staged Whether to stage output.
+ * @note Each printing thread allocates a staging buffer per console on its first write to it, which is kept for reuse by that thread
+ *       until \ref consoleReleaseStaging is called or the thread exits.
+ *       Output that doesn't fit in a thread's buffer before the next update is dropped and counted, see \ref consoleGetStagingDropped.
+ *       Combine with \ref consoleSetBuffered so that updating doesn't wait for vsync on every line.
+ */
+void consoleSetStaged(PrintConsole* console, bool staged);
+
+/**
+ * @brief Releases the staging buffers of the calling thread, see \ref consoleSetStaged.
+ * Call this when a thread which printed to a staged console stops printing. Its pending output is still drawn by the next update,
+ * after which the buffers are reused by other threads. Buffers of threads which exited are reclaimed the same way without this call.
+ */
+void consoleReleaseStaging(void);
+
+/**
+ * @brief Gets the number of bytes of staged output which were dropped because a staging buffer was full.
+ * @param console Console to query, if NULL it will query the current console.
+ * @return Bytes dropped since the console was initialized.
+ */
+u64 consoleGetStagingDropped(PrintConsole* console);
+
+/**
+ * @brief Draws pending output of a buffered console and presents it.
+ * Staged output is merged first, see \ref consoleSetStaged.
+ * Only dirty rows are re-rendered, then the framebuffers are flushed and swapped, and vsync is waited for.
+ * @param console Console to update, if NULL it will update the current console.
+ */
+void consoleUpdate(PrintConsole* console);
+
 /// Clears the screan by using iprintf("\x1b[2J");
 void consoleClear(void);
@@ -52,6 +52,46 @@ ssize_t encode_utf8 (uint8_t *out, uint32_t in);
  */
 ssize_t encode_utf16(uint16_t *out, uint32_t in);
 
+/** Validate a UTF-8 sequence
+ *
+ *  @param[in] in Input sequence (null-terminated)
+ *
+ *  @returns number of input code units, excluding the terminator
+ *  @returns -1 for error
+ */
+ssize_t utf8_validate(const uint8_t *in);
+
+/** Validate a UTF-8 sequence which might not be null-terminated
+ *
+ *  Reads at most \a len code units.
+ *
+ *  @param[in] in  Input sequence
+ *  @param[in] len Size of the input buffer
+ *
+ *  @returns number of input code units, excluding the terminator
+ *  @returns \a len if no terminator was found within \a len code units
+ *  @returns -1 for error
+ */
+ssize_t utf8_validate_n(const uint8_t *in, size_t len);
+
+/** Compute the length of a UTF-8 sequence once converted to UTF-16
+ *
+ *  @param[in] in Input sequence (null-terminated)
+ *
+ *  @returns number of UTF-16 code units the input would produce
+ *  @returns -1 for error
+ */
+ssize_t utf8_utf16_length(const uint8_t *in);
+
+/** Compute the length of a UTF-16 sequence once converted to UTF-8
+ *
+ *  @param[in] in Input sequence (null-terminated)
+ *
+ *  @returns number of UTF-8 code units the input would produce
+ *  @returns -1 for error
+ */
+ssize_t utf16_utf8_length(const uint16_t *in);
+
 /** Convert a UTF-8 sequence into a UTF-16 sequence
  *
  *  Fills the output buffer up to \a len code units.
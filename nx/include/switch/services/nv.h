@@ -15,12 +15,35 @@ typedef enum {
 	NVSERVTYPE_T = 3,
 } nvServiceType;
 
+/// Timing of the ioctls sent with one (fd, request) pair, see \ref nvGetIoctlStats.
+typedef struct {
+	u32 fd;
+	u32 request;
+	u32 count;       ///< Number of ioctls.
+	u64 total_ticks; ///< Total system ticks spent in these ioctls, including building the request.
+	u64 max_ticks;   ///< Longest ioctl, in system ticks.
+} nvIoctlStats;
+
 Result nvInitialize(nvServiceType servicetype, size_t sharedmem_size);
 void nvExit(void);
 
 Result nvOpen(u32 *fd, const char *devicepath);
 Result nvIoctl(u32 fd, u32 request, void* argp);
+/// Same as \ref nvIoctl, with an additional input buffer which is sent as-is instead of being copied into argp. [3.0.0+]
+Result nvIoctl2(u32 fd, u32 request, void* argp, const void* inbuf, size_t inbuf_size);
+/// Same as \ref nvIoctl, with an additional output buffer. [3.0.0+]
+Result nvIoctl3(u32 fd, u32 request, void* argp, void* outbuf, size_t outbuf_size);
 Result nvClose(u32 fd);
 Result nvQueryEvent(u32 fd, u32 event_id, Handle *handle_out);
 
+/**
+ * @brief Gets the timing of the ioctls sent since \ref nvInitialize or \ref nvResetIoctlStats, per (fd, request) pair.
+ * @param[out] stats Output array.
+ * @param[in] max Max number of entries to write.
+ * @return Number of entries written.
+ * @note The first 31 (fd, request) pairs used in a session get their own entry. The ioctls of any further pairs are summed up in one entry with fd and request set to UINT32_MAX.
+ */
+size_t nvGetIoctlStats(nvIoctlStats* stats, size_t max);
+void nvResetIoctlStats(void);
+
 Result nvConvertError(int rc);
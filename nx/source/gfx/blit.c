@@ -0,0 +1,237 @@
+#include <string.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+#include "types.h"
+#include "gfx/gfx.h"
+#include "gfx/blit.h"
+#include "runtime/devices/console.h"
+
+extern size_t g_gfx_framebuf_aligned_width;
+extern size_t g_gfx_framebuf_display_width, g_gfx_framebuf_display_height;
+extern bool g_gfx_drawflip;
+
+typedef struct {
+    u32 color;
+    u32 bg;
+    const u32 *src;
+    u32 stride;
+    s32 x, y;//Destination origin of src/glyph.
+    u32 step_x, step_y;//16.16 source step for scaling.
+    const u16 *glyph;
+} BlitContext;
+
+//A span is up to 4 pixels which are contiguous in the framebuffer, starting at logical x/y.
+typedef void (*BlitSpanFunc)(u32 *dst, s32 x, s32 y, u32 count, const BlitContext *ctx);
+
+//Byte offset of the 4-pixel chunks of a 16-pixel GOB row, see gfxGetFramebufferDisplayOffset.
+static const u32 g_blitChunkOffsets[4] = {0, 32, 256, 288};
+
+//The pixel-offset calculation is separable: offset = row part (depends on y only) + column part (depends on x only).
+static inline u32 _blitRowOffset(u32 y) {
+    return ((y & 127) / 16)*1024 + (y / 128)*(g_gfx_framebuf_aligned_width/16*8)*1024 + ((y%16)/8)*512 + ((y%8)/2)*64 + (y%2)*16;
+}
+
+//Clips the rect to the display area. Returns false when nothing is left.
+static bool _blitClip(s32 *x, s32 *y, u32 *width, u32 *height, s32 *x1, s32 *y1) {
+    s64 tmp_x1 = (s64)*x + *width, tmp_y1 = (s64)*y + *height;
+
+    if (*x < 0) *x = 0;
+    if (*y < 0) *y = 0;
+    if (tmp_x1 > (s64)g_gfx_framebuf_display_width) tmp_x1 = g_gfx_framebuf_display_width;
+    if (tmp_y1 > (s64)g_gfx_framebuf_display_height) tmp_y1 = g_gfx_framebuf_display_height;
+
+    if (tmp_x1 <= *x || tmp_y1 <= *y) return false;
+
+    *x1 = tmp_x1;
+    *y1 = tmp_y1;
+    return true;
+}
+
+//Calls func for every span of the rect, in framebuffer memory order: 16x128-pixel blocks, rows within the block, then the 4 chunks of each GOB row.
+static inline __attribute__((always_inline)) void _blitForEachSpan(s32 x, s32 y, u32 width, u32 height, BlitSpanFunc func, const BlitContext *ctx) {
+    u8 *fb = gfxGetFramebuffer(NULL, NULL);
+    s32 x1, y1, py0, py1, py, block_y, block_y1, col, k, cx0, cx1, ly;
+    u8 *row;
+
+    if (!_blitClip(&x, &y, &width, &height, &x1, &y1)) return;
+
+    //Physical rows, the display is flipped vertically by default.
+    py0 = y;
+    py1 = y1;
+    if (g_gfx_drawflip) {
+        py0 = g_gfx_framebuf_display_height - y1;
+        py1 = g_gfx_framebuf_display_height - y;
+    }
+
+    for (block_y = py0; block_y < py1; block_y = block_y1) {
+        block_y1 = (block_y + 128) & ~127;
+        if (block_y1 > py1) block_y1 = py1;
+
+        for (col = x & ~15; col < x1; col += 16) {
+            for (py = block_y; py < block_y1; py++) {
+                row = fb + _blitRowOffset(py) + (col/16)*16*128*4;
+                ly = g_gfx_drawflip ? (s32)g_gfx_framebuf_display_height-1-py : py;
+
+                for (k = 0; k < 4; k++) {
+                    cx0 = col + k*4;
+                    cx1 = cx0 + 4;
+                    if (cx0 < x) cx0 = x;
+                    if (cx1 > x1) cx1 = x1;
+                    if (cx0 >= cx1) continue;
+
+                    func((u32*)(row + g_blitChunkOffsets[k]) + (cx0 & 3), cx0, ly, cx1 - cx0, ctx);
+                }
+            }
+        }
+    }
+}
+
+//Blends src over dst: dst*(255-a) + src*a, with the result alpha being a + dst_a*(255-a).
+static inline u32 _blitBlend(u32 src, u32 dst) {
+    u32 a = src >> 24, out = 0, t, i;
+
+    src |= 0xff000000;
+    for (i = 0; i < 32; i += 8) {
+        t = ((src >> i) & 0xff)*a + ((dst >> i) & 0xff)*(255-a);
+        out |= ((t + ((t + 128) >> 8) + 128) >> 8) << i;
+    }
+
+    return out;
+}
+
+#ifdef __ARM_NEON
+static inline uint8x16_t _blitBlend4(uint8x16_t src, uint8x16_t dst) {
+    static const u8 alpha_index[16] = {3,3,3,3, 7,7,7,7, 11,11,11,11, 15,15,15,15};
+    uint8x16_t a = vqtbl1q_u8(src, vld1q_u8(alpha_index));
+    uint8x16_t inv_a = vmvnq_u8(a);
+    uint16x8_t lo, hi;
+
+    src = vorrq_u8(src, vreinterpretq_u8_u32(vdupq_n_u32(0xff000000)));
+
+    lo = vmlal_u8(vmull_u8(vget_low_u8(src), vget_low_u8(a)), vget_low_u8(dst), vget_low_u8(inv_a));
+    hi = vmlal_high_u8(vmull_high_u8(src, a), dst, inv_a);
+
+    //Division by 255 with rounding, same as _blitBlend.
+    return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)), vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+#endif
+
+static void _blitFillSpan(u32 *dst, s32 x, s32 y, u32 count, const BlitContext *ctx) {
+#ifdef __ARM_NEON
+    if (count == 4) {
+        vst1q_u32(dst, vdupq_n_u32(ctx->color));
+        return;
+    }
+#endif
+    while (count--) *dst++ = ctx->color;
+}
+
+static void _blitCopySpan(u32 *dst, s32 x, s32 y, u32 count, const BlitContext *ctx) {
+    const u32 *src = &ctx->src[(y - ctx->y)*ctx->stride + (x - ctx->x)];
+
+    memcpy(dst, src, count*4);
+}
+
+static void _blitSpriteSpan(u32 *dst, s32 x, s32 y, u32 count, const BlitContext *ctx) {
+    const u32 *src = &ctx->src[(y - ctx->y)*ctx->stride + (x - ctx->x)];
+
+#ifdef __ARM_NEON
+    if (count == 4) {
+        vst1q_u8((u8*)dst, _blitBlend4(vld1q_u8((const u8*)src), vld1q_u8((const u8*)dst)));
+        return;
+    }
+#endif
+    while (count--) {
+        *dst = _blitBlend(*src++, *dst);
+        dst++;
+    }
+}
+
+static inline void _blitScaledLoad(u32 *out, s32 x, s32 y, u32 count, const BlitContext *ctx) {
+    const u32 *src = &ctx->src[(((u32)(y - ctx->y)*ctx->step_y + ctx->step_y/2) >> 16)*ctx->stride];
+    u32 sx = (u32)(x - ctx->x)*ctx->step_x + ctx->step_x/2, i;
+
+    for (i = 0; i < count; i++, sx += ctx->step_x) out[i] = src[sx >> 16];
+}
+
+static void _blitScaledCopySpan(u32 *dst, s32 x, s32 y, u32 count, const BlitContext *ctx) {
+    _blitScaledLoad(dst, x, y, count, ctx);
+}
+
+static void _blitScaledSpriteSpan(u32 *dst, s32 x, s32 y, u32 count, const BlitContext *ctx) {
+    u32 tmp[4];
+    u32 i;
+
+    _blitScaledLoad(tmp, x, y, count, ctx);
+
+#ifdef __ARM_NEON
+    if (count == 4) {
+        vst1q_u8((u8*)dst, _blitBlend4(vld1q_u8((const u8*)tmp), vld1q_u8((const u8*)dst)));
+        return;
+    }
+#endif
+    for (i = 0; i < count; i++) dst[i] = _blitBlend(tmp[i], dst[i]);
+}
+
+static void _blitGlyphSpan(u32 *dst, s32 x, s32 y, u32 count, const BlitContext *ctx) {
+    u32 bits = (u32)ctx->glyph[y - ctx->y] << (x - ctx->x);
+
+    for (; count; count--, bits <<= 1, dst++) {
+        if (bits & 0x8000) *dst = ctx->color;
+        else if (ctx->bg >> 24) *dst = ctx->bg;
+    }
+}
+
+void blitFillRect(s32 x, s32 y, u32 width, u32 height, u32 color) {
+    BlitContext ctx = {.color = color};
+
+    _blitForEachSpan(x, y, width, height, _blitFillSpan, &ctx);
+}
+
+void blitCopyRect(s32 x, s32 y, u32 width, u32 height, const u32* src, u32 stride) {
+    BlitContext ctx = {.src = src, .stride = stride, .x = x, .y = y};
+
+    _blitForEachSpan(x, y, width, height, _blitCopySpan, &ctx);
+}
+
+void blitSprite(s32 x, s32 y, u32 width, u32 height, const u32* src, u32 stride) {
+    BlitContext ctx = {.src = src, .stride = stride, .x = x, .y = y};
+
+    _blitForEachSpan(x, y, width, height, _blitSpriteSpan, &ctx);
+}
+
+void blitScaled(s32 x, s32 y, u32 width, u32 height, const u32* src, u32 stride, u32 src_width, u32 src_height, bool blend) {
+    BlitContext ctx = {.src = src, .stride = stride, .x = x, .y = y};
+
+    if (width == 0 || height == 0 || src_width == 0 || src_height == 0) return;
+
+    ctx.step_x = ((u64)src_width << 16) / width;
+    ctx.step_y = ((u64)src_height << 16) / height;
+
+    if (blend) _blitForEachSpan(x, y, width, height, _blitScaledSpriteSpan, &ctx);
+    else _blitForEachSpan(x, y, width, height, _blitScaledCopySpan, &ctx);
+}
+
+s32 blitTextSpan(s32 x, s32 y, const ConsoleFont* font, const char* text, size_t len, u32 fg, u32 bg) {
+    BlitContext ctx = {.color = fg, .bg = bg, .y = y};
+    u16 bitmap[16];
+    u32 index;
+    size_t i;
+
+    if (font == NULL) font = &consoleGetDefault()->font;
+
+    for (i = 0; i < len; i++) {
+        index = (u8)text[i] - font->asciiOffset;
+
+        if (index < font->numChars) ctx.glyph = font->gfx + 16*index;
+        else if (font->glyphSource && font->glyphSource(font->glyphUserdata, (u8)text[i], bitmap)) ctx.glyph = bitmap;
+        else continue;
+
+        ctx.x = x;
+        _blitForEachSpan(x, y, 16, 16, _blitGlyphSpan, &ctx);
+        x += 16;
+    }
+
+    return x;
+}
@@ -31,9 +31,42 @@ static char g_bufferProducer_InterfaceDescriptor[] = "android.gui.IGraphicBuffer
 
 static Binder *g_bufferProducerBinderSession;
 
+//The parcels for the per-frame DequeueBuffer/QueueBuffer transactions are kept across calls, with the interface token already serialized.
+//Only the arguments following the token are rewritten for each call.
+static Parcel g_bufferProducerDequeueParcel, g_bufferProducerQueueParcel, g_bufferProducerSwapReply;
+static u32 g_bufferProducerDequeueParcelBase, g_bufferProducerQueueParcelBase;
+
+//Same as parcelWriteInterfaceToken, with the descriptor from the parcel string pool.
+static void _bufferProducerWriteInterfaceToken(Parcel *parcel)
+{
+    const ParcelString16 *str = parcelInternString16(g_bufferProducer_InterfaceDescriptor);
+
+    if (str == NULL) {
+        parcelWriteInterfaceToken(parcel, g_bufferProducer_InterfaceDescriptor);
+        return;
+    }
+
+    parcelWriteInt32(parcel, 0x100);
+    parcelWriteInternedString16(parcel, str);
+}
+
+static void _bufferProducerPrepareParcel(Parcel *parcel, u32 *base)
+{
+    if (*base == 0) {
+        parcelInitialize(parcel);
+        _bufferProducerWriteInterfaceToken(parcel);
+        *base = parcel->size;
+    }
+
+    parcel->size = *base;
+    parcel->pos = 0;
+}
+
 Result bufferProducerInitialize(Binder *session)
 {
     g_bufferProducerBinderSession = session;
+    g_bufferProducerDequeueParcelBase = 0;
+    g_bufferProducerQueueParcelBase = 0;
     return 0;
 }
 
@@ -53,7 +86,7 @@ Result bufferProducerRequestBuffer(s32 bufferIdx, bufferProducerGraphicBuffer *b
     parcelInitialize(&parcel);
     parcelInitialize(&parcel_reply);
 
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
+    _bufferProducerWriteInterfaceToken(&parcel);
     parcelWriteInt32(&parcel, bufferIdx);
 
     rc = parcelTransact(g_bufferProducerBinderSession, REQUEST_BUFFER, &parcel, &parcel_reply);
@@ -83,37 +116,36 @@ Result bufferProducerRequestBuffer(s32 bufferIdx, bufferProducerGraphicBuffer *b
 Result bufferProducerDequeueBuffer(bool async, u32 width, u32 height, s32 format, u32 usage, s32 *buf, bufferProducerFence *fence)
 {
     Result rc;
-    Parcel parcel, parcel_reply;
+    Parcel *parcel = &g_bufferProducerDequeueParcel;
+    Parcel *parcel_reply = &g_bufferProducerSwapReply;
 
     if (g_bufferProducerBinderSession == NULL)
         return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
 
-    parcelInitialize(&parcel);
-    parcelInitialize(&parcel_reply);
-
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
+    _bufferProducerPrepareParcel(parcel, &g_bufferProducerDequeueParcelBase);
+    parcelInitialize(parcel_reply);
 
-    parcelWriteInt32(&parcel, async);
-    parcelWriteUInt32(&parcel, width);
-    parcelWriteUInt32(&parcel, height);
-    parcelWriteInt32(&parcel, format);
-    parcelWriteUInt32(&parcel, usage);
+    parcelWriteInt32(parcel, async);
+    parcelWriteUInt32(parcel, width);
+    parcelWriteUInt32(parcel, height);
+    parcelWriteInt32(parcel, format);
+    parcelWriteUInt32(parcel, usage);
 
-    rc = parcelTransact(g_bufferProducerBinderSession, DEQUEUE_BUFFER, &parcel, &parcel_reply);
+    rc = parcelTransact(g_bufferProducerBinderSession, DEQUEUE_BUFFER, parcel, parcel_reply);
 
     if (R_SUCCEEDED(rc)) {
-        *buf = parcelReadInt32(&parcel_reply);
+        *buf = parcelReadInt32(parcel_reply);
 
-        if(parcelReadInt32(&parcel_reply)) {
+        if(parcelReadInt32(parcel_reply)) {
             size_t tmpsize=0;
             void* tmp_ptr;
 
-            tmp_ptr = parcelReadFlattenedObject(&parcel_reply, &tmpsize);
+            tmp_ptr = parcelReadFlattenedObject(parcel_reply, &tmpsize);
             if (tmp_ptr==NULL || tmpsize!=sizeof(bufferProducerFence)) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
             if (fence) memcpy(fence, tmp_ptr, sizeof(bufferProducerFence));
         }
 
-        int result = parcelReadInt32(&parcel_reply);
+        int result = parcelReadInt32(parcel_reply);
         if (result != 0)
             rc = MAKERESULT(Module_Libnx, LibnxError_BufferProducerError);
     }
@@ -132,7 +164,7 @@ Result bufferProducerDetachBuffer(s32 slot)
     parcelInitialize(&parcel);
     parcelInitialize(&parcel_reply);
 
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
+    _bufferProducerWriteInterfaceToken(&parcel);
     parcelWriteInt32(&parcel, slot);
 
     rc = parcelTransact(g_bufferProducerBinderSession, DETACH_BUFFER, &parcel, &parcel_reply);
@@ -147,24 +179,24 @@ Result bufferProducerDetachBuffer(s32 slot)
 Result bufferProducerQueueBuffer(s32 buf, bufferProducerQueueBufferInput *input, bufferProducerQueueBufferOutput *output)
 {
     Result rc;
-    Parcel parcel, parcel_reply;
+    Parcel *parcel = &g_bufferProducerQueueParcel;
+    Parcel *parcel_reply = &g_bufferProducerSwapReply;
 
     if (g_bufferProducerBinderSession == NULL)
         return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
 
-    parcelInitialize(&parcel);
-    parcelInitialize(&parcel_reply);
+    _bufferProducerPrepareParcel(parcel, &g_bufferProducerQueueParcelBase);
+    parcelInitialize(parcel_reply);
 
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
-    parcelWriteInt32(&parcel, buf);
-    parcelWriteFlattenedObject(&parcel, input, sizeof(bufferProducerQueueBufferInput));
+    parcelWriteInt32(parcel, buf);
+    parcelWriteFlattenedObject(parcel, input, sizeof(bufferProducerQueueBufferInput));
 
-    rc = parcelTransact(g_bufferProducerBinderSession, QUEUE_BUFFER, &parcel, &parcel_reply);
+    rc = parcelTransact(g_bufferProducerBinderSession, QUEUE_BUFFER, parcel, parcel_reply);
 
     if (R_SUCCEEDED(rc)) {
-        if (parcelReadData(&parcel_reply, output, sizeof(bufferProducerQueueBufferOutput))==NULL) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+        if (parcelReadData(parcel_reply, output, sizeof(bufferProducerQueueBufferOutput))==NULL) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
 
-        int result = parcelReadInt32(&parcel_reply);
+        int result = parcelReadInt32(parcel_reply);
         if (result != 0)
             rc = MAKERESULT(Module_Libnx, LibnxError_BufferProducerError);
     }
@@ -183,7 +215,7 @@ Result bufferProducerQuery(s32 what, s32* value)
     parcelInitialize(&parcel);
     parcelInitialize(&parcel_reply);
 
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
+    _bufferProducerWriteInterfaceToken(&parcel);
     parcelWriteInt32(&parcel, what);
 
     rc = parcelTransact(g_bufferProducerBinderSession, QUERY, &parcel, &parcel_reply);
@@ -210,7 +242,7 @@ Result bufferProducerConnect(s32 api, bool producerControlledByApp, bufferProduc
     parcelInitialize(&parcel);
     parcelInitialize(&parcel_reply);
 
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
+    _bufferProducerWriteInterfaceToken(&parcel);
 
     // Hard-code this as if listener==NULL, since that's not known to be used officially.
     parcelWriteInt32(&parcel, 0);
@@ -241,7 +273,7 @@ Result bufferProducerDisconnect(s32 api)
     parcelInitialize(&parcel);
     parcelInitialize(&parcel_reply);
 
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
+    _bufferProducerWriteInterfaceToken(&parcel);
     parcelWriteInt32(&parcel, api);
 
     rc = parcelTransact(g_bufferProducerBinderSession, DISCONNECT, &parcel, &parcel_reply);
@@ -264,7 +296,7 @@ Result bufferProducerGraphicBufferInit(s32 buf, bufferProducerGraphicBuffer *inp
     parcelInitialize(&parcel);
     parcelInitialize(&parcel_reply);
 
-    parcelWriteInterfaceToken(&parcel, g_bufferProducer_InterfaceDescriptor);
+    _bufferProducerWriteInterfaceToken(&parcel);
     parcelWriteInt32(&parcel, buf);
 
     if (input!=NULL) flag = 1;
@@ -23,10 +23,14 @@ static Binder g_gfxBinderSession;
 static s32 g_gfxCurrentBuffer = 0;
 static s32 g_gfxCurrentProducerBuffer = 0;
 static bool g_gfx_ProducerConnected = 0;
-static bool g_gfx_ProducerSlotsRequested[2] = {0, 0};
+static bool g_gfx_ProducerSlotsRequested[GFX_MAX_FRAMEBUFFERS];
 static u8 *g_gfxFramebuf;
 static size_t g_gfxFramebufSize;
 static bufferProducerFence g_gfx_DequeueBuffer_fence;
+static GfxFence g_gfx_DequeueFence;//Fence from the previous DequeueBuffer, to wait on before the current framebuffer is written. Cleared once waited on.
+static bool g_gfx_AsyncDequeue;
+static bool g_gfx_RetiredFramebuf;//Whether the framebuffer memory replaced by gfxSetFramebufferResolution wasn't freed yet.
+static u32 g_gfx_ResizeQueuedSlots;//Slots queued since gfxSetFramebufferResolution.
 static bufferProducerQueueBufferOutput g_gfx_Connect_QueueBufferOutput;
 static bufferProducerQueueBufferOutput g_gfx_QueueBuffer_QueueBufferOutput;
 
@@ -34,6 +38,25 @@ static GfxMode g_gfxMode = GfxMode_LinearDouble;
 
 static u8 *g_gfxFramebufLinear;
 
+//Dirty-rect tracking: for each framebuffer, one bit per 512-byte GOB which still has to be transferred/flushed.
+static u64 *g_gfxDirtyGobs;
+static size_t g_gfxDirtyGobsWords;
+static u32 g_gfxDirtyFullMask;//Framebuffers which have to be handled entirely.
+static bool g_gfxDirtyMarked;//Whether gfxMarkDirtyRect was used since the last gfxFlushBuffers.
+
+//Frame statistics and pacing. Times are in system ticks.
+#define GFX_VSYNC_TICKS (19200000ULL/60)
+
+static GfxFrameStats g_gfxFrameStats[GFX_FRAME_STATS_COUNT];
+static u64 g_gfxFrameCount;
+static u64 g_gfxFrameStartTick;//End of the previous gfxSwapBuffers.
+static u64 g_gfxFrameVsyncTicks;//Time spent in gfxWaitForVsync since g_gfxFrameStartTick.
+static u64 g_gfxFrameFenceTicks;//Time spent waiting on the dequeue fence since g_gfxFrameStartTick.
+static u64 g_gfxLastPresentVsyncTick;//Vsync at which the previous frame is displayed.
+static u64 g_gfxLastVsyncTick;
+static u32 g_gfxFramePacing;//Vsync-interval, 0 = disabled.
+
+u32 g_gfx_framebuf_count=0;
 size_t g_gfx_framebuf_width=0, g_gfx_framebuf_aligned_width=0;
 size_t g_gfx_framebuf_height=0, g_gfx_framebuf_aligned_height=0;
 size_t g_gfx_framebuf_display_width=0, g_gfx_framebuf_display_height=0;
@@ -123,6 +146,14 @@ static Result _gfxGetNativeWindowID(u8 *buf, u64 size, s32 *out_ID) {
     return 0;
 }
 
+static void _gfxFenceFromProducer(GfxFence *out, const bufferProducerFence *fence) {
+    nvioctl_fence nv_fences[4];
+
+    //is_valid is actually the number of fences used.
+    memcpy(nv_fences, fence->nv_fences, sizeof(nv_fences));//bufferProducerFence is packed.
+    gfxFenceCreate(out, nv_fences, fence->is_valid < 4 ? fence->is_valid : 4);
+}
+
 static Result _gfxDequeueBuffer(void) {
     Result rc=0;
     bufferProducerFence *fence = &g_gfx_DequeueBuffer_fence;
@@ -138,10 +169,29 @@ static Result _gfxDequeueBuffer(void) {
 
     rc = bufferProducerDequeueBuffer(async, g_gfx_framebuf_width, g_gfx_framebuf_height, 0, 0x300, &g_gfxCurrentProducerBuffer, fence);
 
-    //Only run nvgfxEventWait when the fence is valid and the id is not NO_FENCE.
-    if (R_SUCCEEDED(rc) && tmp_fence.is_valid && tmp_fence.nv_fences[0].id!=0xffffffff) rc = nvgfxEventWait(tmp_fence.nv_fences[0].id, tmp_fence.nv_fences[0].value, -1);
+    //The wait is deferred until the framebuffer is accessed (see _gfxWaitFramebufferAccess), or left to the user with async-dequeue.
+    if (R_SUCCEEDED(rc)) {
+        _gfxFenceFromProducer(&g_gfx_DequeueFence, &tmp_fence);
+        if (!g_gfxInitialized) rc = gfxWaitDequeueFence();
+    }
+
+    //The slot index is also the index of the framebuffer within the framebuf memory, see _gfxGraphicBufferInit().
+    if (R_SUCCEEDED(rc)) {
+        if (g_gfxCurrentProducerBuffer < 0 || (u32)g_gfxCurrentProducerBuffer >= g_nvgfx_totalframebufs) rc = MAKERESULT(Module_Libnx, LibnxError_BufferProducerError);
+        else g_gfxCurrentBuffer = g_gfxCurrentProducerBuffer;
+    }
+
+    //Slots are requested on first use, which is also needed after gfxSetFramebufferResolution detached them.
+    if (R_SUCCEEDED(rc) && !g_gfx_ProducerSlotsRequested[g_gfxCurrentProducerBuffer]) {
+        rc = bufferProducerRequestBuffer(g_gfxCurrentProducerBuffer, NULL);
+        if (R_SUCCEEDED(rc)) g_gfx_ProducerSlotsRequested[g_gfxCurrentProducerBuffer] = 1;
+    }
 
-    if (R_SUCCEEDED(rc)) g_gfxCurrentBuffer = (g_gfxCurrentBuffer + 1) & (g_nvgfx_totalframebufs-1);
+    //A slot which was queued after the resize is only released once the compositor displayed a newer frame, so the replaced framebuffer memory isn't in use anymore.
+    if (R_SUCCEEDED(rc) && g_gfx_RetiredFramebuf && (g_gfx_ResizeQueuedSlots & BIT(g_gfxCurrentProducerBuffer))) {
+        nvgfxFreeRetiredFramebuffers();
+        g_gfx_RetiredFramebuf = 0;
+    }
 
     //if (R_SUCCEEDED(rc)) rc = nvgfxSubmitGpfifo();
 
@@ -161,9 +211,36 @@ static Result _gfxQueueBuffer(s32 buf) {
     rc = bufferProducerQueueBuffer(buf, &g_gfxQueueBufferData, &g_gfx_QueueBuffer_QueueBufferOutput);
     if (R_FAILED(rc)) return rc;
 
+    g_gfx_ResizeQueuedSlots |= BIT(buf);
+
+    //The present fence only applies to one frame.
+    gfxSetPresentFence(NULL);
+
     return rc;
 }
 
+//Updates the framebuffer sizes and the GraphicBuffer data for g_gfx_framebuf_width/height.
+static void _gfxConfigureFramebufferSize(void) {
+    g_gfx_framebuf_aligned_width = (g_gfx_framebuf_width+15) & ~15;//Align to 16.
+    g_gfx_framebuf_aligned_height = (g_gfx_framebuf_height+127) & ~127;//Align to 128.
+
+    g_gfx_singleframebuf_size = g_gfx_framebuf_aligned_width*g_gfx_framebuf_aligned_height*4;
+    g_gfx_singleframebuf_linear_size = g_gfx_framebuf_width*g_gfx_framebuf_height*4;
+
+    g_gfx_BufferInitData.width = g_gfx_framebuf_width;
+    g_gfx_BufferInitData.height = g_gfx_framebuf_height;
+    g_gfx_BufferInitData.stride = g_gfx_framebuf_aligned_width;
+
+    g_gfx_BufferInitData.data.width_unk0 = g_gfx_framebuf_width;
+    g_gfx_BufferInitData.data.width_unk1 = g_gfx_framebuf_width;
+    g_gfx_BufferInitData.data.height_unk = g_gfx_framebuf_height;
+
+    g_gfx_BufferInitData.data.byte_stride = g_gfx_framebuf_aligned_width*4;
+
+    g_gfx_BufferInitData.data.buffer_size0 = g_gfx_singleframebuf_size;
+    g_gfx_BufferInitData.data.buffer_size1 = g_gfx_singleframebuf_size;
+}
+
 static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 LayerFlags, u64 LayerId, nvServiceType nv_servicetype, size_t nv_transfermem_size) {
     Result rc=0;
     u32 i=0;
@@ -184,6 +261,12 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
 
     memset(g_gfx_ProducerSlotsRequested, 0, sizeof(g_gfx_ProducerSlotsRequested));
     memset(&g_gfx_DequeueBuffer_fence, 0, sizeof(g_gfx_DequeueBuffer_fence));
+    memset(&g_gfx_DequeueFence, 0, sizeof(g_gfx_DequeueFence));
+    gfxSetPresentFence(NULL);
+    g_gfx_RetiredFramebuf = 0;
+    g_gfx_ResizeQueuedSlots = 0;
+
+    if (g_gfx_framebuf_count==0) g_gfx_framebuf_count = 2;
 
     if (g_gfx_framebuf_width==0 || g_gfx_framebuf_height==0) {
         g_gfx_framebuf_width = 1280;
@@ -193,24 +276,7 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
     g_gfx_framebuf_display_width = g_gfx_framebuf_width;
     g_gfx_framebuf_display_height = g_gfx_framebuf_height;
 
-    g_gfx_framebuf_aligned_width = (g_gfx_framebuf_width+15) & ~15;//Align to 16.
-    g_gfx_framebuf_aligned_height = (g_gfx_framebuf_height+127) & ~127;//Align to 128.
-
-    g_gfx_singleframebuf_size = g_gfx_framebuf_aligned_width*g_gfx_framebuf_aligned_height*4;
-    g_gfx_singleframebuf_linear_size = g_gfx_framebuf_width*g_gfx_framebuf_height*4;
-
-    g_gfx_BufferInitData.width = g_gfx_framebuf_width;
-    g_gfx_BufferInitData.height = g_gfx_framebuf_height;
-    g_gfx_BufferInitData.stride = g_gfx_framebuf_aligned_width;
-
-    g_gfx_BufferInitData.data.width_unk0 = g_gfx_framebuf_width;
-    g_gfx_BufferInitData.data.width_unk1 = g_gfx_framebuf_width;
-    g_gfx_BufferInitData.data.height_unk = g_gfx_framebuf_height;
-
-    g_gfx_BufferInitData.data.byte_stride = g_gfx_framebuf_aligned_width*4;
-
-    g_gfx_BufferInitData.data.buffer_size0 = g_gfx_singleframebuf_size;
-    g_gfx_BufferInitData.data.buffer_size1 = g_gfx_singleframebuf_size;
+    _gfxConfigureFramebufferSize();
 
     g_gfxFramebufLinear = memalign(0x1000, g_gfx_singleframebuf_linear_size);
     if (g_gfxFramebufLinear) {
@@ -250,16 +316,19 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
 
     if (R_SUCCEEDED(rc)) rc = nvgfxGetFramebuffer(&g_gfxFramebuf, &g_gfxFramebufSize);
 
-    if (R_SUCCEEDED(rc)) { //Official sw would use bufferProducerRequestBuffer() when required during swap-buffers/or similar, but that's not really an option here due to gfxSetDoubleBuffering().
-       for(i=0; i<2; i++) {
-           rc = _gfxDequeueBuffer();
-           if (R_FAILED(rc)) break;
+    if (R_SUCCEEDED(rc)) {
+        g_gfxDirtyGobsWords = (g_gfx_singleframebuf_size/512 + 63) / 64;
+        g_gfxDirtyGobs = calloc(g_nvgfx_totalframebufs*g_gfxDirtyGobsWords, sizeof(u64));
+        g_gfxDirtyFullMask = ~0;
+        g_gfxDirtyMarked = 0;
+        if (g_gfxDirtyGobs == NULL) rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
 
-           rc = bufferProducerRequestBuffer(g_gfxCurrentProducerBuffer, NULL);
+    if (R_SUCCEEDED(rc)) { //Every slot is dequeued (and requested by _gfxDequeueBuffer) once here, instead of when it's first used during swap-buffers like official sw.
+       for(i=0; i<g_nvgfx_totalframebufs; i++) {
+           rc = _gfxDequeueBuffer();
            if (R_FAILED(rc)) break;
 
-           g_gfx_ProducerSlotsRequested[i] = 1;
-
            //Officially, nvioctlNvmap_FromID() and nvioctlChannel_SubmitGPFIFO() are used here.
 
            rc = _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
@@ -283,7 +352,7 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
 
     if (R_FAILED(rc)) {
         _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
-        for(i=0; i<2; i++) {
+        for(i=0; i<GFX_MAX_FRAMEBUFFERS; i++) {
             if (g_gfx_ProducerSlotsRequested[i]) bufferProducerDetachBuffer(i);
         }
         if (g_gfx_ProducerConnected) bufferProducerDisconnect(NATIVE_WINDOW_API_CPU);
@@ -305,6 +374,9 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
         free(g_gfxFramebufLinear);
         g_gfxFramebufLinear = NULL;
 
+        free(g_gfxDirtyGobs);
+        g_gfxDirtyGobs = NULL;
+
         g_gfxNativeWindow_ID = 0;
         g_gfxCurrentBuffer = 0;
         g_gfxCurrentProducerBuffer = -1;
@@ -314,11 +386,19 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
 
         g_gfx_framebuf_width = 0;
         g_gfx_framebuf_height = 0;
+        g_gfx_framebuf_count = 0;
 
         memset(g_gfx_ProducerSlotsRequested, 0, sizeof(g_gfx_ProducerSlotsRequested));
     }
 
-    if (R_SUCCEEDED(rc)) g_gfxInitialized = 1;
+    if (R_SUCCEEDED(rc)) {
+        g_gfxFrameCount = 0;
+        g_gfxFrameStartTick = svcGetSystemTick();
+        g_gfxFrameVsyncTicks = 0;
+        g_gfxFrameFenceTicks = 0;
+        g_gfxLastPresentVsyncTick = 0;
+        g_gfxInitialized = 1;
+    }
 
     return rc;
 }
@@ -352,7 +432,7 @@ void gfxExit(void)
         return;
 
     _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
-    for (i=0; i<2; i++) {
+    for (i=0; i<GFX_MAX_FRAMEBUFFERS; i++) {
         if (g_gfx_ProducerSlotsRequested[i]) bufferProducerDetachBuffer(i);
     }
     if (g_gfx_ProducerConnected) bufferProducerDisconnect(2);
@@ -378,6 +458,9 @@ void gfxExit(void)
     free(g_gfxFramebufLinear);
     g_gfxFramebufLinear = NULL;
 
+    free(g_gfxDirtyGobs);
+    g_gfxDirtyGobs = NULL;
+
     g_gfxInitialized = 0;
     g_gfxNativeWindow_ID = 0;
 
@@ -389,6 +472,10 @@ void gfxExit(void)
 
     g_gfx_framebuf_width = 0;
     g_gfx_framebuf_height = 0;
+    g_gfx_framebuf_count = 0;
+    g_gfx_AsyncDequeue = 0;
+    g_gfx_RetiredFramebuf = 0;
+    g_gfxFramePacing = 0;
 
     gfxConfigureAutoResolution(0, 0, 0, 0, 0);
 
@@ -408,6 +495,19 @@ void gfxInitResolutionDefault(void) {
     gfxInitResolution(1920, 1080);
 }
 
+void gfxInitBufferCount(u32 count) {
+    if (g_gfxInitialized) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_AlreadyInitialized));
+
+    if (count > GFX_MAX_FRAMEBUFFERS) count = GFX_MAX_FRAMEBUFFERS;
+    if (count == 1) count = 2;
+    g_gfx_framebuf_count = count;
+}
+
+void gfxConfigureAsyncDequeue(bool enable) {
+    if (!enable) gfxWaitDequeueFence();
+    g_gfx_AsyncDequeue = enable;
+}
+
 void gfxConfigureCrop(s32 left, s32 top, s32 right, s32 bottom) {
     if (right==0 || bottom==0) {
         g_gfx_framebuf_display_width = g_gfx_framebuf_width;
@@ -432,6 +532,8 @@ void gfxConfigureCrop(s32 left, s32 top, s32 right, s32 bottom) {
         g_gfx_framebuf_display_width = right;
         g_gfx_framebuf_display_height = bottom;
     }
+
+    g_gfxDirtyFullMask = ~0;
 }
 
 void gfxConfigureResolution(s32 width, s32 height) {
@@ -475,6 +577,126 @@ void gfxConfigureAutoResolutionDefault(bool enable) {
     gfxConfigureAutoResolution(enable, 1280, 720, 0, 0);
 }
 
+//Detaches the buffer producer slots, which are requested again on first use.
+static void _gfxDetachFramebuffers(void) {
+    u32 i;
+
+    for (i=0; i<GFX_MAX_FRAMEBUFFERS; i++) {
+        if (g_gfx_ProducerSlotsRequested[i]) bufferProducerDetachBuffer(i);
+    }
+    memset(g_gfx_ProducerSlotsRequested, 0, sizeof(g_gfx_ProducerSlotsRequested));
+    memset(&g_gfx_DequeueBuffer_fence, 0, sizeof(g_gfx_DequeueBuffer_fence));
+    memset(&g_gfx_DequeueFence, 0, sizeof(g_gfx_DequeueFence));
+    g_gfxCurrentProducerBuffer = -1;
+}
+
+//Registers the framebuffer memory with the detached slots, then dequeues a framebuffer.
+static Result _gfxAttachFramebuffers(void) {
+    Result rc=0;
+    GfxMode mode = g_gfxMode;
+
+    rc = nvgfxRegisterFramebuffers();
+
+    if (R_SUCCEEDED(rc)) rc = nvgfxGetFramebuffer(&g_gfxFramebuf, &g_gfxFramebufSize);
+
+    //With GfxMode_TiledSingle the framebuffer which is drawn to is the displayed one, so it's dequeued and queued once here.
+    g_gfxMode = GfxMode_LinearDouble;
+    if (R_SUCCEEDED(rc)) rc = _gfxDequeueBuffer();
+    if (R_SUCCEEDED(rc) && mode == GfxMode_TiledSingle) {
+        rc = _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
+        g_gfxCurrentProducerBuffer = -1;
+    }
+    g_gfxMode = mode;
+
+    return rc;
+}
+
+Result gfxSetFramebufferResolution(u32 width, u32 height) {
+    Result rc=0;
+    size_t old_width = g_gfx_framebuf_width, old_height = g_gfx_framebuf_height;
+    size_t dirty_words, old_dirty_words = g_gfxDirtyGobsWords;
+    u8 *linear = NULL, *old_linear = g_gfxFramebufLinear;
+    u64 *dirty = NULL, *old_dirty = g_gfxDirtyGobs;
+
+    if (!g_gfxInitialized) {
+        gfxInitResolution(width, height);
+        return 0;
+    }
+
+    width = (width+3) & ~3;
+    height = (height+3) & ~3;
+
+    if (width==0 || height==0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    if (width == g_gfx_framebuf_width && height == g_gfx_framebuf_height) return 0;
+
+    //Everything is allocated before the swap chain is touched, so that nothing changes when an allocation fails.
+    g_gfx_framebuf_width = width;
+    g_gfx_framebuf_height = height;
+    _gfxConfigureFramebufferSize();
+
+    dirty_words = (g_gfx_singleframebuf_size/512 + 63) / 64;
+    linear = memalign(0x1000, g_gfx_singleframebuf_linear_size);
+    dirty = calloc(g_nvgfx_totalframebufs*dirty_words, sizeof(u64));
+    if (linear == NULL || dirty == NULL) rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    if (R_SUCCEEDED(rc)) rc = nvgfxResizeFramebuffers();
+
+    if (R_FAILED(rc)) {
+        free(linear);
+        free(dirty);
+        g_gfx_framebuf_width = old_width;
+        g_gfx_framebuf_height = old_height;
+        _gfxConfigureFramebufferSize();
+        return rc;
+    }
+
+    memset(linear, 0, g_gfx_singleframebuf_linear_size);
+    g_gfxFramebufLinear = linear;
+    g_gfxDirtyGobs = dirty;
+    g_gfxDirtyGobsWords = dirty_words;
+    g_gfxDirtyFullMask = ~0;
+    g_gfxDirtyMarked = 0;
+
+    //The layer and the producer connection stay as-is, only the slots get new buffers. The dequeued framebuffer isn't queued, since it has the old size.
+    _gfxDetachFramebuffers();
+
+    g_gfx_RetiredFramebuf = 1;
+    g_gfx_ResizeQueuedSlots = 0;
+
+    rc = _gfxAttachFramebuffers();
+
+    //The slots are registered with the previous framebuffer memory again, so that the previous resolution keeps working.
+    if (R_FAILED(rc)) {
+        _gfxDetachFramebuffers();
+
+        g_gfx_framebuf_width = old_width;
+        g_gfx_framebuf_height = old_height;
+        _gfxConfigureFramebufferSize();
+        nvgfxRestoreFramebuffers();
+        g_gfx_RetiredFramebuf = 0;
+
+        free(linear);
+        free(dirty);
+        g_gfxFramebufLinear = old_linear;
+        g_gfxDirtyGobs = old_dirty;
+        g_gfxDirtyGobsWords = old_dirty_words;
+
+        _gfxAttachFramebuffers();
+        return rc;
+    }
+
+    free(old_linear);
+    free(old_dirty);
+
+    //The crop is reset like with gfxInitResolution, then the auto-resolution config is applied again for the new size.
+    memset(&g_gfxQueueBufferData.crop, 0, sizeof(g_gfxQueueBufferData.crop));
+    g_gfx_framebuf_display_width = g_gfx_framebuf_width;
+    g_gfx_framebuf_display_height = g_gfx_framebuf_height;
+    if (g_gfx_autoresolution_enabled) _gfxAutoResolutionAppletHook(AppletHookType_OnOperationMode, 0);
+
+    return rc;
+}
+
 Result _gfxGraphicBufferInit(s32 buf, u32 nvmap_handle) {
     g_gfx_BufferInitData.refcount = buf;
     g_gfx_BufferInitData.data.nvmap_handle0 = nvmap_handle;
@@ -501,20 +723,169 @@ static void _waitevent(Handle *handle) {
     if (R_FAILED(rc2)) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxEventWait));
 }
 
-void gfxWaitForVsync(void) {
+static u64 _gfxWaitForVsync(void) {
+    u64 tick = svcGetSystemTick();
+
     _waitevent(&g_gfxDisplayVsyncEvent);
+
+    g_gfxLastVsyncTick = svcGetSystemTick();
+    return g_gfxLastVsyncTick - tick;
+}
+
+void gfxWaitForVsync(void) {
+    g_gfxFrameVsyncTicks += _gfxWaitForVsync();
+}
+
+//Returns the estimated vsync at which a frame queued at the specified tick is displayed, based on the last vsync which was waited on. Returns 0 when there's no recent vsync to base this on.
+static u64 _gfxPresentVsyncTick(u64 tick) {
+    if (g_gfxLastVsyncTick == 0 || tick < g_gfxLastVsyncTick || tick - g_gfxLastVsyncTick >= GFX_VSYNC_TICKS*60) return 0;
+
+    return g_gfxLastVsyncTick + ((tick - g_gfxLastVsyncTick) / GFX_VSYNC_TICKS + 1) * GFX_VSYNC_TICKS;
+}
+
+//Blocks on the vsync event until a frame queued now would be displayed the configured number of vsyncs after the previous one.
+static u64 _gfxPaceFrame(void) {
+    u64 ticks = 0;
+    u64 target, vsync;
+
+    if (g_gfxFramePacing == 0 || g_gfxLastPresentVsyncTick == 0) return 0;
+
+    target = g_gfxLastPresentVsyncTick + g_gfxFramePacing*GFX_VSYNC_TICKS;
+
+    while (1) {
+        vsync = _gfxPresentVsyncTick(svcGetSystemTick());
+        if (vsync && vsync + GFX_VSYNC_TICKS/2 >= target) break;
+
+        ticks += _gfxWaitForVsync();
+    }
+
+    return ticks;
 }
 
 void gfxSwapBuffers(void) {
     Result rc=0;
+    GfxFrameStats *stats = &g_gfxFrameStats[g_gfxFrameCount % GFX_FRAME_STATS_COUNT];
+    u64 tick0, tick1, tick2, vsync, interval;
+    u32 target = g_gfxFramePacing ? g_gfxFramePacing : 1;
 
+    tick0 = svcGetSystemTick();
+    stats->cpu_ticks = tick0 - g_gfxFrameStartTick - g_gfxFrameVsyncTicks - g_gfxFrameFenceTicks;
+    stats->vsync_ticks = g_gfxFrameVsyncTicks + _gfxPaceFrame();
+    stats->fence_ticks = g_gfxFrameFenceTicks;
+
+    tick0 = svcGetSystemTick();
     rc = _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
 
     if (R_FAILED(rc)) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxQueueBuffer));
 
+    tick1 = svcGetSystemTick();
     rc = _gfxDequeueBuffer();
 
     if (R_FAILED(rc)) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxDequeueBuffer));
+
+    tick2 = svcGetSystemTick();
+
+    //A frame displayed later than the target interval missed that many vsyncs. Without a recent vsync the queue time is used instead.
+    vsync = _gfxPresentVsyncTick(tick0);
+    if (vsync == 0) vsync = tick0;
+    interval = g_gfxLastPresentVsyncTick ? (vsync - g_gfxLastPresentVsyncTick + GFX_VSYNC_TICKS/2) / GFX_VSYNC_TICKS : target;
+
+    stats->frame = g_gfxFrameCount;
+    stats->present_tick = tick0;
+    stats->queue_ticks = tick1 - tick0;
+    stats->dequeue_ticks = tick2 - tick1;
+    stats->vsyncs = interval;
+    stats->missed_vsyncs = interval > target ? interval - target : 0;
+    stats->pending_buffers = g_gfx_QueueBuffer_QueueBufferOutput.numPendingBuffers;
+
+    g_gfxFrameCount++;
+    g_gfxLastPresentVsyncTick = vsync;
+    g_gfxFrameStartTick = tick2;
+    g_gfxFrameVsyncTicks = 0;
+    g_gfxFrameFenceTicks = 0;
+}
+
+void gfxConfigureFramePacing(u32 interval) {
+    g_gfxFramePacing = interval;
+}
+
+u32 gfxGetFrameStats(GfxFrameStats *stats, u32 max) {
+    u32 i, count = g_gfxFrameCount < GFX_FRAME_STATS_COUNT ? g_gfxFrameCount : GFX_FRAME_STATS_COUNT;
+
+    if (count > max) count = max;
+
+    for (i=0; i<count; i++)
+        stats[i] = g_gfxFrameStats[(g_gfxFrameCount - count + i) % GFX_FRAME_STATS_COUNT];
+
+    return count;
+}
+
+void gfxFenceCreate(GfxFence *fence, const nvioctl_fence *nv_fences, u32 count) {
+    u32 i;
+
+    fence->num_fences = 0;
+
+    for (i=0; i<count && fence->num_fences<GFX_FENCE_MAX; i++) {
+        if (nv_fences[i].id != 0xffffffff) fence->fences[fence->num_fences++] = nv_fences[i];
+    }
+}
+
+Result gfxWaitFence(const GfxFence *fence, u64 timeout) {
+    Result rc=0;
+    u64 start = svcGetSystemTick(), elapsed;
+    s32 timeout_ms = -1;
+    u32 i;
+
+    if (fence == NULL) return 0;
+
+    for (i=0; i<fence->num_fences && R_SUCCEEDED(rc); i++) {
+        //The remaining time is converted to milliseconds for the syncpoint wait, rounded up.
+        if (timeout != UINT64_MAX) {
+            elapsed = (svcGetSystemTick() - start) * 625 / 12;
+            elapsed = timeout > elapsed ? timeout - elapsed : 0;
+            timeout_ms = elapsed >= 0x7fffffffULL*1000000 ? 0x7fffffff : (elapsed + 999999) / 1000000;
+        }
+
+        rc = nvgfxEventWait(fence->fences[i].id, fence->fences[i].value, timeout_ms);
+    }
+
+    return rc;
+}
+
+void gfxSetPresentFence(const GfxFence *fence) {
+    u32 i, count = fence ? fence->num_fences : 0;
+
+    //Without a fence, one NO_FENCE entry is used like official sw.
+    g_gfxQueueBufferData.fence.is_valid = count ? count : 1;
+
+    for (i=0; i<4; i++) {
+        g_gfxQueueBufferData.fence.nv_fences[i].id = i<count ? fence->fences[i].id : 0xffffffff;
+        g_gfxQueueBufferData.fence.nv_fences[i].value = i<count ? fence->fences[i].value : 0;
+    }
+}
+
+bool gfxGetDequeueFence(GfxFence *fence) {
+    if (fence) memcpy(fence, &g_gfx_DequeueFence, sizeof(GfxFence));
+    return g_gfx_DequeueFence.num_fences != 0;
+}
+
+Result gfxWaitDequeueFence(void) {
+    Result rc = gfxWaitFence(&g_gfx_DequeueFence, UINT64_MAX);
+
+    if (R_SUCCEEDED(rc)) g_gfx_DequeueFence.num_fences = 0;
+
+    return rc;
+}
+
+//Without async-dequeue, the dequeue fence is only waited on once the framebuffer memory is accessed. With force it's also waited on with async-dequeue.
+static void _gfxWaitFramebufferAccess(bool force) {
+    u64 tick;
+
+    if ((g_gfx_AsyncDequeue && !force) || g_gfx_DequeueFence.num_fences == 0) return;
+
+    tick = svcGetSystemTick();
+    if (R_FAILED(gfxWaitDequeueFence())) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxDequeueBuffer));
+    g_gfxFrameFenceTicks += svcGetSystemTick() - tick;
 }
 
 u8* gfxGetFramebuffer(u32* width, u32* height) {
@@ -524,9 +895,23 @@ u8* gfxGetFramebuffer(u32* width, u32* height) {
     if (g_gfxMode == GfxMode_LinearDouble)
         return g_gfxFramebufLinear;
 
+    _gfxWaitFramebufferAccess(false);
+
     return &g_gfxFramebuf[g_gfxCurrentBuffer*g_gfx_singleframebuf_size];
 }
 
+u32 gfxGetFramebuffers(u8 **framebufs) {
+    u32 i;
+
+    //Callers like the console can't wait on the fence themselves, so this always waits, even with async-dequeue.
+    _gfxWaitFramebufferAccess(true);
+
+    for (i=0; i<g_nvgfx_totalframebufs; i++)
+        framebufs[i] = &g_gfxFramebuf[i*g_gfx_singleframebuf_size];
+
+    return g_nvgfx_totalframebufs;
+}
+
 void gfxGetFramebufferResolution(u32* width, u32* height) {
     if(width) *width = g_gfx_framebuf_width;
     if(height) *height = g_gfx_framebuf_height;
@@ -541,33 +926,129 @@ size_t gfxGetFramebufferSize(void) {
 
 void gfxSetMode(GfxMode mode) {
     g_gfxMode = mode;
+    g_gfxDirtyFullMask = ~0;
 }
 
 void gfxSetDrawFlip(bool flip) {
     g_gfx_drawflip = flip;
+    g_gfxDirtyFullMask = ~0;
 }
 
 void gfxConfigureTransform(u32 transform) {
     g_gfxQueueBufferData.transform = transform;
 }
 
+void gfxMarkDirtyRect(u32 x, u32 y, u32 width, u32 height) {
+    size_t gobs_per_row = g_gfx_framebuf_aligned_width/16*16;
+    u32 gx, gy, i;
+
+    if (g_gfxDirtyGobs == NULL) return;
+
+    if (x >= g_gfx_framebuf_display_width || y >= g_gfx_framebuf_display_height) return;
+    if (width > g_gfx_framebuf_display_width - x) width = g_gfx_framebuf_display_width - x;
+    if (height > g_gfx_framebuf_display_height - y) height = g_gfx_framebuf_display_height - y;
+    if (width == 0 || height == 0) return;
+
+    g_gfxDirtyMarked = 1;
+
+    if (g_gfx_drawflip) y = g_gfx_framebuf_display_height - y - height;
+
+    //The rect is marked for every framebuffer, since each one has to catch up on it when it's next flushed.
+    for (gy=y/8; gy<=(y+height-1)/8; gy++) {
+        for (gx=x/16; gx<=(x+width-1)/16; gx++) {
+            size_t gob = (gy/16)*gobs_per_row + gx*16 + (gy%16);
+
+            for (i=0; i<g_nvgfx_totalframebufs; i++)
+                g_gfxDirtyGobs[i*g_gfxDirtyGobsWords + gob/64] |= 1ULL << (gob%64);
+        }
+    }
+}
+
+//Transfers one 512-byte GOB (16x8 pixels) from the linear framebuffer, one 64-byte GOB row at a time.
+static void _gfxSwizzleGob(u8 *actual_framebuf, size_t gob) {
+    size_t gobs_per_row = g_gfx_framebuf_aligned_width/16*16;
+    size_t width = g_gfx_framebuf_display_width;
+    size_t height = g_gfx_framebuf_display_height;
+    u32 x = (gob % gobs_per_row) / 16 * 16;
+    u32 y = (gob / gobs_per_row) * 128 + (gob % 16) * 8;
+    u8 *out = &actual_framebuf[gob*512];
+    u32 *in_framebuf = (u32*)g_gfxFramebufLinear;
+    u32 i, j;
+
+    if (x >= width) return;
+
+    for (i=0; i<8 && y+i<height; i++) {
+        //Each row is stored as 4 chunks of 4 pixels, at these offsets within the GOB.
+        u8 *out_row = &out[(i/2)*64 + (i%2)*16];
+        u32 in_y = g_gfx_drawflip ? height-1-(y+i) : y+i;
+        u128 *in_row = (u128*)&in_framebuf[in_y*width + x];
+
+        if (x + 16 <= width) {
+            u128 a = in_row[0], b = in_row[1], c = in_row[2], d = in_row[3];
+
+            *((u128*)&out_row[0]) = a;
+            *((u128*)&out_row[32]) = b;
+            *((u128*)&out_row[256]) = c;
+            *((u128*)&out_row[256+32]) = d;
+        }
+        else {
+            for (j=0; x+j*4<width; j++)
+                *((u128*)&out_row[(j/2)*256 + (j%2)*32]) = in_row[j];
+        }
+    }
+}
+
 void gfxFlushBuffers(void) {
-    u32 *actual_framebuf = (u32*)&g_gfxFramebuf[g_gfxCurrentBuffer*g_gfx_singleframebuf_size];
+    u8 *actual_framebuf = &g_gfxFramebuf[g_gfxCurrentBuffer*g_gfx_singleframebuf_size];
+    size_t total_gobs = g_gfx_singleframebuf_size/512;
+    u32 buf_mask = 1U << g_gfxCurrentBuffer;
+    u64 *dirty;
+    size_t i, gob, run_start = 0, run_len = 0;
+
+    _gfxWaitFramebufferAccess(false);
 
-    if (g_gfxMode == GfxMode_LinearDouble) {
-        size_t x, y;
-        size_t width = g_gfx_framebuf_display_width;
-        size_t height = g_gfx_framebuf_display_height;
-        u32 *in_framebuf = (u32*)g_gfxFramebufLinear;
+    //Without any dirty rects this frame, the whole frame counts as modified for every framebuffer.
+    if (!g_gfxDirtyMarked) g_gfxDirtyFullMask = ~0;
+    g_gfxDirtyMarked = 0;
 
-        for (y=0; y<height; y++) {
-            for (x=0; x<width; x+=4) {
-                *((u128*)&actual_framebuf[gfxGetFramebufferDisplayOffset(x, y)]) = *((u128*)&in_framebuf[y * width + x]);
+    if (g_gfxDirtyGobs == NULL || (g_gfxDirtyFullMask & buf_mask)) {
+        g_gfxDirtyFullMask &= ~buf_mask;
+        if (g_gfxDirtyGobs) memset(&g_gfxDirtyGobs[g_gfxCurrentBuffer*g_gfxDirtyGobsWords], 0, g_gfxDirtyGobsWords*sizeof(u64));
+
+        if (g_gfxMode == GfxMode_LinearDouble) {
+            for (gob=0; gob<total_gobs; gob++)
+                _gfxSwizzleGob(actual_framebuf, gob);
+        }
+
+        armDCacheFlush(actual_framebuf, g_gfx_singleframebuf_size);
+        return;
+    }
+
+    //Only transfer/flush the dirty GOBs, with the cache flushed per run of consecutive GOBs.
+    dirty = &g_gfxDirtyGobs[g_gfxCurrentBuffer*g_gfxDirtyGobsWords];
+
+    for (i=0; i<g_gfxDirtyGobsWords; i++) {
+        u64 bits = dirty[i];
+        dirty[i] = 0;
+
+        while (bits) {
+            gob = i*64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            if (g_gfxMode == GfxMode_LinearDouble) _gfxSwizzleGob(actual_framebuf, gob);
+
+            if (run_len && run_start + run_len == gob) {
+                run_len++;
+                continue;
             }
+
+            if (run_len) armDCacheFlush(&actual_framebuf[run_start*512], run_len*512);
+            run_start = gob;
+            run_len = 1;
         }
     }
 
-    armDCacheFlush(actual_framebuf, g_gfx_singleframebuf_size);
+    if (run_len) armDCacheFlush(&actual_framebuf[run_start*512], run_len*512);
 }
 
 /*static Result _gfxGetDisplayResolution(u64 *width, u64 *height) {
@@ -0,0 +1,582 @@
+// Host backend for gfx.c/blit.c, see gfx_host.h. This implements the services used by gfx.c on host memory, it's only built by Makefile.host.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "types.h"
+#include "result.h"
+#include "arm/cache.h"
+#include "kernel/svc.h"
+#include "services/fatal.h"
+#include "services/vi.h"
+#include "services/applet.h"
+#include "services/nv.h"
+#include "gfx/binder.h"
+#include "gfx/buffer_producer.h"
+#include "gfx/nvgfx.h"
+#include "gfx/gfx.h"
+#include "gfx/gfx_host.h"
+#include "runtime/devices/console.h"
+
+#include "default_font_bin.h"
+
+#define GFX_HOST_VSYNC_TICKS (19200000ULL/60)
+#define GFX_HOST_VSYNC_HANDLE 0x1
+#define GFX_HOST_THREAD_HANDLE 0x100
+#define GFX_HOST_MAX_THREADS 256
+
+typedef enum {
+    GfxHostSlot_Free,
+    GfxHostSlot_Dequeued,
+    GfxHostSlot_Queued,
+    GfxHostSlot_Displayed,
+} GfxHostSlotState;
+
+typedef struct {
+    bool registered;//Set by GraphicBufferInit, cleared by DetachBuffer.
+    GfxHostSlotState state;
+    u32 width, height, stride;
+    u32 offset;//Byte offset within the framebuffer memory.
+    bufferProducerRect crop;
+    u32 transform;
+} GfxHostSlot;
+
+u32 __nx_applet_type = AppletType_Default;
+u32 g_nvgfx_totalframebufs = 0;
+
+extern size_t g_gfx_singleframebuf_size;
+extern u32 g_gfx_framebuf_count;
+
+Result _gfxGraphicBufferInit(s32 buf, u32 nvmap_handle);
+
+static GfxHostVsync g_gfxHostVsyncMode = GfxHostVsync_Virtual;
+static u64 g_gfxHostTickOffset;//Ticks skipped by virtual waits.
+static u64 g_gfxHostComposedVsync;//Last vsync handled by the compositor, in vsync intervals.
+
+static Service g_gfxHostRelaySession;
+static AppletHookCookie *g_gfxHostAppletHooks;
+
+static u8 *g_gfxHostFramebuf, *g_gfxHostRetiredFramebuf;
+static size_t g_gfxHostFramebufSize;
+
+static GfxHostSlot g_gfxHostSlots[GFX_MAX_FRAMEBUFFERS];
+
+static u32 g_gfxHostThreadCount;
+static bool g_gfxHostThreadExited[GFX_HOST_MAX_THREADS];
+static s32 g_gfxHostQueue[GFX_MAX_FRAMEBUFFERS];//Queued slots, oldest first.
+static u32 g_gfxHostQueueCount;
+static s32 g_gfxHostLastQueued = -1;
+static u32 g_gfxHostFrameCount;
+static u32 g_gfxHostFenceWaits;
+static bool g_gfxHostFailDequeue;
+
+static char *g_gfxHostDumpPath;
+
+static PrintConsole g_gfxHostConsole = {
+    .font = {(u16*)default_font_bin, 0, 256, NULL, NULL},
+};
+
+//System tick and vsync clock.
+
+u64 svcGetSystemTick(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    //The tick is read by other threads, e.g. staged console writers.
+    return ((u64)ts.tv_sec*1000000000ULL + ts.tv_nsec) * 12 / 625 + __atomic_load_n(&g_gfxHostTickOffset, __ATOMIC_RELAXED);
+}
+
+static void _gfxHostWaitUntil(u64 tick) {
+    u64 now = svcGetSystemTick();
+    u64 ns;
+    struct timespec ts;
+
+    if (tick <= now) return;
+
+    if (g_gfxHostVsyncMode == GfxHostVsync_Virtual) {
+        __atomic_fetch_add(&g_gfxHostTickOffset, tick - now, __ATOMIC_RELAXED);
+        return;
+    }
+
+    ns = (tick - now) * 625 / 12 + 1;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (nanosleep(&ts, &ts) != 0);
+}
+
+//Handles the vsyncs since the last call: each vsync the oldest queued frame replaces the displayed one, which is released.
+static void _gfxHostCompose(void) {
+    u64 vsync = svcGetSystemTick() / GFX_HOST_VSYNC_TICKS;
+    u32 i;
+
+    for (; g_gfxHostComposedVsync < vsync && g_gfxHostQueueCount; g_gfxHostComposedVsync++) {
+        for (i=0; i<GFX_MAX_FRAMEBUFFERS; i++) {
+            if (g_gfxHostSlots[i].state == GfxHostSlot_Displayed) g_gfxHostSlots[i].state = GfxHostSlot_Free;
+        }
+
+        g_gfxHostSlots[g_gfxHostQueue[0]].state = GfxHostSlot_Displayed;
+        memmove(&g_gfxHostQueue[0], &g_gfxHostQueue[1], (--g_gfxHostQueueCount)*sizeof(s32));
+    }
+
+    g_gfxHostComposedVsync = vsync;
+}
+
+static void _gfxHostWaitForVsync(void) {
+    _gfxHostWaitUntil((svcGetSystemTick() / GFX_HOST_VSYNC_TICKS + 1) * GFX_HOST_VSYNC_TICKS);
+    _gfxHostCompose();
+}
+
+Result svcSleepThread(u64 nano) {
+    _gfxHostWaitUntil(svcGetSystemTick() + nano * 12 / 625);
+    return 0;
+}
+
+static bool _gfxHostIsThread(Handle handle) {
+    return handle >= GFX_HOST_THREAD_HANDLE && handle - GFX_HOST_THREAD_HANDLE < __atomic_load_n(&g_gfxHostThreadCount, __ATOMIC_ACQUIRE);
+}
+
+Handle gfxHostThreadCreate(void) {
+    u32 index = __atomic_fetch_add(&g_gfxHostThreadCount, 1, __ATOMIC_ACQ_REL);
+
+    if (index >= GFX_HOST_MAX_THREADS) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_OutOfMemory));
+    return GFX_HOST_THREAD_HANDLE + index;
+}
+
+void gfxHostThreadExit(Handle handle) {
+    if (_gfxHostIsThread(handle)) __atomic_store_n(&g_gfxHostThreadExited[handle - GFX_HOST_THREAD_HANDLE], true, __ATOMIC_RELEASE);
+}
+
+Result svcGetThreadId(u64* threadID, Handle handle) {
+    if (!_gfxHostIsThread(handle)) return MAKERESULT(Module_Kernel, KernelError_InvalidHandle);
+
+    //IDs differ from handles, like on hardware.
+    *threadID = 0x10000 + handle - GFX_HOST_THREAD_HANDLE;
+    return 0;
+}
+
+Result svcWaitSynchronization(s32* index, const Handle* handles, s32 handleCount, u64 timeout) {
+    //Thread handles are signalled once the thread exited.
+    if (handleCount == 1 && _gfxHostIsThread(handles[0])) {
+        bool *exited = &g_gfxHostThreadExited[handles[0] - GFX_HOST_THREAD_HANDLE];
+
+        while (!__atomic_load_n(exited, __ATOMIC_ACQUIRE)) {
+            if (timeout == 0) return MAKERESULT(Module_Kernel, KernelError_Timeout);
+            sched_yield();
+        }
+
+        if (index) *index = 0;
+        return 0;
+    }
+
+    //Otherwise the vsync event is the only one which exists here.
+    if (handleCount != 1 || handles[0] != GFX_HOST_VSYNC_HANDLE) return MAKERESULT(Module_Kernel, KernelError_Timeout);
+
+    _gfxHostWaitForVsync();
+    if (index) *index = 0;
+
+    return 0;
+}
+
+Result svcResetSignal(Handle handle) {
+    return 0;
+}
+
+Result svcCloseHandle(Handle handle) {
+    return 0;
+}
+
+void armDCacheFlush(void* addr, size_t size) {
+}
+
+void NORETURN fatalSimple(Result err) {
+    fprintf(stderr, "fatalSimple: 0x%x\n", err);
+    abort();
+}
+
+//Applet: always handheld, hooks are kept for completeness.
+
+void appletHook(AppletHookCookie* cookie, AppletHookFn callback, void* param) {
+    cookie->callback = callback;
+    cookie->param = param;
+    cookie->next = g_gfxHostAppletHooks;
+    g_gfxHostAppletHooks = cookie;
+}
+
+void appletUnhook(AppletHookCookie* cookie) {
+    AppletHookCookie **cur;
+
+    for (cur = &g_gfxHostAppletHooks; *cur; cur = &(*cur)->next) {
+        if (*cur == cookie) {
+            *cur = cookie->next;
+            break;
+        }
+    }
+}
+
+u8 appletGetOperationMode(void) {
+    return AppletOperationMode_Handheld;
+}
+
+//vi/nv/binder: only what gfx.c needs for opening the layer.
+
+Result viInitialize(ViServiceType servicetype) {
+    return 0;
+}
+
+void viExit(void) {
+}
+
+Service* viGetSession_IHOSBinderDriverRelay(void) {
+    return &g_gfxHostRelaySession;
+}
+
+Result viOpenDisplay(const char *DisplayName, ViDisplay *display) {
+    memset(display, 0, sizeof(ViDisplay));
+    strncpy(display->display_name, DisplayName, sizeof(display->display_name)-1);
+    display->initialized = 1;
+    return 0;
+}
+
+Result viCloseDisplay(ViDisplay *display) {
+    display->initialized = 0;
+    return 0;
+}
+
+Result viOpenLayer(u8 NativeWindow[0x100], u64 *NativeWindow_Size, const ViDisplay *display, ViLayer *layer, u32 LayerFlags, u64 LayerId) {
+    u32 *parcel = (u32*)NativeWindow;
+
+    //Parcel with the binder ID at offset 8 of the data, see _gfxGetNativeWindowID().
+    memset(NativeWindow, 0, 0x100);
+    parcel[0] = 0xc;
+    parcel[1] = 0x10;
+    parcel[4+2] = 1;
+    *NativeWindow_Size = 0x100;
+
+    memset(layer, 0, sizeof(ViLayer));
+    layer->layer_id = LayerId;
+    layer->initialized = 1;
+    return 0;
+}
+
+Result viCloseLayer(ViLayer *layer) {
+    layer->initialized = 0;
+    return 0;
+}
+
+Result viSetLayerScalingMode(ViLayer *layer, u32 ScalingMode) {
+    return 0;
+}
+
+Result viGetDisplayVsyncEvent(ViDisplay *display, Handle *handle_out) {
+    *handle_out = GFX_HOST_VSYNC_HANDLE;
+    return 0;
+}
+
+Result nvInitialize(nvServiceType servicetype, size_t sharedmem_size) {
+    return 0;
+}
+
+void nvExit(void) {
+}
+
+void binderCreateSession(Binder *session, Handle sessionHandle, s32 ID) {
+    memset(session, 0, sizeof(Binder));
+    session->created = 1;
+    session->sessionHandle = sessionHandle;
+    session->id = ID;
+}
+
+Result binderInitSession(Binder *session, u32 unk0) {
+    session->initialized = 1;
+    return 0;
+}
+
+void binderExitSession(Binder *session) {
+    memset(session, 0, sizeof(Binder));
+}
+
+//nvgfx: the framebuffer memory is plain host memory, fences are always signalled.
+//Dequeued buffers still come with a fence, so that the code waiting on it runs.
+
+Result nvgfxInitialize(void) {
+    g_nvgfx_totalframebufs = g_gfx_framebuf_count;
+
+    g_gfxHostFramebufSize = g_nvgfx_totalframebufs*g_gfx_singleframebuf_size;
+    g_gfxHostFramebuf = calloc(1, g_gfxHostFramebufSize);
+    if (g_gfxHostFramebuf == NULL) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    return nvgfxRegisterFramebuffers();
+}
+
+void nvgfxExit(void) {
+    nvgfxFreeRetiredFramebuffers();
+    free(g_gfxHostFramebuf);
+    g_gfxHostFramebuf = NULL;
+    g_gfxHostFramebufSize = 0;
+}
+
+Result nvgfxEventWait(u32 syncpt_id, u32 threshold, s32 timeout) {
+    g_gfxHostFenceWaits++;
+    return 0;
+}
+
+Result nvgfxGetFramebuffer(u8 **buffer, size_t *size) {
+    if (g_gfxHostFramebuf == NULL) return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    if (buffer) *buffer = g_gfxHostFramebuf;
+    if (size) *size = g_gfxHostFramebufSize;
+    return 0;
+}
+
+Result nvgfxRegisterFramebuffers(void) {
+    Result rc=0;
+    u32 i;
+
+    for (i=0; i<g_nvgfx_totalframebufs && R_SUCCEEDED(rc); i++) rc = _gfxGraphicBufferInit(i, 0);
+
+    return rc;
+}
+
+Result nvgfxResizeFramebuffers(void) {
+    size_t size = g_nvgfx_totalframebufs*g_gfx_singleframebuf_size;
+    u8 *mem = calloc(1, size);
+
+    if (mem == NULL) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    nvgfxFreeRetiredFramebuffers();
+    g_gfxHostRetiredFramebuf = g_gfxHostFramebuf;
+    g_gfxHostFramebuf = mem;
+    g_gfxHostFramebufSize = size;
+    return 0;
+}
+
+void nvgfxRestoreFramebuffers(void) {
+    if (g_gfxHostRetiredFramebuf == NULL) return;
+
+    free(g_gfxHostFramebuf);
+    g_gfxHostFramebuf = g_gfxHostRetiredFramebuf;
+    g_gfxHostFramebufSize = g_nvgfx_totalframebufs*g_gfx_singleframebuf_size;
+    g_gfxHostRetiredFramebuf = NULL;
+}
+
+void nvgfxFreeRetiredFramebuffers(void) {
+    free(g_gfxHostRetiredFramebuf);
+    g_gfxHostRetiredFramebuf = NULL;
+}
+
+//Buffer producer, with the compositor emulated by _gfxHostCompose.
+
+Result bufferProducerInitialize(Binder *session) {
+    memset(g_gfxHostSlots, 0, sizeof(g_gfxHostSlots));
+    g_gfxHostQueueCount = 0;
+    g_gfxHostLastQueued = -1;
+    g_gfxHostFrameCount = 0;
+    g_gfxHostComposedVsync = svcGetSystemTick() / GFX_HOST_VSYNC_TICKS;
+    return 0;
+}
+
+void bufferProducerExit(void) {
+}
+
+Result bufferProducerConnect(s32 api, bool producerControlledByApp, bufferProducerQueueBufferOutput *output) {
+    if (output) memset(output, 0, sizeof(*output));
+    return 0;
+}
+
+Result bufferProducerDisconnect(s32 api) {
+    return 0;
+}
+
+Result bufferProducerGraphicBufferInit(s32 buf, bufferProducerGraphicBuffer *input) {
+    GfxHostSlot *slot;
+
+    if (buf < 0 || buf >= GFX_MAX_FRAMEBUFFERS) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    slot = &g_gfxHostSlots[buf];
+    slot->registered = 1;
+    slot->width = input->width;
+    slot->height = input->height;
+    slot->stride = input->stride;
+    slot->offset = input->data.buffer_offset;
+    return 0;
+}
+
+Result bufferProducerRequestBuffer(s32 bufferIdx, bufferProducerGraphicBuffer *buf) {
+    if (bufferIdx < 0 || bufferIdx >= GFX_MAX_FRAMEBUFFERS || !g_gfxHostSlots[bufferIdx].registered) return MAKERESULT(Module_Libnx, LibnxError_BufferProducerError);
+    if (buf) memset(buf, 0, sizeof(*buf));
+    return 0;
+}
+
+Result bufferProducerDequeueBuffer(bool async, u32 width, u32 height, s32 format, u32 usage, s32 *buf, bufferProducerFence *fence) {
+    u32 i;
+
+    if (g_gfxHostFailDequeue) {
+        g_gfxHostFailDequeue = 0;
+        return MAKERESULT(Module_Libnx, LibnxError_BufferProducerError);
+    }
+
+    while (1) {
+        _gfxHostCompose();
+
+        for (i=0; i<GFX_MAX_FRAMEBUFFERS; i++) {
+            if (g_gfxHostSlots[i].registered && g_gfxHostSlots[i].state == GfxHostSlot_Free) {
+                g_gfxHostSlots[i].state = GfxHostSlot_Dequeued;
+                *buf = i;
+                if (fence) {
+                    memset(fence, 0, sizeof(*fence));
+                    fence->is_valid = 1;
+                    fence->nv_fences[0].id = 0;
+                    fence->nv_fences[0].value = g_gfxHostFrameCount;
+                }
+                return 0;
+            }
+        }
+
+        //Without queued frames no slot will be released.
+        if (g_gfxHostQueueCount == 0) return MAKERESULT(Module_Libnx, LibnxError_BufferProducerError);
+
+        _gfxHostWaitForVsync();
+    }
+}
+
+Result bufferProducerDetachBuffer(s32 slot) {
+    u32 i;
+
+    if (slot < 0 || slot >= GFX_MAX_FRAMEBUFFERS) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    for (i=0; i<g_gfxHostQueueCount; i++) {
+        if (g_gfxHostQueue[i] == slot) {
+            memmove(&g_gfxHostQueue[i], &g_gfxHostQueue[i+1], (--g_gfxHostQueueCount - i)*sizeof(s32));
+            break;
+        }
+    }
+
+    if (g_gfxHostLastQueued == slot) g_gfxHostLastQueued = -1;
+
+    g_gfxHostSlots[slot].registered = 0;
+    g_gfxHostSlots[slot].state = GfxHostSlot_Free;
+    return 0;
+}
+
+//Byte offset of a pixel in a block-linear buffer, without the vertical flip done by gfxGetFramebufferDisplayOffset.
+static u32 _gfxHostPixelOffset(u32 x, u32 y, u32 stride) {
+    u32 pos = ((y & 127) / 16) + (x/16*8) + ((y/128)*(stride/16*8));
+
+    return pos*16*16*4 + ((y%16)/8)*512 + ((x%16)/8)*256 + ((y%8)/2)*64 + ((x%8)/4)*32 + (y%2)*16 + (x%4)*4;
+}
+
+//Converts a queued slot to linear pixels like the compositor displays it. An all-zero crop is the whole buffer.
+static void _gfxHostReadSlot(const GfxHostSlot *slot, u32 *out, u32 *width, u32 *height) {
+    bufferProducerRect crop = slot->crop;
+    u32 x, y, src_x, src_y, w, h;
+
+    if (crop.right <= crop.left || crop.bottom <= crop.top) {
+        crop.left = crop.top = 0;
+        crop.right = slot->width;
+        crop.bottom = slot->height;
+    }
+
+    w = crop.right - crop.left;
+    h = crop.bottom - crop.top;
+    if (width) *width = w;
+    if (height) *height = h;
+    if (out == NULL) return;
+
+    for (y=0; y<h; y++) {
+        src_y = crop.top + ((slot->transform & NATIVE_WINDOW_TRANSFORM_FLIP_V) ? h-1-y : y);
+
+        for (x=0; x<w; x++) {
+            src_x = crop.left + ((slot->transform & NATIVE_WINDOW_TRANSFORM_FLIP_H) ? w-1-x : x);
+            memcpy(&out[y*w + x], &g_gfxHostFramebuf[slot->offset + _gfxHostPixelOffset(src_x, src_y, slot->stride)], 4);
+        }
+    }
+}
+
+static void _gfxHostDumpFrame(const GfxHostSlot *slot, u32 frame) {
+    char path[256];
+    u32 width, height, i;
+    u32 *pixels;
+    u8 *rgb;
+    FILE *f;
+
+    _gfxHostReadSlot(slot, NULL, &width, &height);
+
+    pixels = malloc((size_t)width*height*4);
+    rgb = malloc((size_t)width*height*3);
+    snprintf(path, sizeof(path), g_gfxHostDumpPath, frame);
+    f = pixels && rgb ? fopen(path, "wb") : NULL;
+
+    if (f) {
+        _gfxHostReadSlot(slot, pixels, NULL, NULL);
+
+        //RGBA8 is R, G, B, A in memory.
+        for (i=0; i<width*height; i++) memcpy(&rgb[i*3], &pixels[i], 3);
+
+        fprintf(f, "P6\n%u %u\n255\n", width, height);
+        fwrite(rgb, 3, (size_t)width*height, f);
+        fclose(f);
+    }
+    else {
+        fprintf(stderr, "gfx host: failed to dump frame %u to %s\n", frame, path);
+    }
+
+    free(pixels);
+    free(rgb);
+}
+
+Result bufferProducerQueueBuffer(s32 buf, bufferProducerQueueBufferInput *input, bufferProducerQueueBufferOutput *output) {
+    GfxHostSlot *slot;
+
+    if (buf < 0 || buf >= GFX_MAX_FRAMEBUFFERS || g_gfxHostSlots[buf].state != GfxHostSlot_Dequeued) return MAKERESULT(Module_Libnx, LibnxError_BufferProducerError);
+
+    _gfxHostCompose();
+
+    slot = &g_gfxHostSlots[buf];
+    slot->state = GfxHostSlot_Queued;
+    slot->crop = input->crop;
+    slot->transform = input->transform;
+    g_gfxHostQueue[g_gfxHostQueueCount++] = buf;
+    g_gfxHostLastQueued = buf;
+
+    if (g_gfxHostDumpPath) _gfxHostDumpFrame(slot, g_gfxHostFrameCount);
+    g_gfxHostFrameCount++;
+
+    if (output) {
+        output->width = slot->width;
+        output->height = slot->height;
+        output->transformHint = 0;
+        output->numPendingBuffers = g_gfxHostQueueCount;
+    }
+
+    return 0;
+}
+
+//blit.c uses the default console font. Weak, so that console.c can be linked in as well.
+__attribute__((weak)) PrintConsole* consoleGetDefault(void) {
+    return &g_gfxHostConsole;
+}
+
+void gfxHostConfigureVsync(GfxHostVsync mode) {
+    g_gfxHostVsyncMode = mode;
+}
+
+void gfxHostConfigureFrameDump(const char *path) {
+    free(g_gfxHostDumpPath);
+    g_gfxHostDumpPath = path ? strdup(path) : NULL;
+}
+
+void gfxHostFailNextDequeue(void) {
+    g_gfxHostFailDequeue = 1;
+}
+
+u32 gfxHostGetFenceWaits(void) {
+    return g_gfxHostFenceWaits;
+}
+
+bool gfxHostGetFrame(u32 *out, u32 *width, u32 *height) {
+    if (g_gfxHostLastQueued < 0 || g_gfxHostFramebuf == NULL) return false;
+
+    _gfxHostReadSlot(&g_gfxHostSlots[g_gfxHostLastQueued], out, width, height);
+    return true;
+}
@@ -86,3 +86,18 @@ Result nvioctlNvmap_GetId(u32 fd, u32 nvmap_handle, u32 *id) {
 
     return rc;
 }
+
+Result nvioctlNvmap_Free(u32 fd, u32 nvmap_handle) {
+    struct {
+        __nv_in  u32 handle;
+        u32       pad;
+        __nv_out u64 refcount;
+        __nv_out u32 size;
+        __nv_out u32 flags;   // 1=NOT_FREED_YET
+    } data;
+
+    memset(&data, 0, sizeof(data));
+    data.handle = nvmap_handle;
+
+    return nvIoctl(fd, _NV_IOWR(0x01, 0x05, data), &data);
+}
@@ -4,6 +4,8 @@
 #include "result.h"
 #include "arm/cache.h"
 #include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/thread.h"
 #include "services/nv.h"
 #include "gfx/binder.h"
 #include "gfx/buffer_producer.h"
@@ -47,16 +49,68 @@ u32 g_nvgfx_totalframebufs = 0;
 
 static nvmapobj nvmap_objs[18];
 
+static u64 g_nvgfx_init_ticks[NvgfxInitStep_Count];
+static Thread g_nvgfx_gpuinit_thread;
+static bool g_nvgfx_gpuinit_thread_started;//Only changed by nvgfxInitialize and nvgfxExit.
+static bool g_nvgfx_gpuinit_done;//Atomic, set once g_nvgfx_gpuinit_rc and the ticks of the GPU steps are written.
+static Result g_nvgfx_gpuinit_rc;
+static Mutex g_nvgfx_gpuinit_mutex;
+
+//GPU memory heap: chunks of NVGFX_HEAP_CHUNK_SIZE which are mapped once, then split into power-of-two blocks (buddy allocator).
+#define NVGFX_HEAP_PAGES (NVGFX_HEAP_CHUNK_SIZE/NVGFX_HEAP_PAGE_SIZE)
+
+typedef struct {
+    nvmapobj obj;
+    u64 gpu_va;
+    u64 free_blocks[NVGFX_HEAP_ORDERS][NVGFX_HEAP_PAGES/64];//Bit (page>>order) is set when that block is free.
+    u8 alloc_order[NVGFX_HEAP_PAGES];//1+order at the first page of allocated blocks, otherwise 0.
+} nvgfxHeapChunk;
+
+typedef struct {
+    void *ptr;
+    nvioctl_fence fence;
+} nvgfxHeapDeferredFree;
+
+static nvgfxHeapChunk g_nvgfx_heap_chunks[NVGFX_HEAP_MAX_CHUNKS];
+static nvgfxHeapDeferredFree g_nvgfx_heap_deferred[NVGFX_HEAP_MAX_DEFERRED];
+static u32 g_nvgfx_heap_deferred_first, g_nvgfx_heap_deferred_count;
+
 static u64 nvmap_obj3_mapbuffer_x0_offset;
 static u64 nvmap_obj4_mapbuffer_x0_offset;
+static u64 nvmap_obj6_mapbuffer_offsets[2];
 static u64 nvmap_obj6_mapbuffer_xdb_offset;
 
-static u64 g_nvgfx_gpfifo_pos = 0;
+//Framebuffer memory replaced by nvgfxResizeFramebuffers, which can still be displayed until nvgfxFreeRetiredFramebuffers.
+static nvmapobj g_nvgfx_framebuf_retired;
+static u64 g_nvgfx_framebuf_retired_offsets[3];
+
+//GPFIFO command ring in nvmap_objs[3]. Positions are running byte counts, the offset within the ring is pos % mem_size.
+static u64 g_nvgfx_gpfifo_pos = 0;//Next allocation.
+static u64 g_nvgfx_gpfifo_tail = 0;//Start of the oldest data which can still be in use by the GPU.
+static u64 g_nvgfx_gpfifo_pushed_pos = 0;//End of the last pushed command list.
+
+//Submissions not known to have completed yet, the ring space before end is reclaimed once the fence is signalled.
+typedef struct {
+    u64 end;
+    nvioctl_fence fence;
+} nvgfxGpfifoSubmission;
+
+static nvgfxGpfifoSubmission g_nvgfx_gpfifo_inflight[NVGFX_GPFIFO_MAX_INFLIGHT];
+static u32 g_nvgfx_gpfifo_inflight_first, g_nvgfx_gpfifo_inflight_count;
+
+//Command lists pushed since the last submission.
+static nvioctl_gpfifo_entry g_nvgfx_gpfifo_entries[NVGFX_GPFIFO_MAX_ENTRIES];
+static u32 g_nvgfx_gpfifo_num_entries;
+static size_t g_nvgfx_gpfifo_flush_start, g_nvgfx_gpfifo_flush_end;//Ring range which still has to be flushed from the data cache.
 
 extern size_t g_gfx_singleframebuf_size;
+extern u32 g_gfx_framebuf_count;
 
 Result _gfxGraphicBufferInit(s32 buf, u32 nvmap_handle);
 
+static Result _nvgfxGpfifoReclaim(void);
+static Result _nvgfxHeapReclaim(bool wait);
+
 static Result nvmapobjInitialize(nvmapobj *obj, size_t size) {
     Result rc=0;
 
@@ -92,6 +146,11 @@ static void nvmapobjCloseAll(void) {
     u32 pos=0;
 
     for(pos=0; pos<sizeof(nvmap_objs)/sizeof(nvmapobj); pos++) nvmapobjClose(&nvmap_objs[pos]);
+    for(pos=0; pos<NVGFX_HEAP_MAX_CHUNKS; pos++) nvmapobjClose(&g_nvgfx_heap_chunks[pos].obj);
+    nvmapobjClose(&g_nvgfx_framebuf_retired);
+
+    g_nvgfx_heap_deferred_first = 0;
+    g_nvgfx_heap_deferred_count = 0;
 }
 
 static Result nvmapobjSetup(nvmapobj *obj, u32 heapmask, u32 flags, u32 align, u8 kind) {
@@ -103,69 +162,59 @@ static Result nvmapobjSetup(nvmapobj *obj, u32 heapmask, u32 flags, u32 align, u
     return rc;
 }
 
-Result nvgfxInitialize(void) {
+//Allocates and maps the framebuffer memory in nvmap_objs[6], for g_nvgfx_totalframebufs framebuffers of g_gfx_singleframebuf_size.
+static Result _nvgfxFramebufferAlloc(void) {
     Result rc=0;
-    u32 pos=0, i=0;
-    s32 tmp=0;
-    u32 tmpval=0;
-    if(g_nvgfxInitialized)return 0;
-
+    u32 pos=0;
     u32 framebuf_nvmap_handle = 0;//Special handle ID for framebuf/windowbuf.
 
-    g_nvgfx_fd_nvhostctrlgpu = 0;
-    g_nvgfx_fd_nvhostasgpu = 0;
-    g_nvgfx_fd_nvmap = 0;
-    g_nvgfx_fd_nvhostgpu = 0;
-    g_nvgfx_fd_nvhostctrl = 0;
+    rc = nvmapobjInitialize(&nvmap_objs[6], g_nvgfx_totalframebufs*g_gfx_singleframebuf_size);
 
-    g_nvgfx_nvhostctrl_eventhandle = INVALID_HANDLE;
+    if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[6], 0, 0x1, 0x20000, 0);
 
-    g_nvgfx_totalframebufs = 2;
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0, nvmap_objs[6].handle, 0x10000, 0, 0, 0, &nvmap_obj6_mapbuffer_offsets[0]);
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0xfe, nvmap_objs[6].handle, 0x10000, 0, 0, 0, &nvmap_obj6_mapbuffer_offsets[1]);
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0xdb, nvmap_objs[6].handle, 0x10000, 0, 0, 0, &nvmap_obj6_mapbuffer_xdb_offset);
 
-    memset(nvmap_objs, 0, sizeof(nvmap_objs));
+    if (R_SUCCEEDED(rc)) {
+         for(pos=0; pos<g_nvgfx_totalframebufs; pos++) {
+             rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0x100, 0xdb, framebuf_nvmap_handle, 0, pos*g_gfx_singleframebuf_size, g_gfx_singleframebuf_size, nvmap_obj6_mapbuffer_xdb_offset, NULL);
+             if (R_FAILED(rc)) break;
+         }
+    }
 
-    memset(&g_nvgfx_gpu_characteristics, 0, sizeof(gpu_characteristics));
-    memset(g_nvgfx_tpcmasks, 0, sizeof(g_nvgfx_tpcmasks));
-    memset(g_nvgfx_zcullinfo, 0, sizeof(g_nvgfx_zcullinfo));
-    memset(g_nvgfx_nvhostasgpu_varegions, 0, sizeof(g_nvgfx_nvhostasgpu_varegions));
-    memset(&g_nvgfx_l2state, 0, sizeof(nvioctl_l2_state));
-    memset(&g_nvgfx_nvhost_fence, 0, sizeof(g_nvgfx_nvhost_fence));
-    memset(&g_nvgfx_nvhostgpu_gpfifo_fence, 0, sizeof(g_nvgfx_nvhostgpu_gpfifo_fence));
-    g_nvgfx_nvhostasgpu_allocspace_offset = 0;
-    g_nvgfx_zcullctxsize = 0;
-    nvmap_obj3_mapbuffer_x0_offset = 0;
-    nvmap_obj4_mapbuffer_x0_offset = 0;
-    nvmap_obj6_mapbuffer_xdb_offset = 0;
-    g_nvgfx_nvhostctrl_eventres = 0;
+    return rc;
+}
 
-    g_nvgfx_gpfifo_pos = 0;
+//Unmaps and frees framebuffer memory, the mappings with a 0 offset are skipped.
+static void _nvgfxFramebufferFree(nvmapobj *obj, u64 offsets[3]) {
+    u32 pos=0;
 
-    //All of the below sizes for nvmapobjInitialize are from certain official sw.
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[0], 0x1000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[1], 0x10000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[2], 0x1000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[3], 0x10000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[4], 0x59000);
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[5], 0x1000000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[6], g_nvgfx_totalframebufs*g_gfx_singleframebuf_size);
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[7], 0x1000000);
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[8], 0x800000);
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[9], 0x100000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[10], 0x3000);
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[11], 0x1000);
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[12], 0x1000);
-    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[13], 0x1000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[14], 0x1000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[15], 0x6000);
-    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[16], 0x1000);
+    if(!obj->initialized)return;
 
-    if (R_SUCCEEDED(rc)) { //Unknown what size/etc is used officially.
-        g_nvgfx_nvhost_userdata_size = 0x1000;
-        g_nvgfx_nvhost_userdata = memalign(0x1000, g_nvgfx_nvhost_userdata_size);
-        if (g_nvgfx_nvhost_userdata==NULL) rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
-        if (R_SUCCEEDED(rc)) memset(g_nvgfx_nvhost_userdata, 0, g_nvgfx_nvhost_userdata_size);
+    for(pos=0; pos<3; pos++) {
+        if (offsets[pos]) nvioctlNvhostAsGpu_UnmapBuffer(g_nvgfx_fd_nvhostasgpu, offsets[pos]);
+        offsets[pos] = 0;
     }
 
+    if (obj->handle) nvioctlNvmap_Free(g_nvgfx_fd_nvmap, obj->handle);
+
+    nvmapobjClose(obj);
+}
+
+static void _nvgfxInitStepDone(NvgfxInitStep step, u64 *tick) {
+    u64 now = svcGetSystemTick();
+
+    g_nvgfx_init_ticks[step] = now - *tick;
+    *tick = now;
+}
+
+//GPU channel setup. This isn't needed for presenting framebuffers, so it's done after nvgfxInitialize returns.
+static Result _nvgfxInitializeGpu(void) {
+    Result rc=0;
+    u64 tick = svcGetSystemTick();
+
+    //All of the below sizes for nvmapobjInitialize are from certain official sw.
     //Officially NVHOST_IOCTL_CTRL_GET_CONFIG is used a lot (here and later), skip that. This is done with a /dev/nvhost-ctrl fd, seperate from the one used later.
 
     if (R_SUCCEEDED(rc)) rc = nvOpen(&g_nvgfx_fd_nvhostctrlgpu, "/dev/nvhost-ctrl-gpu");
@@ -179,27 +228,18 @@ Result nvgfxInitialize(void) {
 
     if (R_SUCCEEDED(rc)) rc = nvQueryEvent(g_nvgfx_fd_nvhostctrlgpu, 2, &g_nvgfx_nvhostctrlgpu_event2);
 
-    if (R_SUCCEEDED(rc)) rc = nvOpen(&g_nvgfx_fd_nvhostasgpu, "/dev/nvhost-as-gpu");
-
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_InitializeEx(g_nvgfx_fd_nvhostasgpu, 1, /*0*/0x10000);
-
-    //Officially this is used twice here - only use it once here.
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_GetVARegions(g_nvgfx_fd_nvhostasgpu, g_nvgfx_nvhostasgpu_varegions);
-
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_AllocSpace(g_nvgfx_fd_nvhostasgpu, 0x10000, /*0x20000*/0x10000, 0, 0x10000, &g_nvgfx_nvhostasgpu_allocspace_offset);
-    if (R_SUCCEEDED(rc)) rc = nvOpen(&g_nvgfx_fd_nvmap, "/dev/nvmap");
-
-    /*if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[0], 0, 0, 0x20000, 0);
-
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0, nvmap_objs[0].handle, 0x10000, 0, 0, 0, NULL);
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0xfe, nvmap_objs[0].handle, 0x10000, 0, 0, 0, NULL);*/
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostCtrlGpu_GetL2State(g_nvgfx_fd_nvhostctrlgpu, &g_nvgfx_l2state);
 
-    if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[1], 0, 0, 0x20000, 0);
+    if (R_SUCCEEDED(rc)) _nvgfxInitStepDone(NvgfxInitStep_GpuInfo, &tick);
 
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 5, 0, nvmap_objs[1].handle, 0x10000, 0, 0x10000, g_nvgfx_nvhostasgpu_allocspace_offset, NULL);
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0xfe, nvmap_objs[1].handle, 0x10000, 0, 0, 0, NULL);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[2], 0x1000);
 
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostCtrlGpu_GetL2State(g_nvgfx_fd_nvhostctrlgpu, &g_nvgfx_l2state);
+    if (R_SUCCEEDED(rc)) { //Unknown what size/etc is used officially.
+        g_nvgfx_nvhost_userdata_size = 0x1000;
+        g_nvgfx_nvhost_userdata = memalign(0x1000, g_nvgfx_nvhost_userdata_size);
+        if (g_nvgfx_nvhost_userdata==NULL) rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        if (R_SUCCEEDED(rc)) memset(g_nvgfx_nvhost_userdata, 0, g_nvgfx_nvhost_userdata_size);
+    }
 
     if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[2], 0, 0x1, 0x1000, 0);
 
@@ -221,6 +261,34 @@ Result nvgfxInitialize(void) {
 
     if (R_SUCCEEDED(rc)) rc = nvioctlChannel_SetPriority(g_nvgfx_fd_nvhostgpu, NvChannelPriority_Medium);
 
+    if (R_SUCCEEDED(rc)) _nvgfxInitStepDone(NvgfxInitStep_GpuChannel, &tick);
+
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[0], 0x1000);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[1], 0x10000);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[3], 0x10000);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[4], 0x59000);
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[5], 0x1000000);
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[7], 0x1000000);
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[8], 0x800000);
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[9], 0x100000);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[10], 0x3000);
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[11], 0x1000);
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[12], 0x1000);
+    //if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[13], 0x1000);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[14], 0x1000);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[15], 0x6000);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjInitialize(&nvmap_objs[16], 0x1000);
+
+    /*if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[0], 0, 0, 0x20000, 0);
+
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0, nvmap_objs[0].handle, 0x10000, 0, 0, 0, NULL);
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0xfe, nvmap_objs[0].handle, 0x10000, 0, 0, 0, NULL);*/
+
+    if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[1], 0, 0, 0x20000, 0);
+
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 5, 0, nvmap_objs[1].handle, 0x10000, 0, 0x10000, g_nvgfx_nvhostasgpu_allocspace_offset, NULL);
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0xfe, nvmap_objs[1].handle, 0x10000, 0, 0, 0, NULL);
+
     if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[3], 0, 0, 0x20000, 0);
 
     if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0, nvmap_objs[3].handle, 0x10000, 0, 0, 0, &nvmap_obj3_mapbuffer_x0_offset);
@@ -242,12 +310,6 @@ Result nvgfxInitialize(void) {
     if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0, nvmap_objs[5].handle, 0x10000, 0, 0, 0, NULL);
     if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0xfe, nvmap_objs[5].handle, 0x10000, 0, 0, 0, NULL);*/
 
-    if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[6], 0, 0x1, 0x20000, 0);
-
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0, nvmap_objs[6].handle, 0x10000, 0, 0, 0, NULL);
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0xfe, nvmap_objs[6].handle, 0x10000, 0, 0, 0, NULL);
-    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0xdb, nvmap_objs[6].handle, 0x10000, 0, 0, 0, &nvmap_obj6_mapbuffer_xdb_offset);
-
     /*if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[7], 0, 0, 0x20000, 0);
 
     if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0, nvmap_objs[7].handle, 0x10000, 0, 0, 0, NULL);
@@ -261,38 +323,6 @@ Result nvgfxInitialize(void) {
 
     //Skip init for 0x10000000-byte nvmap obj done by certain official sw.
 
-    if (R_SUCCEEDED(rc)) {
-         for(pos=0; pos<g_nvgfx_totalframebufs; pos++) {
-             rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0x100, 0xdb, framebuf_nvmap_handle, 0, pos*g_gfx_singleframebuf_size, g_gfx_singleframebuf_size, nvmap_obj6_mapbuffer_xdb_offset, NULL);
-             if (R_FAILED(rc)) break;
-         }
-    }
-
-    if (R_SUCCEEDED(rc)) {
-        rc = bufferProducerQuery(NATIVE_WINDOW_FORMAT, &tmp);//TODO: What does official sw use the output from this for?
-
-        if (R_SUCCEEDED(rc)) {
-            for(i=0; i<2; i++) {
-                tmpval = 0;
-                rc = nvioctlNvmap_GetId(g_nvgfx_fd_nvmap, nvmap_objs[6].handle, &tmpval);
-                if (R_FAILED(rc)) break;
-
-                if(tmpval==~0) {
-                    rc = 6;//official error
-                    break;
-                }
-
-                rc = nvioctlNvmap_FromId(g_nvgfx_fd_nvmap, tmpval, &tmpval);
-                if (R_FAILED(rc)) break;
-
-                //The above gets a nvmap_handle, but normally it's the same value passed to nvioctlNvmap_GetId().
-
-                rc = _gfxGraphicBufferInit(i, tmpval);
-                if (R_FAILED(rc)) break;
-            }
-        }
-    }
-
     /*if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&nvmap_objs[9], 0, 0, 0x20000, 0);
 
     if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0, nvmap_objs[9].handle, 0x10000, 0, 0, 0, NULL);
@@ -335,8 +365,119 @@ Result nvgfxInitialize(void) {
     if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 5, 0, nvmap_objs[16].handle, 0x10000, 0, 0x10000, g_nvgfx_nvhostasgpu_allocspace_offset+0x10000+0x800000+0x10000+0x10000+0x10000, NULL);
     if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 4, 0xfe, nvmap_objs[16].handle, 0x10000, 0, 0, 0, NULL);
 
+    if (R_SUCCEEDED(rc)) _nvgfxInitStepDone(NvgfxInitStep_GpuBuffers, &tick);
+
+    return rc;
+}
+
+static void _nvgfxInitializeGpuThread(void *arg) {
+    g_nvgfx_gpuinit_rc = _nvgfxInitializeGpu();
+    __atomic_store_n(&g_nvgfx_gpuinit_done, 1, __ATOMIC_RELEASE);
+}
+
+//Waits for the GPU channel setup to finish, or does it now when it wasn't started on a thread. The thread is only closed by nvgfxExit, so this can be used from any thread.
+static Result _nvgfxWaitGpuInit(void) {
+    if (!__atomic_load_n(&g_nvgfx_gpuinit_done, __ATOMIC_ACQUIRE)) {
+        if (g_nvgfx_gpuinit_thread_started) {
+            threadWaitForExit(&g_nvgfx_gpuinit_thread);
+        }
+        else {
+            mutexLock(&g_nvgfx_gpuinit_mutex);
+
+            if (!__atomic_load_n(&g_nvgfx_gpuinit_done, __ATOMIC_ACQUIRE)) {
+                g_nvgfx_gpuinit_rc = _nvgfxInitializeGpu();
+                __atomic_store_n(&g_nvgfx_gpuinit_done, 1, __ATOMIC_RELEASE);
+            }
+
+            mutexUnlock(&g_nvgfx_gpuinit_mutex);
+        }
+    }
+
+    return g_nvgfx_gpuinit_rc;
+}
+
+Result nvgfxInitialize(void) {
+    Result rc=0;
+    s32 tmp=0;
+    u64 tick = svcGetSystemTick();
+    if(g_nvgfxInitialized)return 0;
+
+    g_nvgfx_fd_nvhostctrlgpu = 0;
+    g_nvgfx_fd_nvhostasgpu = 0;
+    g_nvgfx_fd_nvmap = 0;
+    g_nvgfx_fd_nvhostgpu = 0;
+    g_nvgfx_fd_nvhostctrl = 0;
+
+    g_nvgfx_nvhostctrl_eventhandle = INVALID_HANDLE;
+
+    g_nvgfx_totalframebufs = g_gfx_framebuf_count;
+
+    memset(nvmap_objs, 0, sizeof(nvmap_objs));
+    memset(&g_nvgfx_framebuf_retired, 0, sizeof(g_nvgfx_framebuf_retired));
+    memset(g_nvgfx_framebuf_retired_offsets, 0, sizeof(g_nvgfx_framebuf_retired_offsets));
+
+    memset(&g_nvgfx_gpu_characteristics, 0, sizeof(gpu_characteristics));
+    memset(g_nvgfx_tpcmasks, 0, sizeof(g_nvgfx_tpcmasks));
+    memset(g_nvgfx_zcullinfo, 0, sizeof(g_nvgfx_zcullinfo));
+    memset(g_nvgfx_nvhostasgpu_varegions, 0, sizeof(g_nvgfx_nvhostasgpu_varegions));
+    memset(&g_nvgfx_l2state, 0, sizeof(nvioctl_l2_state));
+    memset(&g_nvgfx_nvhost_fence, 0, sizeof(g_nvgfx_nvhost_fence));
+    memset(&g_nvgfx_nvhostgpu_gpfifo_fence, 0, sizeof(g_nvgfx_nvhostgpu_gpfifo_fence));
+    g_nvgfx_nvhostasgpu_allocspace_offset = 0;
+    g_nvgfx_zcullctxsize = 0;
+    nvmap_obj3_mapbuffer_x0_offset = 0;
+    nvmap_obj4_mapbuffer_x0_offset = 0;
+    memset(nvmap_obj6_mapbuffer_offsets, 0, sizeof(nvmap_obj6_mapbuffer_offsets));
+    nvmap_obj6_mapbuffer_xdb_offset = 0;
+    g_nvgfx_nvhostctrl_eventres = 0;
+
+    g_nvgfx_gpfifo_pos = 0;
+    g_nvgfx_gpfifo_tail = 0;
+    g_nvgfx_gpfifo_pushed_pos = 0;
+    g_nvgfx_gpfifo_inflight_first = 0;
+    g_nvgfx_gpfifo_inflight_count = 0;
+    g_nvgfx_gpfifo_num_entries = 0;
+    g_nvgfx_gpfifo_flush_start = 0;
+    g_nvgfx_gpfifo_flush_end = 0;
+
+    memset(g_nvgfx_init_ticks, 0, sizeof(g_nvgfx_init_ticks));
+    g_nvgfx_gpuinit_thread_started = 0;
+    __atomic_store_n(&g_nvgfx_gpuinit_done, 0, __ATOMIC_RELAXED);
+    g_nvgfx_gpuinit_rc = 0;
+
+    //Only what's needed for presenting framebuffers is done here, the GPU channel setup is done by _nvgfxInitializeGpu.
+
+    if (R_SUCCEEDED(rc)) rc = nvOpen(&g_nvgfx_fd_nvhostasgpu, "/dev/nvhost-as-gpu");
+    if (R_SUCCEEDED(rc)) rc = nvOpen(&g_nvgfx_fd_nvmap, "/dev/nvmap");
     if (R_SUCCEEDED(rc)) rc = nvOpen(&g_nvgfx_fd_nvhostctrl, "/dev/nvhost-ctrl");
 
+    if (R_SUCCEEDED(rc)) _nvgfxInitStepDone(NvgfxInitStep_Open, &tick);
+
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_InitializeEx(g_nvgfx_fd_nvhostasgpu, 1, /*0*/0x10000);
+
+    //Officially this is used twice here - only use it once here.
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_GetVARegions(g_nvgfx_fd_nvhostasgpu, g_nvgfx_nvhostasgpu_varegions);
+
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_AllocSpace(g_nvgfx_fd_nvhostasgpu, 0x10000, /*0x20000*/0x10000, 0, 0x10000, &g_nvgfx_nvhostasgpu_allocspace_offset);
+
+    if (R_SUCCEEDED(rc)) _nvgfxInitStepDone(NvgfxInitStep_AddressSpace, &tick);
+
+    if (R_SUCCEEDED(rc)) rc = _nvgfxFramebufferAlloc();
+
+    if (R_SUCCEEDED(rc)) _nvgfxInitStepDone(NvgfxInitStep_Framebuffers, &tick);
+
+    if (R_SUCCEEDED(rc)) rc = bufferProducerQuery(NATIVE_WINDOW_FORMAT, &tmp);//TODO: What does official sw use the output from this for?
+
+    if (R_SUCCEEDED(rc)) rc = nvgfxRegisterFramebuffers();
+
+    if (R_SUCCEEDED(rc)) _nvgfxInitStepDone(NvgfxInitStep_GraphicBuffers, &tick);
+
+    //The GPU channel is only needed by the nvgfxGpfifo* functions, which wait for it. When the thread can't be started it's set up on first use instead.
+    if (R_SUCCEEDED(rc) && R_SUCCEEDED(threadCreate(&g_nvgfx_gpuinit_thread, _nvgfxInitializeGpuThread, NULL, 0x4000, 0x2C, -2))) {
+        if (R_SUCCEEDED(threadStart(&g_nvgfx_gpuinit_thread))) g_nvgfx_gpuinit_thread_started = 1;
+        else threadClose(&g_nvgfx_gpuinit_thread);
+    }
+
     //if (R_SUCCEEDED(rc)) rc = -1;
 
     if (R_FAILED(rc)) {
@@ -382,6 +523,20 @@ Result nvgfxInitialize(void) {
 void nvgfxExit(void) {
     if(!g_nvgfxInitialized)return;
 
+    if (g_nvgfx_gpuinit_thread_started) {
+        _nvgfxWaitGpuInit();
+        threadClose(&g_nvgfx_gpuinit_thread);
+        g_nvgfx_gpuinit_thread_started = 0;
+    }
+
+    //The GPU may still be reading from the command ring or the heap.
+    while (g_nvgfx_gpfifo_inflight_count) {
+        if (R_FAILED(_nvgfxGpfifoReclaim())) break;
+    }
+    while (g_nvgfx_heap_deferred_count) {
+        if (R_FAILED(_nvgfxHeapReclaim(true))) break;
+    }
+
     if (g_nvgfx_nvhostctrl_eventhandle != INVALID_HANDLE) {
         svcCloseHandle(g_nvgfx_nvhostctrl_eventhandle);
         g_nvgfx_nvhostctrl_eventhandle = INVALID_HANDLE;
@@ -424,7 +579,7 @@ Result nvgfxEventWait(u32 syncpt_id, u32 threshold, s32 timeout) {
     if (R_SUCCEEDED(rc)) {
         do {
             rc = nvioctlNvhostCtrl_EventWait(g_nvgfx_fd_nvhostctrl, syncpt_id, threshold, timeout, 0, &g_nvgfx_nvhostctrl_eventres);
-        } while(rc==5);//timeout error
+        } while(timeout<0 && (rc==5 || rc==MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Timeout)));//timeout error, only retried without a timeout
     }
 
     //Official sw only uses the below block when event-waiting timeout occurs.
@@ -441,36 +596,397 @@ Result nvgfxEventWait(u32 syncpt_id, u32 threshold, s32 timeout) {
     return rc;
 }
 
+//Waits for the oldest in-flight submission, then releases its ring space.
+static Result _nvgfxGpfifoReclaim(void) {
+    Result rc=0;
+    nvgfxGpfifoSubmission *sub = &g_nvgfx_gpfifo_inflight[g_nvgfx_gpfifo_inflight_first];
+
+    if (sub->fence.id != 0xffffffff) rc = nvgfxEventWait(sub->fence.id, sub->fence.value, -1);
+    if (R_FAILED(rc)) return rc;
+
+    g_nvgfx_gpfifo_tail = sub->end;
+    g_nvgfx_gpfifo_inflight_first = (g_nvgfx_gpfifo_inflight_first + 1) % NVGFX_GPFIFO_MAX_INFLIGHT;
+    g_nvgfx_gpfifo_inflight_count--;
+
+    return rc;
+}
+
+static void _nvgfxGpfifoFlushRange(void) {
+    if (g_nvgfx_gpfifo_flush_end > g_nvgfx_gpfifo_flush_start)
+        armDCacheFlush(&nvmap_objs[3].mem[g_nvgfx_gpfifo_flush_start], g_nvgfx_gpfifo_flush_end - g_nvgfx_gpfifo_flush_start);
+
+    g_nvgfx_gpfifo_flush_start = 0;
+    g_nvgfx_gpfifo_flush_end = 0;
+}
+
+Result nvgfxGpfifoAlloc(size_t size, void **cpu_ptr, u64 *gpu_va) {
+    Result rc=0;
+    size_t ring_size;
+    u64 start, end;
+
+    if(!g_nvgfxInitialized)return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    rc = _nvgfxWaitGpuInit();
+    if (R_FAILED(rc)) return rc;
+
+    ring_size = nvmap_objs[3].mem_size;
+
+    size = (size+3) & ~3;
+    if (size == 0 || size > ring_size) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    //Command lists are contiguous, skip the rest of the ring when the allocation doesn't fit before the end.
+    start = g_nvgfx_gpfifo_pos;
+    if ((start % ring_size) + size > ring_size) start += ring_size - (start % ring_size);
+    end = start + size;
+
+    while (end - g_nvgfx_gpfifo_tail > ring_size) {
+        if (g_nvgfx_gpfifo_inflight_count) rc = _nvgfxGpfifoReclaim();
+        else if (g_nvgfx_gpfifo_num_entries) rc = nvgfxGpfifoSubmit(NULL);
+        else rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);//The ring is filled with data which wasn't pushed.
+
+        if (R_FAILED(rc)) return rc;
+    }
+
+    g_nvgfx_gpfifo_pos = end;
+
+    if (cpu_ptr) *cpu_ptr = &nvmap_objs[3].mem[start % ring_size];
+    if (gpu_va) *gpu_va = nvmap_obj3_mapbuffer_x0_offset + (start % ring_size);
+
+    return rc;
+}
+
+Result nvgfxGpfifoPush(u64 gpu_va, size_t size, u32 flags) {
+    Result rc=0;
+    size_t offset = gpu_va - nvmap_obj3_mapbuffer_x0_offset;
+    nvioctl_gpfifo_entry *entry;
+
+    if(!g_nvgfxInitialized)return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    if (gpu_va < nvmap_obj3_mapbuffer_x0_offset || offset + size > nvmap_objs[3].mem_size || (size & 3)) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (g_nvgfx_gpfifo_num_entries == NVGFX_GPFIFO_MAX_ENTRIES) {
+        rc = nvgfxGpfifoSubmit(NULL);
+        if (R_FAILED(rc)) return rc;
+    }
+
+    //Merge the range to flush with the previous one when contiguous.
+    if (g_nvgfx_gpfifo_flush_end != offset || g_nvgfx_gpfifo_flush_end == g_nvgfx_gpfifo_flush_start) {
+        _nvgfxGpfifoFlushRange();
+        g_nvgfx_gpfifo_flush_start = offset;
+    }
+    g_nvgfx_gpfifo_flush_end = offset + size;
+
+    //Convert the ring offset back to a position, the command list was allocated within the last ring_size bytes.
+    g_nvgfx_gpfifo_pushed_pos = g_nvgfx_gpfifo_pos - ((g_nvgfx_gpfifo_pos - (offset + size)) % nvmap_objs[3].mem_size);
+
+    entry = &g_nvgfx_gpfifo_entries[g_nvgfx_gpfifo_num_entries++];
+    entry->entry0 = (u32)gpu_va;
+    entry->entry1 = ((u32)(gpu_va>>32)) | ((size/4)<<10) | flags;
+
+    return rc;
+}
+
+Result nvgfxGpfifoSubmit(nvioctl_fence *fence_out) {
+    Result rc=0;
+    nvgfxGpfifoSubmission *sub;
+
+    if(!g_nvgfxInitialized)return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    if (g_nvgfx_gpfifo_num_entries == 0) return 0;
+
+    _nvgfxGpfifoFlushRange();
+
+    if (g_nvgfx_gpfifo_inflight_count == NVGFX_GPFIFO_MAX_INFLIGHT) {
+        rc = _nvgfxGpfifoReclaim();
+        if (R_FAILED(rc)) return rc;
+    }
+
+    rc = nvioctlChannel_SubmitGpfifo(g_nvgfx_fd_nvhostgpu, g_nvgfx_gpfifo_entries, g_nvgfx_gpfifo_num_entries, 0x104, &g_nvgfx_nvhostgpu_gpfifo_fence);
+    g_nvgfx_gpfifo_num_entries = 0;
+
+    //Without a fence the ring space is released on the next reclaim.
+    sub = &g_nvgfx_gpfifo_inflight[(g_nvgfx_gpfifo_inflight_first + g_nvgfx_gpfifo_inflight_count) % NVGFX_GPFIFO_MAX_INFLIGHT];
+    sub->end = g_nvgfx_gpfifo_pushed_pos;
+    sub->fence.id = 0xffffffff;
+    sub->fence.value = 0;
+    if (R_SUCCEEDED(rc)) sub->fence = g_nvgfx_nvhostgpu_gpfifo_fence;
+    g_nvgfx_gpfifo_inflight_count++;
+
+    if (R_SUCCEEDED(rc) && fence_out) *fence_out = g_nvgfx_nvhostgpu_gpfifo_fence;
+
+    return rc;
+}
+
 Result nvgfxSubmitGpfifo(void) {
     //Extracted from memory of certain official sw.
-    u8 gpfifo_data[] = {0x00, 0x00, 0x00, 0x00, 0x51, 0x04, 0x00, 0x80, 0xB2, 0x00, 0x01, 0x20, 0x42, 0x00, 0x10, 0x00, 0x51, 0x04, 0x00, 0x80, 0xC0, 0x06, 0x04, 0x20, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x10, 0xF0, 0x00, 0x10, 0xE0, 0x03, 0x00, 0x80};
+    static const u8 gpfifo_data[] = {0x00, 0x00, 0x00, 0x00, 0x51, 0x04, 0x00, 0x80, 0xB2, 0x00, 0x01, 0x20, 0x42, 0x00, 0x10, 0x00, 0x51, 0x04, 0x00, 0x80, 0xC0, 0x06, 0x04, 0x20, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x10, 0xF0, 0x00, 0x10, 0xE0, 0x03, 0x00, 0x80};
+
+    Result rc=0;
+    u8 *ptr = NULL;
+    u64 va = 0;
+
+    rc = nvgfxGpfifoAlloc(0x1778+sizeof(gpfifo_data), (void**)&ptr, &va);
+
+    //memcpy(ptr, nvgfx_gpu_gpfifo_data0_bin, nvgfx_gpu_gpfifo_data0_bin_size);
+    if (R_SUCCEEDED(rc)) memcpy(&ptr[0x1778], gpfifo_data, sizeof(gpfifo_data));
+
+    if (R_SUCCEEDED(rc)) rc = nvgfxGpfifoPush(va, 0x1778, 0x200);
+    if (R_SUCCEEDED(rc)) rc = nvgfxGpfifoPush(va+0x1778, sizeof(gpfifo_data), 0x80000200);
+    if (R_SUCCEEDED(rc)) rc = nvgfxGpfifoSubmit(NULL);
+
+    return rc;
+}
+
+static Result _nvgfxHeapChunkCreate(nvgfxHeapChunk *chunk) {
+    Result rc=0;
+
+    rc = nvmapobjInitialize(&chunk->obj, NVGFX_HEAP_CHUNK_SIZE);
+    if (R_SUCCEEDED(rc)) rc = nvmapobjSetup(&chunk->obj, 0, 0, 0x20000, 0);
+    if (R_SUCCEEDED(rc)) rc = nvioctlNvhostAsGpu_MapBufferEx(g_nvgfx_fd_nvhostasgpu, 0, 0, chunk->obj.handle, 0x10000, 0, 0, 0, &chunk->gpu_va);
+
+    if (R_FAILED(rc)) {
+        nvmapobjClose(&chunk->obj);
+        return rc;
+    }
+
+    memset(chunk->free_blocks, 0, sizeof(chunk->free_blocks));
+    memset(chunk->alloc_order, 0, sizeof(chunk->alloc_order));
+    chunk->free_blocks[NVGFX_HEAP_ORDERS-1][0] = 1;
+
+    return rc;
+}
+
+static bool _nvgfxHeapChunkAlloc(nvgfxHeapChunk *chunk, u32 order, u32 *out_page) {
+    u32 k, i, page = 0;
+    bool found = 0;
+
+    //Find the smallest free block which is large enough.
+    for (k=order; k<NVGFX_HEAP_ORDERS && !found; k++) {
+        for (i=0; i<((NVGFX_HEAP_PAGES>>k)+63)/64; i++) {
+            if (chunk->free_blocks[k][i]) {
+                u32 bit = __builtin_ctzll(chunk->free_blocks[k][i]);
+                chunk->free_blocks[k][i] &= ~(1ULL<<bit);
+                page = (i*64 + bit) << k;
+                found = 1;
+                break;
+            }
+        }
+    }
+    if (!found) return 0;
+
+    //Split it, the upper halves become free blocks.
+    for (k--; k>order; k--) {
+        i = (page >> (k-1)) | 1;
+        chunk->free_blocks[k-1][i/64] |= 1ULL<<(i%64);
+    }
+
+    chunk->alloc_order[page] = order+1;
+    *out_page = page;
+    return 1;
+}
+
+static void _nvgfxHeapChunkFree(nvgfxHeapChunk *chunk, u32 page) {
+    u32 order = chunk->alloc_order[page]-1;
+    u32 buddy;
+
+    chunk->alloc_order[page] = 0;
+
+    //Merge with the buddy block while it's free.
+    for (; order<NVGFX_HEAP_ORDERS-1; order++) {
+        buddy = (page >> order) ^ 1;
+        if (!(chunk->free_blocks[order][buddy/64] & (1ULL<<(buddy%64)))) break;
+
+        chunk->free_blocks[order][buddy/64] &= ~(1ULL<<(buddy%64));
+        page &= ~(1U<<order);
+    }
+
+    chunk->free_blocks[order][(page>>order)/64] |= 1ULL<<((page>>order)%64);
+}
+
+static nvgfxHeapChunk* _nvgfxHeapFindChunk(void *ptr, u32 *page) {
+    u32 i;
+    size_t offset;
+
+    for (i=0; i<NVGFX_HEAP_MAX_CHUNKS; i++) {
+        nvgfxHeapChunk *chunk = &g_nvgfx_heap_chunks[i];
+        if (!chunk->obj.initialized || (u8*)ptr < chunk->obj.mem || (u8*)ptr >= chunk->obj.mem + NVGFX_HEAP_CHUNK_SIZE) continue;
+
+        offset = (u8*)ptr - chunk->obj.mem;
+        if ((offset % NVGFX_HEAP_PAGE_SIZE) || chunk->alloc_order[offset / NVGFX_HEAP_PAGE_SIZE] == 0) return NULL;
+
+        *page = offset / NVGFX_HEAP_PAGE_SIZE;
+        return chunk;
+    }
+
+    return NULL;
+}
+
+//Frees the oldest deferred block once its fence is signalled. Without wait, this returns LibnxError_NotFound when the fence isn't signalled yet.
+static Result _nvgfxHeapReclaim(bool wait) {
+    Result rc=0;
+    nvgfxHeapDeferredFree *entry = &g_nvgfx_heap_deferred[g_nvgfx_heap_deferred_first];
+    nvgfxHeapChunk *chunk;
+    u32 page=0;
+
+    if (wait) rc = nvgfxEventWait(entry->fence.id, entry->fence.value, -1);
+    else if (nvioctlNvhostCtrl_EventWait(g_nvgfx_fd_nvhostctrl, entry->fence.id, entry->fence.value, 0, 0, &g_nvgfx_nvhostctrl_eventres) != 0) rc = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    if (R_FAILED(rc)) return rc;
+
+    chunk = _nvgfxHeapFindChunk(entry->ptr, &page);
+    if (chunk) _nvgfxHeapChunkFree(chunk, page);
+
+    g_nvgfx_heap_deferred_first = (g_nvgfx_heap_deferred_first + 1) % NVGFX_HEAP_MAX_DEFERRED;
+    g_nvgfx_heap_deferred_count--;
+
+    return rc;
+}
+
+Result nvgfxHeapAlloc(size_t size, void **cpu_ptr, u64 *gpu_va) {
+    Result rc=0;
+    u32 order=0, page=0, i;
+    nvgfxHeapChunk *chunk;
+
+    if(!g_nvgfxInitialized)return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    if (size == 0 || size > NVGFX_HEAP_CHUNK_SIZE) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    while (((size_t)NVGFX_HEAP_PAGE_SIZE << order) < size) order++;
+
+    //Release deferred blocks which are already done with, without blocking.
+    while (g_nvgfx_heap_deferred_count && R_SUCCEEDED(_nvgfxHeapReclaim(false)));
+
+    while (1) {
+        chunk = NULL;
+        for (i=0; i<NVGFX_HEAP_MAX_CHUNKS; i++) {
+            if (g_nvgfx_heap_chunks[i].obj.initialized && _nvgfxHeapChunkAlloc(&g_nvgfx_heap_chunks[i], order, &page)) {
+                chunk = &g_nvgfx_heap_chunks[i];
+                break;
+            }
+        }
+        if (chunk) break;
+
+        //Map another chunk when possible, otherwise wait for deferred blocks.
+        for (i=0; i<NVGFX_HEAP_MAX_CHUNKS && g_nvgfx_heap_chunks[i].obj.initialized; i++);
+
+        if (i < NVGFX_HEAP_MAX_CHUNKS) rc = _nvgfxHeapChunkCreate(&g_nvgfx_heap_chunks[i]);
+        else if (g_nvgfx_heap_deferred_count) rc = _nvgfxHeapReclaim(true);
+        else rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+        if (R_FAILED(rc)) return rc;
+    }
 
-    nvioctl_gpfifo_entry gpfifo_entries[2];
+    if (cpu_ptr) *cpu_ptr = &chunk->obj.mem[page * NVGFX_HEAP_PAGE_SIZE];
+    if (gpu_va) *gpu_va = chunk->gpu_va + page * NVGFX_HEAP_PAGE_SIZE;
 
-    u64 total_size = 0x1778+sizeof(gpfifo_data);
-    u64 tmpva;
+    return rc;
+}
 
-    if (g_nvgfx_gpfifo_pos >= nvmap_objs[3].mem_size || g_nvgfx_gpfifo_pos+total_size >= nvmap_objs[3].mem_size) g_nvgfx_gpfifo_pos = 0;
+void nvgfxHeapFree(void *cpu_ptr, const nvioctl_fence *fence) {
+    nvgfxHeapChunk *chunk;
+    nvgfxHeapDeferredFree *entry;
+    u32 page=0;
 
-    //memcpy(&nvmap_objs[3].mem[g_nvgfx_gpfifo_pos], nvgfx_gpu_gpfifo_data0_bin, nvgfx_gpu_gpfifo_data0_bin_size);
-    memcpy(&nvmap_objs[3].mem[g_nvgfx_gpfifo_pos+0x1778], gpfifo_data, sizeof(gpfifo_data));
-    armDCacheFlush(nvmap_objs[3].mem, nvmap_objs[3].mem_size);
+    if (cpu_ptr == NULL) return;
 
-    tmpva = nvmap_obj3_mapbuffer_x0_offset+g_nvgfx_gpfifo_pos;
-    gpfifo_entries[0].entry0 = (u32)tmpva | (0x00177aULL<<40);
-    gpfifo_entries[0].entry1 = ((u32)(tmpva>>32)) | (0x00177a<<8);
+    if (fence == NULL || fence->id == 0xffffffff) {
+        chunk = _nvgfxHeapFindChunk(cpu_ptr, &page);
+        if (chunk) _nvgfxHeapChunkFree(chunk, page);
+        return;
+    }
 
-    tmpva = nvmap_obj3_mapbuffer_x0_offset+g_nvgfx_gpfifo_pos+0x1778;
-    gpfifo_entries[1].entry0 = (u32)tmpva;
-    gpfifo_entries[1].entry1 = ((u32)(tmpva>>32)) | (0x80002e<<8);
+    if (g_nvgfx_heap_deferred_count == NVGFX_HEAP_MAX_DEFERRED) _nvgfxHeapReclaim(true);
 
-    g_nvgfx_gpfifo_pos+= total_size;
+    entry = &g_nvgfx_heap_deferred[(g_nvgfx_heap_deferred_first + g_nvgfx_heap_deferred_count) % NVGFX_HEAP_MAX_DEFERRED];
+    entry->ptr = cpu_ptr;
+    entry->fence = *fence;
+    g_nvgfx_heap_deferred_count++;
+}
+
+Result nvgfxRegisterFramebuffers(void) {
+    Result rc=0;
+    u32 i=0;
+    u32 tmpval=0;
 
-    Result rc = nvioctlChannel_SubmitGpfifo(g_nvgfx_fd_nvhostgpu, gpfifo_entries, 2, 0x104, &g_nvgfx_nvhostgpu_gpfifo_fence);
+    for(i=0; i<g_nvgfx_totalframebufs; i++) {
+        tmpval = 0;
+        rc = nvioctlNvmap_GetId(g_nvgfx_fd_nvmap, nvmap_objs[6].handle, &tmpval);
+        if (R_FAILED(rc)) break;
+
+        if(tmpval==~0) {
+            rc = 6;//official error
+            break;
+        }
+
+        rc = nvioctlNvmap_FromId(g_nvgfx_fd_nvmap, tmpval, &tmpval);
+        if (R_FAILED(rc)) break;
+
+        //The above gets a nvmap_handle, but normally it's the same value passed to nvioctlNvmap_GetId().
+
+        rc = _gfxGraphicBufferInit(i, tmpval);
+        if (R_FAILED(rc)) break;
+    }
 
     return rc;
 }
 
+Result nvgfxResizeFramebuffers(void) {
+    Result rc=0;
+    nvmapobj old_obj;
+    u64 old_offsets[3];
+
+    if(!g_nvgfxInitialized)return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    //Only one retired framebuffer is kept, an older one is assumed to be no longer displayed.
+    nvgfxFreeRetiredFramebuffers();
+
+    memcpy(&old_obj, &nvmap_objs[6], sizeof(nvmapobj));
+    old_offsets[0] = nvmap_obj6_mapbuffer_offsets[0];
+    old_offsets[1] = nvmap_obj6_mapbuffer_offsets[1];
+    old_offsets[2] = nvmap_obj6_mapbuffer_xdb_offset;
+
+    memset(&nvmap_objs[6], 0, sizeof(nvmapobj));
+    memset(nvmap_obj6_mapbuffer_offsets, 0, sizeof(nvmap_obj6_mapbuffer_offsets));
+    nvmap_obj6_mapbuffer_xdb_offset = 0;
+
+    rc = _nvgfxFramebufferAlloc();
+
+    if (R_FAILED(rc)) {
+        u64 new_offsets[3] = {nvmap_obj6_mapbuffer_offsets[0], nvmap_obj6_mapbuffer_offsets[1], nvmap_obj6_mapbuffer_xdb_offset};
+
+        _nvgfxFramebufferFree(&nvmap_objs[6], new_offsets);
+
+        memcpy(&nvmap_objs[6], &old_obj, sizeof(nvmapobj));
+        nvmap_obj6_mapbuffer_offsets[0] = old_offsets[0];
+        nvmap_obj6_mapbuffer_offsets[1] = old_offsets[1];
+        nvmap_obj6_mapbuffer_xdb_offset = old_offsets[2];
+        return rc;
+    }
+
+    memcpy(&g_nvgfx_framebuf_retired, &old_obj, sizeof(nvmapobj));
+    memcpy(g_nvgfx_framebuf_retired_offsets, old_offsets, sizeof(old_offsets));
+
+    return rc;
+}
+
+void nvgfxRestoreFramebuffers(void) {
+    u64 new_offsets[3] = {nvmap_obj6_mapbuffer_offsets[0], nvmap_obj6_mapbuffer_offsets[1], nvmap_obj6_mapbuffer_xdb_offset};
+
+    if(!g_nvgfxInitialized || !g_nvgfx_framebuf_retired.initialized)return;
+
+    _nvgfxFramebufferFree(&nvmap_objs[6], new_offsets);
+
+    memcpy(&nvmap_objs[6], &g_nvgfx_framebuf_retired, sizeof(nvmapobj));
+    nvmap_obj6_mapbuffer_offsets[0] = g_nvgfx_framebuf_retired_offsets[0];
+    nvmap_obj6_mapbuffer_offsets[1] = g_nvgfx_framebuf_retired_offsets[1];
+    nvmap_obj6_mapbuffer_xdb_offset = g_nvgfx_framebuf_retired_offsets[2];
+
+    memset(&g_nvgfx_framebuf_retired, 0, sizeof(nvmapobj));
+    memset(g_nvgfx_framebuf_retired_offsets, 0, sizeof(g_nvgfx_framebuf_retired_offsets));
+}
+
+void nvgfxFreeRetiredFramebuffers(void) {
+    if(!g_nvgfxInitialized)return;
+
+    _nvgfxFramebufferFree(&g_nvgfx_framebuf_retired, g_nvgfx_framebuf_retired_offsets);
+}
+
 Result nvgfxGetFramebuffer(u8 **buffer, size_t *size) {
     if(!g_nvgfxInitialized)return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
 
@@ -480,3 +996,20 @@ Result nvgfxGetFramebuffer(u8 **buffer, size_t *size) {
     return 0;
 }
 
+Result nvgfxWaitGpuInit(void) {
+    if(!g_nvgfxInitialized)return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    return _nvgfxWaitGpuInit();
+}
+
+u64 nvgfxGetInitStepTicks(NvgfxInitStep step) {
+    if (step >= NvgfxInitStep_Count) return 0;
+
+    //The GPU steps are written by the thread, only read them once it's done. Without the thread this doesn't do the setup.
+    if (step >= NvgfxInitStep_GpuInfo) {
+        if (g_nvgfxInitialized && g_nvgfx_gpuinit_thread_started) _nvgfxWaitGpuInit();
+        if (!__atomic_load_n(&g_nvgfx_gpuinit_done, __ATOMIC_ACQUIRE)) return 0;
+    }
+
+    return g_nvgfx_init_ticks[step];
+}
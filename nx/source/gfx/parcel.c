@@ -1,5 +1,6 @@
 #include <string.h>
 #include "result.h"
+#include "kernel/mutex.h"
 #include "gfx/parcel.h"
 
 //This implements Android Parcel, hence names etc here are based on Android Parcel.cpp.
@@ -11,50 +12,87 @@ u8 parcel_reply_log[0x10000] = {0};
 size_t parcel_reply_log_size = 0;
 #endif
 
+//Pool of pre-encoded constant strings. Entries are never removed, so lookups only need the published count.
+static ParcelString16 g_parcelString16Pool[PARCEL_STRING16_POOL_ENTRIES];
+static u32 g_parcelString16PoolCount;
+static u8 g_parcelString16PoolData[PARCEL_STRING16_POOL_SIZE] __attribute__((aligned(4)));
+static u32 g_parcelString16PoolDataSize;
+static Mutex g_parcelString16PoolMutex;
+
+//Entries are matched by content against their encoding, so the caller's string doesn't have to outlive the call.
+static bool _parcelString16Equals(const ParcelString16 *entry, const char *str, u32 len)
+{
+    const u16 *ptr = (const u16*)&entry->data[4];
+    u32 pos;
+
+    if (*(const u32*)entry->data != len) return false;
+
+    for (pos=0; pos<len; pos++) {
+        if (ptr[pos] != (u16)str[pos]) return false;
+    }
+
+    return true;
+}
+
+static const ParcelString16* _parcelFindString16(const char *str, u32 len, u32 start, u32 count)
+{
+    u32 i;
+
+    for (i=start; i<count; i++) {
+        if (_parcelString16Equals(&g_parcelString16Pool[i], str, len)) return &g_parcelString16Pool[i];
+    }
+
+    return NULL;
+}
+
 void parcelInitialize(Parcel *ctx)
 {
-    memset(ctx, 0, sizeof(Parcel));
-    ctx->capacity = sizeof(ctx->payload);
+    //The data buffer isn't cleared, parcelWriteData zeroes the padding itself.
+    ctx->payload = &ctx->data[PARCEL_HEADER_SIZE];
+    ctx->capacity = sizeof(ctx->data) - PARCEL_HEADER_SIZE;
+    ctx->size = 0;
+    ctx->pos = 0;
+    ctx->ParcelObjects = NULL;
+    ctx->ParcelObjectsSize = 0;
 }
 
 Result parcelTransact(Binder *session, u32 code, Parcel *in_parcel, Parcel *parcel_reply)
 {
     Result rc=0;
-    u8 inparcel[0x400];
-    u8 outparcel[0x400];
-    size_t outparcel_size = sizeof(outparcel);
+    u8 *inparcel = in_parcel->data;
+    u8 *outparcel = parcel_reply->data;
+    size_t outparcel_size = sizeof(parcel_reply->data);
     u32 *inparcel32 = (u32*)inparcel;
     u32 *outparcel32 = (u32*)outparcel;
     u32 payloadSize = in_parcel->size;
     u32 ParcelObjectsSize = in_parcel->ParcelObjectsSize;
 
-    memset(inparcel, 0, sizeof(inparcel));
-    memset(outparcel, 0, outparcel_size);
-
-    if((size_t)payloadSize >= sizeof(inparcel) || (size_t)ParcelObjectsSize >= sizeof(inparcel) || ((size_t)payloadSize)+((size_t)ParcelObjectsSize)+0x10 >= sizeof(inparcel)) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    if((size_t)payloadSize >= sizeof(in_parcel->data) || (size_t)ParcelObjectsSize >= sizeof(in_parcel->data) || ((size_t)payloadSize)+((size_t)ParcelObjectsSize)+PARCEL_HEADER_SIZE >= sizeof(in_parcel->data)) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
 
+    //The payload was already written in place following the header.
     inparcel32[0] = payloadSize;//payloadSize
-    inparcel32[1] = 0x10;//payloadOffset
+    inparcel32[1] = PARCEL_HEADER_SIZE;//payloadOffset
     inparcel32[2] = ParcelObjectsSize;//ParcelObjectsSize
-    inparcel32[3] = 0x10+payloadSize;//ParcelObjectsOffset
+    inparcel32[3] = PARCEL_HEADER_SIZE+payloadSize;//ParcelObjectsOffset
 
-    if(in_parcel->payload && payloadSize)memcpy(&inparcel[inparcel32[1]], in_parcel->payload, payloadSize);
     if(in_parcel->ParcelObjects && ParcelObjectsSize)memcpy(&inparcel[inparcel32[3]], in_parcel->ParcelObjects, ParcelObjectsSize);
 
-    rc = binderTransactParcel(session, code, inparcel, payloadSize+ParcelObjectsSize+0x10, outparcel, outparcel_size, 0);
+    rc = binderTransactParcel(session, code, inparcel, payloadSize+ParcelObjectsSize+PARCEL_HEADER_SIZE, outparcel, outparcel_size, 0);
     if (R_FAILED(rc)) return rc;
 
     if((size_t)outparcel32[1] >= outparcel_size || ((size_t)outparcel32[0])+((size_t)outparcel32[1]) >= outparcel_size) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
     if((size_t)outparcel32[2] >= outparcel_size || ((size_t)outparcel32[2])+((size_t)outparcel32[3]) >= outparcel_size) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
     if((size_t)outparcel32[0] >= outparcel_size || (size_t)outparcel32[3] >= outparcel_size) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
 
-    memcpy(parcel_reply->payload, &outparcel[outparcel32[1]], outparcel32[0]);
+    //The reply is parsed in place.
+    parcel_reply->payload = &outparcel[outparcel32[1]];
     parcel_reply->size = outparcel32[0];
+    parcel_reply->pos = 0;
 
     #ifdef PARCEL_LOGGING
-    if(parcel_reply_log_size + sizeof(inparcel) + outparcel_size <= sizeof(parcel_reply_log)) {
-        memcpy(&parcel_reply_log[parcel_reply_log_size], inparcel, sizeof(inparcel));
-        parcel_reply_log_size+= sizeof(inparcel);
+    if(parcel_reply_log_size + sizeof(in_parcel->data) + outparcel_size <= sizeof(parcel_reply_log)) {
+        memcpy(&parcel_reply_log[parcel_reply_log_size], inparcel, sizeof(in_parcel->data));
+        parcel_reply_log_size+= sizeof(in_parcel->data);
         memcpy(&parcel_reply_log[parcel_reply_log_size], outparcel, outparcel_size);
         parcel_reply_log_size+= outparcel_size;
     }
@@ -66,19 +104,22 @@ Result parcelTransact(Binder *session, u32 code, Parcel *in_parcel, Parcel *parc
 void* parcelWriteData(Parcel *ctx, void* data, size_t data_size)
 {
     void* ptr = &ctx->payload[ctx->size];
+    size_t aligned_data_size;
 
     if(data_size & BIT(31))
         return NULL;
 
-    data_size = (data_size+3) & ~3;
+    aligned_data_size = (data_size+3) & ~3;
 
-    if(ctx->size + data_size >= ctx->capacity)
+    if(ctx->size + aligned_data_size >= ctx->capacity)
         return NULL;
 
     if(data)
         memcpy(ptr, data, data_size);
 
-    ctx->size += data_size;
+    memset((u8*)ptr + data_size, 0, aligned_data_size - data_size);
+
+    ctx->size += aligned_data_size;
     return ptr;
 }
 
@@ -127,6 +168,52 @@ void parcelWriteString16(Parcel *ctx, const char *str)
     }
 }
 
+const ParcelString16* parcelInternString16(const char *str)
+{
+    const ParcelString16 *entry;
+    ParcelString16 *new_entry;
+    u32 count = __atomic_load_n(&g_parcelString16PoolCount, __ATOMIC_ACQUIRE);
+    u32 pos, len = strlen(str), size;
+    u16 *ptr;
+
+    entry = _parcelFindString16(str, len, 0, count);
+    if (entry) return entry;
+
+    mutexLock(&g_parcelString16PoolMutex);
+
+    //Another thread could have added the string meanwhile.
+    entry = _parcelFindString16(str, len, count, g_parcelString16PoolCount);
+
+    size = 4 + (((len+1)*2 + 3) & ~3);
+
+    if (entry == NULL && g_parcelString16PoolCount < PARCEL_STRING16_POOL_ENTRIES && size <= sizeof(g_parcelString16PoolData) - g_parcelString16PoolDataSize) {
+        new_entry = &g_parcelString16Pool[g_parcelString16PoolCount];
+        new_entry->data = &g_parcelString16PoolData[g_parcelString16PoolDataSize];
+        new_entry->size = size;
+
+        //Same layout as parcelWriteString16: length, UTF-16 with NUL-terminator, zero padding.
+        memset(&g_parcelString16PoolData[g_parcelString16PoolDataSize], 0, size);
+        *(u32*)&g_parcelString16PoolData[g_parcelString16PoolDataSize] = len;
+        ptr = (u16*)&g_parcelString16PoolData[g_parcelString16PoolDataSize + 4];
+        for(pos=0; pos<len; pos++) {
+            ptr[pos] = (u16)str[pos];
+        }
+
+        g_parcelString16PoolDataSize += size;
+        __atomic_store_n(&g_parcelString16PoolCount, g_parcelString16PoolCount+1, __ATOMIC_RELEASE);
+        entry = new_entry;
+    }
+
+    mutexUnlock(&g_parcelString16PoolMutex);
+
+    return entry;
+}
+
+void parcelWriteInternedString16(Parcel *ctx, const ParcelString16 *str)
+{
+    parcelWriteData(ctx, (void*)str->data, str->size);
+}
+
 void parcelWriteInterfaceToken(Parcel *ctx, const char *interface) {
     parcelWriteInt32(ctx, 0x100);
     parcelWriteString16(ctx, interface);
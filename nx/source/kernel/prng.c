@@ -0,0 +1,150 @@
+/*
+  xoshiro256** 1.0 and splitmix64
+  David Blackman and Sebastiano Vigna
+  Public domain.
+*/
+
+#include <string.h>
+#include "types.h"
+#include "kernel/random.h"
+#include "kernel/prng.h"
+
+static u64 _splitmix64(u64* x)
+{
+    u64 z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void prngSeed(Prng* p, u64 seed)
+{
+    int i;
+    for (i=0; i<4; i++)
+        p->s[i] = _splitmix64(&seed);
+}
+
+void prngSeedRandom(Prng* p)
+{
+    // The all-zero state is the only one xoshiro cannot leave.
+    do {
+        randomGet(p->s, sizeof(p->s));
+    } while (!(p->s[0] | p->s[1] | p->s[2] | p->s[3]));
+}
+
+u32 prngNextBounded(Prng* p, u32 bound)
+{
+    // Lemire's nearly divisionless method.
+    u64 m = (u64)prngNext32(p) * bound;
+    u32 l = (u32)m;
+
+    if (l < bound) {
+        u32 t = -bound % bound;
+
+        while (l < t) {
+            m = (u64)prngNext32(p) * bound;
+            l = (u32)m;
+        }
+    }
+
+    return m >> 32;
+}
+
+static void _prngJump(Prng* p, const u64 poly[4])
+{
+    u64 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i, b;
+
+    for (i=0; i<4; i++) {
+        for (b=0; b<64; b++) {
+            if (poly[i] & (1ULL << b)) {
+                s0 ^= p->s[0];
+                s1 ^= p->s[1];
+                s2 ^= p->s[2];
+                s3 ^= p->s[3];
+            }
+            prngNext64(p);
+        }
+    }
+
+    p->s[0] = s0;
+    p->s[1] = s1;
+    p->s[2] = s2;
+    p->s[3] = s3;
+}
+
+void prngJump(Prng* p)
+{
+    static const u64 jump[4] = {
+        0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL, 0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL
+    };
+
+    _prngJump(p, jump);
+}
+
+void prngLongJump(Prng* p)
+{
+    static const u64 long_jump[4] = {
+        0x76E15D3EFEFDCBBFULL, 0xC5004E441C522FB3ULL, 0x77710069854EE241ULL, 0x39109BB02ACBE635ULL
+    };
+
+    _prngJump(p, long_jump);
+}
+
+void prngSplit(Prng* p, Prng* out)
+{
+    *out = *p;
+    prngJump(p);
+}
+
+void prngFill(Prng* p, void* buf, size_t len)
+{
+    u8* out = (u8*)buf;
+
+    while (len >= 8) {
+        u64 tmp = prngNext64(p);
+        memcpy(out, &tmp, 8);
+        out += 8;
+        len -= 8;
+    }
+
+    if (len) {
+        u64 tmp = prngNext64(p);
+        memcpy(out, &tmp, len);
+    }
+}
+
+void prngFillFloat(Prng* p, float* out, size_t count)
+{
+    // Each 64-bit output yields two 24-bit mantissas.
+    while (count >= 2) {
+        u64 tmp = prngNext64(p);
+        out[0] = (tmp >> 40) * (1.0f / (1U << 24));
+        out[1] = ((tmp >> 8) & 0xFFFFFF) * (1.0f / (1U << 24));
+        out += 2;
+        count -= 2;
+    }
+
+    if (count)
+        out[0] = prngNextFloat(p);
+}
+
+void prngFillBounded(Prng* p, u32* out, size_t count, u32 bound)
+{
+    size_t i;
+    for (i=0; i<count; i++)
+        out[i] = prngNextBounded(p, bound);
+}
+
+static __thread Prng g_prngThread;
+static __thread bool g_prngThreadInit;
+
+Prng* prngGetThreadDefault(void)
+{
+    if (!g_prngThreadInit) {
+        prngSeedRandom(&g_prngThread);
+        g_prngThreadInit = true;
+    }
+
+    return &g_prngThread;
+}
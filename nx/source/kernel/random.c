@@ -7,6 +7,9 @@
 */
 
 #include <string.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 #include "types.h"
 #include "result.h"
 #include "services/fatal.h"
@@ -33,10 +36,24 @@
     x[a] = PLUS(x[a],x[b]); x[d] = ROTATE(XOR(x[d],x[a]), 8); \
     x[c] = PLUS(x[c],x[d]); x[b] = ROTATE(XOR(x[b],x[c]), 7);
 
+#define CHACHA_ROUNDS     20
+#define CHACHA_BLOCK_SIZE 64
+#define CHACHA_NUM_LANES  4
+
+// Size of the keystream cached per thread (one batch of lanes).
+#define RANDOM_BUF_SIZE   (CHACHA_BLOCK_SIZE*CHACHA_NUM_LANES)
+
 typedef struct {
     u32 input[16];
 } ChaCha;
 
+typedef struct {
+    ChaCha state;
+    u8     buf[RANDOM_BUF_SIZE];
+    size_t pos;
+    bool   init;
+} RandomThreadState;
+
 static void _Round(u8 output[64], const u32 input[16])
 {
     u32 x[16];
@@ -45,7 +62,7 @@ static void _Round(u8 output[64], const u32 input[16])
     for (i = 0;i < 16;++i)
         x[i] = input[i];
 
-    for (i = 8;i > 0;i -= 2) {
+    for (i = CHACHA_ROUNDS;i > 0;i -= 2) {
         QUARTERROUND( 0, 4, 8,12);
         QUARTERROUND( 1, 5, 9,13);
         QUARTERROUND( 2, 6,10,14);
@@ -88,41 +105,105 @@ static void chachaInit(ChaCha* x, const u8* key, const u8* iv)
     x->input[15] = U8TO32_LITTLE(iv + 4);
 }
 
-static void chachaEncrypt(ChaCha* x, const u8* m, u8* c, size_t bytes)
+static void chachaNextBlock(ChaCha* x, u8 output[CHACHA_BLOCK_SIZE])
 {
-    u8 output[64];
-    int i;
+    _Round(output, x->input);
 
-    while (bytes > 0)
-    {
-        _Round(output, x->input);
+    x->input[12] = PLUSONE(x->input[12]);
+
+    if (!x->input[12]) {
+        x->input[13] = PLUSONE(x->input[13]);
+        /* stopping at 2^70 bytes per nonce is user's responsibility */
+    }
+}
+
+#ifdef __ARM_NEON
+
+#define VROTATE(v,c) vsriq_n_u32(vshlq_n_u32(v,c), v, 32-(c))
+#define VROTATE16(v) vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(v)))
+
+#define VQUARTERROUND(a,b,c,d) \
+    v[a] = vaddq_u32(v[a],v[b]); v[d] = VROTATE16(veorq_u32(v[d],v[a])); \
+    v[c] = vaddq_u32(v[c],v[d]); v[b] = VROTATE(veorq_u32(v[b],v[c]),12); \
+    v[a] = vaddq_u32(v[a],v[b]); v[d] = VROTATE(veorq_u32(v[d],v[a]), 8); \
+    v[c] = vaddq_u32(v[c],v[d]); v[b] = VROTATE(veorq_u32(v[b],v[c]), 7);
 
-        x->input[12] = PLUSONE(x->input[12]);
+// Stores words [i, i+4) of four interleaved blocks, one block per lane.
+static inline void _StoreLanes(u8* output, size_t i, uint32x4_t a, uint32x4_t b, uint32x4_t c, uint32x4_t d)
+{
+    uint32x4x2_t ab = vtrnq_u32(a, b);
+    uint32x4x2_t cd = vtrnq_u32(c, d);
+
+    vst1q_u8(output + 0*CHACHA_BLOCK_SIZE + 4*i, vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(ab.val[0]),  vget_low_u32(cd.val[0]))));
+    vst1q_u8(output + 1*CHACHA_BLOCK_SIZE + 4*i, vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(ab.val[1]),  vget_low_u32(cd.val[1]))));
+    vst1q_u8(output + 2*CHACHA_BLOCK_SIZE + 4*i, vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0]))));
+    vst1q_u8(output + 3*CHACHA_BLOCK_SIZE + 4*i, vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1]))));
+}
+
+static void chachaNextBlocks(ChaCha* x, u8 output[RANDOM_BUF_SIZE])
+{
+    uint32x4_t in[16];
+    uint32x4_t v[16];
+    int i;
 
-        if (!x->input[12]) {
-            x->input[13] = PLUSONE(x->input[13]);
-            /* stopping at 2^70 bytes per nonce is user's responsibility */
-        }
+    // Each lane computes one block, with consecutive block counters.
+    u64 ctr = x->input[12] | ((u64)x->input[13] << 32);
+    u32 lo[4], hi[4];
 
-        if (bytes <= 64) {
-            for (i = 0;i < bytes;++i)
-                c[i] = m[i] ^ output[i];
-            return;
-        }
+    for (i = 0;i < 4;++i) {
+        lo[i] = (u32)(ctr + i);
+        hi[i] = (u32)((ctr + i) >> 32);
+    }
+
+    for (i = 0;i < 16;++i)
+        in[i] = vdupq_n_u32(x->input[i]);
 
-        for (i = 0;i < 64;++i)
-            c[i] = m[i] ^ output[i];
+    in[12] = vld1q_u32(lo);
+    in[13] = vld1q_u32(hi);
 
-        bytes -= 64;
-        c += 64;
-        m += 64;
+    for (i = 0;i < 16;++i)
+        v[i] = in[i];
+
+    for (i = CHACHA_ROUNDS;i > 0;i -= 2) {
+        VQUARTERROUND( 0, 4, 8,12);
+        VQUARTERROUND( 1, 5, 9,13);
+        VQUARTERROUND( 2, 6,10,14);
+        VQUARTERROUND( 3, 7,11,15);
+        VQUARTERROUND( 0, 5,10,15);
+        VQUARTERROUND( 1, 6,11,12);
+        VQUARTERROUND( 2, 7, 8,13);
+        VQUARTERROUND( 3, 4, 9,14);
     }
+
+    for (i = 0;i < 16;++i)
+        v[i] = vaddq_u32(v[i], in[i]);
+
+    for (i = 0;i < 16;i += 4)
+        _StoreLanes(output, i, v[i], v[i+1], v[i+2], v[i+3]);
+
+    ctr += CHACHA_NUM_LANES;
+    x->input[12] = (u32)ctr;
+    x->input[13] = (u32)(ctr >> 32);
+}
+
+#else
+
+static void chachaNextBlocks(ChaCha* x, u8 output[RANDOM_BUF_SIZE])
+{
+    int i;
+
+    for (i = 0;i < CHACHA_NUM_LANES;++i)
+        chachaNextBlock(x, output + i*CHACHA_BLOCK_SIZE);
 }
 
+#endif
+
 static ChaCha g_chacha;
 static bool   g_randInit = false;
 static Mutex  g_randMutex;
 
+static __thread RandomThreadState g_randThread;
+
 static void _randomInit(void)
 {
     // Has already initialized?
@@ -143,19 +224,62 @@ static void _randomInit(void)
     memset(iv, 0, sizeof iv);
 
     chachaInit(&g_chacha, (const u8*) seed, iv);
+    memset(seed, 0, sizeof seed);
     g_randInit = true;
 }
 
-void randomGet(void* buf, size_t len)
+static void _randomThreadInit(RandomThreadState* t)
 {
-    mutexLock(&g_randMutex);
+    u8 block[CHACHA_BLOCK_SIZE];
 
+    // Fork this thread's key and iv off the process-wide generator.
+    mutexLock(&g_randMutex);
     _randomInit();
+    chachaNextBlock(&g_chacha, block);
+    mutexUnlock(&g_randMutex);
 
-    memset(buf, 0, len);
-    chachaEncrypt(&g_chacha, (const u8*)buf, (u8*)buf, len);
+    chachaInit(&t->state, block, block + 32);
+    memset(block, 0, sizeof block);
 
-    mutexUnlock(&g_randMutex);
+    t->pos  = RANDOM_BUF_SIZE;
+    t->init = true;
+}
+
+void randomGet(void* buf, size_t len)
+{
+    RandomThreadState* t = &g_randThread;
+    u8* out = (u8*)buf;
+    size_t n;
+
+    if (!t->init)
+        _randomThreadInit(t);
+
+    // Serve from the cached keystream first, wiping what gets handed out.
+    n = RANDOM_BUF_SIZE - t->pos;
+    if (n > len)
+        n = len;
+
+    if (n) {
+        memcpy(out, &t->buf[t->pos], n);
+        memset(&t->buf[t->pos], 0, n);
+        t->pos += n;
+        out += n;
+        len -= n;
+    }
+
+    // Large requests are generated straight into the output buffer.
+    while (len >= RANDOM_BUF_SIZE) {
+        chachaNextBlocks(&t->state, out);
+        out += RANDOM_BUF_SIZE;
+        len -= RANDOM_BUF_SIZE;
+    }
+
+    if (len) {
+        chachaNextBlocks(&t->state, t->buf);
+        memcpy(out, t->buf, len);
+        memset(t->buf, 0, len);
+        t->pos = len;
+    }
 }
 
 u64 randomGet64(void)
@@ -1,9 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <malloc.h>
 #include <sys/iosupport.h>
+#include "result.h"
 #include "runtime/devices/console.h"
 #include "kernel/svc.h"
+#include "kernel/mutex.h"
 #include "gfx/gfx.h"
+#include "../../internal.h"
 
 #include "default_font_bin.h"
 
@@ -44,7 +49,9 @@ PrintConsole defaultConsole =
 	{
 		(u16*)default_font_bin, //font gfx
 		0, //first ascii character in the set
-		256 //number of characters in the font set
+		256, //number of characters in the font set
+		NULL, //glyph source
+		NULL //glyph source user data
 	},
 	(u32*)NULL,
 	(u32*)NULL,
@@ -61,7 +68,20 @@ PrintConsole defaultConsole =
 	0,		// background color
 	0,		// flags
 	0,		//print callback
-	false	//console initialized
+	false,	//console initialized
+	false,	//buffered
+	NULL,	//cells
+	NULL,	//dirty rows
+	0,		//top row
+	0,		//pending scroll
+	0,		//partial UTF-8 character
+	0,		//pending UTF-8 bytes
+	0,		//escape sequence state
+	0,		//number of escape sequence parameters
+	{0},	//escape sequence parameters
+	false,	//staged
+	NULL,	//staging buffer of the thread drained last
+	0		//bytes of staged output dropped
 };
 
 PrintConsole currentCopy;
@@ -73,651 +93,1861 @@ PrintConsole* consoleGetDefault(void){return &defaultConsole;}
 void consolePrintChar(int c);
 void consoleDrawChar(int c);
 
+static void consolePutChar(PrintConsole* con, int c);
+static void consoleDrawCursorChar(PrintConsole* con, int c);
+static void consoleResolveColors(PrintConsole* con, int *fg, int *bg);
+static const u16 *consoleGlyphBitmap(PrintConsole* con, u32 c);
+static void consoleDrawGlyph(PrintConsole* con, int cx, int cy, int c, int fgIndex, int bgIndex, int flags);
+static void consoleGlyphSourceForget(ConsoleGlyphSource source, void *userdata);
+static void consoleStagingFinish(PrintConsole* console);
+
+// Framebuffers of the current batch of output, see consoleBeginBatch(). Kept
+// per thread, since staged output is drawn by whichever thread updates.
+static __thread u32 *g_consoleBatchFbs[GFX_MAX_FRAMEBUFFERS];
+static __thread u32 g_consoleBatchNumFbs;
+static __thread int g_consoleBatchDepth;
+
 //---------------------------------------------------------------------------------
-static void consoleCls(char mode) {
+static void consoleBeginBatch(void) {
 //---------------------------------------------------------------------------------
+	// The framebuffers are looked up on first use within the batch, so output
+	// which only updates a cell buffer doesn't wait on the dequeue fence
+	if (g_consoleBatchDepth++ == 0)
+		g_consoleBatchNumFbs = 0;
+}
 
-	int i = 0;
-	int colTemp,rowTemp;
+//---------------------------------------------------------------------------------
+static void consoleEndBatch(void) {
+//---------------------------------------------------------------------------------
+	g_consoleBatchDepth--;
+}
 
-	switch (mode)
-	{
-	case '[':
-	case '0':
-		{
-			colTemp = currentConsole->cursorX ;
-			rowTemp = currentConsole->cursorY ;
+//---------------------------------------------------------------------------------
+static void consolePresent(PrintConsole* con) {
+//---------------------------------------------------------------------------------
+	// Buffered consoles are only presented by consoleUpdate()
+	if (con->buffered)
+		return;
+
+	gfxFlushBuffers();
+	gfxSwapBuffers();
+	gfxWaitForVsync();
 
-			while(i++ < ((currentConsole->windowHeight * currentConsole->windowWidth) - (rowTemp * currentConsole->consoleWidth + colTemp)))
-				consolePrintChar(' ');
+	// The next framebuffer comes with its own fence
+	g_consoleBatchNumFbs = 0;
+}
 
-			currentConsole->cursorX  = colTemp;
-			currentConsole->cursorY  = rowTemp;
-			break;
+//---------------------------------------------------------------------------------
+static inline int consoleCellRow(PrintConsole* con, int y) {
+//---------------------------------------------------------------------------------
+	// Maps a window row to its row in the cell ring buffer
+	y += con->topRow;
+	if (y >= con->windowHeight)
+		y -= con->windowHeight;
+	return y;
+}
+
+//---------------------------------------------------------------------------------
+static inline u32 consoleFramebuffers(u32 **fbs) {
+//---------------------------------------------------------------------------------
+	// The console draws into every framebuffer, so its output stays on screen whichever one is displayed.
+	// They're looked up once per batch, since they're replaced when the framebuffer resolution changes.
+	// The lookup also waits on the dequeue fence, even with async-dequeue.
+	if (g_consoleBatchDepth == 0)
+		return gfxGetFramebuffers((u8**)fbs);
+
+	if (g_consoleBatchNumFbs == 0)
+		g_consoleBatchNumFbs = gfxGetFramebuffers((u8**)g_consoleBatchFbs);
+
+	memcpy(fbs, g_consoleBatchFbs, g_consoleBatchNumFbs * sizeof(u32*));
+	return g_consoleBatchNumFbs;
+}
+
+//---------------------------------------------------------------------------------
+static inline u32 *consoleTile(u32 *fb, int cx, int cy) {
+//---------------------------------------------------------------------------------
+	// 16x16 pixel tiles are stored as contiguous 1KiB blocks in the block-linear layout
+	return &fb[gfxGetFramebufferDisplayOffset(cx * 16, cy * 16) & ~255];
+}
+
+//---------------------------------------------------------------------------------
+static bool consoleTilesAligned(PrintConsole* con) {
+//---------------------------------------------------------------------------------
+	// With a vertical flip, cells only line up with tiles when the display height is a multiple of 16
+	u32 x = con->windowX * 16;
+	u32 y = con->windowY * 16;
+
+	return (gfxGetFramebufferDisplayOffset(x, y) & ~255) == (gfxGetFramebufferDisplayOffset(x + 15, y + 15) & ~255);
+}
+
+//---------------------------------------------------------------------------------
+static bool consoleScrollTiles(PrintConsole* con, int rows) {
+//---------------------------------------------------------------------------------
+	u32 *fbs[GFX_MAX_FRAMEBUFFERS];
+	u32 numFbs, k;
+	int x, y;
+
+	if (!consoleTilesAligned(con))
+		return false;
+
+	numFbs = consoleFramebuffers(fbs);
+
+	for (k=0; k<numFbs; k++) {
+		for (y=0; y<con->windowHeight-rows; y++) {
+			for (x=0; x<con->windowWidth; x++) {
+				int cx = con->windowX + x;
+				int cy = con->windowY + y;
+
+				memcpy(consoleTile(fbs[k], cx, cy), consoleTile(fbs[k], cx, cy + rows), 16*16*4);
+			}
 		}
-	case '1':
-		{
-			colTemp = currentConsole->cursorX ;
-			rowTemp = currentConsole->cursorY ;
+	}
+
+	return true;
+}
 
-			currentConsole->cursorY  = 0;
-			currentConsole->cursorX  = 0;
+//---------------------------------------------------------------------------------
+static bool consoleGlyphBlank(PrintConsole* con, int c) {
+//---------------------------------------------------------------------------------
+	const u16 *bitmap = consoleGlyphBitmap(con, c);
+	int i;
 
-			while (i++ < (rowTemp * currentConsole->windowWidth + colTemp))
-				consolePrintChar(' ');
+	if (bitmap == NULL)
+		return false;
 
-			currentConsole->cursorX  = colTemp;
-			currentConsole->cursorY  = rowTemp;
-			break;
+	for (i=0; i<16; i++) {
+		if (bitmap[i])
+			return false;
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static void consoleClearCells(PrintConsole* con, int x0, int x1, int y0, int y1) {
+//---------------------------------------------------------------------------------
+	// Clears the cells [x0,x1) of the rows [y0,y1) with the current attributes
+	int fg, bg;
+	int flags = con->flags & (CONSOLE_UNDERLINE | CONSOLE_CROSSED_OUT);
+	int x, y, i;
+
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > con->windowWidth)  x1 = con->windowWidth;
+	if (y1 > con->windowHeight) y1 = con->windowHeight;
+
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	// A print callback still sees the clear as spaces
+	if (con->PrintChar) {
+		int cursorX = con->cursorX;
+		int cursorY = con->cursorY;
+
+		for (y=y0; y<y1; y++) {
+			con->cursorY = y;
+			for (x=x0; x<x1; x++) {
+				con->cursorX = x;
+				if (!con->PrintChar(con, ' '))
+					consoleDrawCursorChar(con, ' ');
+			}
 		}
-	case '2':
-		{
-			currentConsole->cursorY  = 0;
-			currentConsole->cursorX  = 0;
 
-			while(i++ < currentConsole->windowHeight * currentConsole->windowWidth)
-				consolePrintChar(' ');
+		con->cursorX = cursorX;
+		con->cursorY = cursorY;
+		return;
+	}
 
-			currentConsole->cursorY  = 0;
-			currentConsole->cursorX  = 0;
-			break;
+	consoleResolveColors(con, &fg, &bg);
+
+	if (con->buffered) {
+		ConsoleCell blank = { ' ', fg, bg, flags };
+
+		for (y=y0; y<y1; y++) {
+			int row = consoleCellRow(con, y);
+			ConsoleCell *cells = &con->cells[row * con->windowWidth];
+
+			for (x=x0; x<x1; x++)
+				cells[x] = blank;
+
+			con->dirtyRows[row] = 1;
 		}
+		return;
+	}
+
+	// Blank cells are whole tiles of the background color
+	if (!flags && consoleTilesAligned(con) && consoleGlyphBlank(con, ' ')) {
+		u32 *fbs[GFX_MAX_FRAMEBUFFERS];
+		u32 numFbs = consoleFramebuffers(fbs), k;
+		u128 color = colorTable[bg];
+		color |= color << 32;
+		color |= color << 64;
+
+		for (k=0; k<numFbs; k++) {
+			for (y=y0; y<y1; y++) {
+				for (x=x0; x<x1; x++) {
+					u128 *dst = (u128*)consoleTile(fbs[k], con->windowX + x, con->windowY + y);
+
+					for (i=0; i<16*16*4/16; i++)
+						dst[i] = color;
+				}
+			}
+		}
+		return;
+	}
+
+	for (y=y0; y<y1; y++) {
+		for (x=x0; x<x1; x++)
+			consoleDrawGlyph(con, x, y, ' ', fg, bg, flags);
 	}
-	gfxFlushBuffers();
-	gfxSwapBuffers();
-	gfxWaitForVsync();
 }
+
 //---------------------------------------------------------------------------------
-static void consoleClearLine(char mode) {
+static void consoleCls(PrintConsole* con, char mode) {
 //---------------------------------------------------------------------------------
+	int cursorX = con->cursorX;
+	int cursorY = con->cursorY;
+
+	switch (mode)
+	{
+	case '[':
+	case '0':
+		// From the cursor to the end of the window
+		consoleClearCells(con, cursorX, con->windowWidth, cursorY, cursorY + 1);
+		consoleClearCells(con, 0, con->windowWidth, cursorY + 1, con->windowHeight);
+		break;
+	case '1':
+		// From the start of the window to the cursor
+		consoleClearCells(con, 0, con->windowWidth, 0, cursorY);
+		consoleClearCells(con, 0, cursorX + 1, cursorY, cursorY + 1);
+		break;
+	case '2':
+		consoleClearCells(con, 0, con->windowWidth, 0, con->windowHeight);
+		con->cursorY  = 0;
+		con->cursorX  = 0;
+		break;
+	}
+	consolePresent(con);
+}
 
-	int i = 0;
-	int colTemp;
+//---------------------------------------------------------------------------------
+static void consoleClearLine(PrintConsole* con, char mode) {
+//---------------------------------------------------------------------------------
+	int cursorX = con->cursorX;
+	int cursorY = con->cursorY;
 
 	switch (mode)
 	{
 	case '[':
 	case '0':
-		{
-			colTemp = currentConsole->cursorX ;
+		consoleClearCells(con, cursorX, con->windowWidth, cursorY, cursorY + 1);
+		break;
+	case '1':
+		consoleClearCells(con, 0, cursorX + 1, cursorY, cursorY + 1);
+		break;
+	case '2':
+		consoleClearCells(con, 0, con->windowWidth, cursorY, cursorY + 1);
+		break;
+	}
+	consolePresent(con);
+}
+
+//---------------------------------------------------------------------------------
+static inline void consolePosition(PrintConsole* con, int x, int y) {
+//---------------------------------------------------------------------------------
+	// invalid position
+	if(x < 0 || y < 0)
+		return;
+
+	// 1-based, but we'll take a 0
+	if(x < 1)
+		x = 1;
+	if(y < 1)
+		y = 1;
+
+	// clip to console edge
+	if(x > con->windowWidth)
+		x = con->windowWidth;
+	if(y > con->windowHeight)
+		y = con->windowHeight;
+
+	// 1-based adjustment
+	con->cursorX = x - 1;
+	con->cursorY = y - 1;
+}
+
+//---------------------------------------------------------------------------------
+static void consoleDecodeUtf8(PrintConsole* con, u8 chr) {
+//---------------------------------------------------------------------------------
+	if (con->utf8Pending) {
+		if ((chr & 0xC0) == 0x80) {
+			con->utf8Char = (con->utf8Char << 6) | (chr & 0x3F);
+
+			if (--con->utf8Pending == 0) {
+				// The marker bit above the payload tells the sequence length,
+				// anything below the smallest code point of that length is overlong
+				u32 c = con->utf8Char;
+				u32 min;
+
+				if (c & (1 << 21)) {
+					c -= 1 << 21;
+					min = 0x10000;
+				} else if (c & (1 << 16)) {
+					c -= 1 << 16;
+					min = 0x800;
+				} else {
+					c -= 1 << 11;
+					min = 0x80;
+				}
+
+				if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+					c = 0xFFFD;
 
-			while(i++ < (currentConsole->windowWidth - colTemp)) {
-				consolePrintChar(' ');
+				consolePutChar(con, c);
 			}
+			return;
+		}
+
+		// Truncated sequence
+		con->utf8Pending = 0;
+		consolePutChar(con, 0xFFFD);
+	}
+
+	if (chr < 0x80) {
+		consolePutChar(con, chr);
+	} else if ((chr & 0xE0) == 0xC0) {
+		con->utf8Char = 0x20 | (chr & 0x1F);
+		con->utf8Pending = 1;
+	} else if ((chr & 0xF0) == 0xE0) {
+		con->utf8Char = 0x10 | (chr & 0x0F);
+		con->utf8Pending = 2;
+	} else if ((chr & 0xF8) == 0xF0) {
+		con->utf8Char = 0x08 | (chr & 0x07);
+		con->utf8Pending = 3;
+	} else {
+		consolePutChar(con, 0xFFFD);
+	}
+}
+
+// Escape sequence parser states
+enum {
+	ConsoleEsc_Text,   // Printing text
+	ConsoleEsc_Escape, // After ESC
+	ConsoleEsc_Csi,    // Parsing the parameters of a control sequence
+	ConsoleEsc_Ignore, // Skipping an unsupported control sequence up to its final byte
+};
+
+// Character classes of bytes inside a control sequence
+enum {
+	ConsoleChar_Control,
+	ConsoleChar_Digit,
+	ConsoleChar_Separator,
+	ConsoleChar_Private,
+	ConsoleChar_Intermediate,
+	ConsoleChar_Final,
+};
+
+static const u8 consoleCharClass[256] = {
+	[0x00 ... 0x1F] = ConsoleChar_Control,
+	[0x20 ... 0x2F] = ConsoleChar_Intermediate,
+	[0x30 ... 0x39] = ConsoleChar_Digit,
+	[0x3A]          = ConsoleChar_Private,
+	[0x3B]          = ConsoleChar_Separator,
+	[0x3C ... 0x3F] = ConsoleChar_Private,
+	[0x40 ... 0x7E] = ConsoleChar_Final,
+	[0x7F ... 0xFF] = ConsoleChar_Control,
+};
+
+//---------------------------------------------------------------------------------
+static inline int consoleEscParam(PrintConsole* con, int index, int defaultValue) {
+//---------------------------------------------------------------------------------
+	if (index >= con->escNumParams || con->escParams[index] < 0)
+		return defaultValue;
+
+	return con->escParams[index];
+}
+
+//---------------------------------------------------------------------------------
+static void consoleSetGraphicsRendition(PrintConsole* con, int parameter) {
+//---------------------------------------------------------------------------------
+	switch(parameter) {
+	case 0: // reset
+		con->flags = 0;
+		con->bg    = 0;
+		con->fg    = 7;
+		break;
+
+	case 1: // bold
+		con->flags &= ~CONSOLE_COLOR_FAINT;
+		con->flags |= CONSOLE_COLOR_BOLD;
+		break;
+
+	case 2: // faint
+		con->flags &= ~CONSOLE_COLOR_BOLD;
+		con->flags |= CONSOLE_COLOR_FAINT;
+		break;
+
+	case 3: // italic
+		con->flags |= CONSOLE_ITALIC;
+		break;
+
+	case 4: // underline
+		con->flags |= CONSOLE_UNDERLINE;
+		break;
+
+	case 5: // blink slow
+		con->flags &= ~CONSOLE_BLINK_FAST;
+		con->flags |= CONSOLE_BLINK_SLOW;
+		break;
+
+	case 6: // blink fast
+		con->flags &= ~CONSOLE_BLINK_SLOW;
+		con->flags |= CONSOLE_BLINK_FAST;
+		break;
+
+	case 7: // reverse video
+		con->flags |= CONSOLE_COLOR_REVERSE;
+		break;
+
+	case 8: // conceal
+		con->flags |= CONSOLE_CONCEAL;
+		break;
+
+	case 9: // crossed-out
+		con->flags |= CONSOLE_CROSSED_OUT;
+		break;
+
+	case 21: // bold off
+		con->flags &= ~CONSOLE_COLOR_BOLD;
+		break;
+
+	case 22: // normal color
+		con->flags &= ~CONSOLE_COLOR_BOLD;
+		con->flags &= ~CONSOLE_COLOR_FAINT;
+		break;
+
+	case 23: // italic off
+		con->flags &= ~CONSOLE_ITALIC;
+		break;
+
+	case 24: // underline off
+		con->flags &= ~CONSOLE_UNDERLINE;
+		break;
+
+	case 25: // blink off
+		con->flags &= ~CONSOLE_BLINK_SLOW;
+		con->flags &= ~CONSOLE_BLINK_FAST;
+		break;
+
+	case 27: // reverse off
+		con->flags &= ~CONSOLE_COLOR_REVERSE;
+		break;
+
+	case 29: // crossed-out off
+		con->flags &= ~CONSOLE_CROSSED_OUT;
+		break;
+
+	case 30 ... 37: // writing color
+		con->fg = parameter - 30;
+		break;
+
+	case 39: // reset foreground color
+		con->fg = 7;
+		break;
+
+	case 40 ... 47: // screen color
+		con->bg = parameter - 40;
+		break;
+
+	case 49: // reset background color
+		con->bg = 0;
+		break;
+	}
+}
+
+//---------------------------------------------------------------------------------
+static void consoleEscDispatch(PrintConsole* con, char chr) {
+//---------------------------------------------------------------------------------
+	int parameter, i;
+
+	switch (chr) {
+		//---------------------------------------
+		// Cursor directional movement
+		//---------------------------------------
+		case 'A':
+			parameter = consoleEscParam(con, 0, 1);
+			con->cursorY = (con->cursorY - parameter) < 0 ? 0 : con->cursorY - parameter;
+			break;
+		case 'B':
+			parameter = consoleEscParam(con, 0, 1);
+			con->cursorY = (con->cursorY + parameter) > con->windowHeight - 1 ? con->windowHeight - 1 : con->cursorY + parameter;
+			break;
+		case 'C':
+			parameter = consoleEscParam(con, 0, 1);
+			con->cursorX = (con->cursorX + parameter) > con->windowWidth - 1 ? con->windowWidth - 1 : con->cursorX + parameter;
+			break;
+		case 'D':
+			parameter = consoleEscParam(con, 0, 1);
+			con->cursorX = (con->cursorX - parameter) < 0 ? 0 : con->cursorX - parameter;
+			break;
+		//---------------------------------------
+		// Cursor position movement
+		//---------------------------------------
+		case 'H':
+		case 'f':
+			consolePosition(con, consoleEscParam(con, 1, 1), consoleEscParam(con, 0, 1));
+			break;
+		//---------------------------------------
+		// Screen clear
+		//---------------------------------------
+		case 'J':
+			parameter = consoleEscParam(con, 0, 0);
+			if (parameter <= 2)
+				consoleCls(con, '0' + parameter);
+			break;
+		//---------------------------------------
+		// Line clear
+		//---------------------------------------
+		case 'K':
+			parameter = consoleEscParam(con, 0, 0);
+			if (parameter <= 2)
+				consoleClearLine(con, '0' + parameter);
+			break;
+		//---------------------------------------
+		// Save cursor position
+		//---------------------------------------
+		case 's':
+			if (con->escNumParams == 1 && con->escParams[0] < 0) {
+				con->prevCursorX = con->cursorX;
+				con->prevCursorY = con->cursorY;
+			}
+			break;
+		//---------------------------------------
+		// Load cursor position
+		//---------------------------------------
+		case 'u':
+			if (con->escNumParams == 1 && con->escParams[0] < 0) {
+				con->cursorX = con->prevCursorX;
+				con->cursorY = con->prevCursorY;
+			}
+			break;
+		//---------------------------------------
+		// Color scan codes
+		//---------------------------------------
+		case 'm':
+			for (i=0; i<con->escNumParams; i++)
+				consoleSetGraphicsRendition(con, consoleEscParam(con, i, 0));
+			break;
+
+		default:
+			// some sort of unsupported escape; just gloss over it
+			break;
+	}
+}
+
+//---------------------------------------------------------------------------------
+static void consoleWriteText(PrintConsole* con, const char *ptr, size_t len) {
+//---------------------------------------------------------------------------------
+	size_t i;
+
+	// The parser state lives in the console, so sequences may be split across writes
+	for (i=0; i<len; i++) {
+		u8 chr = ptr[i];
+		int *param;
+
+		switch (con->escState) {
+		case ConsoleEsc_Text:
+			if (chr == 0x1b) {
+				// An escape interrupts a partial UTF-8 character
+				if (con->utf8Pending) {
+					con->utf8Pending = 0;
+					consolePutChar(con, 0xFFFD);
+				}
+				con->escState = ConsoleEsc_Escape;
+			} else {
+				consoleDecodeUtf8(con, chr);
+			}
+			continue;
+
+		case ConsoleEsc_Escape:
+			if (chr == '[') {
+				con->escState = ConsoleEsc_Csi;
+				con->escNumParams = 1;
+				con->escParams[0] = -1;
+				continue;
+			}
+
+			// Only control sequences are supported, the byte is printed
+			if (chr != 0x1b) {
+				con->escState = ConsoleEsc_Text;
+				consoleDecodeUtf8(con, chr);
+			}
+			continue;
 
-			currentConsole->cursorX  = colTemp;
+		case ConsoleEsc_Csi:
+			switch (consoleCharClass[chr]) {
+			case ConsoleChar_Digit:
+				param = &con->escParams[con->escNumParams - 1];
+				if (*param < 0)
+					*param = 0;
+				if (*param < 100000)
+					*param = *param * 10 + (chr - '0');
+				continue;
+
+			case ConsoleChar_Separator:
+				if (con->escNumParams < CONSOLE_ESC_MAX_PARAMS)
+					con->escParams[con->escNumParams++] = -1;
+				continue;
+
+			case ConsoleChar_Final:
+				con->escState = ConsoleEsc_Text;
+				consoleEscDispatch(con, chr);
+				continue;
+
+			case ConsoleChar_Private:
+			case ConsoleChar_Intermediate:
+				con->escState = ConsoleEsc_Ignore;
+				continue;
+			}
+			break;
 
+		case ConsoleEsc_Ignore:
+			if (consoleCharClass[chr] == ConsoleChar_Final) {
+				con->escState = ConsoleEsc_Text;
+				continue;
+			}
+			if (consoleCharClass[chr] != ConsoleChar_Control)
+				continue;
 			break;
 		}
-	case '1':
-		{
-			colTemp = currentConsole->cursorX ;
 
-			currentConsole->cursorX  = 0;
+		// A control character cancels the sequence and is handled as text,
+		// unless it starts a new one
+		if (chr == 0x1b) {
+			con->escState = ConsoleEsc_Escape;
+		} else {
+			con->escState = ConsoleEsc_Text;
+			consoleDecodeUtf8(con, chr);
+		}
+	}
+}
+
+#define CONSOLE_STAGING_SIZE 0x4000
+
+// Text attributes and parser state, kept per thread while output is staged
+typedef struct {
+	int fg;
+	int bg;
+	int flags;
+	u32 utf8Char;
+	int utf8Pending;
+	int escState;
+	int escNumParams;
+	int escParams[CONSOLE_ESC_MAX_PARAMS];
+} ConsoleTextState;
+
+// A write waiting in a staging buffer, followed by its bytes
+typedef struct {
+	u64 tick;
+	u32 size;
+	u32 padding;
+} ConsoleStagingRecord;
+
+// Ring buffer of one thread's staged writes to one console. Only the owning
+// thread advances tail and only the drain advances head, so neither side takes
+// a lock. Buffers are never freed: once released by their thread, or once the
+// thread has exited, and drained, the drain hands them back for reuse by
+// clearing owner. Owners are thread IDs, which unlike handles are never reused.
+typedef struct ConsoleStaging {
+	struct ConsoleStaging *next;
+	u64 owner;
+	Handle ownerHandle;
+	PrintConsole *console;
+	bool released;
+	u32 head;
+	u32 tail;
+	u32 drainEnd;
+	ConsoleTextState state;
+	u8 data[CONSOLE_STAGING_SIZE];
+} ConsoleStaging;
+
+static ConsoleStaging *g_consoleStagingList;
+static Mutex g_consoleStagingListMutex;
+static Mutex g_consoleDrainMutex;
+static __thread ConsoleStaging *g_consoleStagingThread;
+
+//---------------------------------------------------------------------------------
+static void consoleSaveTextState(PrintConsole* con, ConsoleTextState *state) {
+//---------------------------------------------------------------------------------
+	state->fg = con->fg;
+	state->bg = con->bg;
+	state->flags = con->flags;
+	state->utf8Char = con->utf8Char;
+	state->utf8Pending = con->utf8Pending;
+	state->escState = con->escState;
+	state->escNumParams = con->escNumParams;
+	memcpy(state->escParams, con->escParams, sizeof(state->escParams));
+}
+
+//---------------------------------------------------------------------------------
+static void consoleLoadTextState(PrintConsole* con, const ConsoleTextState *state) {
+//---------------------------------------------------------------------------------
+	con->fg = state->fg;
+	con->bg = state->bg;
+	con->flags = state->flags;
+	con->utf8Char = state->utf8Char;
+	con->utf8Pending = state->utf8Pending;
+	con->escState = state->escState;
+	con->escNumParams = state->escNumParams;
+	memcpy(con->escParams, state->escParams, sizeof(con->escParams));
+}
+
+//---------------------------------------------------------------------------------
+static void consoleStagingCopyIn(ConsoleStaging *staging, u32 pos, const void *src, u32 size) {
+//---------------------------------------------------------------------------------
+	u32 offset = pos & (CONSOLE_STAGING_SIZE - 1);
+	u32 first = CONSOLE_STAGING_SIZE - offset;
+
+	if (first > size)
+		first = size;
+
+	memcpy(&staging->data[offset], src, first);
+	memcpy(staging->data, (const u8*)src + first, size - first);
+}
+
+//---------------------------------------------------------------------------------
+static void consoleStagingCopyOut(ConsoleStaging *staging, u32 pos, void *dst, u32 size) {
+//---------------------------------------------------------------------------------
+	u32 offset = pos & (CONSOLE_STAGING_SIZE - 1);
+	u32 first = CONSOLE_STAGING_SIZE - offset;
+
+	if (first > size)
+		first = size;
+
+	memcpy(dst, &staging->data[offset], first);
+	memcpy((u8*)dst + first, staging->data, size - first);
+}
+
+//---------------------------------------------------------------------------------
+static void consoleStagingReset(ConsoleStaging *staging) {
+//---------------------------------------------------------------------------------
+	// Threads start out with the default attributes
+	staging->console = NULL;
+	staging->released = false;
+	staging->state.fg = 7;
+	staging->state.bg = 0;
+	staging->state.flags = 0;
+	staging->state.utf8Char = 0;
+	staging->state.utf8Pending = 0;
+	staging->state.escState = ConsoleEsc_Text;
+	staging->state.escNumParams = 0;
+}
+
+//---------------------------------------------------------------------------------
+static bool consoleStagingOwnerExited(ConsoleStaging *staging) {
+//---------------------------------------------------------------------------------
+	u64 id;
+
+	// Once the handle was closed, or reused by another object, the thread is gone
+	if (R_FAILED(svcGetThreadId(&id, staging->ownerHandle)) || id != staging->owner)
+		return true;
+
+	return R_SUCCEEDED(svcWaitSynchronizationSingle(staging->ownerHandle, 0));
+}
+
+//---------------------------------------------------------------------------------
+static ConsoleStaging *consoleStagingAcquire(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	Handle handle = getThreadVars()->handle;
+	ConsoleStaging *staging, *reuse = NULL;
+	u64 owner;
+
+	if (R_FAILED(svcGetThreadId(&owner, handle)))
+		return NULL;
+
+	mutexLock(&g_consoleStagingListMutex);
+
+	for (staging = g_consoleStagingList; staging; staging = staging->next) {
+		u64 stagingOwner = __atomic_load_n(&staging->owner, __ATOMIC_ACQUIRE);
+
+		if (stagingOwner == owner && staging->console == console && !staging->released)
+			break;
+
+		if (stagingOwner == 0 && reuse == NULL)
+			reuse = staging;
+	}
+
+	// Buffers handed back by the drain are already empty and reset
+	if (staging == NULL && reuse != NULL) {
+		staging = reuse;
+		staging->ownerHandle = handle;
+		__atomic_store_n(&staging->console, console, __ATOMIC_RELAXED);
+		__atomic_store_n(&staging->owner, owner, __ATOMIC_RELAXED);
+	}
+
+	if (staging == NULL) {
+		staging = (ConsoleStaging*)malloc(sizeof(ConsoleStaging));
+
+		if (staging != NULL) {
+			staging->head = 0;
+			staging->tail = 0;
+			staging->drainEnd = 0;
+			consoleStagingReset(staging);
+			staging->console = console;
+			staging->ownerHandle = handle;
+			staging->owner = owner;
+
+			// The list only ever grows, so the drain can walk it without the lock
+			staging->next = g_consoleStagingList;
+			__atomic_store_n(&g_consoleStagingList, staging, __ATOMIC_RELEASE);
+		}
+	}
+
+	mutexUnlock(&g_consoleStagingListMutex);
+
+	g_consoleStagingThread = staging;
+	return staging;
+}
+
+//---------------------------------------------------------------------------------
+static void consoleStage(PrintConsole* console, const char *ptr, size_t len) {
+//---------------------------------------------------------------------------------
+	ConsoleStaging *staging = g_consoleStagingThread;
+	ConsoleStagingRecord record;
+
+	// The lock is only taken by a thread's first write to a console
+	if (staging == NULL || staging->console != console) {
+		staging = consoleStagingAcquire(console);
+		if (staging == NULL) {
+			__atomic_fetch_add(&console->stagingDropped, len, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	record.tick = svcGetSystemTick();
+	record.padding = 0;
+
+	// Large writes are split into several records; whatever doesn't fit is dropped
+	while (len > 0) {
+		u32 head = __atomic_load_n(&staging->head, __ATOMIC_ACQUIRE);
+		u32 tail = staging->tail;
+		u32 avail = CONSOLE_STAGING_SIZE - (tail - head);
+
+		if (avail <= sizeof(record)) {
+			__atomic_fetch_add(&console->stagingDropped, len, __ATOMIC_RELAXED);
+			break;
+		}
+
+		record.size = avail - sizeof(record);
+		if (record.size > len)
+			record.size = len;
+
+		consoleStagingCopyIn(staging, tail, &record, sizeof(record));
+		consoleStagingCopyIn(staging, tail + sizeof(record), ptr, record.size);
+		__atomic_store_n(&staging->tail, tail + sizeof(record) + record.size, __ATOMIC_SEQ_CST);
+
+		ptr += record.size;
+		len -= record.size;
+	}
+
+	// Staging was disabled while writing and its last drain may have missed
+	// this output. Either that drain sees the new tail or this thread sees the
+	// flag cleared, since both sides publish before they look.
+	if (!__atomic_load_n(&console->staged, __ATOMIC_SEQ_CST))
+		consoleStagingFinish(console);
+}
+
+//---------------------------------------------------------------------------------
+static void consoleDrainStaging(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	ConsoleStaging *list = __atomic_load_n(&g_consoleStagingList, __ATOMIC_ACQUIRE);
+	ConsoleStaging *staging;
+	ConsoleStagingRecord record;
+
+	mutexLock(&g_consoleDrainMutex);
+	consoleBeginBatch();
+
+	// Only output staged for this console before the drain started is merged,
+	// so busy threads can't starve it. A buffer's console is set before its
+	// first write, so it's visible once the write is.
+	for (staging = list; staging; staging = staging->next) {
+		u32 tail = __atomic_load_n(&staging->tail, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&staging->console, __ATOMIC_RELAXED) == console)
+			staging->drainEnd = tail;
+		else
+			staging->drainEnd = staging->head;
+	}
+
+	for (;;) {
+		ConsoleStaging *next = NULL;
+		u64 nextTick = 0;
+
+		// Merge by picking the oldest pending record of all threads
+		for (staging = list; staging; staging = staging->next) {
+			if (staging->head == staging->drainEnd)
+				continue;
+
+			consoleStagingCopyOut(staging, staging->head, &record, sizeof(record));
+			if (next == NULL || record.tick < nextTick) {
+				next = staging;
+				nextTick = record.tick;
+			}
+		}
+
+		if (next == NULL)
+			break;
+
+		// The console holds the text state of the thread drained last
+		if (next != console->stagingLast) {
+			if (console->stagingLast)
+				consoleSaveTextState(console, &console->stagingLast->state);
+			consoleLoadTextState(console, &next->state);
+			console->stagingLast = next;
+		}
+
+		u32 pos = next->head;
+		consoleStagingCopyOut(next, pos, &record, sizeof(record));
+		pos += sizeof(record);
+
+		// The parser is incremental, so text wrapping around the ring is parsed in two parts
+		while (record.size > 0) {
+			u32 offset = pos & (CONSOLE_STAGING_SIZE - 1);
+			u32 size = CONSOLE_STAGING_SIZE - offset;
+
+			if (size > record.size)
+				size = record.size;
+
+			consoleWriteText(console, (const char*)&next->data[offset], size);
+
+			pos += size;
+			record.size -= size;
+		}
+
+		__atomic_store_n(&next->head, pos, __ATOMIC_RELEASE);
+	}
+
+	// Hand buffers released by their threads back once they are empty. Idle
+	// buffers of threads which exited without releasing them go back as well.
+	for (staging = list; staging; staging = staging->next) {
+		if (__atomic_load_n(&staging->owner, __ATOMIC_ACQUIRE) == 0 || staging->console != console)
+			continue;
+
+		if (staging->head != __atomic_load_n(&staging->tail, __ATOMIC_ACQUIRE))
+			continue;
+
+		if (!__atomic_load_n(&staging->released, __ATOMIC_ACQUIRE) && !consoleStagingOwnerExited(staging))
+			continue;
+
+		if (console->stagingLast == staging)
+			console->stagingLast = NULL;
+
+		consoleStagingReset(staging);
+		__atomic_store_n(&staging->owner, 0, __ATOMIC_RELEASE);
+	}
+
+	consoleEndBatch();
+	mutexUnlock(&g_consoleDrainMutex);
+}
+
+//---------------------------------------------------------------------------------
+static void consoleStagingFinish(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	// Output already staged is still drawn, and the console keeps the
+	// attributes of the last thread drained
+	consoleDrainStaging(console);
+
+	mutexLock(&g_consoleDrainMutex);
+	if (console->stagingLast) {
+		consoleSaveTextState(console, &console->stagingLast->state);
+		console->stagingLast = NULL;
+	}
+	mutexUnlock(&g_consoleDrainMutex);
+}
+
+//---------------------------------------------------------------------------------
+void consoleReleaseStaging(void) {
+//---------------------------------------------------------------------------------
+	ConsoleStaging *staging;
+	u64 owner;
+
+	if (R_FAILED(svcGetThreadId(&owner, getThreadVars()->handle)))
+		return;
+
+	mutexLock(&g_consoleStagingListMutex);
+
+	for (staging = g_consoleStagingList; staging; staging = staging->next) {
+		if (__atomic_load_n(&staging->owner, __ATOMIC_RELAXED) == owner)
+			__atomic_store_n(&staging->released, true, __ATOMIC_RELEASE);
+	}
+
+	mutexUnlock(&g_consoleStagingListMutex);
+
+	g_consoleStagingThread = NULL;
+}
+
+//---------------------------------------------------------------------------------
+u64 consoleGetStagingDropped(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	if (!console) console = currentConsole;
+
+	return __atomic_load_n(&console->stagingDropped, __ATOMIC_RELAXED);
+}
+
+//---------------------------------------------------------------------------------
+static ssize_t con_write(struct _reent *r,void *fd,const char *ptr, size_t len) {
+//---------------------------------------------------------------------------------
+	PrintConsole *console = currentConsole;
+
+	if(!ptr) return -1;
+
+	if(__atomic_load_n(&console->staged, __ATOMIC_ACQUIRE)) {
+		consoleStage(console, ptr, len);
+	} else {
+		consoleBeginBatch();
+		consoleWriteText(console, ptr, len);
+		consoleEndBatch();
+	}
+
+	return len;
+}
+
+static const devoptab_t dotab_stdout = {
+	"con",
+	0,
+	NULL,
+	NULL,
+	con_write,
+	NULL,
+	NULL,
+	NULL
+};
+
+//---------------------------------------------------------------------------------
+static ssize_t debug_write(struct _reent *r, void *fd, const char *ptr, size_t len) {
+//---------------------------------------------------------------------------------
+	svcOutputDebugString(ptr,len);
+	return len;
+}
+
+static const devoptab_t dotab_svc = {
+	"svc",
+	0,
+	NULL,
+	NULL,
+	debug_write,
+	NULL,
+	NULL,
+	NULL
+};
+
+
+static const devoptab_t dotab_null = {
+	"null",
+	0,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+// Consoles holding a cell buffer or staged output. consoleInit only releases
+// those, so it never reads the data of a console which wasn't initialized.
+static PrintConsole **g_consoleLive;
+static int g_consoleLiveCount, g_consoleLiveCapacity;
+
+//---------------------------------------------------------------------------------
+static int consoleLiveFind(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	int i;
+
+	for (i=0; i<g_consoleLiveCount; i++) {
+		if (g_consoleLive[i] == console)
+			return i;
+	}
+
+	return -1;
+}
+
+//---------------------------------------------------------------------------------
+static bool consoleLiveAdd(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	if (consoleLiveFind(console) >= 0)
+		return true;
+
+	if (g_consoleLiveCount == g_consoleLiveCapacity) {
+		int capacity = g_consoleLiveCapacity ? g_consoleLiveCapacity * 2 : 4;
+		PrintConsole **live = (PrintConsole**)realloc(g_consoleLive, capacity * sizeof(PrintConsole*));
+
+		if (!live)
+			return false;
+
+		g_consoleLive = live;
+		g_consoleLiveCapacity = capacity;
+	}
+
+	g_consoleLive[g_consoleLiveCount++] = console;
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static void consoleLiveRemove(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	int i = consoleLiveFind(console);
+
+	if (i < 0 || console->buffered || console->staged)
+		return;
+
+	g_consoleLive[i] = g_consoleLive[--g_consoleLiveCount];
+
+	if (!g_consoleLiveCount) {
+		free(g_consoleLive);
+		g_consoleLive = NULL;
+		g_consoleLiveCapacity = 0;
+	}
+}
+
+//---------------------------------------------------------------------------------
+PrintConsole* consoleInit(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+
+	static bool firstConsoleInit = true;
+
+	if(firstConsoleInit) {
+		devoptab_list[STD_OUT] = &dotab_stdout;
+		devoptab_list[STD_ERR] = &dotab_stdout;
+
+		setvbuf(stdout, NULL , _IONBF, 0);
+		setvbuf(stderr, NULL , _IONBF, 0);
+
+		firstConsoleInit = false;
+	}
+
+	if(console) {
+		currentConsole = console;
+	} else {
+		console = currentConsole;
+	}
+
+	// Reinitializing a console releases its cell buffer, and staged output is drawn
+	if(consoleLiveFind(console) >= 0) {
+		consoleSetStaged(console, false);
+		consoleSetBuffered(console, false);
+	}
+
+	*currentConsole = defaultConsole;
+
+	console->consoleInitialised = 1;
+
+	gfxSetMode(GfxMode_TiledDouble);
+
+	gfxFlushBuffers();
+	gfxSwapBuffers();
+	gfxWaitForVsync();
+
+	// Only kept for existing code reading them
+	u32 *fbs[GFX_MAX_FRAMEBUFFERS];
+	consoleFramebuffers(fbs);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+	console->frameBuffer  = fbs[0];
+	console->frameBuffer2 = fbs[1];
+#pragma GCC diagnostic pop
+
+	consoleCls(console, '2');
+
+	return currentConsole;
+
+}
+
+//---------------------------------------------------------------------------------
+void consoleDebugInit(debugDevice device){
+//---------------------------------------------------------------------------------
+
+	int buffertype = _IONBF;
+
+	switch(device) {
+
+	case debugDevice_SVC:
+		devoptab_list[STD_ERR] = &dotab_svc;
+		buffertype = _IOLBF;
+		break;
+	case debugDevice_CONSOLE:
+		devoptab_list[STD_ERR] = &dotab_stdout;
+		break;
+	case debugDevice_NULL:
+		devoptab_list[STD_ERR] = &dotab_null;
+		break;
+	}
+	setvbuf(stderr, NULL , buffertype, 0);
+
+}
+
+//---------------------------------------------------------------------------------
+PrintConsole *consoleSelect(PrintConsole* console){
+//---------------------------------------------------------------------------------
+	PrintConsole *tmp = currentConsole;
+	currentConsole = console;
+	return tmp;
+}
+
+//---------------------------------------------------------------------------------
+void consoleSetFont(PrintConsole* console, ConsoleFont* font){
+//---------------------------------------------------------------------------------
+
+	if(!console) console = currentConsole;
+
+	console->font = *font;
+
+}
+
+//---------------------------------------------------------------------------------
+static const char *bdfNextLine(const char *p, const char *end) {
+//---------------------------------------------------------------------------------
+	const char *eol = memchr(p, '\n', end - p);
+	return eol ? eol + 1 : end;
+}
+
+//---------------------------------------------------------------------------------
+static bool bdfKeyword(const char **p, const char *end, const char *keyword) {
+//---------------------------------------------------------------------------------
+	size_t len = strlen(keyword);
+
+	if ((size_t)(end - *p) < len || memcmp(*p, keyword, len) != 0)
+		return false;
+
+	if (*p + len < end && (*p)[len] != ' ' && (*p)[len] != '\t' && (*p)[len] != '\r' && (*p)[len] != '\n')
+		return false;
+
+	*p += len;
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static int bdfInt(const char **p, const char *end) {
+//---------------------------------------------------------------------------------
+	const char *s = *p;
+	bool negative = false;
+	int value = 0;
+
+	while (s < end && (*s == ' ' || *s == '\t'))
+		s++;
+
+	if (s < end && *s == '-') {
+		negative = true;
+		s++;
+	}
+
+	while (s < end && *s >= '0' && *s <= '9')
+		value = value * 10 + (*s++ - '0');
+
+	*p = s;
+	return negative ? -value : value;
+}
+
+//---------------------------------------------------------------------------------
+static int bdfGlyphCompare(const void *a, const void *b) {
+//---------------------------------------------------------------------------------
+	u32 ca = ((const ConsoleBdfGlyph*)a)->codepoint;
+	u32 cb = ((const ConsoleBdfGlyph*)b)->codepoint;
+
+	return (ca > cb) - (ca < cb);
+}
+
+//---------------------------------------------------------------------------------
+bool consoleBdfFontInit(ConsoleBdfFont* font, const char* data, size_t size) {
+//---------------------------------------------------------------------------------
+	const char *end = data + size;
+	const char *p = data;
+	const char *glyph = NULL;
+	u32 capacity = 0;
+	int height = 16, yoff = 0;
+
+	memset(font, 0, sizeof(*font));
+
+	if (!bdfKeyword(&p, end, "STARTFONT"))
+		return false;
+
+	// A single pass records where each encoded glyph starts, glyphs are only parsed when drawn
+	for (p = bdfNextLine(p, end); p < end; p = bdfNextLine(p, end)) {
+		const char *line = p;
+
+		if (bdfKeyword(&p, end, "FONTBOUNDINGBOX")) {
+			bdfInt(&p, end);
+			height = bdfInt(&p, end);
+			bdfInt(&p, end);
+			yoff = bdfInt(&p, end);
+		} else if (bdfKeyword(&p, end, "STARTCHAR")) {
+			glyph = line;
+		} else if (glyph && bdfKeyword(&p, end, "ENCODING")) {
+			int codepoint = bdfInt(&p, end);
+
+			// Unencoded glyphs and code point 0 can't be printed
+			if (codepoint <= 0)
+				continue;
+
+			if (font->numGlyphs == capacity) {
+				u32 newCapacity = capacity ? capacity * 2 : 256;
+				ConsoleBdfGlyph *glyphs = (ConsoleBdfGlyph*)realloc(font->glyphs, newCapacity * sizeof(ConsoleBdfGlyph));
+
+				if (glyphs == NULL) {
+					consoleBdfFontExit(font);
+					return false;
+				}
+
+				font->glyphs = glyphs;
+				capacity = newCapacity;
+			}
+
+			font->glyphs[font->numGlyphs].codepoint = codepoint;
+			font->glyphs[font->numGlyphs].offset = glyph - data;
+			font->numGlyphs++;
+			glyph = NULL;
+		}
+	}
+
+	qsort(font->glyphs, font->numGlyphs, sizeof(ConsoleBdfGlyph), bdfGlyphCompare);
+
+	// Center fonts smaller than the cell vertically
+	font->baseline = (height > 16 ? 16 : (16 + height) / 2) + yoff;
+	font->data = data;
+	font->size = size;
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+void consoleBdfFontExit(ConsoleBdfFont* font) {
+//---------------------------------------------------------------------------------
+	consoleGlyphSourceForget(consoleBdfFontGetGlyph, font);
+
+	free(font->glyphs);
+	font->glyphs = NULL;
+	font->numGlyphs = 0;
+}
+
+//---------------------------------------------------------------------------------
+bool consoleBdfFontGetGlyph(void* userdata, u32 codepoint, u16* bitmap) {
+//---------------------------------------------------------------------------------
+	ConsoleBdfFont *font = (ConsoleBdfFont*)userdata;
+	ConsoleBdfGlyph key = { codepoint, 0 };
+	ConsoleBdfGlyph *glyph = (ConsoleBdfGlyph*)bsearch(&key, font->glyphs, font->numGlyphs, sizeof(ConsoleBdfGlyph), bdfGlyphCompare);
+
+	if (glyph == NULL)
+		return false;
+
+	const char *end = font->data + font->size;
+	const char *p = font->data + glyph->offset;
+	int width = 0, height = 0, xoff = 0, yoff = 0;
+	int row, i;
+
+	memset(bitmap, 0, 16 * sizeof(u16));
+
+	for (p = bdfNextLine(p, end); p < end; p = bdfNextLine(p, end)) {
+		if (bdfKeyword(&p, end, "BBX")) {
+			width  = bdfInt(&p, end);
+			height = bdfInt(&p, end);
+			xoff   = bdfInt(&p, end);
+			yoff   = bdfInt(&p, end);
+		} else if (bdfKeyword(&p, end, "BITMAP")) {
+			break;
+		} else if (bdfKeyword(&p, end, "ENDCHAR")) {
+			return false;
+		}
+	}
+
+	if (p >= end)
+		return false;
+
+	// Rows are hex strings with the leftmost pixel in the MSB, clipped to the 16x16 cell
+	row = font->baseline - yoff - height;
+
+	for (p = bdfNextLine(p, end); p < end && height > 0; p = bdfNextLine(p, end), row++, height--) {
+		u32 bits = 0;
+		int digits = 0;
+
+		if (bdfKeyword(&p, end, "ENDCHAR"))
+			break;
+
+		for (i=0; p + i < end && digits < 8; i++) {
+			char c = p[i];
+			int nibble;
+
+			if (c >= '0' && c <= '9') nibble = c - '0';
+			else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+			else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+			else break;
+
+			bits = (bits << 4) | nibble;
+			digits++;
+		}
+
+		// Glyphs without a width have nothing to draw
+		if (row < 0 || row >= 16 || digits == 0 || width <= 0)
+			continue;
+
+		// Align the row to the top of 32 bits, then move it to the glyph's X offset
+		bits <<= 32 - digits * 4;
+		if (width < 32)
+			bits &= ~0u << (32 - width);
+
+		if (xoff >= 32 || xoff <= -32)
+			bits = 0;
+		else if (xoff >= 0)
+			bits >>= xoff;
+		else
+			bits <<= -xoff;
+
+		bitmap[row] = bits >> 16;
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static void newRow(PrintConsole* con) {
+//---------------------------------------------------------------------------------
+
+
+	con->cursorY ++;
 
-			while(i++ < ((currentConsole->windowWidth - colTemp)-2)) {
-				consolePrintChar(' ');
-			}
 
-			currentConsole->cursorX  = colTemp;
+	if(con->cursorY  >= con->windowHeight)  {
+		con->cursorY --;
 
-			break;
-		}
-	case '2':
-		{
-			colTemp = currentConsole->cursorX ;
+		if (con->buffered) {
+			// Bump the ring; the new bottom row reuses the old top row
+			int row = con->topRow;
 
-			currentConsole->cursorX  = 0;
+			con->topRow = consoleCellRow(con, 1);
+			con->dirtyRows[row] = 1;
+			if (con->scrollPending < con->windowHeight)
+				con->scrollPending++;
 
-			while(i++ < currentConsole->windowWidth) {
-				consolePrintChar(' ');
+			consoleClearLine(con, '2');
+			return;
+		}
+
+		if (!consoleScrollTiles(con, 1)) {
+			u32 *fbs[GFX_MAX_FRAMEBUFFERS];
+			u32 numFbs = consoleFramebuffers(fbs), k;
+			int i,j;
+			u32 x, y;
+
+			x = con->windowX * 16;
+			y = con->windowY * 16;
+
+			for (k=0; k<numFbs; k++) {
+				for (i=0; i<con->windowWidth*16; i++) {
+					u32 *from;
+					u32 *to;
+					for (j=0;j<(con->windowHeight-1)*16;j++) {
+						to = &fbs[k][gfxGetFramebufferDisplayOffset(x + i, y + j)];
+						from = &fbs[k][gfxGetFramebufferDisplayOffset(x + i, y + 16 + j)];
+						*to = *from;
+					}
+				}
 			}
+		}
 
-			currentConsole->cursorX  = colTemp;
+		consoleClearLine(con, '2');
+	}
+}
+//---------------------------------------------------------------------------------
+static void consoleResolveColors(PrintConsole* con, int *fg, int *bg) {
+//---------------------------------------------------------------------------------
+	int writingColor = con->fg;
+	int screenColor = con->bg;
 
-			break;
-		}
+	if (con->flags & CONSOLE_COLOR_BOLD) {
+		writingColor += 8;
+	} else if (con->flags & CONSOLE_COLOR_FAINT) {
+		writingColor += 16;
 	}
-	gfxFlushBuffers();
-	gfxSwapBuffers();
-	gfxWaitForVsync();
+
+	if (con->flags & CONSOLE_COLOR_REVERSE) {
+		int tmp = writingColor;
+		writingColor = screenColor;
+		screenColor = tmp;
+	}
+
+	*fg = writingColor;
+	*bg = screenColor;
 }
 
+#define CONSOLE_GLYPH_CACHE_SETS 64
+#define CONSOLE_GLYPH_CACHE_WAYS 4
+
+// A glyph expanded to RGBA8 and already laid out as a block-linear 16x16 tile
+typedef struct {
+	u32 tile[16*16];
+	u64 key;
+	const u16 *font;
+	ConsoleGlyphSource glyphSource;
+	const void *glyphUserdata;
+	u16 asciiOffset;
+	u16 numChars;
+	bool valid;
+	u32 lastUse;
+} ALIGN(16) ConsoleGlyphTile;
+
+static ConsoleGlyphTile *g_consoleGlyphCache;
+static u32 g_consoleGlyphCacheClock;
+
+// Unicode code points of the upper half of the default font, which follows code page 437
+static const u16 consoleCp437[128] = {
+	0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7, 0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+	0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9, 0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+	0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA, 0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+	0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556, 0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+	0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F, 0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+	0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B, 0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+	0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4, 0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+	0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248, 0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0,
+};
+
+#define CONSOLE_ATLAS_MIN_SIZE 256
+#define CONSOLE_ATLAS_SOURCES 4
+
+// A glyph rasterized by a font's glyph source
+typedef struct {
+	u32 codepoint;
+	bool valid;
+	u16 bitmap[16];
+} ConsoleAtlasEntry;
+
+// Open addressed table of the glyphs rasterized by one glyph source, keyed by code point (0 marks a free entry)
+typedef struct {
+	ConsoleGlyphSource source;
+	void *userdata;
+	ConsoleAtlasEntry *entries;
+	u32 size;
+	u32 count;
+	u32 lastUse;
+} ConsoleAtlas;
+
+// One atlas per glyph source, so consoles with different fonts don't evict each other's glyphs.
+// The least recently used one is dropped for a new source.
+static ConsoleAtlas g_consoleAtlases[CONSOLE_ATLAS_SOURCES];
+static u32 g_consoleAtlasClock;
 
 //---------------------------------------------------------------------------------
-static inline void consolePosition(int x, int y) {
+static ConsoleAtlasEntry *consoleAtlasSlot(ConsoleAtlasEntry *atlas, u32 size, u32 codepoint) {
 //---------------------------------------------------------------------------------
-	// invalid position
-	if(x < 0 || y < 0)
-		return;
+	u32 i = (codepoint * 0x9E3779B1) & (size - 1);
 
-	// 1-based, but we'll take a 0
-	if(x < 1)
-		x = 1;
-	if(y < 1)
-		y = 1;
-
-	// clip to console edge
-	if(x > currentConsole->windowWidth)
-		x = currentConsole->windowWidth;
-	if(y > currentConsole->windowHeight)
-		y = currentConsole->windowHeight;
+	while (atlas[i].codepoint != 0 && atlas[i].codepoint != codepoint)
+		i = (i + 1) & (size - 1);
 
-	// 1-based adjustment
-	currentConsole->cursorX = x - 1;
-	currentConsole->cursorY = y - 1;
+	return &atlas[i];
 }
 
 //---------------------------------------------------------------------------------
-static ssize_t con_write(struct _reent *r,void *fd,const char *ptr, size_t len) {
+static bool consoleAtlasGrow(ConsoleAtlas *atlas) {
 //---------------------------------------------------------------------------------
+	u32 size = atlas->size ? atlas->size * 2 : CONSOLE_ATLAS_MIN_SIZE;
+	ConsoleAtlasEntry *entries = (ConsoleAtlasEntry*)calloc(size, sizeof(ConsoleAtlasEntry));
+	u32 i;
 
-	char chr;
-
-	int i, count = 0;
-	char *tmp = (char*)ptr;
-
-	if(!tmp) return -1;
-
-	i = 0;
-
-	while(i<len) {
-
-		chr = *(tmp++);
-		i++; count++;
-
-		if ( chr == 0x1b && *tmp == '[' ) {
-			bool escaping = true;
-			char *escapeseq	= tmp++;
-			int escapelen = 1;
-			i++; count++;
-
-			do {
-				chr = *(tmp++);
-				i++; count++; escapelen++;
-				int parameter, assigned, consumed;
-
-				// make sure parameters are positive values and delimited by semicolon
-				if((chr >= '0' && chr <= '9') || chr == ';')
-					continue;
-
-				switch (chr) {
-					//---------------------------------------
-					// Cursor directional movement
-					//---------------------------------------
-					case 'A':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dA%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorY  =  (currentConsole->cursorY  - parameter) < 0 ? 0 : currentConsole->cursorY  - parameter;
-						escaping = false;
-						break;
-					case 'B':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dB%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorY  =  (currentConsole->cursorY  + parameter) > currentConsole->windowHeight - 1 ? currentConsole->windowHeight - 1 : currentConsole->cursorY  + parameter;
-						escaping = false;
-						break;
-					case 'C':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dC%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorX  =  (currentConsole->cursorX  + parameter) > currentConsole->windowWidth - 1 ? currentConsole->windowWidth - 1 : currentConsole->cursorX  + parameter;
-						escaping = false;
-						break;
-					case 'D':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dD%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorX  =  (currentConsole->cursorX  - parameter) < 0 ? 0 : currentConsole->cursorX  - parameter;
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Cursor position movement
-					//---------------------------------------
-					case 'H':
-					case 'f':
-					{
-						int  x, y;
-						char c;
-						if(sscanf(escapeseq,"[%d;%d%c", &y, &x, &c) == 3 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						x = y = 1;
-						if(sscanf(escapeseq,"[%d;%c", &y, &c) == 2 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						x = y = 1;
-						if(sscanf(escapeseq,"[;%d%c", &x, &c) == 2 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						x = y = 1;
-						if(sscanf(escapeseq,"[;%c", &c) == 1 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						// invalid format
-						escaping = false;
-						break;
-					}
-					//---------------------------------------
-					// Screen clear
-					//---------------------------------------
-					case 'J':
-						if(escapelen <= 3)
-							consoleCls(escapeseq[escapelen-2]);
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Line clear
-					//---------------------------------------
-					case 'K':
-						if(escapelen <= 3)
-							consoleClearLine(escapeseq[escapelen-2]);
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Save cursor position
-					//---------------------------------------
-					case 's':
-						if(escapelen == 2) {
-							currentConsole->prevCursorX  = currentConsole->cursorX ;
-							currentConsole->prevCursorY  = currentConsole->cursorY ;
-						}
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Load cursor position
-					//---------------------------------------
-					case 'u':
-						if(escapelen == 2) {
-							currentConsole->cursorX  = currentConsole->prevCursorX ;
-							currentConsole->cursorY  = currentConsole->prevCursorY ;
-						}
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Color scan codes
-					//---------------------------------------
-					case 'm':
-						escapeseq++;
-						escapelen--;
-
-						do {
-							parameter = 0;
-							if (escapelen == 1) {
-								consumed = 1;
-							} else if (memchr(escapeseq,';',escapelen)) {
-								sscanf(escapeseq,"%d;%n", &parameter, &consumed);
-							} else {
-								sscanf(escapeseq,"%dm%n", &parameter, &consumed);
-							}
-
-							escapeseq += consumed;
-							escapelen -= consumed;
-
-							switch(parameter) {
-							case 0: // reset
-								currentConsole->flags = 0;
-								currentConsole->bg    = 0;
-								currentConsole->fg    = 7;
-								break;
-
-							case 1: // bold
-								currentConsole->flags &= ~CONSOLE_COLOR_FAINT;
-								currentConsole->flags |= CONSOLE_COLOR_BOLD;
-								break;
-
-							case 2: // faint
-								currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
-								currentConsole->flags |= CONSOLE_COLOR_FAINT;
-								break;
-
-							case 3: // italic
-								currentConsole->flags |= CONSOLE_ITALIC;
-								break;
-
-							case 4: // underline
-								currentConsole->flags |= CONSOLE_UNDERLINE;
-								break;
-
-							case 5: // blink slow
-								currentConsole->flags &= ~CONSOLE_BLINK_FAST;
-								currentConsole->flags |= CONSOLE_BLINK_SLOW;
-								break;
-
-							case 6: // blink fast
-								currentConsole->flags &= ~CONSOLE_BLINK_SLOW;
-								currentConsole->flags |= CONSOLE_BLINK_FAST;
-								break;
-
-							case 7: // reverse video
-								currentConsole->flags |= CONSOLE_COLOR_REVERSE;
-								break;
-
-							case 8: // conceal
-								currentConsole->flags |= CONSOLE_CONCEAL;
-								break;
-
-							case 9: // crossed-out
-								currentConsole->flags |= CONSOLE_CROSSED_OUT;
-								break;
-
-							case 21: // bold off
-								currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
-								break;
-
-							case 22: // normal color
-								currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
-								currentConsole->flags &= ~CONSOLE_COLOR_FAINT;
-								break;
-
-							case 23: // italic off
-								currentConsole->flags &= ~CONSOLE_ITALIC;
-								break;
-
-							case 24: // underline off
-								currentConsole->flags &= ~CONSOLE_UNDERLINE;
-								break;
-
-							case 25: // blink off
-								currentConsole->flags &= ~CONSOLE_BLINK_SLOW;
-								currentConsole->flags &= ~CONSOLE_BLINK_FAST;
-								break;
-
-							case 27: // reverse off
-								currentConsole->flags &= ~CONSOLE_COLOR_REVERSE;
-								break;
-
-							case 29: // crossed-out off
-								currentConsole->flags &= ~CONSOLE_CROSSED_OUT;
-								break;
-
-							case 30 ... 37: // writing color
-								currentConsole->fg = parameter - 30;
-								break;
-
-							case 39: // reset foreground color
-								currentConsole->fg = 7;
-								break;
-
-							case 40 ... 47: // screen color
-								currentConsole->bg = parameter - 40;
-								break;
-
-							case 49: // reset background color
-								currentConsole->fg = 0;
-								break;
-							}
-						} while (escapelen > 0);
-
-						escaping = false;
-						break;
-
-					default:
-						// some sort of unsupported escape; just gloss over it
-						escaping = false;
-						break;
-				}
-			} while (escaping);
-			continue;
-		}
+	if (entries == NULL)
+		return false;
 
-		consolePrintChar(chr);
+	for (i=0; i<atlas->size; i++) {
+		if (atlas->entries[i].codepoint != 0)
+			*consoleAtlasSlot(entries, size, atlas->entries[i].codepoint) = atlas->entries[i];
 	}
 
-	return count;
-}
+	free(atlas->entries);
+	atlas->entries = entries;
+	atlas->size = size;
 
-static const devoptab_t dotab_stdout = {
-	"con",
-	0,
-	NULL,
-	NULL,
-	con_write,
-	NULL,
-	NULL,
-	NULL
-};
+	return true;
+}
 
 //---------------------------------------------------------------------------------
-static ssize_t debug_write(struct _reent *r, void *fd, const char *ptr, size_t len) {
+static void consoleAtlasClear(ConsoleAtlas *atlas) {
 //---------------------------------------------------------------------------------
-	svcOutputDebugString(ptr,len);
-	return len;
+	free(atlas->entries);
+	memset(atlas, 0, sizeof(ConsoleAtlas));
 }
 
-static const devoptab_t dotab_svc = {
-	"svc",
-	0,
-	NULL,
-	NULL,
-	debug_write,
-	NULL,
-	NULL,
-	NULL
-};
-
-
-static const devoptab_t dotab_null = {
-	"null",
-	0,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL
-};
-
 //---------------------------------------------------------------------------------
-PrintConsole* consoleInit(PrintConsole* console) {
+static ConsoleAtlas *consoleAtlasGet(PrintConsole* con) {
 //---------------------------------------------------------------------------------
+	ConsoleAtlas *atlas = &g_consoleAtlases[0];
+	int i;
+
+	for (i=0; i<CONSOLE_ATLAS_SOURCES; i++) {
+		if (g_consoleAtlases[i].source == con->font.glyphSource && g_consoleAtlases[i].userdata == con->font.glyphUserdata) {
+			atlas = &g_consoleAtlases[i];
+			atlas->lastUse = ++g_consoleAtlasClock;
+			return atlas;
+		}
 
-	static bool firstConsoleInit = true;
+		if (g_consoleAtlases[i].lastUse < atlas->lastUse)
+			atlas = &g_consoleAtlases[i];
+	}
 
-	if(firstConsoleInit) {
-		devoptab_list[STD_OUT] = &dotab_stdout;
-		devoptab_list[STD_ERR] = &dotab_stdout;
+	consoleAtlasClear(atlas);
+	atlas->source = con->font.glyphSource;
+	atlas->userdata = con->font.glyphUserdata;
+	atlas->lastUse = ++g_consoleAtlasClock;
 
-		setvbuf(stdout, NULL , _IONBF, 0);
-		setvbuf(stderr, NULL , _IONBF, 0);
+	return atlas;
+}
 
-		firstConsoleInit = false;
-	}
+//---------------------------------------------------------------------------------
+static const u16 *consoleAtlasGlyph(PrintConsole* con, u32 codepoint) {
+//---------------------------------------------------------------------------------
+	ConsoleAtlas *atlas = consoleAtlasGet(con);
 
-	if(console) {
-		currentConsole = console;
-	} else {
-		console = currentConsole;
-	}
+	if (atlas->entries) {
+		ConsoleAtlasEntry *entry = consoleAtlasSlot(atlas->entries, atlas->size, codepoint);
 
-	*currentConsole = defaultConsole;
+		if (entry->codepoint == codepoint)
+			return entry->valid ? entry->bitmap : NULL;
+	}
 
-	console->consoleInitialised = 1;
+	// Keep the load factor at or below 1/2
+	if ((atlas->count + 1) * 2 > atlas->size && !consoleAtlasGrow(atlas))
+		return NULL;
 
-	gfxSetMode(GfxMode_TiledDouble);
+	// Missing glyphs are remembered too, so the source is only asked once per code point
+	ConsoleAtlasEntry *entry = consoleAtlasSlot(atlas->entries, atlas->size, codepoint);
 
-	console->frameBuffer  = (u32*)gfxGetFramebuffer(NULL, NULL);
-	gfxSwapBuffers();
-	console->frameBuffer2 = (u32*)gfxGetFramebuffer(NULL, NULL);
+	entry->codepoint = codepoint;
+	entry->valid = con->font.glyphSource(con->font.glyphUserdata, codepoint, entry->bitmap);
+	atlas->count++;
 
-	gfxFlushBuffers();
-	gfxSwapBuffers();
-	gfxWaitForVsync();
+	return entry->valid ? entry->bitmap : NULL;
+}
 
-	consoleCls('2');
+//---------------------------------------------------------------------------------
+static void consoleGlyphSourceForget(ConsoleGlyphSource source, void *userdata) {
+//---------------------------------------------------------------------------------
+	int i;
 
-	return currentConsole;
+	// The user data is going away, and another source can get its address
+	for (i=0; i<CONSOLE_ATLAS_SOURCES; i++) {
+		if (g_consoleAtlases[i].source == source && g_consoleAtlases[i].userdata == userdata)
+			consoleAtlasClear(&g_consoleAtlases[i]);
+	}
 
+	if (g_consoleGlyphCache) {
+		for (i=0; i<CONSOLE_GLYPH_CACHE_SETS * CONSOLE_GLYPH_CACHE_WAYS; i++) {
+			if (g_consoleGlyphCache[i].glyphSource == source && g_consoleGlyphCache[i].glyphUserdata == userdata)
+				g_consoleGlyphCache[i].valid = false;
+		}
+	}
 }
 
 //---------------------------------------------------------------------------------
-void consoleDebugInit(debugDevice device){
+static const u16 *consoleFontGlyph(PrintConsole* con, u32 c) {
 //---------------------------------------------------------------------------------
+	u32 index = c;
+	int i;
 
-	int buffertype = _IONBF;
+	// The upper half of the default font follows code page 437 rather than Latin-1
+	if (c >= 0x80 && con->font.gfx == (u16*)default_font_bin) {
+		for (i=0; i<128 && consoleCp437[i] != c; i++);
 
-	switch(device) {
+		if (i == 128)
+			return NULL;
 
-	case debugDevice_SVC:
-		devoptab_list[STD_ERR] = &dotab_svc;
-		buffertype = _IOLBF;
-		break;
-	case debugDevice_CONSOLE:
-		devoptab_list[STD_ERR] = &dotab_stdout;
-		break;
-	case debugDevice_NULL:
-		devoptab_list[STD_ERR] = &dotab_null;
-		break;
+		index = 0x80 + i;
 	}
-	setvbuf(stderr, NULL , buffertype, 0);
 
+	index -= con->font.asciiOffset;
+	if (index >= con->font.numChars)
+		return NULL;
+
+	return con->font.gfx + (16 * index);
 }
 
 //---------------------------------------------------------------------------------
-PrintConsole *consoleSelect(PrintConsole* console){
+static const u16 *consoleGlyphBitmap(PrintConsole* con, u32 c) {
 //---------------------------------------------------------------------------------
-	PrintConsole *tmp = currentConsole;
-	currentConsole = console;
-	return tmp;
+	const u16 *bitmap = consoleFontGlyph(con, c);
+
+	if (bitmap == NULL && con->font.glyphSource)
+		bitmap = consoleAtlasGlyph(con, c);
+
+	// Characters nothing can draw are shown as '?'
+	if (bitmap == NULL && c != '?')
+		bitmap = consoleGlyphBitmap(con, '?');
+
+	return bitmap;
 }
 
 //---------------------------------------------------------------------------------
-void consoleSetFont(PrintConsole* console, ConsoleFont* font){
+static void consoleExpandGlyph(const u16 *fontdata, int fgIndex, int bgIndex, int flags, u32 *pixels) {
 //---------------------------------------------------------------------------------
+	u32 bg = colorTable[bgIndex];
+	u32 fg = colorTable[fgIndex];
 
-	if(!console) console = currentConsole;
+	int i, j;
 
-	console->font = *font;
+	for (j=0;j<16;j++) {
+		u16 bits = fontdata[j];
+
+		if ((flags & CONSOLE_CROSSED_OUT) && j == 7) bits = 0xffff;
 
+		if ((flags & CONSOLE_UNDERLINE) && j == 15) bits = 0xffff;
+
+		for (i=0;i<16;i++)
+			pixels[j*16 + i] = (bits & (0x8000 >> i)) ? fg : bg;
+	}
 }
 
 //---------------------------------------------------------------------------------
-static void newRow(void) {
+static const u32 *consoleGlyphTile(PrintConsole* con, int c, int fgIndex, int bgIndex, int flags, int x, int y) {
 //---------------------------------------------------------------------------------
+	extern bool g_gfx_drawflip;
 
+	if (g_consoleGlyphCache == NULL) {
+		size_t size = CONSOLE_GLYPH_CACHE_SETS * CONSOLE_GLYPH_CACHE_WAYS * sizeof(ConsoleGlyphTile);
 
-	currentConsole->cursorY ++;
+		g_consoleGlyphCache = (ConsoleGlyphTile*)memalign(16, size);
+		if (g_consoleGlyphCache == NULL)
+			return NULL;
 
+		memset(g_consoleGlyphCache, 0, size);
+	}
 
-	if(currentConsole->cursorY  >= currentConsole->windowHeight)  {
-		currentConsole->cursorY --;
-
-		int i,j;
-		u32 x, y;
+	// The tile layout depends on the flip, so it's part of the key along with the colors
+	u64 key = ((u64)(u32)c << 32) | ((u64)g_gfx_drawflip << 31) | ((u64)flags << 16) | (fgIndex << 8) | bgIndex;
+	u32 set = (u32)((key * 0x9E3779B97F4A7C15ULL) >> 32) % CONSOLE_GLYPH_CACHE_SETS;
 
-		x = currentConsole->windowX * 16;
-		y = currentConsole->windowY * 16;
+	ConsoleGlyphTile *ways = &g_consoleGlyphCache[set * CONSOLE_GLYPH_CACHE_WAYS];
+	ConsoleGlyphTile *victim = ways;
+	int i, j;
 
-		for (i=0; i<currentConsole->windowWidth*16; i++) {
-			u32 *from;
-			u32 *to;
-			for (j=0;j<(currentConsole->windowHeight-1)*16;j++) {
-				to = &currentConsole->frameBuffer[gfxGetFramebufferDisplayOffset(x + i, y + j)];
-				from = &currentConsole->frameBuffer[gfxGetFramebufferDisplayOffset(x + i, y + 16 + j)];
-				*to = *from;
-				to = &currentConsole->frameBuffer2[gfxGetFramebufferDisplayOffset(x + i, y + j)];
-				from = &currentConsole->frameBuffer2[gfxGetFramebufferDisplayOffset(x + i, y + 16 + j)];
-				*to = *from;
-			}
+	// Tiles are only shared by fonts which map code points to the same glyphs
+	for (i=0; i<CONSOLE_GLYPH_CACHE_WAYS; i++) {
+		if (ways[i].valid && ways[i].key == key && ways[i].font == con->font.gfx && ways[i].glyphSource == con->font.glyphSource &&
+			ways[i].glyphUserdata == con->font.glyphUserdata && ways[i].asciiOffset == con->font.asciiOffset && ways[i].numChars == con->font.numChars) {
+			ways[i].lastUse = ++g_consoleGlyphCacheClock;
+			return ways[i].tile;
 		}
 
-		consoleClearLine('2');
+		if (ways[i].lastUse < victim->lastUse)
+			victim = &ways[i];
+	}
+
+	// Miss: replace the least recently used way with the expanded glyph
+	const u16 *bitmap = consoleGlyphBitmap(con, c);
+	if (bitmap == NULL)
+		return NULL;
+
+	u32 pixels[16*16];
+	consoleExpandGlyph(bitmap, fgIndex, bgIndex, flags, pixels);
+
+	for (j=0; j<16; j++) {
+		for (i=0; i<16; i++)
+			victim->tile[gfxGetFramebufferDisplayOffset(x + i, y + j) & 255] = pixels[j*16 + i];
 	}
+
+	victim->key = key;
+	victim->font = con->font.gfx;
+	victim->glyphSource = con->font.glyphSource;
+	victim->glyphUserdata = con->font.glyphUserdata;
+	victim->asciiOffset = con->font.asciiOffset;
+	victim->numChars = con->font.numChars;
+	victim->valid = true;
+	victim->lastUse = ++g_consoleGlyphCacheClock;
+
+	return victim->tile;
 }
+
 //---------------------------------------------------------------------------------
-void consoleDrawChar(int c) {
+static void consoleDrawGlyph(PrintConsole* con, int cx, int cy, int c, int fgIndex, int bgIndex, int flags) {
 //---------------------------------------------------------------------------------
-	c -= currentConsole->font.asciiOffset;
-	if ( c < 0 || c > currentConsole->font.numChars ) return;
+	u32 *fbs[GFX_MAX_FRAMEBUFFERS];
+	u32 numFbs, k;
+	int i, j;
 
-	u16 *fontdata = currentConsole->font.gfx + (16 * c);
+	int x = (cx + con->windowX) * 16;
+	int y = ((cy + con->windowY) *16 );
 
-	int writingColor = currentConsole->fg;
-	int screenColor = currentConsole->bg;
+	if (consoleTilesAligned(con)) {
+		const u32 *tile = consoleGlyphTile(con, c, fgIndex, bgIndex, flags, x, y);
 
-	if (currentConsole->flags & CONSOLE_COLOR_BOLD) {
-		writingColor += 8;
-	} else if (currentConsole->flags & CONSOLE_COLOR_FAINT) {
-		writingColor += 16;
-	}
+		if (tile) {
+			const u128 *src = (const u128*)tile;
 
-	if (currentConsole->flags & CONSOLE_COLOR_REVERSE) {
-		int tmp = writingColor;
-		writingColor = screenColor;
-		screenColor = tmp;
+			numFbs = consoleFramebuffers(fbs);
+			for (k=0; k<numFbs; k++) {
+				u128 *dst = (u128*)consoleTile(fbs[k], cx + con->windowX, cy + con->windowY);
+
+				for (i=0; i<16*16*4/16; i++)
+					dst[i] = src[i];
+			}
+			return;
+		}
 	}
 
-	u32 bg = colorTable[screenColor];
-	u32 fg = colorTable[writingColor];
+	const u16 *bitmap = consoleGlyphBitmap(con, c);
+	if (bitmap == NULL)
+		return;
 
-	u128 *tmp = (u128*)fontdata;
+	u32 pixels[16*16];
+	consoleExpandGlyph(bitmap, fgIndex, bgIndex, flags, pixels);
 
-	u128 bvaltop = tmp[0];
-	u128 bvalbtm = tmp[1];
+	numFbs = consoleFramebuffers(fbs);
+	for (j=0;j<16;j++) {
+		for (i=0;i<16;i++) {
+			uint32_t screenOffset = gfxGetFramebufferDisplayOffset(x + i, y + j);
 
-	if (currentConsole->flags & CONSOLE_UNDERLINE)  bvalbtm |= (u128)0xffffULL << 7*16;
+			for (k=0; k<numFbs; k++)
+				fbs[k][screenOffset] = pixels[j*16 + i];
+		}
+	}
+}
 
-	if (currentConsole->flags & CONSOLE_CROSSED_OUT) bvaltop |= (u128)0xffffULL << 7*16;
+//---------------------------------------------------------------------------------
+static void consoleDrawCursorChar(PrintConsole* con, int c) {
+//---------------------------------------------------------------------------------
+	int fg, bg;
+	int flags = con->flags & (CONSOLE_UNDERLINE | CONSOLE_CROSSED_OUT);
 
-	u16 mask = 0x8000;
+	consoleResolveColors(con, &fg, &bg);
 
-	int i, j;
+	if (con->buffered) {
+		int x = con->cursorX;
+		int y = con->cursorY;
 
-	int x = (currentConsole->cursorX + currentConsole->windowX) * 16;
-	int y = ((currentConsole->cursorY + currentConsole->windowY) *16 );
+		if (x < 0 || x >= con->windowWidth || y < 0 || y >= con->windowHeight)
+			return;
 
-	u32 *screen;
+		y = consoleCellRow(con, y);
 
-	for (i=0;i<16;i++) {
-		for (j=0;j<8;j++) {
-			uint32_t screenOffset = gfxGetFramebufferDisplayOffset(x + i, y + j);
-			screen = &currentConsole->frameBuffer[screenOffset];
-			if (bvaltop >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-			screen = &currentConsole->frameBuffer2[screenOffset];
-			if (bvaltop >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-
-			screenOffset = gfxGetFramebufferDisplayOffset(x + i, y + j + 8);
-			screen = &currentConsole->frameBuffer[screenOffset];
-			if (bvalbtm >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-			screen = &currentConsole->frameBuffer2[screenOffset];
-			if (bvalbtm >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-		}
-		mask >>= 1;
+		ConsoleCell *cell = &con->cells[y * con->windowWidth + x];
+		cell->chr   = c;
+		cell->fg    = fg;
+		cell->bg    = bg;
+		cell->flags = flags;
+		con->dirtyRows[y] = 1;
+		return;
 	}
 
+	consoleDrawGlyph(con, con->cursorX, con->cursorY, c, fg, bg, flags);
 }
 
 //---------------------------------------------------------------------------------
-void consolePrintChar(int c) {
+static void consolePutChar(PrintConsole* con, int c) {
 //---------------------------------------------------------------------------------
 	if (c==0) return;
 
-	if(currentConsole->PrintChar)
-		if(currentConsole->PrintChar(currentConsole, c))
+	if(con->PrintChar)
+		if(con->PrintChar(con, c))
 			return;
 
-	if(currentConsole->cursorX  >= currentConsole->windowWidth) {
-		currentConsole->cursorX  = 0;
+	if(con->cursorX  >= con->windowWidth) {
+		con->cursorX  = 0;
 
-		newRow();
+		newRow(con);
 	}
 
 	switch(c) {
@@ -731,38 +1961,50 @@ void consolePrintChar(int c) {
 		The special escape sequences \b \f & \v are archaic and non-portable.
 		*/
 		case 8:
-			currentConsole->cursorX--;
+			con->cursorX--;
 
-			if(currentConsole->cursorX < 0) {
-				if(currentConsole->cursorY > 0) {
-					currentConsole->cursorX = currentConsole->windowX - 1;
-					currentConsole->cursorY--;
+			if(con->cursorX < 0) {
+				if(con->cursorY > 0) {
+					con->cursorX = con->windowX - 1;
+					con->cursorY--;
 				} else {
-					currentConsole->cursorX = 0;
+					con->cursorX = 0;
 				}
 			}
 
-			consoleDrawChar(' ');
+			consoleDrawCursorChar(con, ' ');
 			break;
 
 		case 9:
-			currentConsole->cursorX  += currentConsole->tabSize - ((currentConsole->cursorX)%(currentConsole->tabSize));
+			con->cursorX  += con->tabSize - ((con->cursorX)%(con->tabSize));
 			break;
 		case 10:
-			newRow();
+			newRow(con);
 		case 13:
-			currentConsole->cursorX  = 0;
-			gfxFlushBuffers();
-			gfxSwapBuffers();
-			gfxWaitForVsync();
+			con->cursorX  = 0;
+			consolePresent(con);
 			break;
 		default:
-			consoleDrawChar(c);
-			++currentConsole->cursorX ;
+			consoleDrawCursorChar(con, c);
+			++con->cursorX ;
 			break;
 	}
 }
 
+//---------------------------------------------------------------------------------
+void consoleDrawChar(int c) {
+//---------------------------------------------------------------------------------
+	consoleDrawCursorChar(currentConsole, c);
+}
+
+//---------------------------------------------------------------------------------
+void consolePrintChar(int c) {
+//---------------------------------------------------------------------------------
+	consoleBeginBatch();
+	consolePutChar(currentConsole, c);
+	consoleEndBatch();
+}
+
 //---------------------------------------------------------------------------------
 void consoleClear(void) {
 //---------------------------------------------------------------------------------
@@ -775,6 +2017,13 @@ void consoleSetWindow(PrintConsole* console, int x, int y, int width, int height
 
 	if(!console) console = currentConsole;
 
+	// The cell buffer is sized for the window, so pending cells are drawn
+	// with the old size before it is reallocated for the new one
+	bool buffered = console->buffered;
+
+	if(buffered)
+		consoleSetBuffered(console, false);
+
 	console->windowWidth = width;
 	console->windowHeight = height;
 	console->windowX = x;
@@ -783,6 +2032,130 @@ void consoleSetWindow(PrintConsole* console, int x, int y, int width, int height
 	console->cursorX = 0;
 	console->cursorY = 0;
 
+	if(buffered)
+		consoleSetBuffered(console, true);
+
+}
+
+//---------------------------------------------------------------------------------
+static void consoleRenderDirty(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	int x, y;
+
+	// Move what is already on screen along with the scrolled rows, unless
+	// the whole window has to be redrawn anyway
+	if (console->scrollPending) {
+		if (console->scrollPending >= console->windowHeight || !consoleScrollTiles(console, console->scrollPending))
+			memset(console->dirtyRows, 1, console->windowHeight);
+
+		console->scrollPending = 0;
+	}
+
+	for (y=0; y<console->windowHeight; y++) {
+		int row = consoleCellRow(console, y);
+
+		if (!console->dirtyRows[row])
+			continue;
+
+		ConsoleCell *cells = &console->cells[row * console->windowWidth];
+
+		for (x=0; x<console->windowWidth; x++)
+			consoleDrawGlyph(console, x, y, cells[x].chr, cells[x].fg, cells[x].bg, cells[x].flags);
+
+		console->dirtyRows[row] = 0;
+	}
+}
+
+//---------------------------------------------------------------------------------
+bool consoleSetBuffered(PrintConsole* console, bool buffered) {
+//---------------------------------------------------------------------------------
+
+	if(!console) console = currentConsole;
+
+	if(console->buffered == buffered)
+		return true;
+
+	if(!buffered) {
+		consoleRenderDirty(console);
+
+		free(console->cells);
+		free(console->dirtyRows);
+		console->cells = NULL;
+		console->dirtyRows = NULL;
+		console->buffered = false;
+		consoleLiveRemove(console);
+		return true;
+	}
+
+	size_t count = console->windowWidth * console->windowHeight;
+
+	console->cells = (ConsoleCell*)malloc(count * sizeof(ConsoleCell));
+	console->dirtyRows = (u8*)malloc(console->windowHeight);
+
+	if(!console->cells || !console->dirtyRows || !consoleLiveAdd(console)) {
+		free(console->cells);
+		free(console->dirtyRows);
+		console->cells = NULL;
+		console->dirtyRows = NULL;
+		return false;
+	}
+
+	ConsoleCell blank = { ' ', 7, 0, 0 };
+	size_t i;
+
+	for (i=0; i<count; i++)
+		console->cells[i] = blank;
+
+	memset(console->dirtyRows, 1, console->windowHeight);
+	console->topRow = 0;
+	console->scrollPending = 0;
+	console->buffered = true;
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+void consoleSetStaged(PrintConsole* console, bool staged) {
+//---------------------------------------------------------------------------------
+
+	if(!console) console = currentConsole;
+
+	if(__atomic_load_n(&console->staged, __ATOMIC_RELAXED) == staged)
+		return;
+
+	// Without room to track the console, its output stays immediate
+	if(staged && !consoleLiveAdd(console))
+		return;
+
+	__atomic_store_n(&console->staged, staged, __ATOMIC_SEQ_CST);
+
+	if(!staged) {
+		consoleStagingFinish(console);
+		consoleLiveRemove(console);
+	}
+
+}
+
+//---------------------------------------------------------------------------------
+void consoleUpdate(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+
+	if(!console) console = currentConsole;
+
+	consoleBeginBatch();
+
+	if(__atomic_load_n(&console->staged, __ATOMIC_ACQUIRE))
+		consoleDrainStaging(console);
+
+	if(console->buffered)
+		consoleRenderDirty(console);
+
+	consoleEndBatch();
+
+	gfxFlushBuffers();
+	gfxSwapBuffers();
+	gfxWaitForVsync();
+
 }
 
 
@@ -105,7 +105,6 @@ static fsdev_fsdevice fsdev_fsdevices[32];
 /*! @endcond */
 
 static char     __cwd[PATH_MAX+1] = "/";
-static __thread char     __fixedpath[PATH_MAX+1];
 
 static fsdev_fsdevice *fsdevFindDevice(const char *name)
 {
@@ -147,69 +146,54 @@ static fsdev_fsdevice *fsdevFindDevice(const char *name)
   return NULL;
 }
 
-static const char*
-fsdev_fixpath(struct _reent *r,
-             const char    *path,
-             fsdev_fsdevice **device)
+static int
+fsdev_getfspath(struct _reent *r,
+               const char     *path,
+               fsdev_fsdevice **device,
+               char           *outpath)
 {
-  ssize_t       units;
-  uint32_t      code;
-  const uint8_t *p = (const uint8_t*)path;
+  ssize_t    units;
+  size_t     cwd_len = 0;
+  const char *colon;
   const char *device_path = path;
 
-  // Move the path pointer to the start of the actual path
-  do
+  // Validate the whole path as UTF-8; this also gives us its length
+  units = utf8_validate((const uint8_t*)path);
+  if(units < 0)
   {
-    units = decode_utf8(&code, p);
-    if(units < 0)
-    {
-      r->_errno = EILSEQ;
-      return NULL;
-    }
-
-    p += units;
-  } while(code != ':' && code != 0);
-
-  // We found a colon; p points to the actual path
-  if(code == ':')
-    path = (const char*)p;
+    r->_errno = EILSEQ;
+    return -1;
+  }
 
-  // Make sure there are no more colons and that the
-  // remainder of the filename is valid UTF-8
-  p = (const uint8_t*)path;
-  do
+  // ':' can't be part of a multi-byte sequence, so plain byte searches are
+  // fine from here on. Move the path pointer to the start of the actual path
+  colon = memchr(path, ':', units);
+  if(colon != NULL)
   {
-    units = decode_utf8(&code, p);
-    if(units < 0)
-    {
-      r->_errno = EILSEQ;
-      return NULL;
-    }
-
-    if(code == ':')
-    {
-      r->_errno = EINVAL;
-      return NULL;
-    }
-
-    p += units;
-  } while(code != 0);
+    units -= colon + 1 - path;
+    path   = colon + 1;
+  }
 
-  if(path[0] == '/')
-    strncpy(__fixedpath, path, PATH_MAX);
-  else
+  // Make sure there are no more colons
+  if(memchr(path, ':', units) != NULL)
   {
-    strncpy(__fixedpath, __cwd, PATH_MAX);
-    strncat(__fixedpath, path, PATH_MAX - strlen(__cwd));
+    r->_errno = EINVAL;
+    return -1;
   }
 
-  if(__fixedpath[PATH_MAX] != 0)
+  if(path[0] != '/')
+    cwd_len = strlen(__cwd);
+
+  if(cwd_len + units >= FS_MAX_PATH)
   {
-    __fixedpath[PATH_MAX] = 0;
     r->_errno = ENAMETOOLONG;
-    return NULL;
+    return -1;
   }
 
+  memcpy(outpath, __cwd, cwd_len);
+  memcpy(outpath + cwd_len, path, units);
+  memset(outpath + cwd_len + units, 0, FS_MAX_PATH - cwd_len - units);
+
   if(device)
   {
     if(path[0] == '/')
@@ -225,32 +209,22 @@ fsdev_fixpath(struct _reent *r,
     if(*device == NULL)
     {
       r->_errno = ENODEV;
-      return NULL;
+      return -1;
     }
   }
 
-  return __fixedpath;
-}
-
-static int
-fsdev_getfspath(struct _reent *r,
-               const char     *path,
-               fsdev_fsdevice **device,
-               char           *outpath)
-{
-  if(fsdev_fixpath(r, path, device) == NULL)
-    return -1;
-
-  memset(outpath, 0, FS_MAX_PATH);
-  strncpy(outpath, __fixedpath, FS_MAX_PATH);
-
   return 0;
 }
 
 static ssize_t fsdev_convertfromfspath(uint8_t *out, uint8_t *in, size_t len)
 {
-  strncpy((char*)out, (char*)in, len);
-  return strnlen((char*)out, len);
+  // The name might not be terminated within len, so don't scan past it
+  ssize_t units = utf8_validate_n(in, len);
+
+  if(units >= 0 && units < len)
+    memcpy(out, in, units + 1);
+
+  return units;
 }
 
 extern int __system_argc;
@@ -370,9 +344,6 @@ Result fsdevCommitDevice(const char *name)
 /*! Initialize SDMC device */
 Result fsdevMountSdmc(void)
 {
-  ssize_t  units;
-  uint32_t code;
-  char     *p;
   Result   rc = 0;
   FsFileSystem fs;
   fsdev_fsdevice *device = NULL;
@@ -398,35 +369,26 @@ Result fsdevMountSdmc(void)
       {
         if(FindDevice(__system_argv[0]) == dev)
         {
-          strncpy(__fixedpath,__system_argv[0],PATH_MAX);
-          if(__fixedpath[PATH_MAX] != 0)
-          {
-            __fixedpath[PATH_MAX] = 0;
-          }
-          else
+          const char *argv0 = __system_argv[0];
+          ssize_t    units  = utf8_validate((const uint8_t*)argv0);
+          const char *path  = strchr(argv0, ':');
+          const char *last_slash = NULL;
+          size_t     offset;
+
+          path = path != NULL ? path + 1 : argv0;
+          if(units >= 0 && units < PATH_MAX)
+            last_slash = strrchr(path, '/');
+
+          // Compose the directory straight into __cwd, without the device
+          // prefix. A relative path is appended to the current "/", and the
+          // trailing slash is kept so the root directory stays "/"
+          if(last_slash != NULL)
           {
-            char *last_slash = NULL;
-            p = __fixedpath;
-            do
-            {
-              units = decode_utf8(&code, (const uint8_t*)p);
-              if(units < 0)
-              {
-                last_slash = NULL;
-                break;
-              }
-
-              if(code == '/')
-                last_slash = p;
-
-              p += units;
-            } while(code != 0);
-
-            if(last_slash != NULL)
-            {
-              last_slash[0] = 0;
-              chdir(__fixedpath);
-            }
+            offset = path[0] == '/' ? 0 : 1;
+            memcpy(__cwd + offset, path, last_slash + 1 - path);
+            __cwd[offset + (last_slash + 1 - path)] = 0;
+            if(chdir(__cwd) != 0)
+              strcpy(__cwd, "/");
           }
         }
       }
@@ -1038,7 +1000,7 @@ fsdev_chdir(struct _reent *r,
   if(R_SUCCEEDED(rc))
   {
     fsDirClose(&fd);
-    strncpy(__cwd, __fixedpath, PATH_MAX);
+    strncpy(__cwd, fs_path, PATH_MAX);
     fsdev_fsdevice_cwd = device->id;
     return 0;
   }
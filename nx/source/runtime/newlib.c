@@ -2,12 +2,14 @@
 #include <errno.h>
 #include <sys/iosupport.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/lock.h>
 #include <sys/reent.h>
 #include "../internal.h"
 #include "types.h"
 #include "runtime/env.h"
 #include "kernel/mutex.h"
+#include "kernel/svc.h"
 #include "services/fatal.h"
 #include "services/time.h"
 #include "result.h"
@@ -28,21 +30,94 @@ static struct _reent* __libnx_get_reent(void) {
     return tv->reent;
 }
 
+/// Frequency of the system tick counter returned by svcGetSystemTick().
+#define SYSTEM_TICK_FREQ 19200000ULL
+
+/// Interval, in system ticks, after which the cached wall-clock sample is refreshed.
+#define REALTIME_RESYNC_TICKS (60*SYSTEM_TICK_FREQ)
+
+static Mutex g_realtimeMutex;
+static bool  g_realtimeValid;
+static u64   g_realtimeBase;
+static u64   g_realtimeBaseTick;
+static u64   g_realtimeSyncTick;
+
+static void _tickToTimespec(u64 tick, struct timespec *tp) {
+    tp->tv_sec  = tick / SYSTEM_TICK_FREQ;
+    tp->tv_nsec = (tick % SYSTEM_TICK_FREQ) * 625 / 12; // 1e9 / 19.2e6 = 625/12
+}
+
 //TODO: timeGetCurrentTime() returns UTC time. How to handle timezones?
 
-int __libnx_gtod(struct _reent *ptr, struct timeval *tp, struct timezone *tz) {
-    if (tp != NULL) {
+static int _getRealtime(struct _reent *ptr, struct timespec *tp) {
+    u64 tick = svcGetSystemTick();
+    u64 base, base_tick;
+
+    mutexLock(&g_realtimeMutex);
+
+    // The time service only has a resolution of seconds and costs an IPC
+    // round-trip, so only sample it occasionally and advance it with the tick.
+    if (!g_realtimeValid || tick - g_realtimeSyncTick >= REALTIME_RESYNC_TICKS) {
         u64 now=0;
-        Result rc=0;
+        Result rc = timeGetCurrentTime(__nx_time_type, &now);
 
-        rc = timeGetCurrentTime(__nx_time_type, &now);
         if (R_FAILED(rc)) {
+            mutexUnlock(&g_realtimeMutex);
             ptr->_errno = EINVAL;
             return -1;
         }
 
-        tp->tv_sec =  now;
-        tp->tv_usec = now*1000000;//timeGetCurrentTime() only returns seconds.
+        if (!g_realtimeValid) {
+            g_realtimeBase     = now;
+            g_realtimeBaseTick = tick;
+            g_realtimeValid    = true;
+        }
+        else {
+            // Move the base up by whole seconds, which keeps the sub-second
+            // phase from the tick. The sample can't tell apart times within
+            // the same second, so only correct the clock when the sample is
+            // in a later second: stepping to the start of the sampled second
+            // is always forward, as the clock reads less than base+1.
+            // A sample more than a second behind means the system clock was
+            // set back, then the clock steps back to the sampled second,
+            // keeping the phase. Callers which can't handle that should use
+            // CLOCK_MONOTONIC.
+            u64 secs = (tick - g_realtimeBaseTick) / SYSTEM_TICK_FREQ;
+
+            g_realtimeBase     += secs;
+            g_realtimeBaseTick += secs * SYSTEM_TICK_FREQ;
+
+            if (now > g_realtimeBase) {
+                g_realtimeBase     = now;
+                g_realtimeBaseTick = tick;
+            }
+            else if (now + 1 < g_realtimeBase) {
+                g_realtimeBase     = now;
+            }
+        }
+
+        g_realtimeSyncTick = tick;
+    }
+
+    base      = g_realtimeBase;
+    base_tick = g_realtimeBaseTick;
+
+    mutexUnlock(&g_realtimeMutex);
+
+    _tickToTimespec(tick - base_tick, tp);
+    tp->tv_sec += base;
+    return 0;
+}
+
+int __libnx_gtod(struct _reent *ptr, struct timeval *tp, struct timezone *tz) {
+    if (tp != NULL) {
+        struct timespec ts;
+
+        if (_getRealtime(ptr, &ts) != 0)
+            return -1;
+
+        tp->tv_sec  = ts.tv_sec;
+        tp->tv_usec = ts.tv_nsec / 1000;
     }
 
     if (tz != NULL) {
@@ -53,6 +128,44 @@ int __libnx_gtod(struct _reent *ptr, struct timeval *tp, struct timezone *tz) {
     return 0;
 }
 
+int clock_gettime(clockid_t clock_id, struct timespec *tp) {
+    struct _reent *ptr = _REENT;
+
+    if (tp == NULL) {
+        ptr->_errno = EINVAL;
+        return -1;
+    }
+
+    switch (clock_id) {
+    case CLOCK_MONOTONIC:
+        _tickToTimespec(svcGetSystemTick(), tp);
+        return 0;
+
+    case CLOCK_REALTIME:
+        return _getRealtime(ptr, tp);
+
+    default:
+        ptr->_errno = EINVAL;
+        return -1;
+    }
+}
+
+int clock_getres(clockid_t clock_id, struct timespec *res) {
+    struct _reent *ptr = _REENT;
+
+    if (clock_id != CLOCK_MONOTONIC && clock_id != CLOCK_REALTIME) {
+        ptr->_errno = EINVAL;
+        return -1;
+    }
+
+    if (res != NULL) {
+        res->tv_sec  = 0;
+        res->tv_nsec = (1000000000ULL + SYSTEM_TICK_FREQ - 1) / SYSTEM_TICK_FREQ;
+    }
+
+    return 0;
+}
+
 int usleep(useconds_t useconds)
 {
     svcSleepThread(useconds * 1000ull);
@@ -1,4 +1,5 @@
 #include "runtime/util/utf.h"
+#include "utf_block.h"
 
 ssize_t
 utf16_to_utf8(uint8_t        *out,
@@ -12,6 +13,26 @@ utf16_to_utf8(uint8_t        *out,
 
   do
   {
+    /* fast path: whole blocks of ASCII */
+    while(utf_block_in_page(in) && utf16_block_is_ascii(in))
+    {
+      if(out != NULL && rc < len)
+      {
+        /* let the slow path fill the tail of the output */
+        if(rc + UTF_BLOCK_SIZE / 2 > len)
+          break;
+
+        utf16_block_to_utf8(out, in);
+        out += UTF_BLOCK_SIZE / 2;
+      }
+
+      if(SSIZE_MAX - (UTF_BLOCK_SIZE / 2) < rc)
+        return -1;
+
+      in += UTF_BLOCK_SIZE / 2;
+      rc += UTF_BLOCK_SIZE / 2;
+    }
+
     units = decode_utf16(&code, in);
     if(units == -1)
       return -1;
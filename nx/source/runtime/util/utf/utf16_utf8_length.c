@@ -0,0 +1,37 @@
+#include "runtime/util/utf.h"
+#include "utf_block.h"
+
+ssize_t
+utf16_utf8_length(const uint16_t *in)
+{
+  ssize_t  rc = 0;
+  ssize_t  units;
+  uint32_t code;
+
+  do
+  {
+    /* fast path: whole blocks of ASCII */
+    while(utf_block_in_page(in) && utf16_block_is_ascii(in))
+    {
+      in += UTF_BLOCK_SIZE / 2;
+      rc += UTF_BLOCK_SIZE / 2;
+    }
+
+    units = decode_utf16(&code, in);
+    if(units == -1)
+      return -1;
+
+    if(code > 0)
+    {
+      in += units;
+
+      units = encode_utf8(NULL, code);
+      if(units == -1)
+        return -1;
+
+      rc += units;
+    }
+  } while(code > 0);
+
+  return rc;
+}
@@ -1,4 +1,5 @@
 #include "runtime/util/utf.h"
+#include "utf_block.h"
 
 ssize_t
 utf8_to_utf16(uint16_t      *out,
@@ -12,6 +13,26 @@ utf8_to_utf16(uint16_t      *out,
 
   do
   {
+    /* fast path: whole blocks of ASCII */
+    while(utf_block_in_page(in) && utf8_block_is_ascii(in))
+    {
+      if(out != NULL && rc < len)
+      {
+        /* let the slow path fill the tail of the output */
+        if(rc + UTF_BLOCK_SIZE > len)
+          break;
+
+        utf8_block_to_utf16(out, in);
+        out += UTF_BLOCK_SIZE;
+      }
+
+      if(SSIZE_MAX - (UTF_BLOCK_SIZE) < rc)
+        return -1;
+
+      in += UTF_BLOCK_SIZE;
+      rc += UTF_BLOCK_SIZE;
+    }
+
     units = decode_utf8(&code, in);
     if(units == -1)
       return -1;
@@ -0,0 +1,34 @@
+#include "runtime/util/utf.h"
+#include "utf_block.h"
+
+ssize_t
+utf8_utf16_length(const uint8_t *in)
+{
+  ssize_t  rc = 0;
+  ssize_t  units;
+  uint32_t code;
+
+  do
+  {
+    /* fast path: whole blocks of ASCII */
+    while(utf_block_in_page(in) && utf8_block_is_ascii(in))
+    {
+      in += UTF_BLOCK_SIZE;
+      rc += UTF_BLOCK_SIZE;
+    }
+
+    units = decode_utf8(&code, in);
+    if(units == -1)
+      return -1;
+
+    if(code > 0)
+    {
+      in += units;
+
+      /* only 4-byte sequences need a surrogate pair */
+      rc += units == 4 ? 2 : 1;
+    }
+  } while(code > 0);
+
+  return rc;
+}
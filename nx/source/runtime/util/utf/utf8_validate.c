@@ -0,0 +1,25 @@
+#include "runtime/util/utf.h"
+#include "utf_block.h"
+
+ssize_t
+utf8_validate(const uint8_t *in)
+{
+  const uint8_t *start = in;
+  ssize_t       units;
+  uint32_t      code;
+
+  do
+  {
+    /* fast path: whole blocks of ASCII */
+    while(utf_block_in_page(in) && utf8_block_is_ascii(in))
+      in += UTF_BLOCK_SIZE;
+
+    units = decode_utf8(&code, in);
+    if(units == -1)
+      return -1;
+
+    in += units;
+  } while(code > 0);
+
+  return in - start - 1;
+}
@@ -0,0 +1,55 @@
+#include "runtime/util/utf.h"
+#include "utf_block.h"
+
+/* Number of bytes decode_utf8 reads for a sequence starting with code1 */
+static inline size_t
+utf8_read_size(uint8_t code1)
+{
+  if(code1 < 0xC2 || code1 >= 0xF5)
+    return 1;
+  if(code1 < 0xE0)
+    return 2;
+  if(code1 < 0xF0)
+    return 3;
+  return 4;
+}
+
+ssize_t
+utf8_validate_n(const uint8_t *in,
+                size_t        len)
+{
+  const uint8_t *start = in;
+  const uint8_t *end   = in + len;
+  uint8_t       tmp[4];
+  ssize_t       units;
+  uint32_t      code;
+
+  do
+  {
+    /* fast path: whole blocks of ASCII, which may not extend past len */
+    while(end - in >= UTF_BLOCK_SIZE && utf8_block_is_ascii(in))
+      in += UTF_BLOCK_SIZE;
+
+    if(in == end)
+      return len;
+
+    /* A sequence cut off by len is decoded from a copy, padded with
+     * continuation bytes which are valid after any lead byte. If the
+     * bytes we have are fine, there's no terminator within len.
+     */
+    if(utf8_read_size(*in) > (size_t)(end - in))
+    {
+      memset(tmp, *in == 0xF4 ? 0x80 : 0xBF, sizeof(tmp));
+      memcpy(tmp, in, end - in);
+      return decode_utf8(&code, tmp) == -1 ? -1 : len;
+    }
+
+    units = decode_utf8(&code, in);
+    if(units == -1)
+      return -1;
+
+    in += units;
+  } while(code > 0);
+
+  return in - start - 1;
+}
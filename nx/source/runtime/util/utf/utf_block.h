@@ -0,0 +1,105 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/* Size in bytes of one fast-path step */
+#define UTF_BLOCK_SIZE 16
+
+#define UTF_SWAR_ONES8   0x0101010101010101ULL
+#define UTF_SWAR_HIGH8   0x8080808080808080ULL
+#define UTF_SWAR_ONES16  0x0001000100010001ULL
+#define UTF_SWAR_HIGH16  0x8000800080008000ULL
+#define UTF_SWAR_ASCII16 0xFF80FF80FF80FF80ULL
+
+/* Non-zero if v contains a zero byte (resp. a zero 16-bit unit) */
+#define UTF_SWAR_HASZERO8(v)  (((v) - UTF_SWAR_ONES8)  & ~(v) & UTF_SWAR_HIGH8)
+#define UTF_SWAR_HASZERO16(v) (((v) - UTF_SWAR_ONES16) & ~(v) & UTF_SWAR_HIGH16)
+
+/* The input strings are null-terminated, so a block may only be loaded
+ * if it does not cross into the next page, which might be unmapped.
+ */
+static inline int
+utf_block_in_page(const void *p)
+{
+  return ((uintptr_t)p & 0xFFF) <= 0x1000 - UTF_BLOCK_SIZE;
+}
+
+/* Returns non-zero if the 16 bytes at in are all in 0x01-0x7F */
+static inline int
+utf8_block_is_ascii(const uint8_t *in)
+{
+#ifdef __ARM_NEON
+  uint8x16_t v = vld1q_u8(in);
+  return vmaxvq_u8(v) < 0x80 && vminvq_u8(v) != 0;
+#else
+  uint64_t a, b;
+  memcpy(&a, in, 8);
+  memcpy(&b, in + 8, 8);
+  return !(((a | b) & UTF_SWAR_HIGH8) | UTF_SWAR_HASZERO8(a) | UTF_SWAR_HASZERO8(b));
+#endif
+}
+
+/* Returns non-zero if the 8 units at in are all in 0x01-0x7F */
+static inline int
+utf16_block_is_ascii(const uint16_t *in)
+{
+#ifdef __ARM_NEON
+  uint16x8_t v = vld1q_u16(in);
+  return vmaxvq_u16(v) < 0x80 && vminvq_u16(v) != 0;
+#else
+  uint64_t a, b;
+  memcpy(&a, in, 8);
+  memcpy(&b, in + 4, 8);
+  return !(((a | b) & UTF_SWAR_ASCII16) | UTF_SWAR_HASZERO16(a) | UTF_SWAR_HASZERO16(b));
+#endif
+}
+
+/* Widens 16 ASCII bytes to UTF-16 */
+static inline void
+utf8_block_to_utf16(uint16_t *out, const uint8_t *in)
+{
+#ifdef __ARM_NEON
+  uint8x16_t v = vld1q_u8(in);
+  vst1q_u16(out,     vmovl_u8(vget_low_u8(v)));
+  vst1q_u16(out + 8, vmovl_high_u8(v));
+#else
+  size_t i;
+  for(i = 0; i < UTF_BLOCK_SIZE; ++i)
+    out[i] = in[i];
+#endif
+}
+
+/* Widens 16 ASCII bytes to UTF-32 */
+static inline void
+utf8_block_to_utf32(uint32_t *out, const uint8_t *in)
+{
+#ifdef __ARM_NEON
+  uint8x16_t v  = vld1q_u8(in);
+  uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+  uint16x8_t hi = vmovl_high_u8(v);
+  vst1q_u32(out,      vmovl_u16(vget_low_u16(lo)));
+  vst1q_u32(out + 4,  vmovl_high_u16(lo));
+  vst1q_u32(out + 8,  vmovl_u16(vget_low_u16(hi)));
+  vst1q_u32(out + 12, vmovl_high_u16(hi));
+#else
+  size_t i;
+  for(i = 0; i < UTF_BLOCK_SIZE; ++i)
+    out[i] = in[i];
+#endif
+}
+
+/* Narrows 8 ASCII UTF-16 units to UTF-8 */
+static inline void
+utf16_block_to_utf8(uint8_t *out, const uint16_t *in)
+{
+#ifdef __ARM_NEON
+  vst1_u8(out, vmovn_u16(vld1q_u16(in)));
+#else
+  size_t i;
+  for(i = 0; i < UTF_BLOCK_SIZE / 2; ++i)
+    out[i] = in[i];
+#endif
+}
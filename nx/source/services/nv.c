@@ -7,12 +7,34 @@
 #include "services/nv.h"
 #include "services/sm.h"
 #include "kernel/tmem.h"
+#include "kernel/mutex.h"
+#include "kernel/detect.h"
 
 static Service g_nvSrv;
 static size_t g_nvIpcBufferSize = 0;
 static u32 g_nvServiceType = -1;
 static TransferMemory g_nvTransfermem;
 
+#define NV_IOCTL_TEMPLATE_WORDS 48
+#define NV_IOCTL_STATS_MAX 32
+
+//One request template per ioctl command: Ioctl (1), Ioctl2 (11) and Ioctl3 (12).
+typedef struct {
+    bool valid;
+    u32 num_words;
+    u32 raw_offset;//Word offset of the raw data, which holds fd and request.
+    u32 static_sizes_offset;//Word offset of the u16 sizes of the receive statics.
+    u32 words[NV_IOCTL_TEMPLATE_WORDS];
+} nvIoctlTemplate;
+
+static nvIoctlTemplate g_nvIoctlTemplates[3];
+static Mutex g_nvIoctlTemplatesMutex;
+
+//Timing per (fd, request) pair. Once the table is full, the last entry sums up all pairs which aren't tracked.
+static nvIoctlStats g_nvIoctlStats[NV_IOCTL_STATS_MAX];
+static size_t g_nvIoctlStatsCount;
+static Mutex g_nvIoctlStatsMutex;
+
 static Result _nvInitialize(Handle proc, Handle sharedmem, u32 transfermem_size);
 static Result _nvSetClientPID(u64 AppletResourceUserId);
 
@@ -47,6 +69,15 @@ Result nvInitialize(nvServiceType servicetype, size_t transfermem_size)
     }
 
     if (R_SUCCEEDED(rc)) {
+        //The templates depend on the pointer buffer size of the session.
+        mutexLock(&g_nvIoctlTemplatesMutex);
+        memset(g_nvIoctlTemplates, 0, sizeof(g_nvIoctlTemplates));
+        mutexUnlock(&g_nvIoctlTemplatesMutex);
+
+        mutexLock(&g_nvIoctlStatsMutex);
+        g_nvIoctlStatsCount = 0;
+        mutexUnlock(&g_nvIoctlStatsMutex);
+
         g_nvIpcBufferSize = 0;
         rc = ipcQueryPointerBufferSize(g_nvSrv.handle, &g_nvIpcBufferSize);
 
@@ -188,62 +219,165 @@ Result nvOpen(u32 *fd, const char *devicepath) {
     return rc;
 }
 
-Result nvIoctl(u32 fd, u32 request, void* argp) {
-    IpcCommand c;
-    ipcInitialize(&c);
+//Fills in a send-static descriptor, same encoding as ipcPrepareHeader.
+static inline void _nvWriteSendStatic(u32 *buf, const void* ptr, size_t size, u8 index) {
+    IpcStaticSendDescriptor* desc = (IpcStaticSendDescriptor*) buf;
 
-    struct {
-        u64 magic;
-        u64 cmd_id;
-        u32 fd;
-        u32 request;
-    } *raw;
+    desc->Addr = (uintptr_t) ptr;
+    desc->Packed = index | (size << 16) | ((((uintptr_t) ptr >> 32) & 15) << 12) | ((((uintptr_t) ptr >> 36) & 15) << 6);
+}
+
+static inline void _nvWriteBuffer(u32 *buf, const void* ptr, size_t size) {
+    IpcBufferDescriptor* desc = (IpcBufferDescriptor*) buf;
+
+    desc->Size = size;
+    desc->Addr = (uintptr_t) ptr;
+    desc->Packed = BufferType_Normal | ((((uintptr_t) ptr >> 32) & 15) << 28) | (((uintptr_t) ptr >> 36) << 2);
+}
+
+static inline void _nvWriteRecvStatic(u32 *buf, const void* ptr, size_t size) {
+    IpcStaticRecvDescriptor* desc = (IpcStaticRecvDescriptor*) buf;
+
+    desc->Addr = (uintptr_t) ptr;
+    desc->Packed = ((uintptr_t) ptr >> 32) | (size << 16);
+}
+
+static inline nvIoctlTemplate* _nvGetIoctlTemplate(u32 cmd_id) {
+    return &g_nvIoctlTemplates[cmd_id == 1 ? 0 : cmd_id - 10];
+}
+
+static void _nvAddIoctlStats(u32 fd, u32 request, u64 ticks) {
+    nvIoctlStats* stats = NULL;
+    size_t i;
+
+    mutexLock(&g_nvIoctlStatsMutex);
+
+    for (i=0; i<g_nvIoctlStatsCount; i++) {
+        if (g_nvIoctlStats[i].fd == fd && g_nvIoctlStats[i].request == request) {
+            stats = &g_nvIoctlStats[i];
+            break;
+        }
+    }
+
+    if (stats == NULL) {
+        if (g_nvIoctlStatsCount < NV_IOCTL_STATS_MAX) {
+            stats = &g_nvIoctlStats[g_nvIoctlStatsCount++];
+            memset(stats, 0, sizeof(*stats));
+            stats->fd = fd;
+            stats->request = request;
+
+            //The last entry is reserved for the pairs which don't fit.
+            if (g_nvIoctlStatsCount == NV_IOCTL_STATS_MAX)
+                stats->fd = stats->request = UINT32_MAX;
+        }
+        else stats = &g_nvIoctlStats[NV_IOCTL_STATS_MAX-1];
+    }
+
+    stats->count++;
+    stats->total_ticks += ticks;
+    if (ticks > stats->max_ticks) stats->max_ticks = ticks;
+
+    mutexUnlock(&g_nvIoctlStatsMutex);
+}
+
+//Each argument buffer is sent both as a buffer and as a static, with the one which isn't used being NULL: statics when the size fits in the pointer buffer, buffers otherwise.
+//The layout of the request only depends on cmd_id, so once a request was built for a command the message is copied from its template, and only the descriptors, fd and request are updated.
+static Result _nvIoctlDispatch(u32 cmd_id, u32 fd, u32 request, void* argp, const void* inbuf, size_t inbuf_size, void* outbuf, size_t outbuf_size) {
+    u32* tls = (u32*)armGetTls();
+    nvIoctlTemplate* t = _nvGetIoctlTemplate(cmd_id);
+    u64 start_tick = svcGetSystemTick();
 
     size_t bufsize = _NV_IOC_SIZE(request);
     u32 dir = _NV_IOC_DIR(request);
 
-    void* buf_send = NULL, *buf_recv = NULL;
-    size_t buf_send_size = 0, buf_recv_size = 0;
+    const void* bufs_send[2] = {NULL, inbuf};
+    void* bufs_recv[2] = {NULL, outbuf};
+    size_t bufs_send_size[2] = {0, inbuf_size};
+    size_t bufs_recv_size[2] = {0, outbuf_size};
+    size_t num_send = cmd_id == 11 ? 2 : 1;
+    size_t num_recv = cmd_id == 12 ? 2 : 1;
+    size_t i;
 
     if(dir & _NV_IOC_WRITE) {
-        buf_send = argp;
-        buf_send_size = bufsize;
+        bufs_send[0] = argp;
+        bufs_send_size[0] = bufsize;
     }
 
     if(dir & _NV_IOC_READ) {
-        buf_recv = argp;
-        buf_recv_size = bufsize;
+        bufs_recv[0] = argp;
+        bufs_recv_size[0] = bufsize;
     }
 
-    void* bufs_send[2] = {buf_send, buf_send};
-    void* bufs_recv[2] = {buf_recv, buf_recv};
-    size_t bufs_send_size[2] = {buf_send_size, buf_send_size};
-    size_t bufs_recv_size[2] = {buf_recv_size, buf_recv_size};
+    bool send_static[2] = {g_nvIpcBufferSize!=0 && bufsize <= g_nvIpcBufferSize, g_nvIpcBufferSize!=0 && inbuf_size <= g_nvIpcBufferSize};
+    bool recv_static[2] = {send_static[0], g_nvIpcBufferSize!=0 && outbuf_size <= g_nvIpcBufferSize};
+
+    struct {
+        u64 magic;
+        u64 cmd_id;
+        u32 fd;
+        u32 request;
+    } *raw;
+
+    mutexLock(&g_nvIoctlTemplatesMutex);
+
+    if (t->valid) {
+        u32* buf = tls + 2;
+        u16* static_sizes = (u16*)(tls + t->static_sizes_offset);
+
+        memcpy(tls, t->words, t->num_words*4);
+
+        raw = (void*)(tls + t->raw_offset);
+        raw->fd = fd;
+        raw->request = request;
+
+        for (i=0; i<num_send; i++, buf+=2)
+            _nvWriteSendStatic(buf, send_static[i] ? bufs_send[i] : NULL, send_static[i] ? bufs_send_size[i] : 0, i);
+
+        for (i=0; i<num_send; i++, buf+=3)
+            _nvWriteBuffer(buf, send_static[i] ? NULL : bufs_send[i], send_static[i] ? 0 : bufs_send_size[i]);
 
-    if(g_nvIpcBufferSize!=0 && bufsize <= g_nvIpcBufferSize) {
-        bufs_send[0] = NULL;
-        bufs_send_size[0] = 0;
-        bufs_recv[0] = NULL;
-        bufs_recv_size[0] = 0;
+        for (i=0; i<num_recv; i++, buf+=3)
+            _nvWriteBuffer(buf, recv_static[i] ? NULL : bufs_recv[i], recv_static[i] ? 0 : bufs_recv_size[i]);
+
+        buf = tls + t->num_words - 2*num_recv;
+
+        for (i=0; i<num_recv; i++, buf+=2) {
+            size_t sz = recv_static[i] ? bufs_recv_size[i] : 0;
+
+            static_sizes[i] = (sz > 0xFFFF) ? 0 : sz;
+            _nvWriteRecvStatic(buf, recv_static[i] ? bufs_recv[i] : NULL, sz);
+        }
     }
     else {
-        bufs_send[1] = NULL;
-        bufs_send_size[1] = 0;
-        bufs_recv[1] = NULL;
-        bufs_recv_size[1] = 0;
-    }
+        IpcCommand c;
+        ipcInitialize(&c);
 
-    ipcAddSendBuffer(&c, bufs_send[0], bufs_send_size[0], 0);
-    ipcAddRecvBuffer(&c, bufs_recv[0], bufs_recv_size[0], 0);
+        for (i=0; i<num_send; i++)
+            ipcAddSendBuffer(&c, send_static[i] ? NULL : bufs_send[i], send_static[i] ? 0 : bufs_send_size[i], 0);
 
-    ipcAddSendStatic(&c, bufs_send[1], bufs_send_size[1], 0);
-    ipcAddRecvStatic(&c, bufs_recv[1], bufs_recv_size[1], 0);
+        for (i=0; i<num_recv; i++)
+            ipcAddRecvBuffer(&c, recv_static[i] ? NULL : bufs_recv[i], recv_static[i] ? 0 : bufs_recv_size[i], 0);
 
-    raw = ipcPrepareHeader(&c, sizeof(*raw));
-    raw->magic = SFCI_MAGIC;
-    raw->cmd_id = 1;
-    raw->fd = fd;
-    raw->request = request;
+        for (i=0; i<num_send; i++)
+            ipcAddSendStatic(&c, send_static[i] ? bufs_send[i] : NULL, send_static[i] ? bufs_send_size[i] : 0, i);
+
+        for (i=0; i<num_recv; i++)
+            ipcAddRecvStatic(&c, recv_static[i] ? bufs_recv[i] : NULL, recv_static[i] ? bufs_recv_size[i] : 0, 0);
+
+        raw = ipcPrepareHeader(&c, sizeof(*raw));
+        raw->magic = SFCI_MAGIC;
+        raw->cmd_id = cmd_id;
+        raw->fd = fd;
+        raw->request = request;
+
+        t->raw_offset = (u32*)raw - tls;
+        t->static_sizes_offset = 2 + 2*num_send + 3*(num_send + num_recv) + sizeof(*raw)/4 + 4;//Same as ipcPrepareHeader, which counts the raw size from before the padding.
+        t->num_words = t->static_sizes_offset + (2*num_recv + 3)/4 + 2*num_recv;
+        memcpy(t->words, tls, t->num_words*4);
+        t->valid = 1;
+    }
+
+    mutexUnlock(&g_nvIoctlTemplatesMutex);
 
     Result rc = serviceIpcDispatch(&g_nvSrv);
 
@@ -263,9 +397,57 @@ Result nvIoctl(u32 fd, u32 request, void* argp) {
             rc = nvConvertError(resp->error);
     }
 
+    _nvAddIoctlStats(fd, request, svcGetSystemTick() - start_tick);
+
     return rc;
 }
 
+Result nvIoctl(u32 fd, u32 request, void* argp) {
+    return _nvIoctlDispatch(1, fd, request, argp, NULL, 0, NULL, 0);
+}
+
+Result nvIoctl2(u32 fd, u32 request, void* argp, const void* inbuf, size_t inbuf_size) {
+    if (!kernelAbove300())
+        return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
+
+    return _nvIoctlDispatch(11, fd, request, argp, inbuf, inbuf_size, NULL, 0);
+}
+
+Result nvIoctl3(u32 fd, u32 request, void* argp, void* outbuf, size_t outbuf_size) {
+    if (!kernelAbove300())
+        return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
+
+    return _nvIoctlDispatch(12, fd, request, argp, NULL, 0, outbuf, outbuf_size);
+}
+
+size_t nvGetIoctlStats(nvIoctlStats* stats, size_t max) {
+    size_t i, count=0;
+
+    mutexLock(&g_nvIoctlStatsMutex);
+
+    for (i=0; i<g_nvIoctlStatsCount && count<max; i++) {
+        if (g_nvIoctlStats[i].count) stats[count++] = g_nvIoctlStats[i];
+    }
+
+    mutexUnlock(&g_nvIoctlStatsMutex);
+
+    return count;
+}
+
+void nvResetIoctlStats(void) {
+    size_t i;
+
+    mutexLock(&g_nvIoctlStatsMutex);
+
+    for (i=0; i<g_nvIoctlStatsCount; i++) {
+        g_nvIoctlStats[i].count = 0;
+        g_nvIoctlStats[i].total_ticks = 0;
+        g_nvIoctlStats[i].max_ticks = 0;
+    }
+
+    mutexUnlock(&g_nvIoctlStatsMutex);
+}
+
 Result nvClose(u32 fd) {
     IpcCommand c;
     ipcInitialize(&c);
@@ -0,0 +1,197 @@
+// Blitter: random operations compared against the same drawing done one pixel at a time with gfxGetFramebufferDisplayOffset.
+#include <stdlib.h>
+#include "test.h"
+#include "switch/types.h"
+#include "switch/result.h"
+#include "switch/gfx/gfx.h"
+#include "switch/gfx/blit.h"
+
+static unsigned g_rand = 5;
+static u16 g_testFontGfx[256*16];
+static PrintConsole g_testConsole;
+
+static u32 *g_shadow;
+static u32 g_width, g_height;
+
+//The blitter's default font, random glyphs here.
+PrintConsole *consoleGetDefault(void) {
+    return &g_testConsole;
+}
+
+//Alpha-blends like the blitter, with the result rounded to nearest.
+static u32 _testBlend(u32 src, u32 dst) {
+    u32 a = src >> 24, out = 0;
+    int i;
+
+    src |= 0xff000000;
+    for (i=0; i<32; i+=8) {
+        u32 t = ((src >> i) & 255) * a + ((dst >> i) & 255) * (255 - a);
+        out |= ((t + ((t + 128) >> 8) + 128) >> 8) << i;
+    }
+    return out;
+}
+
+//Reference drawing of one pixel into the shadow copy of the framebuffer.
+static void _testPut(s32 x, s32 y, u32 color, bool blend) {
+    u32 offset;
+
+    if (x < 0 || y < 0 || x >= (s32)g_width || y >= (s32)g_height) return;
+
+    offset = gfxGetFramebufferDisplayOffset(x, y);
+    g_shadow[offset] = blend ? _testBlend(color, g_shadow[offset]) : color;
+}
+
+static void _testRandomOps(void) {
+    u32 img[64*64], *fb;
+    size_t size = gfxGetFramebufferSize();
+    u32 i, j;
+    int k, op;
+
+    fb = (u32*)gfxGetFramebuffer(&g_width, &g_height);
+    g_shadow = malloc(size);
+    for (i=0; i<size/4; i++) fb[i] = testRand(&g_rand);
+    memcpy(g_shadow, fb, size);
+
+    //Source pixels with all kinds of alpha, including fully transparent and opaque ones.
+    for (i=0; i<64*64; i++) img[i] = testRand(&g_rand);
+    for (i=0; i<64*64; i+=5) img[i] &= 0x00ffffff;
+    for (i=1; i<64*64; i+=7) img[i] |= 0xff000000;
+
+    for (op=0; op<3000; op++) {
+        s32 x = (s32)(testRand(&g_rand) % (g_width + 200)) - 100;
+        s32 y = (s32)(testRand(&g_rand) % (g_height + 200)) - 100;
+        u32 w = testRand(&g_rand) % 64 + 1, h = testRand(&g_rand) % 64 + 1;
+        u32 color = testRand(&g_rand);
+
+        switch (op % 5) {
+        case 0:
+            blitFillRect(x, y, w, h, color);
+            for (j=0; j<h; j++) for (i=0; i<w; i++) _testPut(x+i, y+j, color, false);
+            break;
+
+        case 1:
+            blitCopyRect(x, y, w, h, img, 64);
+            for (j=0; j<h; j++) for (i=0; i<w; i++) _testPut(x+i, y+j, img[j*64 + i], false);
+            break;
+
+        case 2:
+            blitSprite(x, y, w, h, img, 64);
+            for (j=0; j<h; j++) for (i=0; i<w; i++) _testPut(x+i, y+j, img[j*64 + i], true);
+            break;
+
+        case 3: {
+            u32 src_w = w, src_h = h, step_x, step_y;
+            bool blend = testRand(&g_rand) & 1;
+
+            w = testRand(&g_rand) % 200 + 1;
+            h = testRand(&g_rand) % 200 + 1;
+            blitScaled(x, y, w, h, img, 64, src_w, src_h, blend);
+
+            //Nearest-neighbor, sampling at the pixel centers in 16.16 fixed-point.
+            step_x = ((u64)src_w << 16) / w;
+            step_y = ((u64)src_h << 16) / h;
+            for (j=0; j<h; j++) {
+                for (i=0; i<w; i++)
+                    _testPut(x+i, y+j, img[((j*step_y + step_y/2) >> 16)*64 + ((i*step_x + step_x/2) >> 16)], blend);
+            }
+            break;
+        }
+
+        case 4: {
+            char text[8];
+            u32 bg = (testRand(&g_rand) & 1) ? color ^ 0x12345678 : 0x00ffffff;
+
+            for (k=0; k<8; k++) text[k] = testRand(&g_rand);
+            TEST_CHECK(blitTextSpan(x, y, NULL, text, 8, color, bg) == x + 8*16);
+
+            for (k=0; k<8; k++) {
+                for (j=0; j<16; j++) {
+                    for (i=0; i<16; i++) {
+                        if ((g_testFontGfx[(u8)text[k]*16 + j] << i) & 0x8000) _testPut(x + k*16 + i, y+j, color, false);
+                        else if (bg >> 24) _testPut(x + k*16 + i, y+j, bg, false);
+                    }
+                }
+            }
+            break;
+        }
+        }
+    }
+
+    TEST_CHECK(memcmp(fb, g_shadow, size) == 0);
+    free(g_shadow);
+}
+
+static void testBlit(void) {
+    gfxSetMode(GfxMode_TiledDouble);
+
+    _testRandomOps();
+    gfxSetDrawFlip(false);
+    _testRandomOps();
+    gfxSetDrawFlip(true);
+
+    //Clipped to a display size which isn't a multiple of the block size.
+    gfxConfigureResolution(1000, 600);
+    _testRandomOps();
+    gfxConfigureResolution(0, 0);
+}
+
+static void benchBlit(void) {
+    u32 *img, *fb, w, h, x, y;
+    double t;
+    int i;
+
+    fb = (u32*)gfxGetFramebuffer(&w, &h);
+    img = malloc((size_t)w*h*4);
+    for (i=0; i<w*h; i++) img[i] = testRand(&g_rand);
+
+    t = testSeconds();
+    for (i=0; i<20; i++) {
+        for (y=0; y<h; y++) {
+            for (x=0; x<w; x++) fb[gfxGetFramebufferDisplayOffset(x, y)] = img[y*w + x];
+        }
+    }
+    t = testSeconds() - t;
+    printf("bench: %ux%u copy, per-pixel offsets: %.2f ms\n", w, h, t * 1000 / 20);
+
+    t = testSeconds();
+    for (i=0; i<20; i++) blitCopyRect(0, 0, w, h, img, w);
+    t = testSeconds() - t;
+    printf("bench: %ux%u copy, blitCopyRect: %.2f ms\n", w, h, t * 1000 / 20);
+
+    t = testSeconds();
+    for (i=0; i<20; i++) {
+        for (y=0; y<h; y++) {
+            for (x=0; x<w; x++) {
+                u32 offset = gfxGetFramebufferDisplayOffset(x, y);
+                fb[offset] = _testBlend(img[y*w + x], fb[offset]);
+            }
+        }
+    }
+    t = testSeconds() - t;
+    printf("bench: %ux%u alpha-blend, per-pixel offsets: %.2f ms\n", w, h, t * 1000 / 20);
+
+    t = testSeconds();
+    for (i=0; i<20; i++) blitSprite(0, 0, w, h, img, w);
+    t = testSeconds() - t;
+    printf("bench: %ux%u alpha-blend, blitSprite: %.2f ms\n", w, h, t * 1000 / 20);
+
+    free(img);
+}
+
+int main(int argc, char **argv) {
+    int i;
+
+    for (i=0; i<256*16; i++) g_testFontGfx[i] = testRand(&g_rand);
+    g_testConsole.font.gfx = g_testFontGfx;
+    g_testConsole.font.numChars = 256;
+
+    gfxInitDefault();
+
+    testBlit();
+
+    if (testBenchEnabled(argc, argv))
+        benchBlit();
+
+    gfxExit();
+    return testResult("blit");
+}
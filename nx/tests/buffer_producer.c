@@ -0,0 +1,177 @@
+// The kept DequeueBuffer/QueueBuffer parcels send the same requests as parcels built from scratch, with a fake binder transaction.
+#include <stdlib.h>
+#include "test.h"
+#include "gfx/parcel.c"
+#include "gfx/buffer_producer.c"
+
+static u8 g_testRequest[0x400];
+static size_t g_testRequestSize;
+static u32 g_testRequestCode;
+static u8 g_testDequeueReply[0x400], g_testQueueReply[0x400];
+
+Result binderTransactParcel(Binder *session, u32 code, void* parcel_data, size_t parcel_data_size, void* parcel_reply, size_t parcel_reply_size, u32 flags) {
+    const u8 *reply = code == DEQUEUE_BUFFER ? g_testDequeueReply : g_testQueueReply;
+
+    memcpy(g_testRequest, parcel_data, parcel_data_size);
+    g_testRequestSize = parcel_data_size;
+    g_testRequestCode = code;
+    memcpy(parcel_reply, reply, parcel_reply_size < sizeof(g_testQueueReply) ? parcel_reply_size : sizeof(g_testQueueReply));
+    return 0;
+}
+
+void mutexLock(Mutex* m) {
+    while (__atomic_exchange_n(m, 1, __ATOMIC_ACQUIRE));
+}
+
+void mutexUnlock(Mutex* m) {
+    __atomic_store_n(m, 0, __ATOMIC_RELEASE);
+}
+
+static void _testSetReply(u8 *reply, const void *payload, u32 size) {
+    u32 *header = (u32*)reply;
+
+    memset(reply, 0x5a, sizeof(g_testQueueReply));
+    header[0] = size;
+    header[1] = PARCEL_HEADER_SIZE;
+    header[2] = 0;
+    header[3] = PARCEL_HEADER_SIZE + size;
+    memcpy(&reply[PARCEL_HEADER_SIZE], payload, size);
+}
+
+//Replies with slot 2 and a fence for DequeueBuffer, and with the queue state for QueueBuffer.
+static void _testSetReplies(void) {
+    u32 dequeue[3 + 2 + sizeof(bufferProducerFence)/4] = {2, 1, sizeof(bufferProducerFence), 0, 1, 7, 100, 0xffffffff};
+    u32 queue[5] = {1280, 720, 0, 1, 0};
+
+    _testSetReply(g_testDequeueReply, dequeue, sizeof(dequeue));
+    _testSetReply(g_testQueueReply, queue, sizeof(queue));
+}
+
+//Copy of the last request.
+typedef struct {
+    u32 code;
+    size_t size;
+    u8 data[0x400];
+} TestRequest;
+
+static void _testSaveRequest(TestRequest *req) {
+    req->code = g_testRequestCode;
+    req->size = g_testRequestSize;
+    memcpy(req->data, g_testRequest, g_testRequestSize);
+}
+
+static bool _testRequestsEqual(const TestRequest *a, const TestRequest *b) {
+    return a->code == b->code && a->size == b->size && memcmp(a->data, b->data, a->size) == 0;
+}
+
+//The requests like they're built from scratch for every call, as by the other buffer producer commands.
+static void _testPlainDequeue(Binder *binder, bool async, u32 width, u32 height, s32 format, u32 usage) {
+    static Parcel parcel, reply;
+
+    parcelInitialize(&parcel);
+    parcelInitialize(&reply);
+    parcelWriteInterfaceToken(&parcel, "android.gui.IGraphicBufferProducer");
+    parcelWriteInt32(&parcel, async);
+    parcelWriteUInt32(&parcel, width);
+    parcelWriteUInt32(&parcel, height);
+    parcelWriteInt32(&parcel, format);
+    parcelWriteUInt32(&parcel, usage);
+    parcelTransact(binder, DEQUEUE_BUFFER, &parcel, &reply);
+}
+
+static void _testPlainQueue(Binder *binder, s32 buf, bufferProducerQueueBufferInput *input) {
+    static Parcel parcel, reply;
+
+    parcelInitialize(&parcel);
+    parcelInitialize(&reply);
+    parcelWriteInterfaceToken(&parcel, "android.gui.IGraphicBufferProducer");
+    parcelWriteInt32(&parcel, buf);
+    parcelWriteFlattenedObject(&parcel, input, sizeof(bufferProducerQueueBufferInput));
+    parcelTransact(binder, QUEUE_BUFFER, &parcel, &reply);
+}
+
+//Repeated calls with varying arguments, interleaved with other commands and a reinitialization, send the same bytes as the plain encoder.
+static void testRequests(void) {
+    bufferProducerQueueBufferInput input;
+    bufferProducerQueueBufferOutput output;
+    bufferProducerFence fence;
+    TestRequest kept, plain;
+    Binder binder, other;
+    unsigned seed = 5;
+    s32 slot, value;
+    int i, j, mismatches = 0;
+
+    _testSetReplies();
+    bufferProducerInitialize(&binder);
+
+    for (i=0; i<200; i++) {
+        bool async = testRand(&seed) & 1;
+        u32 width = testRand(&seed) % 4096, height = testRand(&seed) % 4096, usage = testRand(&seed);
+        s32 format = testRand(&seed) % 8;
+
+        //The parcels are prepared again for another session.
+        if (i == 100) bufferProducerInitialize(&other);
+
+        TEST_CHECK(R_SUCCEEDED(bufferProducerDequeueBuffer(async, width, height, format, usage, &slot, &fence)));
+        _testSaveRequest(&kept);
+        _testPlainDequeue(&binder, async, width, height, format, usage);
+        _testSaveRequest(&plain);
+        mismatches += !_testRequestsEqual(&kept, &plain);
+        TEST_CHECK(slot == 2 && fence.is_valid == 1 && fence.nv_fences[0].id == 7 && fence.nv_fences[0].value == 100);
+
+        for (j=0; j<sizeof(input); j++) ((u8*)&input)[j] = testRand(&seed);
+        TEST_CHECK(R_SUCCEEDED(bufferProducerQueueBuffer(slot, &input, &output)));
+        _testSaveRequest(&kept);
+        _testPlainQueue(&binder, slot, &input);
+        _testSaveRequest(&plain);
+        mismatches += !_testRequestsEqual(&kept, &plain);
+        TEST_CHECK(output.width == 1280 && output.height == 720 && output.numPendingBuffers == 1);
+
+        //Commands using their own parcels don't disturb the kept ones.
+        if (i % 10 == 0) bufferProducerQuery(i, &value);
+    }
+
+    TEST_CHECK(mismatches == 0);
+    bufferProducerExit();
+}
+
+static void benchBufferProducer(void) {
+    bufferProducerQueueBufferInput input;
+    bufferProducerQueueBufferOutput output;
+    bufferProducerFence fence;
+    Binder binder;
+    s32 slot;
+    double t;
+    int i;
+
+    _testSetReplies();
+    bufferProducerInitialize(&binder);
+    memset(&input, 0, sizeof(input));
+
+    t = testSeconds();
+    for (i=0; i<1000000; i++) {
+        bufferProducerQueueBuffer(i & 1, &input, &output);
+        bufferProducerDequeueBuffer(false, 1280, 720, 0, 0x300, &slot, &fence);
+    }
+    t = testSeconds() - t;
+    printf("bench: queue+dequeue, kept parcels: %.0f ns\n", t * 1e9 / 1000000);
+
+    t = testSeconds();
+    for (i=0; i<1000000; i++) {
+        _testPlainQueue(&binder, i & 1, &input);
+        _testPlainDequeue(&binder, false, 1280, 720, 0, 0x300);
+    }
+    t = testSeconds() - t;
+    printf("bench: queue+dequeue, plain parcels: %.0f ns\n", t * 1e9 / 1000000);
+
+    bufferProducerExit();
+}
+
+int main(int argc, char **argv) {
+    testRequests();
+
+    if (testBenchEnabled(argc, argv))
+        benchBufferProducer();
+
+    return testResult("buffer_producer");
+}
@@ -0,0 +1,738 @@
+// The console on the host gfx backend: buffered output against immediate output, presents, window changes and reinitialization.
+#include <stdlib.h>
+#include <malloc.h>
+#include <pthread.h>
+#include "test.h"
+
+//Number of live heap blocks allocated by the console.
+static int g_testAllocs;
+
+static void *testAlloc(void *ptr) {
+    if (ptr) g_testAllocs++;
+    return ptr;
+}
+
+static void *testRealloc(void *ptr, size_t size) {
+    void *ret = realloc(ptr, size);
+
+    if (ptr == NULL && ret) g_testAllocs++;
+    return ret;
+}
+
+static void testFree(void *ptr) {
+    if (ptr) g_testAllocs--;
+    free(ptr);
+}
+
+#define malloc(size) testAlloc(malloc(size))
+#define calloc(count, size) testAlloc(calloc(count, size))
+#define memalign(align, size) testAlloc(memalign(align, size))
+#define realloc(ptr, size) testRealloc(ptr, size)
+#define free(ptr) testFree(ptr)
+
+//Number of framebuffer lookups by the console.
+static int g_testFramebufferLookups;
+#define gfxGetFramebuffers testGetFramebuffers
+
+#define iprintf printf
+#include "runtime/devices/console.c"
+
+#undef malloc
+#undef calloc
+#undef memalign
+#undef realloc
+#undef free
+#undef gfxGetFramebuffers
+
+u32 gfxGetFramebuffers(u8 **framebufs);
+
+u32 testGetFramebuffers(u8 **framebufs) {
+    g_testFramebufferLookups++;
+    return gfxGetFramebuffers(framebufs);
+}
+#include "switch/gfx/gfx_host.h"
+
+const devoptab_t *devoptab_list[STD_MAX];
+
+Result svcOutputDebugString(const char *str, u64 size) {
+    return 0;
+}
+
+void mutexLock(Mutex* m) {
+    while (__atomic_exchange_n(m, 1, __ATOMIC_ACQUIRE));
+}
+
+void mutexUnlock(Mutex* m) {
+    __atomic_store_n(m, 0, __ATOMIC_RELEASE);
+}
+
+//Each test thread is an emulated kernel thread, which the staging code tells apart by thread ID.
+static void _testThreadEnter(void) {
+    getThreadVars()->handle = gfxHostThreadCreate();
+}
+
+static void _testThreadExit(void) {
+    gfxHostThreadExit(getThreadVars()->handle);
+}
+
+static unsigned g_rand = 3;
+
+//Random text with newlines, tabs and escape sequences, ending with a newline.
+static char *_testGenText(size_t size) {
+    static const char *esc[] = {
+        "\x1b[31;1m", "\x1b[0m", "\x1b[44m", "\x1b[7m", "\x1b[2K", "\x1b[4m", "\x1b[24m", "\x1b[5;10H",
+        "\x1b[3A", "\x1b[2C", "\x1b[0J", "\x1b[1K", "\x1b[s", "\x1b[u", "\x1b[32m", "\x1b[;H",
+    };
+    char *text = malloc(size + 1);
+    size_t i = 0;
+
+    while (i < size - 16) {
+        unsigned r = testRand(&g_rand) % 100;
+
+        if (r < 6) text[i++] = '\n';
+        else if (r < 8) {
+            const char *e = esc[testRand(&g_rand) % 16];
+            memcpy(text + i, e, strlen(e));
+            i += strlen(e);
+        }
+        else if (r < 9) text[i++] = '\t';
+        else text[i++] = 32 + testRand(&g_rand) % 95;
+    }
+    text[i++] = '\n';
+    text[i] = 0;
+    return text;
+}
+
+static u32 *_testGetFrame(void) {
+    u32 w, h, *px;
+
+    if (!gfxHostGetFrame(NULL, &w, &h)) return NULL;
+    px = malloc((size_t)w*h*4);
+    gfxHostGetFrame(px, NULL, NULL);
+    return px;
+}
+
+//Number of frames presented so far.
+static u64 _testFrameCount(void) {
+    GfxFrameStats stats;
+
+    return gfxGetFrameStats(&stats, 1) ? stats.frame + 1 : 0;
+}
+
+static bool _testFramesEqual(const u32 *a, const u32 *b) {
+    u32 w, h;
+
+    gfxHostGetFrame(NULL, &w, &h);
+    return a && b && memcmp(a, b, (size_t)w*h*4) == 0;
+}
+
+//Whether anything but the default background is drawn in a cell of the frame.
+static bool _testCellDrawn(const u32 *px, u32 width, int cx, int cy) {
+    int x, y;
+
+    for (y=0; y<16; y++) {
+        for (x=0; x<16; x++) {
+            if (px[(cy*16 + y)*width + cx*16 + x] != colorTable[0]) return true;
+        }
+    }
+    return false;
+}
+
+static void _testWrite(const char *text, size_t chunk) {
+    size_t pos, len = strlen(text);
+
+    for (pos=0; pos<len; pos+=chunk)
+        con_write(NULL, NULL, text + pos, len - pos < chunk ? len - pos : chunk);
+}
+
+//Buffered output ends up on screen exactly like immediate output, but is only presented by consoleUpdate.
+static void testBuffered(void) {
+    static PrintConsole con;
+    char *text = _testGenText(20000);
+    u32 *immediate, *buffered;
+    u64 frames;
+
+    //Immediate output is presented on every line.
+    consoleInit(&con);
+    frames = _testFrameCount();
+    _testWrite(text, 997);
+    TEST_CHECK(_testFrameCount() - frames > 100);
+    consoleUpdate(&con);
+    immediate = _testGetFrame();
+
+    consoleInit(&con);
+    TEST_CHECK(consoleSetBuffered(&con, true));
+    frames = _testFrameCount();
+    _testWrite(text, 997);
+    TEST_CHECK(_testFrameCount() == frames);
+    consoleUpdate(&con);
+    TEST_CHECK(_testFrameCount() == frames + 1);
+    buffered = _testGetFrame();
+
+    TEST_CHECK(_testFramesEqual(immediate, buffered));
+
+    free(text);
+    free(immediate);
+    free(buffered);
+}
+
+//Escape sequences and UTF-8 split across writes are parsed like whole ones.
+static void testSplitWrites(void) {
+    static PrintConsole con;
+    char *text = _testGenText(4000);
+    u32 *whole, *split;
+
+    consoleInit(&con);
+    consoleSetBuffered(&con, true);
+    _testWrite("\xc3\xa9\x1b[31m", 64);
+    _testWrite(text, 4000);
+    consoleUpdate(&con);
+    whole = _testGetFrame();
+
+    consoleInit(&con);
+    consoleSetBuffered(&con, true);
+    _testWrite("\xc3\xa9\x1b[31m", 1);
+    _testWrite(text, 1);
+    consoleUpdate(&con);
+    split = _testGetFrame();
+
+    TEST_CHECK(_testFramesEqual(whole, split));
+
+    free(text);
+    free(whole);
+    free(split);
+}
+
+//A buffered console keeps working when its window grows, and the cells follow the new size.
+static void testSetWindow(void) {
+    static PrintConsole con;
+    u32 *px, w;
+
+    consoleInit(&con);
+    consoleSetWindow(&con, 10, 10, 20, 10);
+    TEST_CHECK(consoleSetBuffered(&con, true));
+    _testWrite("small window", 64);
+
+    consoleSetWindow(&con, 0, 0, 80, 45);
+    TEST_CHECK(con.buffered && con.windowHeight == 45);
+    _testWrite("\x1b[45;80H#", 64);
+    consoleUpdate(&con);
+
+    px = _testGetFrame();
+    gfxHostGetFrame(NULL, &w, NULL);
+    TEST_CHECK(px && _testCellDrawn(px, w, 79, 44) && !_testCellDrawn(px, w, 78, 44));
+    free(px);
+}
+
+//Reinitializing a buffered console releases its cells.
+static void testReinit(void) {
+    static PrintConsole con;
+    int allocs;
+
+    consoleInit(&con);
+    allocs = g_testAllocs;
+    TEST_CHECK(consoleSetBuffered(&con, true));
+    TEST_CHECK(g_testAllocs > allocs);
+    consoleInit(&con);
+    TEST_CHECK(!con.buffered && con.cells == NULL);
+    TEST_CHECK(g_testAllocs == allocs);
+}
+
+//Console data which was never initialized isn't read, whatever it contains.
+static void testInitUninitialized(void) {
+    PrintConsole con;
+    int allocs = g_testAllocs;
+
+    memset(&con, 0xa5, sizeof(con));
+    consoleInit(&con);
+    TEST_CHECK(!con.buffered && !con.staged && con.cells == NULL);
+    _testWrite("uninitialized\n", 64);
+    TEST_CHECK(g_testAllocs == allocs);
+
+    consoleSelect(&defaultConsole);
+}
+
+static PrintConsole g_testLeft, g_testRight;
+
+static void _testStagedInit(bool staged) {
+    consoleInit(&g_testLeft);
+    consoleInit(&g_testRight);
+    consoleSetWindow(&g_testLeft, 0, 0, 40, 45);
+    consoleSetWindow(&g_testRight, 40, 0, 40, 45);
+    consoleSetBuffered(&g_testLeft, true);
+    consoleSetBuffered(&g_testRight, true);
+    consoleSetStaged(&g_testLeft, staged);
+    consoleSetStaged(&g_testRight, staged);
+}
+
+//Prints to both consoles from another thread, which starts with the default attributes on each.
+static void *_testStagedThread(void *arg) {
+    _testThreadEnter();
+    consoleSelect(&g_testLeft);
+    _testWrite("BBB\n", 64);
+    consoleSelect(&g_testRight);
+    _testWrite("\x1b[34mDDD\n", 64);
+    consoleSelect(&g_testLeft);
+    consoleReleaseStaging();
+    _testThreadExit();
+    return NULL;
+}
+
+//Staged output of several threads ends up on screen like the same output written in order, with each thread
+//keeping its own attributes per console, and released staging buffers are reused.
+static void testStaged(void) {
+    pthread_t thread;
+    u32 *immediate, *staged;
+    int allocs;
+
+    _testStagedInit(false);
+    consoleSelect(&g_testLeft);
+    _testWrite("\x1b[31mAAA\n\x1b[0mBBB\n\x1b[31mCCC\n", 64);
+    consoleSelect(&g_testRight);
+    _testWrite("\x1b[34mDDD\n\x1b[0mEEE\n", 64);
+    consoleUpdate(&g_testRight);
+    consoleUpdate(&g_testLeft);
+    immediate = _testGetFrame();
+
+    _testStagedInit(true);
+    consoleSelect(&g_testLeft);
+    _testWrite("\x1b[31mAAA\n", 64);
+    pthread_create(&thread, NULL, _testStagedThread, NULL);
+    pthread_join(thread, NULL);
+    consoleSelect(&g_testRight);
+    _testWrite("EEE\n", 64);
+    consoleSelect(&g_testLeft);
+    _testWrite("CCC\n", 64);
+
+    //Draining doesn't select the console being drained.
+    consoleSelect(&g_testRight);
+    consoleUpdate(&g_testLeft);
+    TEST_CHECK(currentConsole == &g_testRight);
+    consoleUpdate(&g_testRight);
+    consoleUpdate(&g_testLeft);
+    staged = _testGetFrame();
+
+    TEST_CHECK(_testFramesEqual(immediate, staged));
+    free(immediate);
+    free(staged);
+
+    //The drained buffers of the exited thread are handed to the next one.
+    allocs = g_testAllocs;
+    pthread_create(&thread, NULL, _testStagedThread, NULL);
+    pthread_join(thread, NULL);
+    consoleUpdate(&g_testLeft);
+    consoleUpdate(&g_testRight);
+    TEST_CHECK(g_testAllocs == allocs);
+
+    consoleSelect(&g_testLeft);
+    _testStagedInit(false);
+}
+
+enum { TEST_WRITERS = 4, TEST_WRITER_ROUNDS = 4 };
+
+static int g_testWritersDone;
+static pthread_barrier_t g_testWritersStarted;
+
+//Writes its own row in its own color over and over, and exits without releasing its staging buffer.
+//All writers hold a buffer at once, so every run needs exactly TEST_WRITERS of them.
+static void *_testConcurrentWriter(void *arg) {
+    int row = (int)(uintptr_t)arg, round, col, len;
+    char buf[32];
+
+    _testThreadEnter();
+    len = snprintf(buf, sizeof(buf), "\x1b[%dm", 31 + row);
+    con_write(NULL, NULL, buf, len);
+    pthread_barrier_wait(&g_testWritersStarted);
+
+    for (round=0; round<TEST_WRITER_ROUNDS; round++) {
+        for (col=0; col<40; col++) {
+            len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH%c", row + 1, col + 1, 'a' + row + round);
+            con_write(NULL, NULL, buf, len);
+        }
+    }
+
+    _testThreadExit();
+    return NULL;
+}
+
+static void *_testDrainThread(void *arg) {
+    while (!__atomic_load_n(&g_testWritersDone, __ATOMIC_ACQUIRE)) consoleUpdate(&g_testLeft);
+    return NULL;
+}
+
+static void _testRunWriters(void) {
+    pthread_t writers[TEST_WRITERS], drain;
+    int i;
+
+    g_testWritersDone = 0;
+    pthread_barrier_init(&g_testWritersStarted, NULL, TEST_WRITERS);
+    pthread_create(&drain, NULL, _testDrainThread, NULL);
+    for (i=0; i<TEST_WRITERS; i++) pthread_create(&writers[i], NULL, _testConcurrentWriter, (void*)(uintptr_t)i);
+    for (i=0; i<TEST_WRITERS; i++) pthread_join(writers[i], NULL);
+    __atomic_store_n(&g_testWritersDone, 1, __ATOMIC_RELEASE);
+    pthread_join(drain, NULL);
+    pthread_barrier_destroy(&g_testWritersStarted);
+    consoleUpdate(&g_testLeft);
+}
+
+//Several threads print at once while another one keeps drawing: each keeps its own attributes and nothing is lost,
+//and the staging buffers of the threads, which exit without releasing them, are reused by the next ones.
+static void testStagedConcurrent(void) {
+    int allocs, row, col, bad = 0;
+
+    _testStagedInit(true);
+    consoleSelect(&g_testLeft);
+    _testRunWriters();
+    TEST_CHECK(consoleGetStagingDropped(&g_testLeft) == 0);
+
+    for (row=0; row<TEST_WRITERS; row++) {
+        ConsoleCell *cells = &g_testLeft.cells[((g_testLeft.topRow + row) % g_testLeft.windowHeight) * g_testLeft.windowWidth];
+
+        for (col=0; col<40; col++)
+            bad += cells[col].chr != (u32)('a' + row + TEST_WRITER_ROUNDS - 1) || cells[col].fg != 1 + row;
+    }
+    TEST_CHECK(bad == 0);
+
+    allocs = g_testAllocs;
+    _testRunWriters();
+    TEST_CHECK(g_testAllocs == allocs);
+
+    _testStagedInit(false);
+}
+
+//Output which doesn't fit in the staging buffer before the next update is counted as dropped.
+static void testStagingDropped(void) {
+    u32 record = sizeof(ConsoleStagingRecord) + 100;
+    u32 fits = CONSOLE_STAGING_SIZE / record, rest = CONSOLE_STAGING_SIZE % record;
+    u64 expected = 200 * 100 - fits * 100 - (rest > sizeof(ConsoleStagingRecord) ? rest - sizeof(ConsoleStagingRecord) : 0);
+    char text[100];
+    int i;
+
+    _testStagedInit(true);
+    consoleSelect(&g_testLeft);
+    memset(text, 'x', sizeof(text));
+
+    for (i=0; i<200; i++) con_write(NULL, NULL, text, sizeof(text));
+    TEST_CHECK(consoleGetStagingDropped(NULL) == expected);
+
+    consoleUpdate(&g_testLeft);
+    con_write(NULL, NULL, text, sizeof(text));
+    consoleUpdate(&g_testLeft);
+    TEST_CHECK(consoleGetStagingDropped(&g_testLeft) == expected);
+
+    _testStagedInit(false);
+    TEST_CHECK(consoleGetStagingDropped(&g_testLeft) == 0);
+}
+
+//The output stays on screen whichever framebuffer is displayed, with more than two of them.
+static void testFramebufferCount(void) {
+    static PrintConsole con;
+    u32 *first, *px;
+    int i;
+
+    gfxExit();
+    gfxInitBufferCount(3);
+    gfxInitDefault();
+
+    consoleInit(&con);
+
+    //The deprecated fields still point at the first two framebuffers.
+    u8 *fbs[GFX_MAX_FRAMEBUFFERS];
+    TEST_CHECK(gfxGetFramebuffers(fbs) == 3);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    TEST_CHECK(con.frameBuffer == (u32*)fbs[0] && con.frameBuffer2 == (u32*)fbs[1]);
+#pragma GCC diagnostic pop
+
+    _testWrite("\x1b[31mtriple\x1b[0m buffering\n", 64);
+    first = _testGetFrame();
+
+    for (i=0; i<3; i++) {
+        gfxSwapBuffers();
+        px = _testGetFrame();
+        TEST_CHECK(_testFramesEqual(first, px));
+        free(px);
+    }
+
+    free(first);
+}
+
+//The console looks the framebuffers up once per write or update, not for every glyph it draws.
+static void testFramebufferLookups(void) {
+    static PrintConsole con;
+    int lookups;
+
+    consoleInit(&con);
+    lookups = g_testFramebufferLookups;
+    _testWrite("\x1b[31mone line of text\x1b[1;5H without a newline", 1000);
+    TEST_CHECK(g_testFramebufferLookups == lookups + 1);
+
+    //Each line is presented, and the next framebuffer is looked up again.
+    lookups = g_testFramebufferLookups;
+    _testWrite("a\nb\nc", 1000);
+    TEST_CHECK(g_testFramebufferLookups == lookups + 3);
+
+    //Buffered output only draws on update.
+    consoleSetBuffered(&con, true);
+    lookups = g_testFramebufferLookups;
+    _testWrite("buffered\nlines\n", 1000);
+    TEST_CHECK(g_testFramebufferLookups == lookups);
+    consoleUpdate(&con);
+    TEST_CHECK(g_testFramebufferLookups == lookups + 1);
+
+    consoleSelect(&defaultConsole);
+}
+
+//With async-dequeue the console still waits on the dequeue fence before drawing, since nothing else does. It's waited on
+//once per batch, with a single framebuffer lookup however many glyphs are drawn.
+static void testAsyncDequeue(void) {
+    static PrintConsole con;
+    u32 waits, lookups;
+
+    consoleInit(&con);
+    gfxConfigureAsyncDequeue(true);
+    gfxSwapBuffers();
+    TEST_CHECK(gfxGetDequeueFence(NULL));
+
+    waits = gfxHostGetFenceWaits();
+    lookups = g_testFramebufferLookups;
+    _testWrite("a line of glyphs drawn in one batch", 64);
+    TEST_CHECK(gfxHostGetFenceWaits() == waits + 1 && g_testFramebufferLookups == lookups + 1);
+    TEST_CHECK(!gfxGetDequeueFence(NULL));
+
+    //The same for a buffered update of several lines.
+    consoleSetBuffered(&con, true);
+    _testWrite("\nbuffered\nlines\n", 64);
+    gfxSwapBuffers();
+    waits = gfxHostGetFenceWaits();
+    lookups = g_testFramebufferLookups;
+    consoleUpdate(&con);
+    TEST_CHECK(gfxHostGetFenceWaits() == waits + 1 && g_testFramebufferLookups == lookups + 1);
+
+    consoleSetBuffered(&con, false);
+    gfxConfigureAsyncDequeue(false);
+    consoleSelect(&defaultConsole);
+}
+
+static const char g_testBdf[] =
+    "STARTFONT 2.1\n"
+    "FONTBOUNDINGBOX 8 16 0 -4\n"
+    "CHARS 3\n"
+    "STARTCHAR amacron\n"
+    "ENCODING 257\n"
+    "BBX 8 2 0 10\n"
+    "BITMAP\n"
+    "81\n"
+    "FF\n"
+    "ENDCHAR\n"
+    "STARTCHAR empty\n"
+    "ENCODING 19968\n"
+    "BBX 0 2 0 0\n"
+    "BITMAP\n"
+    "FF\n"
+    "FF\n"
+    "ENDCHAR\n"
+    "STARTCHAR negative\n"
+    "ENCODING 19969\n"
+    "BBX -3 1 0 0\n"
+    "BITMAP\n"
+    "FF\n"
+    "ENDCHAR\n"
+    "ENDFONT\n";
+
+//BDF glyphs are clipped to their bounding box, and drawn through the glyph atlas.
+static void testBdfFont(void) {
+    static PrintConsole con;
+    ConsoleBdfFont bdf;
+    ConsoleFont font;
+    u16 bitmap[16];
+    u32 *px, w, fg, bg;
+    int i, set = 0;
+
+    TEST_CHECK(consoleBdfFontInit(&bdf, g_testBdf, sizeof(g_testBdf) - 1));
+    TEST_CHECK(bdf.numGlyphs == 3);
+
+    //The baseline is 4 pixels above the bottom, so a glyph 10 above it starts at row 0.
+    TEST_CHECK(consoleBdfFontGetGlyph(&bdf, 257, bitmap));
+    TEST_CHECK(bitmap[0] == 0x8100 && bitmap[1] == 0xff00 && bitmap[2] == 0);
+
+    //Glyphs without a width are blank.
+    for (i=0; i<2; i++) {
+        memset(bitmap, 0xff, sizeof(bitmap));
+        TEST_CHECK(consoleBdfFontGetGlyph(&bdf, 19968 + i, bitmap));
+        for (set=0, w=0; w<16; w++) set |= bitmap[w];
+        TEST_CHECK(set == 0);
+    }
+    TEST_CHECK(!consoleBdfFontGetGlyph(&bdf, 'A', bitmap));
+
+    consoleInit(&con);
+    font = con.font;
+    font.glyphSource = consoleBdfFontGetGlyph;
+    font.glyphUserdata = &bdf;
+    consoleSetFont(&con, &font);
+    _testWrite("\xc4\x81\xe4\xb8\x80", 64);
+    consoleUpdate(&con);
+
+    px = _testGetFrame();
+    gfxHostGetFrame(NULL, &w, NULL);
+    fg = colorTable[7];
+    bg = colorTable[0];
+    TEST_CHECK(px && px[0] == fg && px[1] == bg && px[7] == fg && px[w + 3] == fg && px[2*w] == bg);
+    TEST_CHECK(px && px[16] == bg && px[w + 16] == bg);
+    free(px);
+
+    consoleBdfFontExit(&bdf);
+}
+
+static int g_testSourceCalls[2];
+
+//Two glyph sources drawing every code point, with different patterns.
+static bool _testSourceA(void *userdata, u32 codepoint, u16 *bitmap) {
+    g_testSourceCalls[0]++;
+    memset(bitmap, 0xff, 16*sizeof(u16));
+    return true;
+}
+
+static bool _testSourceB(void *userdata, u32 codepoint, u16 *bitmap) {
+    int i;
+
+    g_testSourceCalls[1]++;
+    for (i=0; i<16; i++) bitmap[i] = 0xf0f0;
+    return true;
+}
+
+//Whether the top-left cell of two frames is the same.
+static bool _testFirstCellEqual(const u32 *a, const u32 *b, u32 width) {
+    int y;
+
+    for (y=0; y<16; y++) {
+        if (memcmp(&a[y*width], &b[y*width], 16*4) != 0) return false;
+    }
+    return true;
+}
+
+//Consoles with different fonts keep their own rasterized glyphs and tiles, even when the fonts share the graphics.
+static void testGlyphSources(void) {
+    static PrintConsole a, b, offset;
+    ConsoleFont font;
+    u32 *px, *expected, w;
+    int i;
+
+    consoleInit(&a);
+    consoleInit(&b);
+    font = a.font;
+    font.glyphSource = _testSourceA;
+    consoleSetFont(&a, &font);
+    font.glyphSource = _testSourceB;
+    consoleSetFont(&b, &font);
+
+    //Alternating between the consoles rasterizes each glyph once per source.
+    memset(g_testSourceCalls, 0, sizeof(g_testSourceCalls));
+    for (i=0; i<50; i++) {
+        consoleSelect(&a);
+        _testWrite("\r\xe4\xb8\x80", 64);
+        consoleSelect(&b);
+        _testWrite("\r\xe4\xb8\x80", 64);
+    }
+    TEST_CHECK(g_testSourceCalls[0] == 1 && g_testSourceCalls[1] == 1);
+
+    consoleUpdate(&b);
+    px = _testGetFrame();
+    gfxHostGetFrame(NULL, &w, NULL);
+    TEST_CHECK(px && px[0] == colorTable[7] && px[4] == colorTable[0] && px[8] == colorTable[7]);
+    free(px);
+
+    //A font with an offset draws other glyphs for the same characters from the same graphics.
+    consoleInit(&offset);
+    consoleSelect(&offset);
+    _testWrite("\rA", 64);
+    consoleUpdate(&offset);
+    expected = _testGetFrame();
+    _testWrite("\rB", 64);
+
+    font = offset.font;
+    font.asciiOffset = 1;
+    consoleSetFont(&offset, &font);
+    _testWrite("\rB", 64);
+    consoleUpdate(&offset);
+    px = _testGetFrame();
+    TEST_CHECK(px && expected && _testFirstCellEqual(px, expected, w));
+    free(px);
+    free(expected);
+
+    consoleSelect(&defaultConsole);
+}
+
+//Throughput of colored log output, which is mostly escape sequence parsing and glyph drawing.
+static void benchEscapes(void) {
+    static PrintConsole con;
+    static const char line[] = "\x1b[32m[ ok ]\x1b[0m \x1b[1;37mframe\x1b[0m \x1b[33m12345\x1b[0m \x1b[2K\x1b[36mdone\x1b[0m\n";
+    double t;
+    int i;
+
+    consoleInit(&con);
+    consoleSetBuffered(&con, true);
+    t = testSeconds();
+    for (i=0; i<100000; i++) {
+        _testWrite(line, sizeof(line));
+        if (i % 60 == 59) consoleUpdate(&con);
+    }
+    t = testSeconds() - t;
+    printf("bench: console colored output, buffered: %.1f MB/s\n", 100000.0 * (sizeof(line) - 1) / t / 1e6);
+}
+
+//Lines per second when every line scrolls the window, presented once per 60 lines when buffered.
+static void benchScroll(void) {
+    static PrintConsole con;
+    char line[81];
+    double t;
+    int i;
+
+    memset(line, 'x', 79);
+    line[79] = '\n';
+    line[80] = 0;
+
+    consoleInit(&con);
+    t = testSeconds();
+    for (i=0; i<2000; i++) _testWrite(line, 80);
+    t = testSeconds() - t;
+    printf("bench: console scrolling, immediate: %.0f lines/s\n", 2000 / t);
+
+    consoleInit(&con);
+    consoleSetBuffered(&con, true);
+    t = testSeconds();
+    for (i=0; i<60000; i++) {
+        _testWrite(line, 80);
+        if (i % 60 == 59) consoleUpdate(&con);
+    }
+    t = testSeconds() - t;
+    printf("bench: console scrolling, buffered: %.0f lines/s\n", 60000 / t);
+}
+
+int main(int argc, char **argv) {
+    _testThreadEnter();
+    gfxInitDefault();
+
+    testBuffered();
+    testSetWindow();
+    testReinit();
+    testInitUninitialized();
+    testBdfFont();
+    testGlyphSources();
+    testSplitWrites();
+    testStaged();
+    testStagedConcurrent();
+    testStagingDropped();
+    testAsyncDequeue();
+    testFramebufferLookups();
+
+    if (testBenchEnabled(argc, argv)) {
+        benchScroll();
+        benchEscapes();
+    }
+
+    testFramebufferCount();
+
+    gfxExit();
+    return testResult("console");
+}
@@ -0,0 +1,259 @@
+// gfx on the host backend: displayed frames, crop, virtual vsync and frame-pacing, frame dumps and resolution switching.
+#include <stdlib.h>
+#include <unistd.h>
+#include "test.h"
+#include "switch/types.h"
+#include "switch/result.h"
+#include "switch/kernel/svc.h"
+#include "switch/gfx/gfx.h"
+#include "switch/gfx/blit.h"
+#include "switch/gfx/gfx_host.h"
+
+#define VSYNC_TICKS (19200000.0/60)
+
+static const u32 red = RGBA8_MAXALPHA(255,0,0);
+static const u32 blue = RGBA8_MAXALPHA(0,0,255);
+
+static u32 *getFrame(u32 *width, u32 *height) {
+    u32 w, h, *px;
+
+    if (!gfxHostGetFrame(NULL, &w, &h)) return NULL;
+
+    px = malloc((size_t)w*h*4);
+    gfxHostGetFrame(px, NULL, NULL);
+    if (width) *width = w;
+    if (height) *height = h;
+    return px;
+}
+
+static void testLinear(void) {
+    u32 w, h, *px, *fb;
+
+    fb = (u32*)gfxGetFramebuffer(&w, &h);
+    TEST_CHECK(w == 1280 && h == 720);
+
+    memset(fb, 0, w*h*4);
+    fb[0] = red;
+    fb[5*w + 7] = blue;
+    gfxFlushBuffers();
+    gfxSwapBuffers();
+
+    px = getFrame(&w, &h);
+    TEST_CHECK(px && w == 1280 && h == 720);
+    if (px) TEST_CHECK(px[0] == red && px[5*w + 7] == blue && px[1] == 0);
+    free(px);
+}
+
+static void testTiled(void) {
+    u32 w, h, *px, *fb;
+    int x, y, glyph = 0;
+
+    gfxSetMode(GfxMode_TiledDouble);
+
+    fb = (u32*)gfxGetFramebuffer(NULL, NULL);
+    memset(fb, 0, gfxGetFramebufferSize());
+    blitFillRect(10, 20, 4, 3, red);
+    fb[gfxGetFramebufferDisplayOffset(100, 200)] = blue;
+    blitTextSpan(200, 300, NULL, "A", 1, blue, 0);
+    gfxFlushBuffers();
+    gfxSwapBuffers();
+
+    px = getFrame(&w, &h);
+    TEST_CHECK(px != NULL);
+    if (px == NULL) return;
+
+    TEST_CHECK(px[20*w + 10] == red && px[22*w + 13] == red && px[23*w + 10] == 0);
+    TEST_CHECK(px[200*w + 100] == blue);
+
+    for (y=300; y<316; y++) {
+        for (x=200; x<216; x++) glyph += px[y*w + x] == blue;
+    }
+    TEST_CHECK(glyph > 10);
+    free(px);
+
+    //Crop: the displayed frame is the top-left of the framebuffer.
+    gfxConfigureResolution(640, 360);
+    fb = (u32*)gfxGetFramebuffer(&w, &h);
+    TEST_CHECK(w == 640 && h == 360);
+    memset(fb, 0, gfxGetFramebufferSize());
+    fb[gfxGetFramebufferDisplayOffset(3, 4)] = red;
+    gfxFlushBuffers();
+    gfxSwapBuffers();
+
+    px = getFrame(&w, &h);
+    TEST_CHECK(px && w == 640 && h == 360);
+    if (px) TEST_CHECK(px[4*640 + 3] == red);
+    free(px);
+
+    gfxConfigureResolution(0, 0);
+}
+
+static void testPacing(void) {
+    GfxFrameStats stats[4];
+    u64 tick;
+    double vsyncs;
+    int i;
+
+    //With the virtual clock every frame takes exactly one vsync, without sleeping.
+    tick = svcGetSystemTick();
+    for (i=0; i<100; i++) {
+        gfxGetFramebuffer(NULL, NULL);
+        gfxFlushBuffers();
+        gfxSwapBuffers();
+    }
+    vsyncs = (svcGetSystemTick() - tick) / VSYNC_TICKS;
+    TEST_CHECK(vsyncs > 99 && vsyncs < 102);
+
+    TEST_CHECK(gfxGetFrameStats(stats, 4) == 4);
+    TEST_CHECK(stats[3].vsyncs == 1 && stats[3].missed_vsyncs == 0);
+
+    gfxConfigureFramePacing(2);
+    tick = svcGetSystemTick();
+    for (i=0; i<10; i++) gfxSwapBuffers();
+    vsyncs = (svcGetSystemTick() - tick) / VSYNC_TICKS;
+    TEST_CHECK(vsyncs > 19 && vsyncs < 22);
+
+    TEST_CHECK(gfxGetFrameStats(stats, 1) == 1 && stats[0].vsyncs == 2);
+    gfxConfigureFramePacing(0);
+}
+
+static void testFrameDump(void) {
+    char dir[] = "/tmp/gfxhostXXXXXX";
+    char path[64], header[16];
+    FILE *f;
+    int i;
+
+    if (mkdtemp(dir) == NULL) {
+        TEST_CHECK(!"mkdtemp");
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/%%u.ppm", dir);
+    gfxHostConfigureFrameDump(path);
+    for (i=0; i<2; i++) gfxSwapBuffers();
+    gfxHostConfigureFrameDump(NULL);
+
+    //The file names are frame numbers counted since gfxInitDefault, so the dumps are found by listing the directory.
+    snprintf(path, sizeof(path), "ls %s | wc -l", dir);
+    f = popen(path, "r");
+    TEST_CHECK(f && fscanf(f, "%d", &i) == 1 && i == 2);
+    if (f) pclose(f);
+
+    snprintf(path, sizeof(path), "cat %s/*.ppm | head -c 12", dir);
+    f = popen(path, "r");
+    memset(header, 0, sizeof(header));
+    TEST_CHECK(f && fread(header, 1, 12, f) == 12);
+    TEST_CHECK(memcmp(header, "P6\n1280 720\n", 12) == 0);
+    if (f) pclose(f);
+
+    snprintf(path, sizeof(path), "rm -rf %s", dir);
+    TEST_CHECK(system(path) == 0);
+}
+
+static void testResize(void) {
+    u32 w, h, *px, *fb;
+    int i;
+
+    TEST_CHECK(R_SUCCEEDED(gfxSetFramebufferResolution(1920, 1080)));
+
+    fb = (u32*)gfxGetFramebuffer(&w, &h);
+    TEST_CHECK(w == 1920 && h == 1080);
+    memset(fb, 0, gfxGetFramebufferSize());
+    fb[gfxGetFramebufferDisplayOffset(1919, 1079)] = red;
+    gfxFlushBuffers();
+    gfxSwapBuffers();
+
+    px = getFrame(&w, &h);
+    TEST_CHECK(px && w == 1920 && h == 1080);
+    if (px) TEST_CHECK(px[1079*1920 + 1919] == red);
+    free(px);
+
+    for (i=0; i<4; i++) gfxSwapBuffers();
+}
+
+//When the new framebuffers can't be dequeued the previous ones are used again, with their memory and contents.
+static void testResizeFailure(void) {
+    u32 w, h, *px, *fb;
+    u8 *fbs[GFX_MAX_FRAMEBUFFERS], *old_fbs[GFX_MAX_FRAMEBUFFERS];
+    u32 count;
+
+    gfxSetMode(GfxMode_TiledDouble);
+    count = gfxGetFramebuffers(old_fbs);
+
+    gfxHostFailNextDequeue();
+    TEST_CHECK(gfxSetFramebufferResolution(640, 360) == MAKERESULT(Module_Libnx, LibnxError_BufferProducerError));
+
+    gfxGetFramebufferResolution(&w, &h);
+    TEST_CHECK(w == 1920 && h == 1080);
+    TEST_CHECK(gfxGetFramebuffers(fbs) == count && memcmp(fbs, old_fbs, count*sizeof(u8*)) == 0);
+
+    fb = (u32*)gfxGetFramebuffer(&w, &h);
+    TEST_CHECK(w == 1920 && h == 1080);
+    memset(fb, 0, gfxGetFramebufferSize());
+    fb[gfxGetFramebufferDisplayOffset(1919, 1079)] = blue;
+    gfxFlushBuffers();
+    gfxSwapBuffers();
+
+    px = getFrame(&w, &h);
+    TEST_CHECK(px && w == 1920 && h == 1080);
+    if (px) TEST_CHECK(px[1079*1920 + 1919] == blue);
+    free(px);
+
+    //The retired memory was given back, so the next resize works normally.
+    TEST_CHECK(R_SUCCEEDED(gfxSetFramebufferResolution(1280, 720)));
+    gfxGetFramebuffer(&w, &h);
+    TEST_CHECK(w == 1280 && h == 720);
+    gfxSwapBuffers();
+    TEST_CHECK(R_SUCCEEDED(gfxSetFramebufferResolution(1920, 1080)));
+
+    gfxSetMode(GfxMode_LinearDouble);
+}
+
+static void benchLinear(void) {
+    double t;
+    int i;
+
+    gfxSetMode(GfxMode_LinearDouble);
+
+    t = testSeconds();
+    for (i=0; i<60; i++) {
+        gfxGetFramebuffer(NULL, NULL);
+        gfxFlushBuffers();
+        gfxSwapBuffers();
+    }
+    t = testSeconds() - t;
+    printf("bench: GfxMode_LinearDouble full-frame flush+swap at 1920x1080: %.0f frames/s\n", 60 / t);
+}
+
+static void benchRealtime(void) {
+    double t;
+    int i;
+
+    gfxHostConfigureVsync(GfxHostVsync_Realtime);
+
+    t = testSeconds();
+    for (i=0; i<30; i++) gfxSwapBuffers();
+    t = testSeconds() - t;
+    printf("bench: 30 frames with the realtime vsync clock: %.3f s\n", t);
+
+    gfxHostConfigureVsync(GfxHostVsync_Virtual);
+}
+
+int main(int argc, char **argv) {
+    gfxInitDefault();
+
+    testLinear();
+    testTiled();
+    testPacing();
+    testFrameDump();
+    testResize();
+    testResizeFailure();
+
+    if (testBenchEnabled(argc, argv)) {
+        benchLinear();
+        benchRealtime();
+    }
+
+    gfxExit();
+    return testResult("gfx_host");
+}
@@ -0,0 +1,125 @@
+// GfxMode_LinearDouble transfer to the block-linear framebuffer: full frames, dirty rects and draw flip.
+#include <stdlib.h>
+#include "test.h"
+#include "switch/types.h"
+#include "switch/result.h"
+#include "switch/gfx/gfx.h"
+#include "switch/gfx/gfx_host.h"
+
+static unsigned g_rand = 7;
+
+//Whether the displayed frame matches the linear framebuffer. The draw flip undoes the vertical flip of the default transform,
+//so without it the frame is displayed bottom-up.
+static bool _testFrameMatches(const u32 *lin, bool flip) {
+    u32 w, h, y, *px;
+    bool match = true;
+
+    if (!gfxHostGetFrame(NULL, &w, &h)) return false;
+    px = malloc((size_t)w*h*4);
+    gfxHostGetFrame(px, NULL, NULL);
+
+    for (y=0; y<h && match; y++)
+        match = memcmp(&px[y*w], &lin[(flip ? y : h-1-y)*w], w*4) == 0;
+
+    free(px);
+    return match;
+}
+
+static void _testFillRect(u32 *lin, u32 w, u32 x, u32 y, u32 rw, u32 rh) {
+    u32 i, j;
+
+    for (j=y; j<y+rh; j++) {
+        for (i=x; i<x+rw; i++) lin[j*w + i] = testRand(&g_rand);
+    }
+}
+
+//Every framebuffer catches up on the rects marked while another one was displayed.
+static void _testDirtyRects(bool flip) {
+    u32 w, h, *lin;
+    int frame, i;
+
+    gfxSetDrawFlip(flip);
+    lin = (u32*)gfxGetFramebuffer(&w, &h);
+    _testFillRect(lin, w, 0, 0, w, h);
+
+    for (i=0; i<2; i++) {
+        gfxFlushBuffers();
+        gfxSwapBuffers();
+        TEST_CHECK(_testFrameMatches(lin, flip));
+        gfxGetFramebuffer(NULL, NULL);
+    }
+
+    for (frame=0; frame<30; frame++) {
+        int rects = 1 + testRand(&g_rand) % 4;
+
+        for (i=0; i<rects; i++) {
+            u32 x = testRand(&g_rand) % w, y = testRand(&g_rand) % h;
+            u32 rw = 1 + testRand(&g_rand) % 100, rh = 1 + testRand(&g_rand) % 100;
+
+            if (rw > w - x) rw = w - x;
+            if (rh > h - y) rh = h - y;
+            _testFillRect(lin, w, x, y, rw, rh);
+            gfxMarkDirtyRect(x, y, rw, rh);
+        }
+
+        gfxFlushBuffers();
+        gfxSwapBuffers();
+        TEST_CHECK(_testFrameMatches(lin, flip));
+        gfxGetFramebuffer(NULL, NULL);
+    }
+}
+
+static void testSwizzle(void) {
+    gfxSetMode(GfxMode_LinearDouble);
+
+    _testDirtyRects(false);
+    _testDirtyRects(true);
+
+    //The width isn't a multiple of the 16-pixel GOB width here.
+    gfxConfigureResolution(1000, 600);
+    _testDirtyRects(false);
+    gfxConfigureResolution(0, 0);
+
+    gfxSetDrawFlip(true);
+}
+
+static void benchSwizzle(void) {
+    u32 w, h, *lin;
+    double t;
+    int i;
+
+    gfxSetMode(GfxMode_LinearDouble);
+    lin = (u32*)gfxGetFramebuffer(&w, &h);
+    _testFillRect(lin, w, 0, 0, w, h);
+
+    t = testSeconds();
+    for (i=0; i<100; i++) {
+        gfxGetFramebuffer(NULL, NULL);
+        gfxFlushBuffers();
+        gfxSwapBuffers();
+    }
+    t = testSeconds() - t;
+    printf("bench: GfxMode_LinearDouble full %ux%u frame transfer+swap: %.2f ms/frame\n", w, h, t * 1000 / 100);
+
+    t = testSeconds();
+    for (i=0; i<100; i++) {
+        gfxGetFramebuffer(NULL, NULL);
+        gfxMarkDirtyRect(100, 100, 320, 240);
+        gfxFlushBuffers();
+        gfxSwapBuffers();
+    }
+    t = testSeconds() - t;
+    printf("bench: GfxMode_LinearDouble 320x240 dirty rect transfer+swap: %.2f ms/frame\n", t * 1000 / 100);
+}
+
+int main(int argc, char **argv) {
+    gfxInitDefault();
+
+    testSwizzle();
+
+    if (testBenchEnabled(argc, argv))
+        benchSwizzle();
+
+    gfxExit();
+    return testResult("gfx_swizzle");
+}
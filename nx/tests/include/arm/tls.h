@@ -0,0 +1,12 @@
+// Stand-in for arm/tls.h, for the host tests which include sources using the thread local storage. The device version
+// reads tpidrro_el0, here each thread gets its own buffer. The device header is included first under another name,
+// so that later includes of it are skipped.
+#pragma once
+#define armGetTls armGetTlsDevice
+#include "switch/arm/tls.h"
+#undef armGetTls
+
+static inline void* armGetTls(void) {
+    static __thread u8 tls[0x200] __attribute__((aligned(16)));
+    return tls;
+}
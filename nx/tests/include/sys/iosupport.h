@@ -0,0 +1,43 @@
+// Stand-in for devkitA64's <sys/iosupport.h>: the devoptab and syscall tables libnx registers with newlib.
+#pragma once
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/lock.h>
+#include <sys/reent.h>
+
+enum {
+    STD_IN,
+    STD_OUT,
+    STD_ERR,
+    STD_MAX = 35
+};
+
+struct stat;
+
+typedef struct {
+    const char *name;
+    size_t structSize;
+    int (*open_r)(struct _reent *r, void *fileStruct, const char *path, int flags, int mode);
+    int (*close_r)(struct _reent *r, void *fd);
+    ssize_t (*write_r)(struct _reent *r, void *fd, const char *ptr, size_t len);
+    ssize_t (*read_r)(struct _reent *r, void *fd, char *ptr, size_t len);
+    off_t (*seek_r)(struct _reent *r, void *fd, off_t pos, int dir);
+    int (*fstat_r)(struct _reent *r, void *fd, struct stat *st);
+} devoptab_t;
+
+extern const devoptab_t *devoptab_list[];
+
+typedef struct {
+    void (*exit)(int rc);
+    int (*gettod_r)(struct _reent *ptr, struct timeval *tp, struct timezone *tz);
+    struct _reent *(*getreent)(void);
+    void (*lock_init)(_LOCK_T *lock);
+    void (*lock_acquire)(_LOCK_T *lock);
+    void (*lock_release)(_LOCK_T *lock);
+    void (*lock_init_recursive)(_LOCK_RECURSIVE_T *lock);
+    void (*lock_acquire_recursive)(_LOCK_RECURSIVE_T *lock);
+    void (*lock_release_recursive)(_LOCK_RECURSIVE_T *lock);
+} __syscalls_t;
+
+extern __syscalls_t __syscalls;
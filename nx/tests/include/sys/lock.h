@@ -0,0 +1,10 @@
+// Stand-in for newlib's <sys/lock.h>, for the host tests which include kernel/mutex.h.
+#pragma once
+
+typedef int _LOCK_T;
+
+typedef struct {
+    _LOCK_T lock;
+    unsigned thread_tag;
+    unsigned counter;
+} _LOCK_RECURSIVE_T;
@@ -0,0 +1,11 @@
+// Stand-in for newlib's <sys/reent.h>, with only the reentrancy state libnx uses.
+#pragma once
+
+struct _reent {
+    int _errno;
+    void *deviceData;
+};
+
+extern struct _reent *_impure_ptr;
+
+#define _REENT _impure_ptr
@@ -0,0 +1,141 @@
+// clock_gettime and gettimeofday with a fake system tick and time service.
+#include <stdlib.h>
+#include <unistd.h>
+#include "test.h"
+
+//newlib.c provides these for the device, don't replace the host's.
+#define clock_gettime nxClockGettime
+#define clock_getres nxClockGetres
+#define usleep nxUsleep
+
+//newlibSetup() isn't run, but points below __tls_start, which is only a placeholder here.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#include "runtime/newlib.c"
+#pragma GCC diagnostic pop
+
+#define SEC SYSTEM_TICK_FREQ
+
+struct _reent *_impure_ptr;
+__syscalls_t __syscalls;
+const u8 __tdata_lma[1], __tdata_lma_end[1];
+u8 __tls_start[1];
+
+static struct _reent g_testReent;
+static u64 g_testTick;
+static u64 g_testTime;
+static int g_testTimeCalls;
+
+u64 svcGetSystemTick(void) {
+    return g_testTick;
+}
+
+Result svcSleepThread(u64 nano) {
+    g_testTick += nano * 12 / 625;
+    return 0;
+}
+
+Result timeGetCurrentTime(TimeType type, u64 *timestamp) {
+    g_testTimeCalls++;
+    *timestamp = g_testTime;
+    return 0;
+}
+
+Handle envGetMainThreadHandle(void) {
+    return 0;
+}
+
+void NORETURN fatalSimple(Result err) {
+    abort();
+}
+
+void mutexLock(Mutex* m) {}
+void mutexUnlock(Mutex* m) {}
+void rmutexLock(RMutex* m) {}
+void rmutexUnlock(RMutex* m) {}
+
+//Realtime in nanoseconds.
+static u64 _testRealtime(void) {
+    struct timespec ts;
+
+    TEST_CHECK(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void testMonotonic(void) {
+    struct timespec ts;
+    struct timeval tv;
+
+    g_testTick = 5*SEC + SEC/4;
+    TEST_CHECK(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    TEST_CHECK(ts.tv_sec == 5 && ts.tv_nsec == 250000000);
+
+    TEST_CHECK(clock_getres(CLOCK_MONOTONIC, &ts) == 0);
+    TEST_CHECK(ts.tv_sec == 0 && ts.tv_nsec == 53);
+
+    TEST_CHECK(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == -1 && g_testReent._errno == EINVAL);
+
+    //gettimeofday: the realtime clock with sub-second resolution, from one time service sample.
+    g_testTime = 1000;
+    TEST_CHECK(__libnx_gtod(&g_testReent, &tv, NULL) == 0);
+    TEST_CHECK(tv.tv_sec == 1000 && tv.tv_usec == 0);
+    g_testTick += SEC/2 + SEC/1000;
+    TEST_CHECK(__libnx_gtod(&g_testReent, &tv, NULL) == 0);
+    TEST_CHECK(tv.tv_sec == 1000 && tv.tv_usec == 501000);
+    TEST_CHECK(g_testTimeCalls == 1);
+}
+
+static void testResync(void) {
+    u64 prev, now;
+    int i, calls;
+
+    //Realtime runs with the tick and follows the time service, which only has whole seconds.
+    //Step through 10 minutes at a 0.3 s interval: the clock never goes back, and keeps its phase.
+    prev = _testRealtime();
+    calls = g_testTimeCalls;
+    for (i=0; i<2000; i++) {
+        g_testTick += SEC*3/10;
+        g_testTime = 1000 + (g_testTick - 5*SEC - SEC/4) / SEC;
+
+        now = _testRealtime();
+        TEST_CHECK(now - prev == 300000000);
+        prev = now;
+    }
+    TEST_CHECK(g_testTimeCalls - calls == 10);
+
+    //A time service which is ahead by whole seconds moves the clock forward to the start of that second.
+    g_testTick += REALTIME_RESYNC_TICKS;
+    g_testTime = 1000 + (g_testTick - 5*SEC - SEC/4) / SEC + 5;
+    now = _testRealtime();
+    TEST_CHECK(now == g_testTime * 1000000000ULL);
+    TEST_CHECK(now > prev);
+    prev = now;
+
+    //One which is behind by a second doesn't move the clock back, since the sample is taken within the second.
+    g_testTick += REALTIME_RESYNC_TICKS;
+    g_testTime = 1000 + (g_testTick - 5*SEC - SEC/4) / SEC + 4;
+    now = _testRealtime();
+    TEST_CHECK(now == prev + 60000000000ULL);
+    prev = now;
+
+    //One which is further behind, after the system clock was set back, steps the clock back to the sampled second
+    //and keeps the phase.
+    g_testTick += REALTIME_RESYNC_TICKS;
+    g_testTime = 1000 + (g_testTick - 5*SEC - SEC/4) / SEC - 100;
+    now = _testRealtime();
+    TEST_CHECK(now / 1000000000ULL == g_testTime);
+    TEST_CHECK(now % 1000000000ULL == prev % 1000000000ULL);
+
+    //The clock then runs on from there.
+    g_testTick += SEC/2;
+    TEST_CHECK(_testRealtime() == now + 500000000ULL);
+}
+
+int main(int argc, char **argv) {
+    _impure_ptr = &g_testReent;
+
+    testMonotonic();
+    testResync();
+
+    return testResult("newlib");
+}
@@ -0,0 +1,589 @@
+// nvgfx GPFIFO command ring, on a fake nv ioctl backend with a simulated GPU which completes submissions at random.
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "test.h"
+#include "gfx/nvgfx.c"
+
+#define TEST_SYNCPT 7
+
+typedef struct {
+    u32 size;
+    void *mem;
+} TestNvmap;
+
+typedef struct {
+    u64 va;
+    u32 handle;
+} TestMapping;
+
+typedef struct {
+    const u8 *start, *end;
+    u32 value;
+} TestRange;
+
+static TestNvmap g_testNvmaps[256];
+static u32 g_testNvmapCount;
+static TestMapping g_testMappings[256];
+static u32 g_testMappingCount;
+static u64 g_testNextVa = 0x200000000ULL;
+
+//The simulated GPU: the syncpoint value of the last submission and of the last completed one.
+static u32 g_testSubmitted, g_testCompleted;
+static u32 g_testSubmits, g_testWaits;
+static Result g_testSubmitResult;
+static u32 g_testFrees, g_testUnmaps;
+
+//Command lists submitted and not completed yet, and the ranges flushed since the last submission.
+static TestRange g_testInflight[4096];
+static u32 g_testInflightCount;
+static TestRange g_testFlushed[64];
+static u32 g_testFlushedCount;
+static size_t g_testFlushedBytes;
+static nvioctl_gpfifo_entry g_testLastEntries[NVGFX_GPFIFO_MAX_ENTRIES];
+static int g_testErrors;
+
+//Without g_testThreads the GPU setup is done on first use. g_testGpuInitResult is returned by its last ioctl.
+static bool g_testThreads, g_testGpuInitDelay;
+static Result g_testGpuInitResult;
+static u32 g_testGpuInits;
+static pthread_t g_testThread;
+static ThreadFunc g_testThreadEntry;
+static bool g_testThreadJoined;
+static u64 g_testTick;
+
+size_t g_gfx_singleframebuf_size = 0x10000;
+u32 g_gfx_framebuf_count = 2;
+
+u64 svcGetSystemTick(void) { return __atomic_add_fetch(&g_testTick, 1, __ATOMIC_RELAXED); }
+Result svcCloseHandle(Handle handle) { return 0; }
+void mutexLock(Mutex* m) {}
+void mutexUnlock(Mutex* m) {}
+
+static void* _testThreadMain(void *arg) {
+    g_testThreadEntry(arg);
+    return NULL;
+}
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, size_t stack_sz, int prio, int cpuid) {
+    if (!g_testThreads) return 1;
+    g_testThreadEntry = entry;
+    g_testThreadJoined = 0;
+    return 0;
+}
+
+Result threadStart(Thread* t) { return pthread_create(&g_testThread, NULL, _testThreadMain, NULL) ? 1 : 0; }
+
+Result threadWaitForExit(Thread* t) {
+    if (!g_testThreadJoined) pthread_join(g_testThread, NULL);
+    g_testThreadJoined = 1;
+    return 0;
+}
+
+Result threadClose(Thread* t) { return 0; }
+Result bufferProducerQuery(s32 what, s32* value) { return 0; }
+Result _gfxGraphicBufferInit(s32 buf, u32 nvmap_handle) { return 0; }
+
+Result nvOpen(u32 *fd, const char *devicepath) { static u32 next_fd = 1; *fd = next_fd++; return 0; }
+Result nvClose(u32 fd) { return 0; }
+Result nvQueryEvent(u32 fd, u32 event_id, Handle *handle_out) { *handle_out = INVALID_HANDLE; return 0; }
+
+Result nvioctlNvhostCtrlGpu_GetCharacteristics(u32 fd, gpu_characteristics *out) {
+    g_testGpuInits++;
+    if (g_testGpuInitDelay) usleep(20000);
+    return 0;
+}
+
+Result nvioctlNvhostCtrlGpu_GetTpcMasks(u32 fd, u32 inval, u32 out[24>>2]) { return 0; }
+Result nvioctlNvhostCtrlGpu_ZCullGetCtxSize(u32 fd, u32 *out) { return 0; }
+Result nvioctlNvhostCtrlGpu_ZCullGetInfo(u32 fd, u32 out[40>>2]) { return 0; }
+Result nvioctlNvhostCtrlGpu_GetL2State(u32 fd, nvioctl_l2_state *out) { return 0; }
+Result nvioctlNvhostAsGpu_BindChannel(u32 fd, u32 channel_fd) { return 0; }
+Result nvioctlNvhostAsGpu_AllocSpace(u32 fd, u32 pages, u32 page_size, u32 flags, u64 align, u64 *offset) { *offset = 0x100000000ULL; return 0; }
+Result nvioctlNvhostAsGpu_InitializeEx(u32 fd, u32 big_page_size, u32 flags) { return 0; }
+Result nvioctlNvhostAsGpu_GetVARegions(u32 fd, nvioctl_va_region regions[2]) { return 0; }
+Result nvioctlNvhostAsGpu_UnmapBuffer(u32 fd, u64 offset) { g_testUnmaps++; return 0; }
+Result nvioctlChannel_SetNvmapFd(u32 fd, u32 nvmap_fd) { return 0; }
+Result nvioctlChannel_AllocGpfifoEx2(u32 fd, u32 num_entries, u32 flags, u32 unk0, u32 unk1, u32 unk2, u32 unk3, nvioctl_fence *fence_out) { return 0; }
+Result nvioctlChannel_AllocObjCtx(u32 fd, u32 class_num, u32 flags) { return g_testGpuInitResult; }
+Result nvioctlChannel_SetErrorNotifier(u32 fd, u64 offset, u64 size, u32 nvmap_handle) { return 0; }
+Result nvioctlChannel_SetUserData(u32 fd, void* addr) { return 0; }
+Result nvioctlChannel_SetPriority(u32 fd, u32 priority) { return 0; }
+Result nvioctlChannel_ZCullBind(u32 fd, u64 gpu_va, u32 mode) { return 0; }
+
+Result nvioctlNvmap_Create(u32 fd, u32 size, u32 *nvmap_handle) {
+    g_testNvmaps[g_testNvmapCount].size = size;
+    *nvmap_handle = ++g_testNvmapCount;
+    return 0;
+}
+
+Result nvioctlNvmap_Alloc(u32 fd, u32 nvmap_handle, u32 heapmask, u32 flags, u32 align, u8 kind, void* addr) {
+    g_testNvmaps[nvmap_handle-1].mem = addr;
+    return 0;
+}
+
+Result nvioctlNvmap_Free(u32 fd, u32 nvmap_handle) { g_testFrees++; return 0; }
+Result nvioctlNvmap_GetId(u32 fd, u32 nvmap_handle, u32 *id) { *id = nvmap_handle; return 0; }
+Result nvioctlNvmap_FromId(u32 fd, u32 id, u32 *nvmap_handle) { *nvmap_handle = id; return 0; }
+
+Result nvioctlNvhostAsGpu_MapBufferEx(u32 fd, u32 flags, u32 kind, u32 nvmap_handle, u32 page_size, u64 buffer_offset, u64 mapping_size, u64 input_offset, u64 *offset) {
+    if (offset && nvmap_handle) {
+        g_testMappings[g_testMappingCount].va = g_testNextVa;
+        g_testMappings[g_testMappingCount++].handle = nvmap_handle;
+        *offset = g_testNextVa;
+        g_testNextVa += 0x10000000;
+    }
+    return 0;
+}
+
+void armDCacheFlush(void *addr, size_t size) {
+    if (g_testFlushedCount < 64) {
+        g_testFlushed[g_testFlushedCount].start = addr;
+        g_testFlushed[g_testFlushedCount++].end = (u8*)addr + size;
+    }
+    g_testFlushedBytes += size;
+}
+
+//Whether the GPU sees the CPU writes to a range, i.e. it was flushed since the last submission.
+static bool _testFlushed(const u8 *start, const u8 *end) {
+    u32 i;
+
+    while (start < end) {
+        for (i=0; i<g_testFlushedCount; i++) {
+            if (g_testFlushed[i].start <= start && start < g_testFlushed[i].end) break;
+        }
+        if (i == g_testFlushedCount) return false;
+        start = g_testFlushed[i].end;
+    }
+    return true;
+}
+
+Result nvioctlChannel_SubmitGpfifo(u32 fd, nvioctl_gpfifo_entry *entries, u32 num_entries, u32 flags, nvioctl_fence *fence_out) {
+    u32 i, j;
+
+    if (R_FAILED(g_testSubmitResult)) return g_testSubmitResult;
+
+    g_testSubmits++;
+    g_testSubmitted++;
+    memcpy(g_testLastEntries, entries, num_entries*sizeof(nvioctl_gpfifo_entry));
+
+    for (i=0; i<num_entries; i++) {
+        u64 va = entries[i].entry0 | ((u64)(entries[i].entry1 & 0xff) << 32);
+        size_t size = ((entries[i].entry1 >> 10) & 0x1fffff) * 4;
+        const u8 *start = NULL;
+
+        for (j=0; j<g_testMappingCount; j++) {
+            TestMapping *map = &g_testMappings[j];
+
+            if (va >= map->va && va + size <= map->va + g_testNvmaps[map->handle-1].size)
+                start = (u8*)g_testNvmaps[map->handle-1].mem + (va - map->va);
+        }
+
+        if (start == NULL || !_testFlushed(start, start + size)) g_testErrors++;
+
+        if (start && g_testInflightCount < 4096) {
+            g_testInflight[g_testInflightCount].start = start;
+            g_testInflight[g_testInflightCount].end = start + size;
+            g_testInflight[g_testInflightCount++].value = g_testSubmitted;
+        }
+    }
+
+    g_testFlushedCount = 0;
+    fence_out->id = TEST_SYNCPT;
+    fence_out->value = g_testSubmitted;
+    return 0;
+}
+
+//Polling only sees what the GPU completed, waiting completes everything up to the threshold.
+Result nvioctlNvhostCtrl_EventWait(u32 fd, u32 syncpt_id, u32 threshold, s32 timeout, u32 event_id, u32 *out) {
+    if (syncpt_id != TEST_SYNCPT || threshold > g_testSubmitted) g_testErrors++;
+    if (timeout == 0 && threshold > g_testCompleted) return MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Timeout);
+    g_testWaits++;
+    if (threshold > g_testCompleted) g_testCompleted = threshold;
+    return 0;
+}
+
+//Whether a new allocation overlaps a command list which the GPU can still be reading.
+static bool _testOverlapsInflight(const u8 *start, size_t size) {
+    u32 i, count = 0;
+    bool overlap = false;
+
+    for (i=0; i<g_testInflightCount; i++) {
+        TestRange *range = &g_testInflight[i];
+
+        if (range->value <= g_testCompleted) continue;
+        if (start < range->end && range->start < start + size) overlap = true;
+        g_testInflight[count++] = *range;
+    }
+    g_testInflightCount = count;
+    return overlap;
+}
+
+//The simulated GPU is reset first, the GPU setup can already be running on the thread once nvgfxInitialize returns.
+static void _testInit(void) {
+    g_testSubmitted = g_testCompleted = 0;
+    g_testInflightCount = g_testFlushedCount = 0;
+    TEST_CHECK(R_SUCCEEDED(nvgfxInitialize()));
+}
+
+//Allocations never reuse ring space before the fence of the submission using it was signalled, everything submitted was
+//flushed, and nvgfxExit waits for all submissions.
+static void testRing(void) {
+    unsigned rand = 1;
+    int i, j;
+
+    _testInit();
+    g_testErrors = 0;
+
+    for (i=0; i<20000; i++) {
+        int lists = 1 + testRand(&rand) % 4;
+
+        if (testRand(&rand) % 3 == 0 && g_testCompleted < g_testSubmitted)
+            g_testCompleted += 1 + testRand(&rand) % (g_testSubmitted - g_testCompleted);
+
+        for (j=0; j<lists; j++) {
+            size_t size = 4 * (1 + testRand(&rand) % 1500);
+            void *ptr;
+            u64 va;
+
+            TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoAlloc(size, &ptr, &va)));
+            if (_testOverlapsInflight(ptr, size)) g_testErrors++;
+            memset(ptr, i, size);
+            TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoPush(va, size, 0)));
+        }
+
+        if (testRand(&rand) % 2) TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoSubmit(NULL)));
+    }
+    TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoSubmit(NULL)));
+    TEST_CHECK(g_testErrors == 0);
+
+    //Submissions are batched and space is reclaimed in order, so waits are rare.
+    TEST_CHECK(g_testWaits < g_testSubmits);
+
+    nvgfxExit();
+    TEST_CHECK(g_testCompleted == g_testSubmitted);
+}
+
+//The fixed command list keeps its encoding, and a failed submission doesn't leave ring space reserved.
+static void testSubmit(void) {
+    nvioctl_fence fence;
+    void *ptr;
+    u64 va;
+    int i;
+
+    _testInit();
+
+    TEST_CHECK(R_SUCCEEDED(nvgfxSubmitGpfifo()));
+    TEST_CHECK(g_testLastEntries[0].entry1 == ((0x1778/4) << 10 | 0x200 | (u32)(nvmap_obj3_mapbuffer_x0_offset >> 32)));
+    TEST_CHECK(g_testLastEntries[0].entry0 + 0x1778 == g_testLastEntries[1].entry0);
+    TEST_CHECK(g_testLastEntries[1].entry1 == ((44/4) << 10 | 0x80000200 | (u32)(nvmap_obj3_mapbuffer_x0_offset >> 32)));
+
+    g_testSubmitResult = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoAlloc(0x8000, &ptr, &va)));
+    TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoPush(va, 0x8000, 0)));
+    TEST_CHECK(nvgfxGpfifoSubmit(&fence) == g_testSubmitResult);
+    g_testSubmitResult = 0;
+
+    for (i=0; i<8; i++) {
+        TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoAlloc(0x8000, &ptr, &va)));
+        TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoPush(va, 0x8000, 0)));
+        TEST_CHECK(R_SUCCEEDED(nvgfxGpfifoSubmit(&fence)));
+        TEST_CHECK(fence.id == TEST_SYNCPT && fence.value == g_testSubmitted);
+    }
+
+    nvgfxExit();
+}
+
+//Shadow of the heap pages: the ID of the block using each page, 0 when free. Blocks freed with a fence keep their pages
+//until the fence is signalled.
+static u32 g_testHeapPages[NVGFX_HEAP_MAX_CHUNKS][NVGFX_HEAP_PAGES];
+
+typedef struct {
+    u8 *ptr;
+    u32 order;
+    u32 fence;//Fence value of a deferred free.
+} TestBlock;
+
+static nvgfxHeapChunk *_testHeapChunk(const u8 *ptr, u32 *index) {
+    u32 i;
+
+    for (i=0; i<NVGFX_HEAP_MAX_CHUNKS; i++) {
+        nvgfxHeapChunk *chunk = &g_nvgfx_heap_chunks[i];
+
+        if (chunk->obj.initialized && ptr >= chunk->obj.mem && ptr < chunk->obj.mem + NVGFX_HEAP_CHUNK_SIZE) {
+            *index = i;
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+//Marks the pages of a block with id, returns false when an allocated block overlaps pages which aren't free.
+static bool _testHeapMark(const TestBlock *block, u32 id) {
+    u32 index = 0, i, first;
+    nvgfxHeapChunk *chunk = _testHeapChunk(block->ptr, &index);
+    bool ok = true;
+
+    if (chunk == NULL) return false;
+
+    first = (block->ptr - chunk->obj.mem) / NVGFX_HEAP_PAGE_SIZE;
+    for (i=first; i<first + (1U<<block->order); i++) {
+        if (id && g_testHeapPages[index][i]) ok = false;
+        g_testHeapPages[index][i] = id;
+    }
+    return ok;
+}
+
+//Whether a chunk is one free block of the largest order again.
+static bool _testHeapChunkCoalesced(const nvgfxHeapChunk *chunk) {
+    u32 k, i;
+
+    for (k=0; k<NVGFX_HEAP_ORDERS; k++) {
+        for (i=0; i<NVGFX_HEAP_PAGES/64; i++) {
+            if (chunk->free_blocks[k][i] != (k == NVGFX_HEAP_ORDERS-1 && i == 0 ? 1 : 0)) return false;
+        }
+    }
+    for (i=0; i<NVGFX_HEAP_PAGES; i++) {
+        if (chunk->alloc_order[i]) return false;
+    }
+    return true;
+}
+
+//Random allocations and frees, half of them deferred by fences which the GPU signals at random: blocks are aligned to
+//their size and never overlap each other nor deferred blocks whose fence isn't signalled yet, and everything merges
+//back into whole chunks.
+static void testHeap(void) {
+    static TestBlock live[192], deferred[4096];
+    u32 numLive = 0, numDeferred = 0, chunks = 0, i, j;
+    unsigned rand = 9;
+    void *ptr;
+    int errors = 0;
+
+    _testInit();
+    memset(g_testHeapPages, 0, sizeof(g_testHeapPages));
+    g_testErrors = 0;
+
+    for (i=0; i<50000; i++) {
+        u32 r = testRand(&rand) % 100;
+
+        //The GPU completes some of the submitted work.
+        if (r < 10) g_testSubmitted++;
+        else if (r < 20 && g_testCompleted < g_testSubmitted) g_testCompleted += 1 + testRand(&rand) % (g_testSubmitted - g_testCompleted);
+
+        //Pages of deferred blocks are only free once their fence is signalled.
+        for (j=0; j<numDeferred;) {
+            if (deferred[j].fence <= g_testCompleted) {
+                _testHeapMark(&deferred[j], 0);
+                deferred[j] = deferred[--numDeferred];
+            }
+            else j++;
+        }
+
+        if (numLive < 192 && (numLive < 64 || testRand(&rand) % 2)) {
+            TestBlock *block = &live[numLive];
+            size_t size = testRand(&rand) % 32 == 0 ? 1 + testRand(&rand) % (NVGFX_HEAP_CHUNK_SIZE/4) : 1 + testRand(&rand) % 0x8000;
+            nvgfxHeapChunk *chunk;
+            u32 index = 0;
+            u64 va;
+
+            //Live blocks stay well below the heap size, so this doesn't run out of memory.
+            if (R_FAILED(nvgfxHeapAlloc(size, &ptr, &va))) {
+                errors++;
+                continue;
+            }
+
+            block->ptr = ptr;
+            for (block->order=0; ((size_t)NVGFX_HEAP_PAGE_SIZE << block->order) < size; block->order++);
+            chunk = _testHeapChunk(block->ptr, &index);
+
+            //Blocks are aligned to their size, in the chunk and in the GPU address space.
+            if (chunk == NULL || (block->ptr - chunk->obj.mem) % ((size_t)NVGFX_HEAP_PAGE_SIZE << block->order)) errors++;
+            else if (va - chunk->gpu_va != (u64)(block->ptr - chunk->obj.mem)) errors++;
+            else if (!_testHeapMark(block, i + 1)) errors++;
+
+            numLive++;
+        }
+        else if (numLive) {
+            u32 k = testRand(&rand) % numLive;
+            TestBlock block = live[k];
+
+            live[k] = live[--numLive];
+
+            //Blocks freed without a fence can be reused right away.
+            if (testRand(&rand) % 2 || g_testSubmitted == 0 || numDeferred == 4096) {
+                _testHeapMark(&block, 0);
+                nvgfxHeapFree(block.ptr, NULL);
+            }
+            else {
+                nvioctl_fence fence = {TEST_SYNCPT, g_testCompleted + 1 + testRand(&rand) % (g_testSubmitted - g_testCompleted + 1)};
+
+                if (fence.value > g_testSubmitted) fence.value = g_testSubmitted;
+                block.fence = fence.value;
+                deferred[numDeferred++] = block;
+                nvgfxHeapFree(block.ptr, &fence);
+            }
+        }
+    }
+
+    TEST_CHECK(errors == 0);
+    TEST_CHECK(g_testErrors == 0);
+
+    //Once everything is freed and all fences are signalled, the next allocation releases the deferred blocks.
+    for (i=0; i<numLive; i++) nvgfxHeapFree(live[i].ptr, NULL);
+    g_testCompleted = g_testSubmitted;
+    TEST_CHECK(R_SUCCEEDED(nvgfxHeapAlloc(1, &ptr, NULL)));
+    nvgfxHeapFree(ptr, NULL);
+    TEST_CHECK(g_nvgfx_heap_deferred_count == 0);
+
+    for (i=0; i<NVGFX_HEAP_MAX_CHUNKS; i++) {
+        if (!g_nvgfx_heap_chunks[i].obj.initialized) continue;
+        chunks++;
+        TEST_CHECK(_testHeapChunkCoalesced(&g_nvgfx_heap_chunks[i]));
+    }
+
+    //The random sizes needed more than one chunk.
+    TEST_CHECK(chunks > 1);
+
+    nvgfxExit();
+}
+
+//The heap grows up to NVGFX_HEAP_MAX_CHUNKS chunks, then waits for deferred blocks, and only fails when there are none.
+static void testHeapOutOfMemory(void) {
+    void *ptrs[NVGFX_HEAP_MAX_CHUNKS], *ptr;
+    nvioctl_fence fence;
+    u32 i, waits;
+
+    _testInit();
+
+    for (i=0; i<NVGFX_HEAP_MAX_CHUNKS; i++) TEST_CHECK(R_SUCCEEDED(nvgfxHeapAlloc(NVGFX_HEAP_CHUNK_SIZE, &ptrs[i], NULL)));
+    TEST_CHECK(nvgfxHeapAlloc(NVGFX_HEAP_PAGE_SIZE, &ptr, NULL) == MAKERESULT(Module_Libnx, LibnxError_OutOfMemory));
+    TEST_CHECK(nvgfxHeapAlloc(NVGFX_HEAP_CHUNK_SIZE + 1, &ptr, NULL) == MAKERESULT(Module_Libnx, LibnxError_BadInput));
+
+    //A deferred block is waited for instead.
+    g_testSubmitted++;
+    fence.id = TEST_SYNCPT;
+    fence.value = g_testSubmitted;
+    nvgfxHeapFree(ptrs[3], &fence);
+    waits = g_testWaits;
+    TEST_CHECK(R_SUCCEEDED(nvgfxHeapAlloc(NVGFX_HEAP_PAGE_SIZE, &ptr, NULL)));
+    TEST_CHECK(g_testWaits == waits + 1 && g_testCompleted == g_testSubmitted);
+    TEST_CHECK(ptr == ptrs[3]);
+
+    nvgfxExit();
+}
+
+static void benchRing(void) {
+    size_t flushed;
+    u32 submits;
+    double t;
+    int i;
+
+    _testInit();
+    flushed = g_testFlushedBytes;
+    submits = g_testSubmits;
+
+    t = testSeconds();
+    for (i=0; i<1000000; i++) {
+        void *ptr;
+        u64 va;
+
+        nvgfxGpfifoAlloc(0x100, &ptr, &va);
+        nvgfxGpfifoPush(va, 0x100, 0);
+        if (i % 4 == 3) nvgfxGpfifoSubmit(NULL);
+        g_testCompleted = g_testSubmitted;
+        g_testInflightCount = 0;
+    }
+    t = testSeconds() - t;
+
+    printf("bench: GPFIFO alloc+push, submitted in batches of 4: %.0f ns per command list\n", t * 1e9 / 1000000);
+    printf("bench: GPFIFO data cache flushed per submission: %.1f KiB (ring size %u KiB)\n",
+        (g_testFlushedBytes - flushed) / 1024.0 / (g_testSubmits - submits), (u32)(nvmap_objs[3].mem_size / 1024));
+
+    nvgfxExit();
+}
+
+//Without the thread the GPU setup is only done on first use, and the ticks of its steps stay 0 until then.
+static void testGpuInitInline(void) {
+    g_testGpuInits = 0;
+    _testInit();
+    TEST_CHECK(nvgfxGetInitStepTicks(NvgfxInitStep_Framebuffers) != 0);
+    TEST_CHECK(nvgfxGetInitStepTicks(NvgfxInitStep_GpuBuffers) == 0 && g_testGpuInits == 0);
+
+    TEST_CHECK(R_SUCCEEDED(nvgfxWaitGpuInit()));
+    TEST_CHECK(nvgfxGetInitStepTicks(NvgfxInitStep_GpuBuffers) != 0 && g_testGpuInits == 1);
+    TEST_CHECK(R_SUCCEEDED(nvgfxWaitGpuInit()) && g_testGpuInits == 1);
+    nvgfxExit();
+}
+
+//With the thread, the ticks of the GPU steps are read once it's done, and a failure is reported by nvgfxWaitGpuInit before any nvgfxGpfifo* call.
+static void testGpuInitThread(void) {
+    void *ptr;
+    u64 va;
+
+    g_testThreads = 1;
+    g_testGpuInitDelay = 1;
+    g_testGpuInits = 0;
+    _testInit();
+    TEST_CHECK(nvgfxGetInitStepTicks(NvgfxInitStep_GpuBuffers) != 0);
+    TEST_CHECK(R_SUCCEEDED(nvgfxWaitGpuInit()) && g_testGpuInits == 1);
+    nvgfxExit();
+
+    g_testGpuInitResult = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    _testInit();
+    TEST_CHECK(nvgfxWaitGpuInit() == g_testGpuInitResult);
+    TEST_CHECK(nvgfxGetInitStepTicks(NvgfxInitStep_GpuBuffers) == 0);
+    TEST_CHECK(nvgfxGpfifoAlloc(16, &ptr, &va) == g_testGpuInitResult);
+    nvgfxExit();
+
+    g_testThreads = g_testGpuInitDelay = 0;
+    g_testGpuInitResult = 0;
+}
+
+//Restoring after a resize frees the new framebuffer memory and maps the replaced one again, which isn't retired anymore.
+static void testRestoreFramebuffers(void) {
+    u8 *old_fb = NULL, *fb = NULL;
+    size_t old_size = 0, size = 0;
+    u64 old_va;
+    u32 frees;
+
+    _testInit();
+    nvgfxGetFramebuffer(&old_fb, &old_size);
+    old_va = nvmap_obj6_mapbuffer_offsets[0];
+
+    g_gfx_singleframebuf_size = 0x20000;
+    TEST_CHECK(R_SUCCEEDED(nvgfxResizeFramebuffers()));
+    nvgfxGetFramebuffer(&fb, &size);
+    TEST_CHECK(fb != old_fb && size == 2*0x20000);
+
+    g_gfx_singleframebuf_size = 0x10000;
+    frees = g_testFrees;
+    g_testUnmaps = 0;
+    nvgfxRestoreFramebuffers();
+    nvgfxGetFramebuffer(&fb, &size);
+    TEST_CHECK(fb == old_fb && size == old_size && nvmap_obj6_mapbuffer_offsets[0] == old_va);
+    TEST_CHECK(g_testFrees == frees + 1 && g_testUnmaps == 3);
+
+    //Nothing is retired anymore, so neither this nor a second restore frees anything.
+    nvgfxFreeRetiredFramebuffers();
+    nvgfxRestoreFramebuffers();
+    TEST_CHECK(g_testFrees == frees + 1);
+    nvgfxGetFramebuffer(&fb, NULL);
+    TEST_CHECK(fb == old_fb);
+
+    nvgfxExit();
+}
+
+int main(int argc, char **argv) {
+    testRing();
+    testSubmit();
+    testRestoreFramebuffers();
+    testHeap();
+    testHeapOutOfMemory();
+    testGpuInitInline();
+    testGpuInitThread();
+
+    if (testBenchEnabled(argc, argv))
+        benchRing();
+
+    return testResult("nvgfx");
+}
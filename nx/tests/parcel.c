@@ -0,0 +1,176 @@
+// Parcels built and parsed in place in the IPC buffer, with a fake binder transaction.
+#include <stdlib.h>
+#include "test.h"
+#include "gfx/parcel.c"
+
+static u8 g_testRequest[0x400];
+static size_t g_testRequestSize;
+static u8 g_testReply[0x400];
+
+Result binderTransactParcel(Binder *session, u32 code, void* parcel_data, size_t parcel_data_size, void* parcel_reply, size_t parcel_reply_size, u32 flags) {
+    memcpy(g_testRequest, parcel_data, parcel_data_size);
+    g_testRequestSize = parcel_data_size;
+    memcpy(parcel_reply, g_testReply, parcel_reply_size < sizeof(g_testReply) ? parcel_reply_size : sizeof(g_testReply));
+    return 0;
+}
+
+void mutexLock(Mutex* m) {
+    while (__atomic_exchange_n(m, 1, __ATOMIC_ACQUIRE));
+}
+
+void mutexUnlock(Mutex* m) {
+    __atomic_store_n(m, 0, __ATOMIC_RELEASE);
+}
+
+//Sets up the reply of the next transaction, with the payload at the specified offset.
+static void _testSetReply(const void *payload, u32 size, u32 offset) {
+    u32 *header = (u32*)g_testReply;
+
+    memset(g_testReply, 0x5a, sizeof(g_testReply));
+    header[0] = size;
+    header[1] = offset;
+    header[2] = 0;
+    header[3] = offset + size;
+    memcpy(&g_testReply[offset], payload, size);
+}
+
+//The request is written in place following the header, with the padding zeroed, in the layout of Android Parcel.
+static void testWrite(void) {
+    static const u8 expected[] = {
+        0x00,0x01,0x00,0x00,  0x0e,0x00,0x00,0x00,
+        'a',0,'n',0,'d',0,'r',0,'o',0,'i',0,'d',0,'.',0,'g',0,'u',0,'i',0,'.',0,'I',0,'G',0,0,0,0,0,
+        0xfe,0xff,0xff,0xff,  0x03,0x00,0x00,0x00,  0x01,0x02,0x03,0x00,
+        0x02,0x00,0x00,0x00,  0x00,0x00,0x00,0x00,  0x0a,0x0b,0x00,0x00,
+    };
+    static Parcel parcel, reply;
+    u8 bytes[3] = {1, 2, 3}, obj[2] = {0x0a, 0x0b};
+    u32 *header = (u32*)g_testRequest;
+    Binder binder;
+
+    memset(&parcel, 0xaa, sizeof(parcel));
+    parcelInitialize(&parcel);
+    TEST_CHECK(parcel.payload == &parcel.data[PARCEL_HEADER_SIZE]);
+
+    parcelWriteInterfaceToken(&parcel, "android.gui.IG");
+    parcelWriteInt32(&parcel, -2);
+    parcelWriteUInt32(&parcel, 3);
+    parcelWriteData(&parcel, bytes, 3);
+    parcelWriteFlattenedObject(&parcel, obj, 2);
+    TEST_CHECK(parcel.size == sizeof(expected));
+
+    _testSetReply("\x07\x00\x00\x00", 4, PARCEL_HEADER_SIZE);
+    TEST_CHECK(R_SUCCEEDED(parcelTransact(&binder, 1, &parcel, &reply)));
+
+    TEST_CHECK(g_testRequestSize == PARCEL_HEADER_SIZE + sizeof(expected));
+    TEST_CHECK(header[0] == sizeof(expected) && header[1] == PARCEL_HEADER_SIZE);
+    TEST_CHECK(header[2] == 0 && header[3] == PARCEL_HEADER_SIZE + sizeof(expected));
+    TEST_CHECK(memcmp(&g_testRequest[PARCEL_HEADER_SIZE], expected, sizeof(expected)) == 0);
+}
+
+//The reply is parsed in place wherever its payload is.
+static void testRead(void) {
+    static const u8 payload[] = {
+        0x2a,0x00,0x00,0x00,  0xff,0xff,0xff,0xff,
+        0x04,0x00,0x00,0x00,  0x00,0x00,0x00,0x00,  0x11,0x22,0x33,0x44,
+        0x05,0x00,0x00,0x00,
+    };
+    static Parcel parcel, reply;
+    Binder binder;
+    size_t size;
+    u8 *obj;
+
+    parcelInitialize(&parcel);
+    _testSetReply(payload, sizeof(payload), 0x40);
+    TEST_CHECK(R_SUCCEEDED(parcelTransact(&binder, 2, &parcel, &reply)));
+
+    TEST_CHECK(reply.payload == &reply.data[0x40] && reply.size == sizeof(payload));
+    TEST_CHECK(parcelReadInt32(&reply) == 42);
+    TEST_CHECK(parcelReadUInt32(&reply) == 0xffffffff);
+
+    obj = parcelReadFlattenedObject(&reply, &size);
+    TEST_CHECK(size == 4 && obj == &reply.data[0x40 + 16]);
+    TEST_CHECK(obj && memcmp(obj, "\x11\x22\x33\x44", 4) == 0);
+}
+
+//Oversized writes and reads are refused, and so are replies pointing outside the buffer.
+static void testBounds(void) {
+    static Parcel parcel, reply;
+    Binder binder;
+    u32 *header = (u32*)g_testReply;
+
+    parcelInitialize(&parcel);
+    TEST_CHECK(parcelWriteData(&parcel, NULL, parcel.capacity) == NULL);
+    TEST_CHECK(parcelWriteData(&parcel, NULL, parcel.capacity - 4) != NULL);
+    TEST_CHECK(parcelWriteData(&parcel, NULL, 4) == NULL);
+    TEST_CHECK(parcelWriteData(&parcel, NULL, BIT(31)) == NULL);
+
+    parcelInitialize(&parcel);
+    _testSetReply("\x01\x00\x00\x00", 4, PARCEL_HEADER_SIZE);
+    header[1] = sizeof(reply.data);
+    TEST_CHECK(parcelTransact(&binder, 3, &parcel, &reply) == MAKERESULT(Module_Libnx, LibnxError_BadInput));
+
+    _testSetReply("\x01\x00\x00\x00", 4, PARCEL_HEADER_SIZE);
+    header[0] = sizeof(reply.data) - 8;
+    TEST_CHECK(parcelTransact(&binder, 3, &parcel, &reply) == MAKERESULT(Module_Libnx, LibnxError_BadInput));
+}
+
+//Interned strings are copied and matched by content, and written like parcelWriteString16.
+static void testIntern(void) {
+    static Parcel plain, interned;
+    const ParcelString16 *a, *b;
+    char buf[64];
+    u32 count;
+
+    strcpy(buf, "android.gui.IGraphicBufferProducer");
+    a = parcelInternString16(buf);
+    TEST_CHECK(a != NULL);
+
+    //The same buffer reused for another string doesn't return the old entry, nor change it.
+    strcpy(buf, "android.ui.ISurfaceComposer");
+    b = parcelInternString16(buf);
+    TEST_CHECK(b != NULL && b != a);
+    TEST_CHECK(parcelInternString16("android.gui.IGraphicBufferProducer") == a);
+
+    parcelInitialize(&plain);
+    parcelInitialize(&interned);
+    parcelWriteString16(&plain, "android.gui.IGraphicBufferProducer");
+    parcelWriteInternedString16(&interned, a);
+    TEST_CHECK(plain.size == interned.size && memcmp(plain.payload, interned.payload, plain.size) == 0);
+
+    //Interface tokens don't go through the pool, since they can be any string.
+    count = g_parcelString16PoolCount;
+    parcelWriteInterfaceToken(&plain, "android.gui.ITest");
+    TEST_CHECK(g_parcelString16PoolCount == count);
+}
+
+static void benchParcel(void) {
+    static Parcel parcel, reply;
+    Binder binder;
+    double t;
+    int i;
+
+    _testSetReply("\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00", 12, PARCEL_HEADER_SIZE);
+
+    t = testSeconds();
+    for (i=0; i<1000000; i++) {
+        parcelInitialize(&parcel);
+        parcelWriteInterfaceToken(&parcel, "android.gui.IGraphicBufferProducer");
+        parcelWriteInt32(&parcel, i);
+        parcelTransact(&binder, 7, &parcel, &reply);
+        parcelReadInt32(&reply);
+    }
+    t = testSeconds() - t;
+    printf("bench: parcel write+transact+read: %.0f ns\n", t * 1e9 / 1000000);
+}
+
+int main(int argc, char **argv) {
+    testWrite();
+    testRead();
+    testBounds();
+    testIntern();
+
+    if (testBenchEnabled(argc, argv))
+        benchParcel();
+
+    return testResult("parcel");
+}
@@ -0,0 +1,191 @@
+// xoshiro256** against the reference output, non-overlapping streams after jumps and splits, and the distribution of the bounded and float helpers.
+#include <stdlib.h>
+#include "test.h"
+#include "kernel/random.c"
+#include "kernel/prng.c"
+
+Result svcGetInfo(u64* out, u64 id0, Handle handle, u64 id1) {
+    *out = 0xfedcba9876543210ULL * (id1+1);
+    return 0;
+}
+
+void NORETURN fatalSimple(Result err) {
+    abort();
+}
+
+void mutexLock(Mutex* m) {
+}
+
+void mutexUnlock(Mutex* m) {
+}
+
+static int _testCompareU64(const void *a, const void *b) {
+    u64 x = *(const u64*)a, y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
+
+//Outputs of the reference implementation (xoshiro256starstar.c) for the state {1, 2, 3, 4}, and that state after jump().
+static void testReference(void) {
+    static const u64 expected[] = {
+        0x2d00ULL, 0x0ULL, 0x5a007080ULL, 0x10e0000000009d80ULL, 0x10e0b61ce1009d80ULL, 0x870021ce143ad00ULL,
+    };
+    static const u64 jumped[4] = {
+        0x8c7a153956b5f3d1ULL, 0x701f1a713401d85eULL, 0x6527f66a65469085ULL, 0x8386b786c4408050ULL,
+    };
+    Prng p = {{1, 2, 3, 4}}, q = {{1, 2, 3, 4}};
+    int i;
+
+    for (i=0; i<6; i++) TEST_CHECK(prngNext64(&p) == expected[i]);
+
+    prngJump(&q);
+    TEST_CHECK(memcmp(q.s, jumped, sizeof(jumped)) == 0);
+}
+
+//Streams split off the same state start where the previous one was jumped, and none of them repeat values of another.
+static void testStreams(void) {
+    enum { STREAMS = 4, COUNT = 100000 };
+    u64 *values = malloc(STREAMS * COUNT * sizeof(u64));
+    Prng p, streams[STREAMS], jumped;
+    int i, j, dups = 0;
+
+    prngSeed(&p, 42);
+    for (i=0; i<STREAMS; i++) {
+        jumped = p;
+        prngJump(&jumped);
+        prngSplit(&p, &streams[i]);
+        TEST_CHECK(memcmp(&p, &jumped, sizeof(p)) == 0);
+        if (i) {
+            prngJump(&streams[i-1]);
+            TEST_CHECK(memcmp(&streams[i-1], &streams[i], sizeof(p)) == 0);
+        }
+    }
+
+    prngSeed(&p, 42);
+    for (i=0; i<STREAMS; i++) {
+        prngSplit(&p, &streams[i]);
+        for (j=0; j<COUNT; j++) values[i*COUNT + j] = prngNext64(&streams[i]);
+    }
+
+    qsort(values, STREAMS * COUNT, sizeof(u64), _testCompareU64);
+    for (i=1; i<STREAMS * COUNT; i++) dups += values[i] == values[i-1];
+    TEST_CHECK(dups == 0);
+
+    //A long jump lands on yet another stream.
+    prngSeed(&p, 42);
+    jumped = p;
+    prngLongJump(&jumped);
+    TEST_CHECK(memcmp(&p, &jumped, sizeof(p)) != 0 && prngNext64(&p) != prngNext64(&jumped));
+
+    free(values);
+}
+
+//Chi-square statistic of the bucket counts of prngNextBounded.
+static double _testChiSquare(Prng *p, u32 bound, u32 count) {
+    u32 *buckets = calloc(bound, sizeof(u32));
+    double expected = (double)count / bound, chi = 0;
+    u32 i;
+
+    for (i=0; i<count; i++) {
+        u32 v = prngNextBounded(p, bound);
+        if (v >= bound) {
+            free(buckets);
+            return 1e30;
+        }
+        buckets[v]++;
+    }
+
+    for (i=0; i<bound; i++) chi += (buckets[i] - expected) * (buckets[i] - expected) / expected;
+
+    free(buckets);
+    return chi;
+}
+
+static void testBounded(void) {
+    Prng p;
+    u32 out[1000], i, low = 0;
+
+    prngSeed(&p, 1);
+
+    //Below the 99.9% quantiles of the chi-square distribution with bound-1 degrees of freedom.
+    TEST_CHECK(_testChiSquare(&p, 16, 1600000) < 37.7);
+    TEST_CHECK(_testChiSquare(&p, 10, 1000000) < 27.9);
+    TEST_CHECK(_testChiSquare(&p, 7, 700000) < 22.5);
+    TEST_CHECK(_testChiSquare(&p, 1000, 1000000) < 1143.9);
+    TEST_CHECK(_testChiSquare(&p, 1, 1000) == 0);
+
+    //With a bound of 3<<30, taking the value modulo the bound would give the lowest third twice as often as the others.
+    for (i=0; i<1000000; i++) low += prngNextBounded(&p, 3U<<30) < (1U<<30);
+    TEST_CHECK(low > 331000 && low < 335700);
+
+    prngFillBounded(&p, out, 1000, 3);
+    for (i=0; i<1000; i++) TEST_CHECK(out[i] < 3);
+}
+
+static void testFloat(void) {
+    enum { COUNT = 1000001 };
+    float *out = malloc(COUNT * sizeof(float));
+    double sum = 0;
+    Prng p;
+    u32 i, bad = 0;
+
+    prngSeed(&p, 7);
+    out[COUNT-1] = -1.0f;
+    prngFillFloat(&p, out, COUNT);
+
+    for (i=0; i<COUNT; i++) {
+        bad += !(out[i] >= 0.0f && out[i] < 1.0f);
+        sum += out[i];
+    }
+
+    //The standard deviation of the mean is 1/sqrt(12*COUNT), about 0.0003.
+    TEST_CHECK(bad == 0);
+    TEST_CHECK(sum / COUNT > 0.4985 && sum / COUNT < 0.5015);
+
+    for (i=0; i<1000; i++) {
+        double d = prngNextDouble(&p);
+        TEST_CHECK(d >= 0.0 && d < 1.0);
+    }
+
+    free(out);
+}
+
+static void benchPrng(void) {
+    static u8 buf[1<<20];
+    Prng p;
+    u64 sum = 0;
+    double t;
+    int i;
+
+    prngSeed(&p, 3);
+
+    t = testSeconds();
+    for (i=0; i<100000000; i++) sum += prngNext64(&p);
+    t = testSeconds() - t;
+    printf("bench: prngNext64: %.1f M calls/s (%llx)\n", 1e8 / t / 1e6, (unsigned long long)(sum & 0xf));
+
+    t = testSeconds();
+    for (i=0; i<10000000; i++) sum += randomGet64();
+    t = testSeconds() - t;
+    printf("bench: randomGet64: %.1f M calls/s (%llx)\n", 1e7 / t / 1e6, (unsigned long long)(sum & 0xf));
+
+    t = testSeconds();
+    for (i=0; i<256; i++) prngFill(&p, buf, sizeof(buf));
+    t = testSeconds() - t;
+    printf("bench: prngFill 1 MiB: %.1f MB/s\n", 256 * sizeof(buf) / t / 1e6);
+
+    t = testSeconds();
+    for (i=0; i<64; i++) randomGet(buf, sizeof(buf));
+    t = testSeconds() - t;
+    printf("bench: randomGet 1 MiB: %.1f MB/s\n", 64 * sizeof(buf) / t / 1e6);
+}
+
+int main(int argc, char **argv) {
+    testReference();
+    testStreams();
+    testBounded();
+    testFloat();
+
+    if (testBenchEnabled(argc, argv)) benchPrng();
+
+    return testResult("prng");
+}
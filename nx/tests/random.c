@@ -0,0 +1,161 @@
+// ChaCha20 known-answer tests (RFC 7539), the 4-block core against the single-block one, and randomGet's per-thread keystream buffering.
+#include <stdlib.h>
+#include <pthread.h>
+#include "test.h"
+#include "kernel/random.c"
+
+Result svcGetInfo(u64* out, u64 id0, Handle handle, u64 id1) {
+    *out = 0x0123456789abcdefULL * (id1+1);
+    return 0;
+}
+
+void NORETURN fatalSimple(Result err) {
+    abort();
+}
+
+static pthread_mutex_t g_testMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void mutexLock(Mutex* m) {
+    pthread_mutex_lock(&g_testMutex);
+}
+
+void mutexUnlock(Mutex* m) {
+    pthread_mutex_unlock(&g_testMutex);
+}
+
+//RFC 7539 2.3.2: key 00..1f, nonce 00:00:00:09:00:00:00:4a:00:00:00:00, block counter 1.
+static const u8 g_kat232[CHACHA_BLOCK_SIZE] = {
+    0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+    0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+    0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+    0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e,
+};
+
+//RFC 7539 A.1 test vector #1: all-zero key and nonce, block counter 0.
+static const u8 g_katA1[CHACHA_BLOCK_SIZE] = {
+    0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90, 0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+    0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a, 0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+    0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d, 0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+    0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c, 0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86,
+};
+
+static void testKnownAnswer(void) {
+    u8 key[32], iv[8], block[CHACHA_BLOCK_SIZE], blocks[RANDOM_BUF_SIZE];
+    ChaCha c, lanes;
+    int i;
+
+    //The RFC's 32-bit counter and 96-bit nonce map to input[12] and input[13..15].
+    for (i=0; i<32; i++) key[i] = i;
+    memset(iv, 0, sizeof(iv));
+    iv[3] = 0x4a;
+    chachaInit(&c, key, iv);
+    c.input[12] = 1;
+    c.input[13] = 0x09000000;
+    lanes = c;
+
+    chachaNextBlock(&c, block);
+    TEST_CHECK(memcmp(block, g_kat232, sizeof(block)) == 0);
+
+    chachaNextBlocks(&lanes, blocks);
+    TEST_CHECK(memcmp(blocks, g_kat232, sizeof(block)) == 0);
+
+    memset(key, 0, sizeof(key));
+    memset(iv, 0, sizeof(iv));
+    chachaInit(&c, key, iv);
+    chachaNextBlocks(&c, blocks);
+    TEST_CHECK(memcmp(blocks, g_katA1, sizeof(block)) == 0);
+}
+
+static void testLanes(void) {
+    u8 key[32], iv[8], lanes[RANDOM_BUF_SIZE], single[RANDOM_BUF_SIZE];
+    ChaCha a, b;
+    int i;
+
+    for (i=0; i<32; i++) key[i] = 0xa0 ^ i;
+    for (i=0; i<8; i++) iv[i] = i * 3;
+    chachaInit(&a, key, iv);
+
+    //Start just below the 32-bit wrap, so the carry into input[13] happens inside the batch.
+    a.input[12] = 0xfffffffe;
+    b = a;
+
+    chachaNextBlocks(&a, lanes);
+    for (i=0; i<CHACHA_NUM_LANES; i++) chachaNextBlock(&b, single + i*CHACHA_BLOCK_SIZE);
+
+    TEST_CHECK(memcmp(lanes, single, sizeof(lanes)) == 0);
+    TEST_CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+    TEST_CHECK(a.input[12] == 2 && a.input[13] == 1);
+}
+
+//Returns the keystream randomGet hands out on a new thread, requested in chunks of the given sizes.
+static void *_testThread(void *arg) {
+    const size_t *chunks = arg;
+    u8 *out = malloc(1000);
+    size_t pos = 0;
+
+    while (*chunks) {
+        randomGet(out + pos, *chunks);
+        pos += *chunks++;
+    }
+    return out;
+}
+
+static u8 *_testRunThread(const size_t *chunks) {
+    pthread_t thread;
+    void *out;
+
+    pthread_create(&thread, NULL, _testThread, (void*)chunks);
+    pthread_join(thread, &out);
+    return out;
+}
+
+static void testThreads(void) {
+    static const size_t whole[] = { 1000, 0 };
+    static const size_t split[] = { 3, 300, 1, 256, 440, 0 };
+    u8 *a, *b, *c;
+    int i, zeros = 0;
+
+    //Every new thread forks the next key off the process generator, so equal requests give different output.
+    a = _testRunThread(whole);
+    b = _testRunThread(whole);
+    TEST_CHECK(memcmp(a, b, 1000) != 0);
+
+    //How a request is split up doesn't change the keystream: rewind the process generator so the next thread gets b's key.
+    g_chacha.input[12]--;
+    c = _testRunThread(split);
+    TEST_CHECK(memcmp(b, c, 1000) == 0);
+
+    for (i=0; i<1000; i++) zeros += a[i] == 0;
+    TEST_CHECK(zeros < 20);
+
+    free(a);
+    free(b);
+    free(c);
+}
+
+static void benchRandom(void) {
+    static u8 buf[1<<20];
+    u64 sum = 0;
+    double t;
+    int i;
+
+    t = testSeconds();
+    for (i=0; i<64; i++) randomGet(buf, sizeof(buf));
+    t = testSeconds() - t;
+    printf("bench: randomGet 1 MiB: %.1f MB/s\n", 64 * sizeof(buf) / t / 1e6);
+
+    t = testSeconds();
+    for (i=0; i<10000000; i++) sum += randomGet64();
+    t = testSeconds() - t;
+    printf("bench: randomGet64: %.1f M calls/s (%llx)\n", 1e7 / t / 1e6, (unsigned long long)(sum & 0xf));
+}
+
+int main(int argc, char **argv) {
+    testKnownAnswer();
+    testLanes();
+    testThreads();
+
+    if (testBenchEnabled(argc, argv)) benchRandom();
+
+    return testResult("random");
+}
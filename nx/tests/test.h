@@ -0,0 +1,40 @@
+// Helpers for the host tests, which are built and run by "make -f Makefile.host check".
+// Each test is a program which returns non-zero when a check failed. With "bench" as argument (make -f Makefile.host bench) the benchmarks are run too.
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int g_testFailures;
+
+#define TEST_CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        g_testFailures++; \
+    } \
+} while (0)
+
+static inline int testResult(const char *name) {
+    printf("%s: %s\n", name, g_testFailures ? "FAILED" : "ok");
+    return g_testFailures != 0;
+}
+
+static inline int testBenchEnabled(int argc, char **argv) {
+    return argc > 1 && strcmp(argv[1], "bench") == 0;
+}
+
+//Host time in seconds, for the benchmarks.
+static inline double testSeconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Small deterministic PRNG (xorshift32) for generating test input.
+static inline unsigned testRand(unsigned *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
@@ -0,0 +1,196 @@
+// Differential fuzz test of the UTF block fast paths against the scalar decode/encode loops they replaced,
+// with the input placed at the end of a page so that reads past the terminator fault.
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "test.h"
+#include "runtime/util/utf.h"
+
+#define PAGE_SIZE 0x1000
+
+//The scalar conversion: one code point at a time, output written while it fits and the full length returned.
+static ssize_t refUtf8ToUtf16(uint16_t *out, const uint8_t *in, size_t len) {
+    ssize_t rc = 0, units;
+    uint32_t code;
+    uint16_t encoded[2];
+
+    for (;;) {
+        units = decode_utf8(&code, in);
+        if (units == -1) return -1;
+        if (code == 0) return rc;
+        in += units;
+
+        units = encode_utf16(encoded, code);
+        if (units == -1) return -1;
+        if (out != NULL && rc + units <= len) {
+            memcpy(out, encoded, units * sizeof(*out));
+            out += units;
+        }
+        rc += units;
+    }
+}
+
+static ssize_t refUtf8ToUtf32(uint32_t *out, const uint8_t *in, size_t len) {
+    ssize_t rc = 0, units;
+    uint32_t code;
+
+    for (;;) {
+        units = decode_utf8(&code, in);
+        if (units == -1) return -1;
+        if (code == 0) return rc;
+        in += units;
+
+        if (out != NULL && rc + 1 <= len) *out++ = code;
+        rc++;
+    }
+}
+
+static ssize_t refUtf16ToUtf8(uint8_t *out, const uint16_t *in, size_t len) {
+    ssize_t rc = 0, units;
+    uint32_t code;
+    uint8_t encoded[4];
+
+    for (;;) {
+        units = decode_utf16(&code, in);
+        if (units == -1) return -1;
+        if (code == 0) return rc;
+        in += units;
+
+        units = encode_utf8(encoded, code);
+        if (units == -1) return -1;
+        if (out != NULL && rc + units <= len) {
+            memcpy(out, encoded, units);
+            out += units;
+        }
+        rc += units;
+    }
+}
+
+static unsigned g_rand = 1;
+
+//Random UTF-8 of n bytes: plain ASCII, ASCII with stray high bytes, arbitrary bytes, or valid multi-byte text.
+static void _testGenUtf8(uint8_t *buf, int n) {
+    int i, mode = testRand(&g_rand) % 4;
+    uint32_t r, cp;
+    uint8_t tmp[4];
+    ssize_t units;
+
+    for (i=0; i<n; i++) {
+        r = testRand(&g_rand);
+        switch (mode) {
+            case 0: buf[i] = 1 + r%127; break;
+            case 1: buf[i] = r%8 == 0 ? ((r>>8) | 0x80) & 0xff : 1 + r%127; break;
+            case 2: buf[i] = r & 0xff ? r & 0xff : 'a'; break;
+            default:
+                cp = r%5 == 0 ? 0x80 + r%0x780 : r%7 == 0 ? 0x800 + (r>>4)%0xf000 : r%11 == 0 ? 0x10000 + (r>>3)%0x100000 : 1 + r%127;
+                units = encode_utf8(tmp, cp);
+                if (units < 0 || i + units > n) {
+                    buf[i] = 'x';
+                    break;
+                }
+                memcpy(buf + i, tmp, units);
+                i += units - 1;
+                break;
+        }
+    }
+    buf[n] = 0;
+}
+
+static void testFuzz(uint8_t *page) {
+    uint8_t buf[128], *s, q1[300], q2[300];
+    uint16_t w[130], *ws, o1[128], o2[128];
+    uint32_t p1[128], p2[128];
+    ssize_t a, b, valid;
+    size_t len;
+    int it, i, n, wn;
+
+    for (it=0; it<200000; it++) {
+        n = testRand(&g_rand) % 80;
+        _testGenUtf8(buf, n);
+        s = page + PAGE_SIZE - (n+1);
+        memcpy(s, buf, n+1);
+        len = testRand(&g_rand) % 100;
+
+        memset(o1, 0xaa, sizeof(o1));
+        memset(o2, 0xaa, sizeof(o2));
+        a = utf8_to_utf16(o1, s, len);
+        b = refUtf8ToUtf16(o2, s, len);
+        TEST_CHECK(a == b && memcmp(o1, o2, sizeof(o1)) == 0);
+        TEST_CHECK(utf8_to_utf16(NULL, s, 0) == b);
+        TEST_CHECK(utf8_utf16_length(s) == b);
+
+        valid = utf8_validate(s);
+        TEST_CHECK(valid == (b < 0 ? -1 : n));
+        TEST_CHECK(utf8_validate_n(s, n+1) == valid);
+
+        memset(p1, 0xaa, sizeof(p1));
+        memset(p2, 0xaa, sizeof(p2));
+        a = utf8_to_utf32(p1, s, len);
+        b = refUtf8ToUtf32(p2, s, len);
+        TEST_CHECK(a == b && memcmp(p1, p2, sizeof(p1)) == 0);
+
+        //UTF-16 input: the converted text when valid, otherwise random units including lone surrogates.
+        b = refUtf8ToUtf16(w, buf, 128);
+        if (b >= 0 && b < 128) wn = b;
+        else {
+            wn = n;
+            for (i=0; i<n; i++) {
+                uint32_t r = testRand(&g_rand);
+                w[i] = r%9 == 0 ? (r>>8) & 0xffff : 1 + r%127;
+                if (w[i] == 0) w[i] = 1;
+            }
+        }
+        w[wn] = 0;
+        ws = (uint16_t*)(page + PAGE_SIZE) - (wn+1);
+        memcpy(ws, w, (wn+1) * sizeof(*w));
+
+        len = testRand(&g_rand) % 300;
+        memset(q1, 0xaa, sizeof(q1));
+        memset(q2, 0xaa, sizeof(q2));
+        a = utf16_to_utf8(q1, ws, len);
+        b = refUtf16ToUtf8(q2, ws, len);
+        TEST_CHECK(a == b && memcmp(q1, q2, sizeof(q1)) == 0);
+        TEST_CHECK(utf16_utf8_length(ws) == b);
+
+        //Without a terminator within len, only an error in the first len bytes may be reported.
+        len = testRand(&g_rand) % (n+1);
+        memcpy(page + PAGE_SIZE - len, buf, len);
+        a = utf8_validate_n(page + PAGE_SIZE - len, len);
+        TEST_CHECK(a == (ssize_t)len || (a == -1 && valid == -1));
+        if (valid >= 0) TEST_CHECK(a == (ssize_t)len);
+    }
+}
+
+static void benchTranscode(void) {
+    static uint8_t in[4096];
+    static uint16_t out[4096];
+    double t;
+    int i;
+
+    memset(in, 'a', sizeof(in) - 1);
+
+    t = testSeconds();
+    for (i=0; i<20000; i++) utf8_to_utf16(out, in, sizeof(out)/sizeof(*out));
+    t = testSeconds() - t;
+    printf("bench: utf8_to_utf16 ASCII: %.0f MB/s\n", 20000.0 * sizeof(in) / t / 1e6);
+
+    t = testSeconds();
+    for (i=0; i<20000; i++) refUtf8ToUtf16(out, in, sizeof(out)/sizeof(*out));
+    t = testSeconds() - t;
+    printf("bench: scalar loop ASCII: %.0f MB/s\n", 20000.0 * sizeof(in) / t / 1e6);
+}
+
+int main(int argc, char **argv) {
+    //The second page is inaccessible, so any read past the end of the input crashes the test.
+    uint8_t *page = mmap(NULL, 2*PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (page == MAP_FAILED || mprotect(page + PAGE_SIZE, PAGE_SIZE, PROT_NONE) != 0) {
+        printf("utf: mmap failed\n");
+        return 1;
+    }
+
+    testFuzz(page);
+
+    if (testBenchEnabled(argc, argv)) benchTranscode();
+
+    return testResult("utf");
+}